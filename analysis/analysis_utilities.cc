@@ -5,9 +5,20 @@
 #include <iostream>
 #include <fstream>
 #include <cassert>
+#include <pthread.h>
+
+#include "lazy_derivatives.h"
 
 namespace Torch {
 
+// Setting the example of DataSets that wrap the same data is not thread
+// safe (see StochasticGradientPlus::SetMinibatch).
+static pthread_mutex_t data_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Number of chunks of examples of the parallel gradient sums, each with its
+// partial sum (as many gradients in memory).
+#define N_GRADIENT_CHUNKS 16
+
 int GetNParams(GradientMachine *machine)
 {
   int n_params = 0;
@@ -20,10 +31,15 @@ int GetNParams(GradientMachine *machine)
 void ClearDerivatives(GradientMachine *machine)
 {
   Parameters *der_params = machine->der_params;
-  for(int i=0; i<der_params->n_data; i++) {
-    for (int j=0; j<der_params->size[i]; j++)
-      der_params->data[i][j] = 0.0;
-  }
+  for(int i=0; i<der_params->n_data; i++)
+    ClearDerivativesLazily(der_params->data[i], der_params->size[i]);
+}
+
+void SettleDerivatives(GradientMachine *machine)
+{
+  Parameters *der_params = machine->der_params;
+  for(int i=0; i<der_params->n_data; i++)
+    SettleDerivatives(der_params->data[i], der_params->size[i]);
 }
 
 // 
@@ -66,8 +82,103 @@ void LoadDirections(char *directions_filename, int n_directions, Mat *directions
   fd_directions.close();
 }
 
-void EvaluateGradient(GradientMachine *machine, Criterion *criterion, DataSet *data, Vec *gradient)
+// The machine, criterion and data of the pool's thread running the task.
+struct GradientEvaluation
+{
+  TaskPool *pool;
+  GradientMachine *machine;
+  Criterion *criterion;
+  DataSet *data;
+  GradientMachine **replicas;
+  Criterion **replica_criteria;
+  DataSet **replica_data;
+  int n_params;
+  Vec *direction;
+  real *gradients_in_direction;
+};
+
+static void SetupReplicas(GradientEvaluation *evaluation)
+{
+  for(int k=0; k<evaluation->pool->n_threads-1; k++)    {
+    evaluation->replicas[k]->params->copy(evaluation->machine->params);
+    evaluation->replicas[k]->setDataSet(evaluation->replica_data[k]);
+    evaluation->replica_criteria[k]->setDataSet(evaluation->replica_data[k]);
+    ClearDerivatives(evaluation->replicas[k]);
+  }
+}
+
+static void GetSlot(GradientEvaluation *evaluation, GradientMachine **machine,
+                    Criterion **criterion, DataSet **data)
+{
+  int slot = (evaluation->pool ? evaluation->pool->Slot() : 0);
+  if(slot == 0) {
+    *machine = evaluation->machine;
+    *criterion = evaluation->criterion;
+    *data = evaluation->data;
+  } else        {
+    *machine = evaluation->replicas[slot-1];
+    *criterion = evaluation->replica_criteria[slot-1];
+    *data = evaluation->replica_data[slot-1];
+  }
+}
+
+// Forwards and backwards example #i#, accumulating its gradient in the
+// machine's der_params.
+static void AccumulateExampleGradient(GradientMachine *machine, Criterion *criterion,
+                                      DataSet *data, int i)
+{
+  pthread_mutex_lock(&data_mutex);
+  data->setExample(i);
+  pthread_mutex_unlock(&data_mutex);
+
+  machine->forward(data->inputs);
+  criterion->forward(machine->outputs);
+  criterion->backward(machine->outputs, NULL);
+  machine->backward(data->inputs, criterion->beta);
+}
+
+static void EvaluateGradientChunk(void *arg, int begin, int end, real *partial)
+{
+  GradientEvaluation *evaluation = (GradientEvaluation*)arg;
+  GradientMachine *machine;
+  Criterion *criterion;
+  DataSet *data;
+  GetSlot(evaluation, &machine, &criterion, &data);
+
+  for (int i=begin; i<end; i++)
+    AccumulateExampleGradient(machine, criterion, data, i);
+
+  // Move to the chunk's partial sum
+  SettleDerivatives(machine);
+  Parameters *der_params = machine->der_params;
+  for (int pg=0; pg<der_params->n_data; pg++) {
+    memcpy(partial, der_params->data[pg], sizeof(real)*der_params->size[pg]);
+    partial += der_params->size[pg];
+  }
+  ClearDerivatives(machine);
+}
+
+void EvaluateGradient(GradientMachine *machine, Criterion *criterion, DataSet *data, Vec *gradient,
+                      TaskPool *pool, GradientMachine **replicas,
+                      Criterion **replica_criteria, DataSet **replica_data)
 {
+  if(pool && pool->n_threads > 1)      {
+    machine->setDataSet(data);
+    criterion->setDataSet(data);
+    ClearDerivatives(machine);
+
+    GradientEvaluation evaluation = {pool, machine, criterion, data,
+                                     replicas, replica_criteria, replica_data,
+                                     gradient->n, NULL, NULL};
+    SetupReplicas(&evaluation);
+    int chunk_size = (data->n_examples + N_GRADIENT_CHUNKS-1) / N_GRADIENT_CHUNKS;
+    ParallelReduce(pool, data->n_examples, chunk_size, gradient->n,
+                   EvaluateGradientChunk, &evaluation, gradient->ptr);
+    for (int i=0; i<gradient->n; i++)
+      gradient->ptr[i] /= data->n_examples;
+    return;
+  }
+
   // Preparation
   machine->setDataSet(data);
   criterion->setDataSet(data);
@@ -88,6 +199,7 @@ void EvaluateGradient(GradientMachine *machine, Criterion *criterion, DataSet *d
   }
 
   // Copy and normalize
+  SettleDerivatives(machine);
   int offset = 0;
   Parameters *der_params = machine->der_params;
   for (int pg=0; pg<der_params->n_data; pg++) {   // pg = parameter group
@@ -99,40 +211,60 @@ void EvaluateGradient(GradientMachine *machine, Criterion *criterion, DataSet *d
   ClearDerivatives(machine);
 }
 
-real EvaluateGradientVarianceInDirection(GradientMachine *machine, Criterion *criterion, DataSet *data, Vec *direction, bool is_centered)
+static void EvaluateGradientsInDirection(void *arg, int begin, int end)
 {
-  machine->setDataSet(data);
-  criterion->setDataSet(data);
-  ClearDerivatives(machine);
+  GradientEvaluation *evaluation = (GradientEvaluation*)arg;
+  GradientMachine *machine;
+  Criterion *criterion;
+  DataSet *data;
+  GetSlot(evaluation, &machine, &criterion, &data);
 
-  // Variables for holding the gradients
-  Vec example_gradient(GetNParams(machine));
-  Allocator allocator;
-  real *gradients_in_direction = (real*) allocator.alloc(sizeof(real)*data->n_examples);
-  real mean_gradient_in_direction = 0.0;
+  // Holds the gradient of one example
+  Vec example_gradient((real*)ThreadScratch(0, sizeof(real)*evaluation->n_params), evaluation->n_params);
 
-  // Go over the dataset,  
-  for (int i=0; i<data->n_examples; i++)  {
-    data->setExample(i);
-    // fbprop
-    machine->forward(data->inputs);
-    criterion->forward(machine->outputs);
-    criterion->backward(machine->outputs, NULL);
-    machine->backward(data->inputs, criterion->beta);
+  for (int i=begin; i<end; i++) {
+    AccumulateExampleGradient(machine, criterion, data, i);
     // Copy gradient to a vector
+    SettleDerivatives(machine);
     int offset = 0;
     Parameters *der_params = machine->der_params;
     for (int pg=0; pg<der_params->n_data; pg++) {   // pg = parameter group
       for (int p=0; p<der_params->size[pg]; p++)
         example_gradient.ptr[offset+p] = der_params->data[pg][p];
       offset += der_params->size[pg];
-      // Clear derivatives
-      memset(der_params->data[pg], 0, sizeof(real)*der_params->size[pg]);
     }
+    ClearDerivatives(machine);
     // Get gradient in direction
-    gradients_in_direction[i] = direction->iP(&example_gradient);
-    mean_gradient_in_direction += gradients_in_direction[i];
+    evaluation->gradients_in_direction[i] = evaluation->direction->iP(&example_gradient);
   }
+}
+
+real EvaluateGradientVarianceInDirection(GradientMachine *machine, Criterion *criterion, DataSet *data, Vec *direction, bool is_centered,
+                                         TaskPool *pool, GradientMachine **replicas,
+                                         Criterion **replica_criteria, DataSet **replica_data)
+{
+  machine->setDataSet(data);
+  criterion->setDataSet(data);
+  ClearDerivatives(machine);
+
+  // The gradient of each example in the direction. They do not depend on
+  // the pool.
+  Allocator allocator;
+  real *gradients_in_direction = (real*) allocator.alloc(sizeof(real)*data->n_examples);
+  real mean_gradient_in_direction = 0.0;
+
+  GradientEvaluation evaluation = {pool, machine, criterion, data,
+                                   replicas, replica_criteria, replica_data,
+                                   GetNParams(machine), direction, gradients_in_direction};
+  if(pool && pool->n_threads > 1)
+    SetupReplicas(&evaluation);
+  else
+    pool = NULL;
+  evaluation.pool = pool;
+  ParallelFor(pool, data->n_examples, 16, EvaluateGradientsInDirection, &evaluation);
+
+  for (int i=0; i<data->n_examples; i++)
+    mean_gradient_in_direction += gradients_in_direction[i];
 
   // Compute the mean gradient in the direction
   mean_gradient_in_direction /= data->n_examples;
@@ -19,15 +19,34 @@
 #include "GradientMachine.h"
 #include "Criterion.h"
 #include "matrix.h"
+#include "task_pool.h"
 
 
 namespace Torch {
 
 int GetNParams(GradientMachine *machine);
+// Clears the derivatives of #machine# lazily (see lazy_derivatives.h):
+// whatever reads them must settle them first.
 void ClearDerivatives(GradientMachine *machine);
+void SettleDerivatives(GradientMachine *machine);
 void LoadDirections(char *directions_filename, int n_directions, Mat *directions);
-void EvaluateGradient(GradientMachine *machine, Criterion *criterion, DataSet *data, Vec *gradient);
-real EvaluateGradientVarianceInDirection(GradientMachine *machine, Criterion *criterion, DataSet *data, Vec *direction, bool is_centered);
+
+// The evaluations below go over the examples with the tasks of #pool# if not
+// NULL. Torch machines, criteria and DataSets keep the state of the current
+// example, so the pool's thread of slot k>0 (see TaskPool::Slot()) uses
+// replicas[k-1], set on replica_data[k-1] with replica_criteria[k-1]: copies
+// of the machine, criterion and data with the same architecture. Their
+// parameters are copied from the machine's.
+//
+// The gradient is summed by chunks of examples added in a fixed order, so it
+// does not depend on the number of threads. It does differ, by rounding, from
+// the one summed without a pool.
+void EvaluateGradient(GradientMachine *machine, Criterion *criterion, DataSet *data, Vec *gradient,
+                      TaskPool *pool=NULL, GradientMachine **replicas=NULL,
+                      Criterion **replica_criteria=NULL, DataSet **replica_data=NULL);
+real EvaluateGradientVarianceInDirection(GradientMachine *machine, Criterion *criterion, DataSet *data, Vec *direction, bool is_centered,
+                                         TaskPool *pool=NULL, GradientMachine **replicas=NULL,
+                                         Criterion **replica_criteria=NULL, DataSet **replica_data=NULL);
 void StepInParameterSpace(GradientMachine *machine, Vec *direction, real stepsize);
 
 }
@@ -16,12 +16,12 @@
 
 #include <algorithm>
 #include <cassert>
-#include "Random.h"
 
 
 namespace Torch {
 
 Binner::Binner()
+    : rng(RANDOM_STREAM_SAMPLING)
 {
 }
 
@@ -75,7 +75,7 @@ real Binner::draw()
 {
   // Draw a bin based on its weight. Draw from uniform over [0,n_samples[
   // and see which bin that falls into.
-  real bin_selector = Random::boundedUniform(0.0, bin_cumulative_n_samples[n_bins-1]);
+  real bin_selector = rng.BoundedUniform(0.0, bin_cumulative_n_samples[n_bins-1]);
   bin_selector = floor(bin_selector);
 
   int the_bin = 0;
@@ -85,7 +85,7 @@ real Binner::draw()
   assert(the_bin<n_bins);
 
   // Draw a uniform over that bin's range
-  return Random::boundedUniform(bin_lowers[the_bin], bin_uppers[the_bin]);
+  return rng.BoundedUniform(bin_lowers[the_bin], bin_uppers[the_bin]);
 }
 
 void Binner::loadXFile(XFile *file)
@@ -18,6 +18,7 @@
 #include <string>
 #include "Object.h"
 #include "XFile.h"
+#include "random_streams.h"
 
 namespace Torch {
 
@@ -34,7 +35,8 @@ class Binner : public Object
    int *bin_cumulative_n_samples;
    real *bin_lowers;
    real *bin_uppers;
-
+   // The draws.
+   RandomStream rng;
 
    Binner();
 
@@ -0,0 +1,276 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+const char *help = "\
+coder_fused_tester\n\
+\n\
+This program tests the fused Coder path against the unfused one (the\n\
+underlying machines run one after the other). For each nonlinearity, with\n\
+and without corruption, for a plain and a transposed tied coder, it compares\n\
+the outputs, beta and the derivatives of the parameters.\n\
+\n\
+It then tests the incremental noisy coder, which corrects the pre-activation\n\
+of its clean tied coder, against the fused noisy coder.\n";
+
+#include <string>
+#include <iostream>
+#include <math.h>
+
+#include "Allocator.h"
+#include "CmdLine.h"
+#include "Random.h"
+#include "random_streams.h"
+#include "Sequence.h"
+
+#include "coder.h"
+#include "destructive.h"
+
+using namespace Torch;
+
+real MaxAbsDiff(Sequence *a, Sequence *b)
+{
+  real max_diff = 0.;
+  for(int t=0; t<a->n_frames; t++)
+    for(int j=0; j<a->frame_size; j++)  {
+      real diff = fabs(a->frames[t][j] - b->frames[t][j]);
+      if(diff > max_diff)
+        max_diff = diff;
+    }
+  return max_diff;
+}
+
+real MaxAbsDiff(Parameters *a, Parameters *b)
+{
+  real max_diff = 0.;
+  for(int k=0; k<a->n_data; k++)
+    for(int j=0; j<a->size[k]; j++)     {
+      real diff = fabs(a->data[k][j] - b->data[k][j]);
+      if(diff > max_diff)
+        max_diff = diff;
+    }
+  return max_diff;
+}
+
+void CopyParameters(Parameters *from, Parameters *to)
+{
+  for(int k=0; k<from->n_data; k++)
+    for(int j=0; j<from->size[k]; j++)
+      to->data[k][j] = from->data[k][j];
+}
+
+void ClearParameters(Parameters *params)
+{
+  for(int k=0; k<params->n_data; k++)
+    for(int j=0; j<params->size[k]; j++)
+      params->data[k][j] = 0.;
+}
+
+void FillSequence(Sequence *seq, real min, real max)
+{
+  for(int t=0; t<seq->n_frames; t++)
+    for(int j=0; j<seq->frame_size; j++)
+      seq->frames[t][j] = Random::boundedUniform(min, max);
+}
+
+// Puts the corruption stream of #coder#, if noisy, at the start of a stream
+// that only depends on #seed#: coders built one after the other draw their
+// masks from different streams otherwise.
+void ResetCorruption(Coder *coder, int seed)
+{
+  if(coder->destructive_layer)
+    coder->destructive_layer->SetStream((unsigned int)seed, 1, 0);
+}
+
+// A base coder (owner of the weights) and the coder to test, which is the
+// base coder itself, a noisy coder tied to it or its transposed tied coder.
+struct CoderPair
+{
+  Coder *base;
+  Coder *coder;
+};
+
+CoderPair BuildCoders(Allocator *allocator, int n_inputs, int n_hidden,
+                      std::string nonlinearity, bool is_noisy, bool is_transposed,
+                      real corrupt_prob, real corrupt_value, real weight_decay)
+{
+  CoderPair pair;
+  pair.base = new(allocator) Coder(n_inputs, n_hidden, false, NULL, false, false, nonlinearity);
+  pair.base->linear_layer->setROption("weight decay", weight_decay);
+
+  if(is_transposed)
+    pair.coder = new(allocator) Coder(n_hidden, n_inputs, is_noisy, pair.base, true, true, nonlinearity);
+  else if(is_noisy)
+    pair.coder = new(allocator) Coder(n_inputs, n_hidden, true, pair.base, false, false, nonlinearity);
+  else
+    pair.coder = pair.base;
+
+  if(is_noisy)  {
+    pair.coder->destructive_layer->setROption("Destruction probability", corrupt_prob);
+    pair.coder->destructive_layer->setROption("Destruction value", corrupt_value);
+  }
+  return pair;
+}
+
+// ************
+// *** MAIN ***
+// ************
+int main(int argc, char **argv)
+{
+  int flag_n_inputs;
+  int flag_n_hidden;
+  int flag_n_frames;
+  real flag_corrupt_prob;
+  real flag_corrupt_value;
+  real flag_weight_decay;
+  real flag_tolerance;
+  int flag_seed;
+
+  CmdLine cmd;
+  cmd.info(help);
+
+  cmd.addICmdOption("-n_inputs", &flag_n_inputs, 37, "number of inputs", true);
+  cmd.addICmdOption("-n_hidden", &flag_n_hidden, 23, "number of hidden units", true);
+  cmd.addICmdOption("-n_frames", &flag_n_frames, 4, "number of frames (minibatch size)", true);
+  cmd.addRCmdOption("-corrupt_prob", &flag_corrupt_prob, 0.25, "corruption probability", true);
+  cmd.addRCmdOption("-corrupt_value", &flag_corrupt_value, 0.1, "corruption value", true);
+  cmd.addRCmdOption("-weight_decay", &flag_weight_decay, 1e-3, "weight decay of the base coder", true);
+  cmd.addRCmdOption("-tolerance", &flag_tolerance, 1e-4, "largest difference accepted", true);
+  cmd.addICmdOption("-seed", &flag_seed, 1, "random seed", true);
+
+  cmd.read(argc, argv);
+
+  Allocator *allocator = new Allocator;
+
+  std::string nonlinearities[] = {"none", "sigmoid", "tanh", "nonlinear"};
+  int n_failures = 0;
+
+  for(int n=0; n<4; n++)        {
+    for(int is_noisy=0; is_noisy<2; is_noisy++) {
+      for(int is_transposed=0; is_transposed<2; is_transposed++)        {
+        SetRandomSeed((long)flag_seed);
+
+        CoderPair fused = BuildCoders(allocator, flag_n_inputs, flag_n_hidden,
+                                      nonlinearities[n], is_noisy, is_transposed,
+                                      flag_corrupt_prob, flag_corrupt_value, flag_weight_decay);
+        CoderPair unfused = BuildCoders(allocator, flag_n_inputs, flag_n_hidden,
+                                        nonlinearities[n], is_noisy, is_transposed,
+                                        flag_corrupt_prob, flag_corrupt_value, flag_weight_decay);
+        fused.coder->setBOption("fused", true);
+        unfused.coder->setBOption("fused", false);
+
+        CopyParameters(fused.base->params, unfused.base->params);
+        if(fused.coder != fused.base)
+          CopyParameters(fused.coder->params, unfused.coder->params);
+        ClearParameters(fused.base->der_params);
+        ClearParameters(unfused.base->der_params);
+        ClearParameters(fused.coder->der_params);
+        ClearParameters(unfused.coder->der_params);
+
+        Coder *coder = fused.coder;
+        Sequence *inputs = new(allocator) Sequence(flag_n_frames, coder->n_inputs);
+        Sequence *alpha = new(allocator) Sequence(flag_n_frames, coder->n_outputs);
+        FillSequence(inputs, 0., 1.);
+        FillSequence(alpha, -1., 1.);
+
+        // Same seed, so the same corruption.
+        ResetCorruption(fused.coder, flag_seed);
+        fused.coder->forward(inputs);
+        fused.coder->backward(inputs, alpha);
+
+        ResetCorruption(unfused.coder, flag_seed);
+        unfused.coder->forward(inputs);
+        unfused.coder->backward(inputs, alpha);
+
+        real diff_outputs = MaxAbsDiff(fused.coder->outputs, unfused.coder->outputs);
+        real diff_beta = MaxAbsDiff(fused.coder->beta, unfused.coder->beta);
+        real diff_der_params = MaxAbsDiff(fused.base->der_params, unfused.base->der_params);
+        if(fused.coder != fused.base)   {
+          real diff = MaxAbsDiff(fused.coder->der_params, unfused.coder->der_params);
+          if(diff > diff_der_params)
+            diff_der_params = diff;
+        }
+
+        bool ok = coder->IsFused() && diff_outputs <= flag_tolerance
+                  && diff_beta <= flag_tolerance && diff_der_params <= flag_tolerance;
+        if(!ok)
+          n_failures++;
+
+        std::cout << (ok ? "OK   " : "FAIL ") << nonlinearities[n]
+                  << (is_noisy ? " noisy" : " clean")
+                  << (is_transposed ? " transposed" : " plain")
+                  << " fused=" << coder->IsFused()
+                  << " outputs " << diff_outputs
+                  << " beta " << diff_beta
+                  << " der_params " << diff_der_params << std::endl;
+      }
+    }
+  }
+
+  // Incremental noisy coder
+  for(int n=0; n<4; n++)        {
+    SetRandomSeed((long)flag_seed);
+
+    CoderPair full = BuildCoders(allocator, flag_n_inputs, flag_n_hidden,
+                                 nonlinearities[n], true, false,
+                                 flag_corrupt_prob, flag_corrupt_value, flag_weight_decay);
+    CoderPair incremental = BuildCoders(allocator, flag_n_inputs, flag_n_hidden,
+                                        nonlinearities[n], true, false,
+                                        flag_corrupt_prob, flag_corrupt_value, flag_weight_decay);
+    incremental.base->setBOption("keep pre-activation", true);
+    incremental.coder->setBOption("incremental", true);
+
+    CopyParameters(full.base->params, incremental.base->params);
+    ClearParameters(full.base->der_params);
+    ClearParameters(incremental.base->der_params);
+
+    Sequence *inputs = new(allocator) Sequence(flag_n_frames, flag_n_inputs);
+    Sequence *alpha = new(allocator) Sequence(flag_n_frames, flag_n_hidden);
+    FillSequence(inputs, 0., 1.);
+    FillSequence(alpha, -1., 1.);
+
+    full.base->forward(inputs);
+    ResetCorruption(full.coder, flag_seed);
+    full.coder->forward(inputs);
+    full.coder->backward(inputs, alpha);
+
+    incremental.base->forward(inputs);
+    ResetCorruption(incremental.coder, flag_seed);
+    bool used = incremental.coder->IncrementalForward(inputs);
+    incremental.coder->backward(inputs, alpha);
+
+    // The kept pre-activation must not be used twice.
+    bool reused = incremental.coder->IncrementalForward(inputs);
+
+    real diff_outputs = MaxAbsDiff(full.coder->outputs, incremental.coder->outputs);
+    real diff_beta = MaxAbsDiff(full.coder->beta, incremental.coder->beta);
+    real diff_der_params = MaxAbsDiff(full.base->der_params, incremental.base->der_params);
+
+    bool ok = used && !reused && diff_outputs <= flag_tolerance
+              && diff_beta <= flag_tolerance && diff_der_params <= flag_tolerance;
+    if(!ok)
+      n_failures++;
+
+    std::cout << (ok ? "OK   " : "FAIL ") << nonlinearities[n]
+              << " incremental used=" << used
+              << " reused=" << reused
+              << " outputs " << diff_outputs
+              << " beta " << diff_beta
+              << " der_params " << diff_der_params << std::endl;
+  }
+
+  std::cout << n_failures << " failure(s)" << std::endl;
+
+  delete allocator;
+  return(n_failures > 0);
+}
@@ -0,0 +1,241 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+const char *help = "\
+csae_shards_tester\n\
+\n\
+This program checks that the synchronous sharded training of a noisy\n\
+communicating stacked autoencoder (communication type 2, so both the noisy\n\
+encoders and the noisy speakers corrupt) does not depend on how the shards\n\
+are dealt.\n\
+\n\
+It trains the same CSAE a few minibatches in two ways, the way\n\
+StochasticGradientPlus::ShardedGradient does: once with a single machine\n\
+computing every shard, once with n_threads replicas, shard s going to\n\
+replica s%n_threads. Each shard resets the corruption streams to its first\n\
+example, its gradient (of half the squared norm of the outputs) is kept\n\
+apart, and the shard gradients are summed in a fixed tree order before the\n\
+update. The final parameters must be bit-identical.\n";
+
+#include <string.h>
+#include <iostream>
+
+#include "Allocator.h"
+#include "CmdLine.h"
+#include "Random.h"
+#include "random_streams.h"
+#include "Sequence.h"
+
+#include "communicating_stacked_autoencoder.h"
+
+using namespace Torch;
+
+void CopyParameters(Parameters *from, Parameters *to)
+{
+  for(int k=0; k<from->n_data; k++)
+    memcpy(to->data[k], from->data[k], sizeof(real)*from->size[k]);
+}
+
+void ClearParameters(Parameters *params)
+{
+  for(int k=0; k<params->n_data; k++)
+    memset(params->data[k], 0, sizeof(real)*params->size[k]);
+}
+
+bool IdenticalParameters(Parameters *a, Parameters *b)
+{
+  for(int k=0; k<a->n_data; k++)
+    if(memcmp(a->data[k], b->data[k], sizeof(real)*a->size[k]))
+      return false;
+  return true;
+}
+
+int ParametersSize(Parameters *params)
+{
+  int size = 0;
+  for(int k=0; k<params->n_data; k++)
+    size += params->size[k];
+  return size;
+}
+
+CommunicatingStackedAutoencoder *BuildCsae(Allocator *allocator, int n_inputs, int n_layers,
+                                           int *units_per_hidden_layer, int *units_per_speech_layer,
+                                           int n_classes, real corrupt_prob)
+{
+  CommunicatingStackedAutoencoder *csae =
+      new(allocator) CommunicatingStackedAutoencoder("csae", "sigmoid", true, false,
+                                                     n_inputs, n_layers, units_per_hidden_layer,
+                                                     n_classes, true, false,
+                                                     units_per_speech_layer, 2, n_layers);
+  csae->setDestructionOptions(corrupt_prob, 0.);
+  for(int i=0; i<csae->n_communication_layers; i++)
+    csae->noisy_speakers[i]->destructive_layer->setROption("Destruction probability", corrupt_prob);
+  return csae;
+}
+
+// Leaves in #der# the gradient of the shard of #n# examples of #examples#
+// starting at #first#.
+void ShardGradient(CommunicatingStackedAutoencoder *csae, unsigned int key,
+                   Sequence *examples, int first, int n, Sequence *inputs,
+                   Sequence *alpha, real *der)
+{
+  ConnectedMachine *machine = csae->sup_unsup_comC_machine;
+
+  inputs->resize(n);
+  alpha->resize(n);
+  for(int t=0; t<n; t++)
+    memcpy(inputs->frames[t], examples->frames[first+t], sizeof(real)*inputs->frame_size);
+
+  csae->SetCorruptionStreams(key, (unsigned long long)first);
+  machine->forward(inputs);
+  for(int t=0; t<n; t++)
+    memcpy(alpha->frames[t], machine->outputs->frames[t], sizeof(real)*alpha->frame_size);
+
+  ClearParameters(machine->der_params);
+  machine->backward(inputs, alpha);
+
+  Parameters *der_params = machine->der_params;
+  for(int k=0; k<der_params->n_data; k++)       {
+    memcpy(der, der_params->data[k], sizeof(real)*der_params->size[k]);
+    der += der_params->size[k];
+  }
+}
+
+// Sums the shard gradients into the first one in a fixed tree order and
+// takes a step along it.
+void ApplyShards(Parameters *params, real **shard_der, int n_shards, int size, real lr)
+{
+  for(int stride=1; stride<n_shards; stride*=2)
+    for(int s=0; s+stride<n_shards; s+=2*stride)
+      for(int j=0; j<size; j++)
+        shard_der[s][j] += shard_der[s+stride][j];
+
+  real *der = shard_der[0];
+  for(int k=0; k<params->n_data; k++)   {
+    for(int j=0; j<params->size[k]; j++)
+      params->data[k][j] -= lr * der[j];
+    der += params->size[k];
+  }
+}
+
+// ************
+// *** MAIN ***
+// ************
+int main(int argc, char **argv)
+{
+  int flag_n_inputs;
+  int flag_n_layers;
+  int flag_n_hidden;
+  int flag_n_speech;
+  int flag_n_classes;
+  int flag_n_threads;
+  int flag_minibatch_size;
+  int flag_shard_size;
+  int flag_n_minibatches;
+  real flag_corrupt_prob;
+  real flag_lr;
+  int flag_seed;
+
+  CmdLine cmd;
+  cmd.info(help);
+
+  cmd.addICmdOption("-n_inputs", &flag_n_inputs, 37, "number of inputs", true);
+  cmd.addICmdOption("-n_layers", &flag_n_layers, 2, "number of hidden layers", true);
+  cmd.addICmdOption("-n_hidden", &flag_n_hidden, 23, "number of hidden units per layer", true);
+  cmd.addICmdOption("-n_speech", &flag_n_speech, 11, "number of speech units per layer", true);
+  cmd.addICmdOption("-n_classes", &flag_n_classes, 5, "number of classes", true);
+  cmd.addICmdOption("-n_threads", &flag_n_threads, 3, "number of replicas the shards are dealt to", true);
+  cmd.addICmdOption("-minibatch_size", &flag_minibatch_size, 16, "number of examples per update", true);
+  cmd.addICmdOption("-shard_size", &flag_shard_size, 4, "number of examples per shard", true);
+  cmd.addICmdOption("-n_minibatches", &flag_n_minibatches, 4, "number of updates", true);
+  cmd.addRCmdOption("-corrupt_prob", &flag_corrupt_prob, 0.25, "corruption probability", true);
+  cmd.addRCmdOption("-lr", &flag_lr, 0.01, "learning rate", true);
+  cmd.addICmdOption("-seed", &flag_seed, 1, "random seed", true);
+
+  cmd.read(argc, argv);
+
+  if(flag_n_threads < 1 || flag_shard_size < 1)
+    error("the number of threads and the shard size must be at least 1");
+
+  Allocator *allocator = new Allocator;
+
+  int *units_per_hidden_layer = (int*) allocator->alloc(sizeof(int)*flag_n_layers);
+  int *units_per_speech_layer = (int*) allocator->alloc(sizeof(int)*flag_n_layers);
+  for(int i=0; i<flag_n_layers; i++)    {
+    units_per_hidden_layer[i] = flag_n_hidden;
+    units_per_speech_layer[i] = flag_n_speech;
+  }
+
+  // csaes[0] computes every shard, csaes[1..n_threads] are the replicas
+  // (csaes[1] holding the parameters they share).
+  SetRandomSeed((long)flag_seed);
+  int n_csaes = flag_n_threads + 1;
+  CommunicatingStackedAutoencoder **csaes = (CommunicatingStackedAutoencoder**) allocator->alloc(sizeof(CommunicatingStackedAutoencoder*)*n_csaes);
+  for(int r=0; r<n_csaes; r++)  {
+    csaes[r] = BuildCsae(allocator, flag_n_inputs, flag_n_layers, units_per_hidden_layer,
+                         units_per_speech_layer, flag_n_classes, flag_corrupt_prob);
+    if(r > 0)
+      CopyParameters(csaes[0]->sup_unsup_comC_machine->params, csaes[r]->sup_unsup_comC_machine->params);
+  }
+
+  int n_examples = flag_minibatch_size * flag_n_minibatches;
+  Sequence *examples = new(allocator) Sequence(n_examples, flag_n_inputs);
+  for(int t=0; t<n_examples; t++)
+    for(int j=0; j<flag_n_inputs; j++)
+      examples->frames[t][j] = Random::boundedUniform(0., 1.);
+
+  ConnectedMachine *machine = csaes[0]->sup_unsup_comC_machine;
+  Sequence *inputs = new(allocator) Sequence(flag_shard_size, flag_n_inputs);
+  Sequence *alpha = new(allocator) Sequence(flag_shard_size, machine->n_outputs);
+
+  int n_shards = (flag_minibatch_size + flag_shard_size - 1) / flag_shard_size;
+  int size = ParametersSize(machine->params);
+  real **shard_der = (real**) allocator->alloc(sizeof(real*)*n_shards);
+  for(int s=0; s<n_shards; s++)
+    shard_der[s] = (real*) allocator->alloc(sizeof(real)*size);
+
+  unsigned int key = (unsigned int)flag_seed;
+  for(int run=0; run<2; run++)  {
+    int n_ranks = (run == 0 ? 1 : flag_n_threads);
+    Parameters *params = csaes[run]->sup_unsup_comC_machine->params;
+
+    for(int m=0; m<flag_n_minibatches; m++)     {
+      int first_example = m * flag_minibatch_size;
+
+      // The shards of each rank, one rank after the other.
+      for(int rank=0; rank<n_ranks; rank++)     {
+        CommunicatingStackedAutoencoder *csae = csaes[run + rank];
+        if(rank > 0)
+          CopyParameters(params, csae->sup_unsup_comC_machine->params);
+
+        for(int s=rank; s<n_shards; s+=n_ranks)  {
+          int first = s * flag_shard_size;
+          int n = flag_minibatch_size - first < flag_shard_size ? flag_minibatch_size - first : flag_shard_size;
+          ShardGradient(csae, key, examples, first_example + first, n, inputs, alpha, shard_der[s]);
+        }
+      }
+
+      ApplyShards(params, shard_der, n_shards, size, flag_lr);
+    }
+  }
+
+  bool identical = IdenticalParameters(csaes[0]->sup_unsup_comC_machine->params,
+                                       csaes[1]->sup_unsup_comC_machine->params);
+  std::cout << (identical ? "OK   " : "FAIL ") << "1 thread against " << flag_n_threads
+            << " threads, " << n_shards << " shards per minibatch: parameters "
+            << (identical ? "identical" : "DIFFERENT") << std::endl;
+
+  delete allocator;
+  return(identical ? 0 : 1);
+}
@@ -60,6 +60,8 @@ int main(int argc, char **argv)
 
   int flag_max_load;
   bool flag_binary_mode;
+  int flag_n_threads;
+  char *flag_thread_placement;
 
   CmdLine cmd;
   cmd.info(help);
@@ -76,12 +78,17 @@ int main(int argc, char **argv)
 
   cmd.addICmdOption("-max_load", &flag_max_load, -1, "max number of examples to load for train", true);
   cmd.addBCmdOption("-binary_mode", &flag_binary_mode, false, "binary mode for files", true);
+  cmd.addICmdOption("-n_threads", &flag_n_threads, 1, "number of threads of the estimator's updates", true);
+  cmd.addSCmdOption("-thread_placement", &flag_thread_placement, "none", "placement of the threads: none, compact or scatter (NUMA nodes)", true);
 
   cmd.read(argc, argv);
 
   // Allocator
   Allocator *allocator = new Allocator;
 
+  // Before the estimators are built
+  SetDefaultTaskPool(BuildTaskPool(allocator, flag_n_threads, flag_thread_placement));
+
   // Data
   MatDataSet matdata(flag_data_filename, flag_n_inputs, 1, false,
                                 flag_max_load, flag_binary_mode);
@@ -127,6 +134,7 @@ int main(int argc, char **argv)
       csae->backward(data.inputs, criterion.beta);
     
       // Observe the gradients - copy to sample
+      SettleDerivatives(csae);
       int offset = 0;
       for(int j=0; j<der_params->n_data; j++) {
         memcpy(sample.ptr+offset, der_params->data[j], der_params->size[j] * sizeof(real));
@@ -178,12 +178,13 @@ int main(int argc, char **argv)
     model->backward(the_data->inputs, criterion->beta);
     
     // Copy and clear der_params.
+    SettleDerivatives(model);
     real *ptr = gradients->ptr[i];
     for(int j=0; j<der_params->n_data; j++) {
       memcpy(ptr, der_params->data[j], der_params->size[j] * sizeof(real));
-      memset(der_params->data[j], 0, sizeof(real)*der_params->size[j]);
       ptr += der_params->size[j];
     }
+    ClearDerivatives(model);
 
     // Progress
     if ( (real)i/the_data->n_examples > tick/10.0)  {
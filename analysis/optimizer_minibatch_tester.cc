@@ -0,0 +1,144 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+const char *help = "\
+optimizer_minibatch_tester\n\
+\n\
+This program tests that the steps of the optimizers do not depend on the\n\
+minibatch size. For each optimizer, it updates the same linear layer a few\n\
+times through StochasticGradientPlus::UpdateMachine, with the derivatives\n\
+of minibatches of B identical examples (B times the gradient of one), for\n\
+B = 1, 2, 4, ... It compares the parameters with those of B = 1.\n";
+
+#include <string>
+#include <iostream>
+#include <string.h>
+#include <math.h>
+
+#include "Allocator.h"
+#include "CmdLine.h"
+#include "Random.h"
+#include "random_streams.h"
+#include "Linear.h"
+#include "MSECriterion.h"
+
+#include "optimizer.h"
+#include "stochastic_gradient_plus.h"
+
+using namespace Torch;
+
+real MaxAbsDiff(Parameters *a, Parameters *b)
+{
+  real max_diff = 0.;
+  for(int k=0; k<a->n_data; k++)
+    for(int j=0; j<a->size[k]; j++)     {
+      real diff = fabs(a->data[k][j] - b->data[k][j]);
+      if(diff > max_diff)
+        max_diff = diff;
+    }
+  return max_diff;
+}
+
+void CopyParameters(Parameters *from, Parameters *to)
+{
+  for(int k=0; k<from->n_data; k++)
+    memcpy(to->data[k], from->data[k], sizeof(real)*from->size[k]);
+}
+
+// ************
+// *** MAIN ***
+// ************
+int main(int argc, char **argv)
+{
+  int flag_n_inputs;
+  int flag_n_outputs;
+  int flag_n_steps;
+  int flag_max_minibatch_size;
+  real flag_lr;
+  real flag_tolerance;
+  int flag_seed;
+
+  CmdLine cmd;
+  cmd.info(help);
+
+  cmd.addICmdOption("-n_inputs", &flag_n_inputs, 37, "number of inputs", true);
+  cmd.addICmdOption("-n_outputs", &flag_n_outputs, 23, "number of outputs", true);
+  cmd.addICmdOption("-n_steps", &flag_n_steps, 10, "number of updates", true);
+  cmd.addICmdOption("-max_minibatch_size", &flag_max_minibatch_size, 256, "largest minibatch size (runs 1, 2, 4, ... up to it)", true);
+  cmd.addRCmdOption("-lr", &flag_lr, 0.01, "learning rate", true);
+  cmd.addRCmdOption("-tolerance", &flag_tolerance, 0., "largest difference accepted", true);
+  cmd.addICmdOption("-seed", &flag_seed, 1, "random seed", true);
+
+  cmd.read(argc, argv);
+
+  Allocator *allocator = new Allocator;
+
+  SetRandomSeed((long)flag_seed);
+  Linear *reference = new(allocator) Linear(flag_n_inputs, flag_n_outputs);
+  Linear *linear = new(allocator) Linear(flag_n_inputs, flag_n_outputs);
+  Linear *one_example = new(allocator) Linear(flag_n_inputs, flag_n_outputs);
+  MSECriterion *criterion = new(allocator) MSECriterion(flag_n_outputs);
+  StochasticGradientPlus *trainer = new(allocator) StochasticGradientPlus(linear, criterion, NULL);
+
+  // The gradients of one example, one per step.
+  Parameters *der_params = linear->der_params;
+  real ***gradients = (real***) allocator->alloc(sizeof(real**)*flag_n_steps);
+  for(int s=0; s<flag_n_steps; s++)     {
+    gradients[s] = (real**) allocator->alloc(sizeof(real*)*der_params->n_data);
+    for(int k=0; k<der_params->n_data; k++)     {
+      gradients[s][k] = (real*) allocator->alloc(sizeof(real)*der_params->size[k]);
+      for(int j=0; j<der_params->size[k]; j++)
+        gradients[s][k][j] = Random::boundedUniform(-1., 1.);
+    }
+  }
+
+  std::string optimizers[] = {"sgd", "momentum", "adagrad", "rmsprop", "adam"};
+  int n_failures = 0;
+
+  for(int o=0; o<5; o++)        {
+    for(int b=1; b<=flag_max_minibatch_size; b*=2)      {
+      // A new optimizer: its state is found by the arrays' addresses.
+      trainer->optimizer = NewOptimizer(allocator, optimizers[o]);
+      CopyParameters(reference->params, linear->params);
+
+      for(int s=0; s<flag_n_steps; s++) {
+        for(int k=0; k<der_params->n_data; k++)
+          for(int j=0; j<der_params->size[k]; j++)
+            der_params->data[k][j] = (real)b * gradients[s][k][j];
+        trainer->UpdateMachine(linear, flag_lr, b);
+      }
+      allocator->free(trainer->optimizer);
+
+      if(b == 1)        {
+        CopyParameters(linear->params, one_example->params);
+        continue;
+      }
+
+      real diff = MaxAbsDiff(linear->params, one_example->params);
+      bool ok = diff <= flag_tolerance;
+      if(!ok)
+        n_failures++;
+
+      std::cout << (ok ? "OK   " : "FAIL ") << optimizers[o]
+                << " minibatch " << b
+                << " params " << diff << std::endl;
+    }
+  }
+  trainer->optimizer = NULL;
+
+  std::cout << n_failures << " failure(s)" << std::endl;
+
+  delete allocator;
+  return(n_failures > 0);
+}
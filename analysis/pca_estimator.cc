@@ -16,9 +16,48 @@
 #include <cassert>
 #include <iostream>
 #include "pca_estimator.h"
+#include "simd_kernels.h"
+#include "task_pool.h"
 
 namespace Torch {
 
+// Rows of the Gram matrix and columns of the eigenvectors per task.
+#define PCA_ROWS_PER_TASK 16
+#define PCA_COLUMNS_PER_TASK 256
+
+struct PcaSection
+{
+  PcaEstimator *estimator;
+  real *x;
+  real *g;
+  Mat *Vk;
+};
+
+// g[r] = Xt[r] . x for the rows of the chunk.
+static void GramRows(void *arg, int begin, int end)
+{
+  PcaSection *section = (PcaSection*)arg;
+  PcaEstimator *estimator = section->estimator;
+  for(int r=begin; r<end; r++)
+    section->g[r] = SimdDot(estimator->n_dim, estimator->Xt->ptr[r], section->x);
+}
+
+// Ut = Vk' Xt on the columns of the chunk.
+static void EigenvectorColumns(void *arg, int begin, int end)
+{
+  PcaSection *section = (PcaSection*)arg;
+  PcaEstimator *estimator = section->estimator;
+  Mat *Vk = section->Vk;
+  Mat *Ut = estimator->Ut;
+  for(int i=0; i<Ut->m; i++)    {
+    real *ut = Ut->ptr[i] + begin;
+    for(int j=0; j<end-begin; j++)
+      ut[j] = 0.;
+    for(int k=0; k<Vk->m; k++)
+      SimdAxpy(end-begin, Vk->ptr[k][i], estimator->Xt->ptr[k] + begin, ut);
+  }
+}
+
 PcaEstimator::PcaEstimator(int n_dim_, int n_eigen_, int minibatch_size_, real gamma_) : Object()
 {
   n_dim = n_dim_;
@@ -29,6 +68,7 @@ PcaEstimator::PcaEstimator(int n_dim_, int n_eigen_, int minibatch_size_, real g
 
   n_observations = 0;
   minibatch_index = 0;
+  pool = GetDefaultTaskPool();
 
   Initialize();
 }
@@ -94,11 +134,16 @@ void PcaEstimator::Observe(Vec *x)
   // Update the Gram Matrix. Xkt represents the currently used portion
   // of Xt (first rows).
   Vec new_g(G->ptr[row], row + 1);
-  Mat *Xkt =  Xt->subMat(0,0,row,n_dim-1);
-  mxMatMulVec(Xkt, &new_x, &new_g); 
-  //mxMatMulVec(Xkt, x, &new_g); 
-  //std::cout << "I think this is wrong: should multiply by new_x, not x" << std::endl;
-  delete Xkt;
+  if(pool)      {
+    PcaSection section = {this, new_x.ptr, new_g.ptr, NULL};
+    ParallelFor(pool, row+1, PCA_ROWS_PER_TASK, GramRows, &section);
+  } else        {
+    Mat *Xkt =  Xt->subMat(0,0,row,n_dim-1);
+    mxMatMulVec(Xkt, &new_x, &new_g); 
+    //mxMatMulVec(Xkt, x, &new_g); 
+    //std::cout << "I think this is wrong: should multiply by new_x, not x" << std::endl;
+    delete Xkt;
+  }
 
   // Now copy G(row,:) to G(:,row).
   // There are row+1 values, but the diag doesn't need to get copied.
@@ -160,7 +205,11 @@ void PcaEstimator::Reevaluate()
   // into *unnormalized* eigenvectors U of the covariance.
   // wrt the eigen values, not the moving average
   Mat *Vk = V->subMat(0, 0, n_eigen+minibatch_index-1, n_eigen-1);
-  mxTrMatMulMat(Vk, Xt, Ut);
+  if(pool)      {
+    PcaSection section = {this, NULL, NULL, Vk};
+    ParallelFor(pool, n_dim, PCA_COLUMNS_PER_TASK, EigenvectorColumns, &section);
+  } else
+    mxTrMatMulMat(Vk, Xt, Ut);
   delete Vk;
 
   // Take into account the discount factor.
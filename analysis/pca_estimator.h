@@ -20,12 +20,19 @@
 
 namespace Torch {
 
+class TaskPool;
+
 // The PCA estimator estimates the main (largest) eigen values and vectors
 // of the covariance matrix of some samples.
 //
 // A moving low rank (#n_eigen#) estimate of the covariance is reevaluated
 // after #minibatch_size# samples.
 //
+// With a #pool# (GetDefaultTaskPool() at construction, see task_pool.h), the
+// update of the Gram matrix and the products of the reevaluation are split
+// by rows and columns between its threads. Each value is computed the same
+// way whatever the pool, so the estimates do not depend on it.
+//
 class PcaEstimator : public Object
 {
   public:
@@ -71,6 +78,9 @@ class PcaEstimator : public Object
     // they're copied back to Xt.
     Mat *Ut;
 
+    // NULL to compute sequentially
+    TaskPool *pool;
+
     virtual void Initialize();
     virtual void Observe(Vec *x);
     virtual void Reevaluate();
@@ -65,6 +65,8 @@ int main(int argc, char **argv)
   int flag_max_load;
   bool flag_binary_mode;
   char *flag_out_filename;
+  int flag_n_threads;
+  char *flag_thread_placement;
 
   // The actual command line
   CmdLine cmd;
@@ -86,6 +88,8 @@ int main(int argc, char **argv)
   cmd.addICmdOption("-max_load", &flag_max_load, -1, "max number of examples to load for train", true);
   cmd.addBCmdOption("-binary_mode", &flag_binary_mode, false, "binary mode for files", true);
   cmd.addSCmdOption("-out_filename", &flag_out_filename, "second_derivatives.txt", "Name of the file to output to.", true);
+  cmd.addICmdOption("-n_threads", &flag_n_threads, 1, "number of threads evaluating the gradients", true);
+  cmd.addSCmdOption("-thread_placement", &flag_thread_placement, "none", "placement of the threads: none, compact or scatter (NUMA nodes)", true);
 
   cmd.read(argc, argv);
   assert ( flag_is_centered == 0 || flag_is_centered == 1 );
@@ -122,13 +126,36 @@ int main(int argc, char **argv)
   else
     error("criterion type %s is not supported.", flag_criterion_type);
 
+  // Replicas of the model, criterion and data, one per extra thread
+  TaskPool *pool = BuildTaskPool(allocator, flag_n_threads, flag_thread_placement);
+  GradientMachine **replicas = NULL;
+  Criterion **replica_criteria = NULL;
+  DataSet **replica_data = NULL;
+  if (pool) {
+    int n_replicas = flag_n_threads - 1;
+    replicas = (GradientMachine**) allocator->alloc(sizeof(GradientMachine*)*n_replicas);
+    replica_criteria = (Criterion**) allocator->alloc(sizeof(Criterion*)*n_replicas);
+    replica_data = (DataSet**) allocator->alloc(sizeof(DataSet*)*n_replicas);
+    for (int k=0; k<n_replicas; k++)  {
+      replica_data[k] = new(allocator) ClassFormatDataSet(&matdata,flag_n_classes);
+      if (!strcmp(flag_model_type, "csae"))
+        replicas[k] = LoadCSAE(allocator, flag_model_filename);
+      else
+        replicas[k] = LoadCoder(allocator, flag_model_filename);
+      if (!strcmp(flag_criterion_type, "mse"))
+        replica_criteria[k] = new(allocator) MSECriterion(model->n_outputs);
+      else
+        replica_criteria[k] = new(allocator) ClassNLLCriterion(&class_format);
+    }
+  }
+
   // Load the directions
   Mat *directions = new(allocator) Mat(flag_n_directions, n_params);
   LoadDirections(flag_directions_filename, flag_n_directions, directions);
 
   // Evaluate the gradient
   Vec *gradient = new(allocator) Vec(n_params);
-  EvaluateGradient(model, criterion, data, gradient);
+  EvaluateGradient(model, criterion, data, gradient, pool, replicas, replica_criteria, replica_data);
 
   // For each direction:
   //    - project the gradient in the direction.
@@ -162,7 +189,7 @@ int main(int argc, char **argv)
 
     // Positive step
     StepInParameterSpace(model, direction, flag_epsilon);
-    EvaluateGradient(model, criterion, data, gradient_pos_step);
+    EvaluateGradient(model, criterion, data, gradient_pos_step, pool, replicas, replica_criteria, replica_data);
     gradient_in_direction_pos_step = direction->iP(gradient_pos_step);
 
     // Return to original position
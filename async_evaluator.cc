@@ -0,0 +1,177 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "async_evaluator.h"
+#include "early_stopping.h"
+
+#include <string.h>
+
+namespace Torch {
+
+static void *RunWorker(void *arg);
+
+AsyncEvaluator::AsyncEvaluator(GradientMachine *source_, GradientMachine *replica_, MeasurerList *measurers_)
+{
+  source = source_;
+  replica = replica_;
+  measurers = measurers_;
+  early_stopping = NULL;
+
+  if(source->params->n_data != replica->params->n_data)
+    error("AsyncEvaluator: the replica does not have the topology of the source");
+
+  // Group the measurers by DataSet. There are a few of them.
+  n_datas = 0;
+  datas = (DataSet**)allocator->alloc(sizeof(DataSet*)*measurers->n_nodes);
+  n_meas = (int*)allocator->alloc(sizeof(int)*measurers->n_nodes);
+  meas = (Measurer***)allocator->alloc(sizeof(Measurer**)*measurers->n_nodes);
+  for(int i=0; i<measurers->n_nodes; i++)       {
+    Measurer *measurer = measurers->nodes[i];
+    int d;
+    for(d=0; d<n_datas; d++)
+      if(datas[d] == measurer->data)
+        break;
+    if(d == n_datas)    {
+      datas[n_datas] = measurer->data;
+      n_meas[n_datas] = 0;
+      meas[n_datas] = (Measurer**)allocator->alloc(sizeof(Measurer*)*measurers->n_nodes);
+      n_datas++;
+    }
+    meas[d][n_meas[d]++] = measurer;
+  }
+
+  train_errs = NULL;
+  n_train_errs = 0;
+  resultsfile = NULL;
+
+  busy = false;
+  stop = false;
+  pthread_mutex_init(&mutex, NULL);
+  pthread_cond_init(&cond, NULL);
+  pthread_create(&worker, NULL, RunWorker, this);
+}
+
+void AsyncEvaluator::Reset()
+{
+  Wait();
+  for(int i=0; i<measurers->n_nodes; i++)
+    measurers->nodes[i]->reset();
+}
+
+void AsyncEvaluator::Evaluate(real *train_errs_, int n_train_errs_, XFile *resultsfile_)
+{
+  Wait();
+
+  Parameters *from = source->params;
+  Parameters *to = replica->params;
+  for(int i=0; i<from->n_data; i++)
+    memcpy(to->data[i], from->data[i], sizeof(real)*from->size[i]);
+
+  train_errs = (real*)allocator->realloc(train_errs, sizeof(real)*(n_train_errs_ > 0 ? n_train_errs_ : 1));
+  for(int i=0; i<n_train_errs_; i++)
+    train_errs[i] = train_errs_[i];
+  n_train_errs = n_train_errs_;
+  resultsfile = resultsfile_;
+
+  pthread_mutex_lock(&mutex);
+  busy = true;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&mutex);
+}
+
+void AsyncEvaluator::Wait()
+{
+  pthread_mutex_lock(&mutex);
+  while(busy)
+    pthread_cond_wait(&cond, &mutex);
+  pthread_mutex_unlock(&mutex);
+}
+
+void AsyncEvaluator::Finish()
+{
+  Wait();
+  for(int d=0; d<n_datas; d++)
+    for(int i=0; i<n_meas[d]; i++)
+      meas[d][i]->measureEnd();
+}
+
+void AsyncEvaluator::Measure()
+{
+  replica->iterInitialize();
+  for(int d=0; d<n_datas; d++)  {
+    DataSet *dataset = datas[d];
+    for(int t=0; t<dataset->n_examples; t++)    {
+      dataset->setExample(t);
+      replica->forward(dataset->inputs);
+      for(int i=0; i<n_meas[d]; i++)
+        meas[d][i]->measureExample();
+    }
+    for(int i=0; i<n_meas[d]; i++)
+      meas[d][i]->measureIteration();
+  }
+
+  if(early_stopping)
+    early_stopping->Observe(replica);
+
+  if(resultsfile)       {
+    for(int i=0; i<n_train_errs; i++)
+      resultsfile->printf("%g ", train_errs[i]);
+    for(int d=0; d<n_datas; d++)
+      for(int i=0; i<n_meas[d]; i++)
+        resultsfile->printf("%g ", meas[d][i]->current_error);
+    resultsfile->printf("\n");
+    resultsfile->flush();
+  }
+}
+
+void AsyncEvaluator::Work()
+{
+  pthread_mutex_lock(&mutex);
+  while(1)      {
+    while(!busy && !stop)
+      pthread_cond_wait(&cond, &mutex);
+    if(stop)
+      break;
+    pthread_mutex_unlock(&mutex);
+
+    Measure();
+
+    pthread_mutex_lock(&mutex);
+    busy = false;
+    pthread_cond_broadcast(&cond);
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+static void *RunWorker(void *arg)
+{
+  ((AsyncEvaluator*)arg)->Work();
+  return NULL;
+}
+
+AsyncEvaluator::~AsyncEvaluator()
+{
+  pthread_mutex_lock(&mutex);
+  while(busy)
+    pthread_cond_wait(&cond, &mutex);
+  stop = true;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&mutex);
+  pthread_join(worker, NULL);
+
+  pthread_cond_destroy(&cond);
+  pthread_mutex_destroy(&mutex);
+}
+
+}
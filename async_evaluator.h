@@ -0,0 +1,87 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_ASYNC_EVALUATOR_H_
+#define TORCH_ASYNC_EVALUATOR_H_
+
+#include <pthread.h>
+
+#include "GradientMachine.h"
+#include "Measurer.h"
+#include "XFile.h"
+
+namespace Torch {
+
+class EarlyStopping;
+
+// Runs measurers on a worker thread while the training goes on.
+//
+// #replica# is a machine of the same topology as #source#, the machine being
+// trained, that only serves the evaluation. The #measurers# measure the
+// replica's outputs, on DataSets the training does not touch (valid, test).
+// Evaluate() copies the parameters of the source into the replica, and the
+// worker then forwards the replica on the measurers' DataSets and measures.
+// There is at most one evaluation in flight: Evaluate() first waits for the
+// previous one, so the measurers write their files in order.
+//
+// With an #early_stopping# (see early_stopping.h), the worker has it observe
+// the replica after each evaluation.
+class AsyncEvaluator : public Object
+{
+  public:
+    GradientMachine *source;
+    GradientMachine *replica;
+    MeasurerList *measurers;
+    EarlyStopping *early_stopping;
+
+    // The measurers, by DataSet
+    int n_datas;
+    DataSet **datas;
+    int *n_meas;
+    Measurer ***meas;
+
+    AsyncEvaluator(GradientMachine *source_, GradientMachine *replica_, MeasurerList *measurers_);
+
+    // Resets the measurers, before a training.
+    virtual void Reset();
+    // Snapshots the source and measures on the worker. When done, the worker
+    // writes a line to #resultsfile# (if not NULL): the #n_train_errs# errors
+    // of #train_errs#, then the current errors of the measurers.
+    virtual void Evaluate(real *train_errs, int n_train_errs, XFile *resultsfile);
+    // Waits for the evaluation in flight, if any.
+    virtual void Wait();
+    // Waits, then ends the measures (measureEnd()), after a training.
+    virtual void Finish();
+    // The worker's job.
+    virtual void Measure();
+    // The worker's loop.
+    void Work();
+
+    virtual ~AsyncEvaluator();
+
+  private:
+    pthread_t worker;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool busy;
+    bool stop;
+
+    real *train_errs;
+    int n_train_errs;
+    XFile *resultsfile;
+};
+
+}
+
+#endif  // TORCH_ASYNC_EVALUATOR_H_
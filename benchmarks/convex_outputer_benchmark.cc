@@ -0,0 +1,150 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+const char *help = "\
+convex_outputer_benchmark\n\
+\n\
+This program times the training of the outputer of a stacked autoencoder\n\
+(TrainSupervisedTopKLayers with k = 1) with SGD for a number of epochs and\n\
+with the \"convex outputer\" option (same seed), and reports the mean\n\
+negative log-likelihood and the classification error on the train set\n\
+after each.\n";
+
+#include <stdio.h>
+
+#include "Allocator.h"
+#include "CmdLine.h"
+#include "random_streams.h"
+#include "Timer.h"
+
+#include "MatDataSet.h"
+#include "ClassFormatDataSet.h"
+#include "OneHotClassFormat.h"
+#include "ClassNLLCriterion.h"
+
+#include "stacked_autoencoder.h"
+#include "stacked_autoencoder_trainer.h"
+#include "helpers.h"
+
+using namespace Torch;
+
+// Mean negative log-likelihood and classification error of the sae over
+// #data#.
+void Evaluate(StackedAutoencoder *sae, DataSet *data, OneHotClassFormat *class_format,
+              real *nll, real *class_err)
+{
+  *nll = 0.;
+  *class_err = 0.;
+  for(int t=0; t<data->n_examples; t++) {
+    data->setExample(t);
+    sae->forward(data->inputs);
+    real *log_probs = sae->outputs->frames[0];
+    int c = class_format->getClass(data->targets->frames[0]);
+    *nll -= log_probs[c];
+    if(class_format->getClass(log_probs) != c)
+      *class_err += 1.;
+  }
+  *nll /= (real)data->n_examples;
+  *class_err /= (real)data->n_examples;
+}
+
+// ************
+// *** MAIN ***
+// ************
+int main(int argc, char **argv)
+{
+  char *flag_train_data_file;
+  int flag_n_inputs;
+  int flag_n_classes;
+  int flag_n_layers;
+  int flag_n_hidden_units;
+  int flag_max_iter;
+  int flag_minibatch_size;
+  int flag_n_threads;
+  real flag_lr;
+  int flag_max_load;
+  bool flag_binary_mode;
+  int flag_seed;
+
+  CmdLine cmd;
+  cmd.info(help);
+
+  cmd.addSCmdArg("-train_data_file", &flag_train_data_file, "Filename of the training data.");
+  cmd.addICmdArg("-n_inputs", &flag_n_inputs, "number of inputs");
+  cmd.addICmdArg("-n_classes", &flag_n_classes, "number of targets");
+
+  cmd.addICmdOption("-n_layers", &flag_n_layers, 3, "number of hidden layers", true);
+  cmd.addICmdOption("-n_hidden_units", &flag_n_hidden_units, 1000, "number of hidden units per layer", true);
+  cmd.addICmdOption("-max_iter", &flag_max_iter, 10, "number of SGD epochs", true);
+  cmd.addICmdOption("-minibatch_size", &flag_minibatch_size, 1, "number of examples per parameter update", true);
+  cmd.addICmdOption("-n_threads", &flag_n_threads, 1, "number of threads of the convex fit", true);
+  cmd.addRCmdOption("-lr", &flag_lr, 0.01, "learning rate", true);
+  cmd.addICmdOption("-max_load", &flag_max_load, -1, "max number of examples to load", true);
+  cmd.addBCmdOption("-binary_mode", &flag_binary_mode, false, "binary mode for files", true);
+  cmd.addICmdOption("-seed", &flag_seed, 1, "model and shuffle seed", true);
+
+  cmd.read(argc, argv);
+
+  Allocator *data_allocator = new Allocator;
+
+  MatDataSet train_matdata(flag_train_data_file, flag_n_inputs, 1, false,
+                           flag_max_load, flag_binary_mode);
+  ClassFormatDataSet train_data(&train_matdata, flag_n_classes);
+  OneHotClassFormat class_format(&train_data);
+
+  int *units_per_hidden_layer = (int*) data_allocator->alloc(sizeof(int)*flag_n_layers);
+  for(int i=0; i<flag_n_layers; i++)
+    units_per_hidden_layer[i] = flag_n_hidden_units;
+
+  printf("%d train examples, %d layers of %d units, %d SGD epochs, minibatch %d, %d threads\n",
+         train_data.n_examples, flag_n_layers, flag_n_hidden_units, flag_max_iter,
+         flag_minibatch_size, flag_n_threads);
+
+  real times[2];
+  real nlls[2];
+  real class_errs[2];
+  Timer timer;
+  for(int convex=0; convex<2; convex++)   {
+    Allocator *allocator = new Allocator;
+
+    SetRandomSeed((long)flag_seed);
+    StackedAutoencoder *sae = new(allocator) StackedAutoencoder("sae", "sigmoid", true, false,
+                                                                flag_n_inputs, flag_n_layers,
+                                                                units_per_hidden_layer,
+                                                                flag_n_classes, false, false);
+    ClassNLLCriterion *criterion = new(allocator) ClassNLLCriterion(&class_format);
+    StackedAutoencoderTrainer *trainer = new(allocator) StackedAutoencoderTrainer(sae, criterion, "./", false);
+    trainer->setIOption("minibatch size", flag_minibatch_size);
+    trainer->setIOption("max iter", flag_max_iter);
+    trainer->setROption("learning rate", flag_lr);
+    trainer->setROption("end accuracy", 0.);
+    trainer->setBOption("convex outputer", convex);
+    trainer->setIOption("convex outputer threads", flag_n_threads);
+
+    MeasurerList measurers;
+    timer.reset();
+    trainer->TrainSupervisedTopKLayers(&train_data, &measurers, 1);
+    times[convex] = timer.getTime();
+    Evaluate(sae, &train_data, &class_format, &nlls[convex], &class_errs[convex]);
+
+    delete allocator;
+  }
+
+  printf("%-8s %10s %10s %10s\n", "outputer", "time", "nll", "class err");
+  printf("%-8s %9.2fs %10.4g %10.4g\n", "sgd", times[0], nlls[0], class_errs[0]);
+  printf("%-8s %9.2fs %10.4g %10.4g\n", "convex", times[1], nlls[1], class_errs[1]);
+
+  delete data_allocator;
+  return(0);
+}
@@ -0,0 +1,141 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+const char *help = "\
+destructive_benchmark\n\
+\n\
+This program times the corruption of the Destructive layer, forward and\n\
+backward, with the original per-unit Random::uniform() draws and bool flags,\n\
+and with the Philox bitmask and the masked select kernels at each level the\n\
+CPU supports, for corruption probabilities 0.1 to 0.5.\n";
+
+#include <stdio.h>
+
+#include "Allocator.h"
+#include "CmdLine.h"
+#include "Random.h"
+#include "Timer.h"
+
+#include "philox.h"
+#include "simd_kernels.h"
+
+using namespace Torch;
+
+// The loops Destructive used before the bitmask.
+void ReferencePass(int n_inputs, real prob, real value, bool *destroyed,
+                   real *f_inputs, real *f_outputs, real *alpha_, real *beta_)
+{
+  for(int i=0; i<n_inputs; i++) {
+    if(Random::uniform()<prob)  {
+      destroyed[i] = true;
+      f_outputs[i] = value;
+    }   else    {
+      destroyed[i] = false;
+      f_outputs[i] = f_inputs[i];
+    }
+  }
+  for(int i=0; i<n_inputs; i++) {
+    if(destroyed[i])
+      beta_[i] = 0.0;
+    else
+      beta_[i] = alpha_[i];
+  }
+}
+
+void MaskPass(int n_inputs, real prob, real value, unsigned long long stream,
+              unsigned int *mask, real *f_inputs, real *f_outputs,
+              real *alpha_, real *beta_)
+{
+  PhiloxBernoulliMask(1234, 5678, stream, n_inputs, prob, mask);
+  SimdMaskedSelect(n_inputs, mask, value, f_inputs, f_outputs);
+  SimdMaskedSelect(n_inputs, mask, 0., alpha_, beta_);
+}
+
+// ************
+// *** MAIN ***
+// ************
+int main(int argc, char **argv)
+{
+  int flag_n_inputs;
+  int flag_iterations;
+  int flag_seed;
+
+  CmdLine cmd;
+  cmd.info(help);
+
+  cmd.addICmdOption("-n_inputs", &flag_n_inputs, 784, "number of units to corrupt", true);
+  cmd.addICmdOption("-iterations", &flag_iterations, 20000, "number of forward/backward passes per probability", true);
+  cmd.addICmdOption("-seed", &flag_seed, 1, "random seed", true);
+
+  cmd.read(argc, argv);
+
+  Random::manualSeed((long)flag_seed);
+
+  Allocator *allocator = new Allocator;
+
+  int n_inputs = flag_n_inputs;
+  int n_mask_words = (n_inputs+31)/32;
+
+  bool *destroyed = (bool*) allocator->alloc(sizeof(bool)*n_inputs);
+  unsigned int *mask = (unsigned int*) allocator->alloc(sizeof(unsigned int)*n_mask_words);
+  real *f_inputs = (real*) allocator->alloc(sizeof(real)*n_inputs);
+  real *f_outputs = (real*) allocator->alloc(sizeof(real)*n_inputs);
+  real *alpha = (real*) allocator->alloc(sizeof(real)*n_inputs);
+  real *beta = (real*) allocator->alloc(sizeof(real)*n_inputs);
+
+  for(int i=0; i<n_inputs; i++) {
+    f_inputs[i] = Random::uniform();
+    alpha[i] = Random::boundedUniform(-1., 1.);
+  }
+
+  printf("%d units, %d iterations, %d bytes per real\n",
+         n_inputs, flag_iterations, (int)sizeof(real));
+
+  SimdKernelsLevel best = SimdKernelsBestLevel();
+  Timer timer;
+  for(int p=1; p<=5; p++)       {
+    real prob = 0.1 * p;
+
+    // Reference
+    timer.reset();
+    for(int it=0; it<flag_iterations; it++)
+      ReferencePass(n_inputs, prob, 0., destroyed, f_inputs, f_outputs, alpha, beta);
+    real ref_time = timer.getTime();
+    printf("prob %.1f  %-10s %8.4f s  %8.3f ns/unit\n", prob, "reference",
+           ref_time, 1e9 * ref_time / ((real)flag_iterations * n_inputs));
+
+    // Bitmask, at every supported level
+    for(int level=SIMD_KERNELS_SCALAR; level<=best; level++)    {
+      SimdKernelsSetLevel((SimdKernelsLevel)level);
+
+      long n_destroyed = 0;
+      timer.reset();
+      for(int it=0; it<flag_iterations; it++)   {
+        MaskPass(n_inputs, prob, 0., it, mask, f_inputs, f_outputs, alpha, beta);
+        for(int w=0; w<n_mask_words; w++)
+          n_destroyed += __builtin_popcount(mask[w]);
+      }
+      real time = timer.getTime();
+
+      printf("prob %.1f  %-10s %8.4f s  %8.3f ns/unit  speedup %5.2f  corrupted %.4f\n",
+             prob, SimdKernelsLevelName((SimdKernelsLevel)level), time,
+             1e9 * time / ((real)flag_iterations * n_inputs), ref_time / time,
+             (real)n_destroyed / ((real)flag_iterations * n_inputs));
+    }
+    SimdKernelsSetLevel(best);
+  }
+
+  delete allocator;
+  return(0);
+}
@@ -0,0 +1,128 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+const char *help = "\
+fast_math_benchmark\n\
+\n\
+This program reports the accuracy of the fast_math approximations against\n\
+libm (largest absolute and relative errors on a grid) and times the array\n\
+versions against the libm loops the layers use otherwise. \n";
+
+#include <stdio.h>
+#include <math.h>
+
+#include "Allocator.h"
+#include "CmdLine.h"
+#include "Timer.h"
+
+#include "fast_math.h"
+
+using namespace Torch;
+
+double LibmSigmoid(double x)
+{
+  return 1./(1.+exp(-x));
+}
+
+double LibmSoftsign(double x)
+{
+  return 0.5 * (x/(1.0 + fabs(x)) + 1.);
+}
+
+// Largest errors of #approx# against #exact# on #n# points evenly spaced in
+// [min, max] (or geometrically spaced if #geometric#).
+void ReportAccuracy(const char *name, double (*approx)(double), double (*exact)(double),
+                    double min, double max, int n, bool geometric)
+{
+  double max_abs = 0.;
+  double max_rel = 0.;
+  double log_step = (log(max) - log(min)) / (n-1);
+  for(int i=0; i<n; i++)        {
+    double x = geometric ? exp(log(min) + log_step*i) : min + (max-min)*i/(n-1);
+    double y = exact(x);
+    double abs_err = fabs(approx(x) - y);
+    if(abs_err > max_abs)
+      max_abs = abs_err;
+    if(y != 0. && abs_err/fabs(y) > max_rel)
+      max_rel = abs_err/fabs(y);
+  }
+  printf("%-10s [%g, %g]  max abs error %-12g max rel error %g\n",
+         name, min, max, max_abs, max_rel);
+}
+
+// Times #n_repeats# applications on an array of #n# values in [min, max].
+void ReportSpeed(const char *name, void (*approx)(int, real*, real*), double (*exact)(double),
+                 real *inputs, real *outputs, int n, int n_repeats, double min, double max)
+{
+  for(int i=0; i<n; i++)
+    inputs[i] = min + (max-min)*i/(n-1);
+
+  Timer timer;
+  for(int r=0; r<n_repeats; r++)
+    for(int i=0; i<n; i++)
+      outputs[i] = exact(inputs[i]);
+  real libm_time = timer.getTime();
+
+  timer.reset();
+  for(int r=0; r<n_repeats; r++)
+    approx(n, inputs, outputs);
+  real fast_time = timer.getTime();
+
+  double n_values = (double)n * n_repeats;
+  printf("%-10s libm %8.2f ns/value  fast %8.2f ns/value  speedup %5.2f\n", name,
+         1e9*libm_time/n_values, 1e9*fast_time/n_values, libm_time/fast_time);
+}
+
+// ************
+// *** MAIN ***
+// ************
+int main(int argc, char **argv)
+{
+  int flag_n_points;
+  int flag_n_values;
+  int flag_n_repeats;
+
+  CmdLine cmd;
+  cmd.info(help);
+
+  cmd.addICmdOption("-n_points", &flag_n_points, 1000000, "number of points for the accuracy report", true);
+  cmd.addICmdOption("-n_values", &flag_n_values, 1000, "size of the arrays for the timings (a layer)", true);
+  cmd.addICmdOption("-n_repeats", &flag_n_repeats, 10000, "number of times the arrays are processed", true);
+
+  cmd.read(argc, argv);
+
+  Allocator *allocator = new Allocator;
+
+  printf("*** Accuracy against libm ***\n");
+  // The absolute error is meaningless on the whole range.
+  ReportAccuracy("exp", FastExp, exp, -708., 709., flag_n_points, false);
+  ReportAccuracy("exp", FastExp, exp, -10., 10., flag_n_points, false);
+  ReportAccuracy("log", FastLog, log, 1e-300, 1e300, flag_n_points, true);
+  ReportAccuracy("log", FastLog, log, 1e-6, 1., flag_n_points, false);
+  ReportAccuracy("sigmoid", FastSigmoid, LibmSigmoid, -50., 50., flag_n_points, false);
+  ReportAccuracy("tanh", FastTanh, tanh, -20., 20., flag_n_points, false);
+  ReportAccuracy("softsign", FastSoftsign, LibmSoftsign, -50., 50., flag_n_points, false);
+
+  printf("*** Speed, arrays of %d values ***\n", flag_n_values);
+  real *inputs = (real*) allocator->alloc(sizeof(real)*flag_n_values);
+  real *outputs = (real*) allocator->alloc(sizeof(real)*flag_n_values);
+  ReportSpeed("exp", FastExpArray, exp, inputs, outputs, flag_n_values, flag_n_repeats, -10., 10.);
+  ReportSpeed("log", FastLogArray, log, inputs, outputs, flag_n_values, flag_n_repeats, 1e-3, 1.);
+  ReportSpeed("sigmoid", FastSigmoidArray, LibmSigmoid, inputs, outputs, flag_n_values, flag_n_repeats, -10., 10.);
+  ReportSpeed("tanh", FastTanhArray, tanh, inputs, outputs, flag_n_values, flag_n_repeats, -10., 10.);
+  ReportSpeed("softsign", FastSoftsignArray, LibmSoftsign, inputs, outputs, flag_n_values, flag_n_repeats, -10., 10.);
+
+  delete allocator;
+  return(0);
+}
@@ -0,0 +1,171 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+const char *help = "\
+frozen_parameters_benchmark\n\
+\n\
+This program times the phases of a stacked autoencoder that only train its\n\
+top: the layerwise unsupervised training of each layer, then the supervised\n\
+training of the top k layers for k = 1, 2, ... It runs them all without\n\
+and with the \"freeze untrained\" option (same seed) and reports the time\n\
+saved by each phase.\n";
+
+#include <stdio.h>
+
+#include "Allocator.h"
+#include "CmdLine.h"
+#include "random_streams.h"
+#include "Timer.h"
+
+#include "MatDataSet.h"
+#include "ClassFormatDataSet.h"
+#include "OneHotClassFormat.h"
+#include "Trainer.h"         // for MeasurerList!
+#include "ClassNLLCriterion.h"
+
+#include "stacked_autoencoder.h"
+#include "stacked_autoencoder_trainer.h"
+#include "helpers.h"
+
+using namespace Torch;
+
+StackedAutoencoderTrainer *NewTrainer(Allocator *allocator, int n_inputs, int n_layers,
+                                      int *units_per_hidden_layer, int n_classes,
+                                      DataSet *train_data, OneHotClassFormat *class_format,
+                                      int minibatch_size, bool freeze_untrained)
+{
+  StackedAutoencoder *sae = new(allocator) StackedAutoencoder("sae", "sigmoid", true, false,
+                                                              n_inputs, n_layers,
+                                                              units_per_hidden_layer,
+                                                              n_classes, true, false);
+  ClassNLLCriterion *criterion = new(allocator) ClassNLLCriterion(class_format);
+
+  DataSet **unsup_datasets = (DataSet**) allocator->alloc(sizeof(DataSet*)*sae->n_hidden_layers);
+  Criterion **unsup_criterions = (Criterion**) allocator->alloc(sizeof(Criterion*)*sae->n_hidden_layers);
+  Measurer **unsup_measurers = (Measurer**) allocator->alloc(sizeof(Measurer*)*sae->n_hidden_layers);
+  BuildSaeUnsupDataSetsCriteriaMeasurers(allocator, "./", sae, train_data, criterion,
+                                         "xentropy", false, unsup_datasets,
+                                         unsup_criterions, unsup_measurers, false);
+
+  StackedAutoencoderTrainer *trainer = new(allocator) StackedAutoencoderTrainer(sae, criterion, "./", false);
+  trainer->unsup_datasets = unsup_datasets;
+  trainer->unsup_criterions = unsup_criterions;
+  trainer->unsup_measurers = unsup_measurers;
+  trainer->setIOption("minibatch size", minibatch_size);
+  trainer->setBOption("freeze untrained", freeze_untrained);
+  return trainer;
+}
+
+// ************
+// *** MAIN ***
+// ************
+int main(int argc, char **argv)
+{
+  char *flag_train_data_file;
+  int flag_n_inputs;
+  int flag_n_classes;
+  int flag_n_layers;
+  int flag_n_hidden_units;
+  int flag_max_iter;
+  int flag_minibatch_size;
+  real flag_lr;
+  int flag_max_load;
+  bool flag_binary_mode;
+  int flag_seed;
+
+  CmdLine cmd;
+  cmd.info(help);
+
+  cmd.addSCmdArg("-train_data_file", &flag_train_data_file, "Filename of the training data.");
+  cmd.addICmdArg("-n_inputs", &flag_n_inputs, "number of inputs");
+  cmd.addICmdArg("-n_classes", &flag_n_classes, "number of targets");
+
+  cmd.addICmdOption("-n_layers", &flag_n_layers, 4, "number of hidden layers", true);
+  cmd.addICmdOption("-n_hidden_units", &flag_n_hidden_units, 1000, "number of hidden units per layer", true);
+  cmd.addICmdOption("-max_iter", &flag_max_iter, 1, "number of epochs per phase", true);
+  cmd.addICmdOption("-minibatch_size", &flag_minibatch_size, 1, "number of examples per parameter update", true);
+  cmd.addRCmdOption("-lr", &flag_lr, 0.01, "learning rate", true);
+  cmd.addICmdOption("-max_load", &flag_max_load, -1, "max number of examples to load", true);
+  cmd.addBCmdOption("-binary_mode", &flag_binary_mode, false, "binary mode for files", true);
+  cmd.addICmdOption("-seed", &flag_seed, 1, "model and shuffle seed", true);
+
+  cmd.read(argc, argv);
+
+  Allocator *data_allocator = new Allocator;
+
+  MatDataSet train_matdata(flag_train_data_file, flag_n_inputs, 1, false,
+                           flag_max_load, flag_binary_mode);
+  ClassFormatDataSet train_data(&train_matdata, flag_n_classes);
+  OneHotClassFormat class_format(&train_data);
+
+  int *units_per_hidden_layer = (int*) data_allocator->alloc(sizeof(int)*flag_n_layers);
+  for(int i=0; i<flag_n_layers; i++)
+    units_per_hidden_layer[i] = flag_n_hidden_units;
+
+  printf("%d train examples, %d layers of %d units, %d epochs per phase, minibatch %d, %d bytes per real\n",
+         train_data.n_examples, flag_n_layers, flag_n_hidden_units, flag_max_iter,
+         flag_minibatch_size, (int)sizeof(real));
+
+  // The layerwise phases, then the top k phases
+  int n_phases = 2*flag_n_layers;
+  real *times[2];
+  for(int freeze=0; freeze<2; freeze++)
+    times[freeze] = (real*) data_allocator->alloc(sizeof(real)*n_phases);
+
+  Timer timer;
+  for(int freeze=0; freeze<2; freeze++) {
+    Allocator *allocator = new Allocator;
+
+    SetRandomSeed((long)flag_seed);
+    StackedAutoencoderTrainer *trainer = NewTrainer(allocator, flag_n_inputs, flag_n_layers,
+                                                    units_per_hidden_layer, flag_n_classes,
+                                                    &train_data, &class_format,
+                                                    flag_minibatch_size, freeze);
+    trainer->setIOption("max iter", flag_max_iter);
+    trainer->setROption("learning rate", flag_lr);
+    trainer->setROption("end accuracy", 0.);
+
+    trainer->layerwise_training = true;
+    for(int i=0; i<flag_n_layers; i++)  {
+      trainer->layerwise_layer = i;
+      timer.reset();
+      trainer->TrainUnsupLayer();
+      times[freeze][i] = timer.getTime();
+    }
+    trainer->layerwise_training = false;
+
+    MeasurerList measurers;
+    for(int k=1; k<=flag_n_layers; k++) {
+      timer.reset();
+      trainer->TrainSupervisedTopKLayers(&train_data, &measurers, k);
+      times[freeze][flag_n_layers+k-1] = timer.getTime();
+    }
+
+    delete allocator;
+  }
+
+  printf("%-16s %10s %10s %8s\n", "phase", "unfrozen", "frozen", "saved");
+  for(int p=0; p<n_phases; p++) {
+    char name[32];
+    if(p < flag_n_layers)
+      sprintf(name, "layerwise %d", p);
+    else
+      sprintf(name, "top %d layers", p - flag_n_layers + 1);
+    printf("%-16s %9.2fs %9.2fs %7.1f%%\n", name, times[0][p], times[1][p],
+           100. * (times[0][p] - times[1][p]) / times[0][p]);
+  }
+
+  delete data_allocator;
+  return(0);
+}
@@ -0,0 +1,108 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+const char *help = "\
+mapped_data_set_benchmark\n\
+\n\
+This program times the loading of a MatDataSet file, and the opening of\n\
+the same examples converted to a mapped data set file (written next to it\n\
+unless -mapped_file is given), and a pass over all the examples of each.\n";
+
+#include <stdio.h>
+#include <string>
+
+#include "Allocator.h"
+#include "CmdLine.h"
+#include "Timer.h"
+
+#include "MatDataSet.h"
+#include "mapped_data_set.h"
+
+using namespace Torch;
+
+// Sum of the inputs of all the examples, so the pass is not optimized away.
+real SumInputs(DataSet *data)
+{
+  real sum = 0.;
+  for(int t=0; t<data->n_examples; t++) {
+    data->setExample(t);
+    real *frame = data->inputs->frames[0];
+    for(int i=0; i<data->n_inputs; i++)
+      sum += frame[i];
+  }
+  return sum;
+}
+
+// ************
+// *** MAIN ***
+// ************
+int main(int argc, char **argv)
+{
+  char *flag_data_file;
+  int flag_n_inputs;
+  char *flag_mapped_file;
+  int flag_max_load;
+  bool flag_binary_mode;
+
+  CmdLine cmd;
+  cmd.info(help);
+
+  cmd.addSCmdArg("-data_file", &flag_data_file, "Filename of the MatDataSet data.");
+  cmd.addICmdArg("-n_inputs", &flag_n_inputs, "number of inputs");
+
+  cmd.addSCmdOption("-mapped_file", &flag_mapped_file, "", "mapped data set file to write (data_file.mapped if empty)", true);
+  cmd.addICmdOption("-max_load", &flag_max_load, -1, "max number of examples to load", true);
+  cmd.addBCmdOption("-binary_mode", &flag_binary_mode, false, "binary mode for files", true);
+
+  cmd.read(argc, argv);
+
+  std::string mapped_file = flag_mapped_file;
+  if(mapped_file == "")
+    mapped_file = std::string(flag_data_file) + ".mapped";
+
+  Allocator *allocator = new Allocator;
+  Timer timer;
+
+  timer.reset();
+  MatDataSet *matdata = new(allocator) MatDataSet(flag_data_file, flag_n_inputs, 1, false,
+                                                  flag_max_load, flag_binary_mode);
+  real mat_load_time = timer.getTime();
+
+  timer.reset();
+  SaveMappedDataSet(matdata, mapped_file.c_str());
+  real convert_time = timer.getTime();
+
+  timer.reset();
+  real mat_sum = SumInputs(matdata);
+  real mat_pass_time = timer.getTime();
+
+  timer.reset();
+  MappedDataSet *mapped = new(allocator) MappedDataSet(mapped_file.c_str(), flag_n_inputs, flag_max_load);
+  real mapped_open_time = timer.getTime();
+
+  // The first pass reads the file, unless it is in the page cache.
+  timer.reset();
+  real mapped_sum = SumInputs(mapped);
+  real mapped_pass_time = timer.getTime();
+
+  printf("%d examples of %d inputs, %d bytes per real\n",
+         matdata->n_examples, flag_n_inputs, (int)sizeof(real));
+  printf("%-10s %12s %12s\n", "", "load", "pass");
+  printf("%-10s %11.4fs %11.4fs\n", "matdataset", mat_load_time, mat_pass_time);
+  printf("%-10s %11.4fs %11.4fs\n", "mapped", mapped_open_time, mapped_pass_time);
+  printf("conversion %.4fs, sums %g and %g\n", convert_time, mat_sum, mapped_sum);
+
+  delete allocator;
+  return(0);
+}
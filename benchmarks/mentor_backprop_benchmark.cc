@@ -0,0 +1,197 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+const char *help = "\
+mentor_backprop_benchmark\n\
+\n\
+This program times the mentor's side of mentoring with communication type 2\n\
+(see CommunicatingSaePairTrainer::trainMentoring): the backward of the whole\n\
+mentor, then of its communication sub-network only (\"mentor communication\n\
+only\"). Both runs start from the same mentor and student (same seeds) and\n\
+the program reports the mentor-side time per epoch of each.\n";
+
+#include <stdio.h>
+
+#include "Allocator.h"
+#include "CmdLine.h"
+#include "random_streams.h"
+
+#include "MatDataSet.h"
+#include "ClassFormatDataSet.h"
+#include "OneHotClassFormat.h"
+#include "Trainer.h"         // for MeasurerList!
+#include "ClassNLLCriterion.h"
+
+#include "communicating_stacked_autoencoder.h"
+#include "communicating_sae_pair_trainer.h"
+#include "helpers.h"
+
+using namespace Torch;
+
+// A mentor and a student of the same topology, seeded with #seed# and
+// #seed#+1, and the pair trainer of the mentoring with communication type 2.
+CommunicatingSaePairTrainer *NewPairTrainer(Allocator *allocator, int n_inputs, int n_layers,
+                                            int *units_per_hidden_layer, int *units_per_speech_layer,
+                                            int n_classes, int n_communication_layers,
+                                            DataSet *train_data, OneHotClassFormat *class_format,
+                                            int seed, bool communication_only)
+{
+  CommunicatingStackedAutoencoder *csaes[2];
+  Criterion *criterions[2];
+  for(int k=0; k<2; k++)        {
+    SetRandomSeed((long)seed + k);
+    csaes[k] = new(allocator) CommunicatingStackedAutoencoder(k == 0 ? "mentor" : "student", "sigmoid",
+                                                              true, false, n_inputs, n_layers,
+                                                              units_per_hidden_layer, n_classes,
+                                                              false, false, units_per_speech_layer,
+                                                              2, n_communication_layers);
+    criterions[k] = new(allocator) ClassNLLCriterion(class_format);
+  }
+
+  CommunicatingSaePairTrainer *trainer = new(allocator) CommunicatingSaePairTrainer("./", 2, false);
+  trainer->first_csae = csaes[0];
+  trainer->second_csae = csaes[1];
+  trainer->first_sup_criterion = criterions[0];
+  trainer->second_sup_criterion = criterions[1];
+
+  DataSet ***unsup_datasets[2] = {&trainer->first_unsup_datasets, &trainer->second_unsup_datasets};
+  Criterion ***unsup_criterions[2] = {&trainer->first_unsup_criterions, &trainer->second_unsup_criterions};
+  Measurer ***unsup_measurers[2] = {&trainer->first_unsup_measurers, &trainer->second_unsup_measurers};
+  DataSet ***agree_datasets[2] = {&trainer->first_comAgree_datasets, &trainer->second_comAgree_datasets};
+  Criterion ***agree_criterions[2] = {&trainer->first_comAgree_criterions, &trainer->second_comAgree_criterions};
+  Measurer ***agree_measurers[2] = {&trainer->first_comAgree_measurers, &trainer->second_comAgree_measurers};
+  DataSet ***content_datasets[2] = {&trainer->first_comContent_datasets, &trainer->second_comContent_datasets};
+  Criterion ***content_criterions[2] = {&trainer->first_comContent_criterions, &trainer->second_comContent_criterions};
+  Measurer ***content_measurers[2] = {&trainer->first_comContent_measurers, &trainer->second_comContent_measurers};
+
+  for(int k=0; k<2; k++)        {
+    *unsup_datasets[k] = (DataSet**) allocator->alloc(sizeof(DataSet*)*n_layers);
+    *unsup_criterions[k] = (Criterion**) allocator->alloc(sizeof(Criterion*)*n_layers);
+    *unsup_measurers[k] = (Measurer**) allocator->alloc(sizeof(Measurer*)*n_layers);
+    BuildSaeUnsupDataSetsCriteriaMeasurers(allocator, "./", csaes[k], train_data, criterions[k],
+                                           "xentropy", false, *unsup_datasets[k],
+                                           *unsup_criterions[k], *unsup_measurers[k], false);
+
+    *agree_datasets[k] = (DataSet**) allocator->alloc(sizeof(DataSet*)*n_communication_layers);
+    *agree_criterions[k] = (Criterion**) allocator->alloc(sizeof(Criterion*)*n_communication_layers);
+    *agree_measurers[k] = (Measurer**) allocator->alloc(sizeof(Measurer*)*n_communication_layers);
+    BuildSaeComAgreeDatasetsCriteriaMeasurers(allocator, "./", csaes[k], train_data, criterions[k],
+                                              "xentropy", 2, false, *agree_datasets[k],
+                                              *agree_criterions[k], *agree_measurers[k], false,
+                                              n_communication_layers);
+
+    *content_datasets[k] = (DataSet**) allocator->alloc(sizeof(DataSet*)*n_communication_layers);
+    *content_criterions[k] = (Criterion**) allocator->alloc(sizeof(Criterion*)*n_communication_layers);
+    *content_measurers[k] = (Measurer**) allocator->alloc(sizeof(Measurer*)*n_communication_layers);
+    BuildSaeComContentDatasetsCriteriaMeasurers(allocator, "./", csaes[k], train_data, criterions[k],
+                                                "xentropy", false, *content_datasets[k],
+                                                *content_criterions[k], *content_measurers[k], false,
+                                                n_communication_layers);
+  }
+  csaes[0]->BuildMentor();
+
+  trainer->setBOption("mentor communication only", communication_only);
+  return trainer;
+}
+
+// ************
+// *** MAIN ***
+// ************
+int main(int argc, char **argv)
+{
+  char *flag_train_data_file;
+  int flag_n_inputs;
+  int flag_n_classes;
+  int flag_n_layers;
+  int flag_n_hidden_units;
+  int flag_n_speech_units;
+  int flag_n_communication_layers;
+  int flag_max_iter;
+  int flag_minibatch_size;
+  real flag_lr;
+  int flag_max_load;
+  bool flag_binary_mode;
+  int flag_seed;
+
+  CmdLine cmd;
+  cmd.info(help);
+
+  cmd.addSCmdArg("-train_data_file", &flag_train_data_file, "Filename of the training data.");
+  cmd.addICmdArg("-n_inputs", &flag_n_inputs, "number of inputs");
+  cmd.addICmdArg("-n_classes", &flag_n_classes, "number of targets");
+
+  cmd.addICmdOption("-n_layers", &flag_n_layers, 3, "number of hidden layers", true);
+  cmd.addICmdOption("-n_hidden_units", &flag_n_hidden_units, 1000, "number of hidden units per layer", true);
+  cmd.addICmdOption("-n_speech_units", &flag_n_speech_units, 100, "number of speech units per layer", true);
+  cmd.addICmdOption("-n_communication_layers", &flag_n_communication_layers, 3, "number of layers the mentor communicates on", true);
+  cmd.addICmdOption("-max_iter", &flag_max_iter, 2, "number of epochs per run", true);
+  cmd.addICmdOption("-minibatch_size", &flag_minibatch_size, 1, "number of examples per parameter update", true);
+  cmd.addRCmdOption("-lr", &flag_lr, 0.01, "learning rate", true);
+  cmd.addICmdOption("-max_load", &flag_max_load, -1, "max number of examples to load", true);
+  cmd.addBCmdOption("-binary_mode", &flag_binary_mode, false, "binary mode for files", true);
+  cmd.addICmdOption("-seed", &flag_seed, 1, "mentor seed (the student's is seed+1), and shuffle seed", true);
+
+  cmd.read(argc, argv);
+
+  Allocator *data_allocator = new Allocator;
+
+  MatDataSet train_matdata(flag_train_data_file, flag_n_inputs, 1, false,
+                           flag_max_load, flag_binary_mode);
+  ClassFormatDataSet train_data(&train_matdata, flag_n_classes);
+  OneHotClassFormat class_format(&train_data);
+
+  int *units_per_hidden_layer = (int*) data_allocator->alloc(sizeof(int)*flag_n_layers);
+  int *units_per_speech_layer = (int*) data_allocator->alloc(sizeof(int)*flag_n_layers);
+  for(int i=0; i<flag_n_layers; i++)    {
+    units_per_hidden_layer[i] = flag_n_hidden_units;
+    units_per_speech_layer[i] = flag_n_speech_units;
+  }
+
+  printf("%d train examples, %d layers of %d units (%d speech units, %d communication layers), %d epochs, minibatch %d, %d bytes per real\n",
+         train_data.n_examples, flag_n_layers, flag_n_hidden_units, flag_n_speech_units,
+         flag_n_communication_layers, flag_max_iter, flag_minibatch_size, (int)sizeof(real));
+
+  // The whole mentor, then its communication sub-network
+  real times[2];
+  const char *names[2] = {"whole mentor", "communication"};
+  for(int only=0; only<2; only++)       {
+    Allocator *allocator = new Allocator;
+
+    CommunicatingSaePairTrainer *trainer = NewPairTrainer(allocator, flag_n_inputs, flag_n_layers,
+                                                          units_per_hidden_layer, units_per_speech_layer,
+                                                          flag_n_classes, flag_n_communication_layers,
+                                                          &train_data, &class_format,
+                                                          flag_seed, only);
+    trainer->setIOption("max iter", flag_max_iter);
+    trainer->setIOption("minibatch size", flag_minibatch_size);
+    trainer->setROption("learning rate", flag_lr);
+    trainer->setROption("end accuracy", 0.);
+
+    MeasurerList measurers;
+    SetRandomSeed((long)flag_seed);
+    trainer->trainMentoring(&train_data, &measurers, flag_n_communication_layers, 1., 1.);
+    times[only] = trainer->mentor_epoch_time;
+
+    delete allocator;
+  }
+
+  printf("%-16s %12s\n", "mentor backward", "s per epoch");
+  for(int only=0; only<2; only++)
+    printf("%-16s %11.3fs\n", names[only], times[only]);
+  if(times[0] > 0.)
+    printf("saved %.1f%%\n", 100. * (times[0] - times[1]) / times[0]);
+
+  delete data_allocator;
+  return(0);
+}
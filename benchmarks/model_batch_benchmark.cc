@@ -0,0 +1,160 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+const char *help = "\
+model_batch_benchmark\n\
+\n\
+This program trains the supervised network of n_models stacked\n\
+autoencoders of the same topology (seeds seed, seed+1, ...), one after the\n\
+other with StackedAutoencoderTrainer and then all at once with\n\
+ModelBatchTrainer, and reports the time of each and the classification\n\
+error of each model on the train set.\n";
+
+#include <stdio.h>
+
+#include "Allocator.h"
+#include "CmdLine.h"
+#include "random_streams.h"
+#include "Timer.h"
+
+#include "MatDataSet.h"
+#include "ClassFormatDataSet.h"
+#include "OneHotClassFormat.h"
+#include "ClassNLLCriterion.h"
+
+#include "stacked_autoencoder.h"
+#include "stacked_autoencoder_trainer.h"
+#include "model_batch_trainer.h"
+#include "helpers.h"
+
+using namespace Torch;
+
+// Fraction of the examples of #data# whose argmax output is not the target.
+real ClassificationError(StackedAutoencoder *sae, DataSet *data, OneHotClassFormat *class_format)
+{
+  int n_errors = 0;
+  for(int t=0; t<data->n_examples; t++) {
+    data->setExample(t);
+    sae->forward(data->inputs);
+    if(class_format->getClass(sae->outputs->frames[0]) != class_format->getClass(data->targets->frames[0]))
+      n_errors++;
+  }
+  return (real)n_errors / (real)data->n_examples;
+}
+
+// ************
+// *** MAIN ***
+// ************
+int main(int argc, char **argv)
+{
+  char *flag_train_data_file;
+  int flag_n_inputs;
+  int flag_n_classes;
+  int flag_n_models;
+  int flag_n_layers;
+  int flag_n_hidden_units;
+  int flag_max_iter;
+  int flag_minibatch_size;
+  real flag_lr;
+  int flag_max_load;
+  bool flag_binary_mode;
+  int flag_seed;
+
+  CmdLine cmd;
+  cmd.info(help);
+
+  cmd.addSCmdArg("-train_data_file", &flag_train_data_file, "Filename of the training data.");
+  cmd.addICmdArg("-n_inputs", &flag_n_inputs, "number of inputs");
+  cmd.addICmdArg("-n_classes", &flag_n_classes, "number of targets");
+
+  cmd.addICmdOption("-n_models", &flag_n_models, 16, "number of models", true);
+  cmd.addICmdOption("-n_layers", &flag_n_layers, 2, "number of hidden layers", true);
+  cmd.addICmdOption("-n_hidden_units", &flag_n_hidden_units, 100, "number of hidden units per layer", true);
+  cmd.addICmdOption("-max_iter", &flag_max_iter, 5, "number of epochs", true);
+  cmd.addICmdOption("-minibatch_size", &flag_minibatch_size, 1, "number of examples per parameter update", true);
+  cmd.addRCmdOption("-lr", &flag_lr, 0.01, "learning rate of the first model (the n-th one has lr/n)", true);
+  cmd.addICmdOption("-max_load", &flag_max_load, -1, "max number of examples to load", true);
+  cmd.addBCmdOption("-binary_mode", &flag_binary_mode, false, "binary mode for files", true);
+  cmd.addICmdOption("-seed", &flag_seed, 1, "seed of the first model", true);
+
+  cmd.read(argc, argv);
+
+  Allocator *allocator = new Allocator;
+
+  MatDataSet train_matdata(flag_train_data_file, flag_n_inputs, 1, false,
+                           flag_max_load, flag_binary_mode);
+  ClassFormatDataSet train_data(&train_matdata, flag_n_classes);
+  OneHotClassFormat class_format(&train_data);
+
+  int *units_per_hidden_layer = (int*) allocator->alloc(sizeof(int)*flag_n_layers);
+  for(int i=0; i<flag_n_layers; i++)
+    units_per_hidden_layer[i] = flag_n_hidden_units;
+
+  printf("%d train examples, %d models of %d layers of %d units, %d epochs, minibatch %d\n",
+         train_data.n_examples, flag_n_models, flag_n_layers, flag_n_hidden_units,
+         flag_max_iter, flag_minibatch_size);
+
+  // Two identical sets of models.
+  StackedAutoencoder ***saes = (StackedAutoencoder***) allocator->alloc(sizeof(StackedAutoencoder**)*2);
+  for(int k=0; k<2; k++)        {
+    saes[k] = (StackedAutoencoder**) allocator->alloc(sizeof(StackedAutoencoder*)*flag_n_models);
+    for(int m=0; m<flag_n_models; m++)  {
+      SetRandomSeed((long)(flag_seed + m));
+      saes[k][m] = new(allocator) StackedAutoencoder("sae", "sigmoid", true, false,
+                                                     flag_n_inputs, flag_n_layers,
+                                                     units_per_hidden_layer,
+                                                     flag_n_classes, false, false);
+    }
+  }
+
+  Timer timer;
+  real times[2];
+
+  timer.reset();
+  for(int m=0; m<flag_n_models; m++)    {
+    SetRandomSeed((long)flag_seed);
+    ClassNLLCriterion *criterion = new(allocator) ClassNLLCriterion(&class_format);
+    StackedAutoencoderTrainer *trainer = new(allocator) StackedAutoencoderTrainer(saes[0][m], criterion, "./", false);
+    trainer->setIOption("minibatch size", flag_minibatch_size);
+    trainer->setIOption("max iter", flag_max_iter);
+    trainer->setROption("learning rate", flag_lr/(real)(m+1));
+    trainer->setROption("end accuracy", 0.);
+    MeasurerList measurers;
+    trainer->train(&train_data, &measurers);
+  }
+  times[0] = timer.getTime();
+
+  timer.reset();
+  SetRandomSeed((long)flag_seed);
+  ModelBatchTrainer batch_trainer(saes[1], flag_n_models, &class_format);
+  batch_trainer.setIOption("minibatch size", flag_minibatch_size);
+  batch_trainer.setIOption("max iter", flag_max_iter);
+  for(int m=0; m<flag_n_models; m++)
+    batch_trainer.learning_rates[m] = flag_lr/(real)(m+1);
+  batch_trainer.Train(&train_data, NULL);
+  times[1] = timer.getTime();
+
+  real n_seen = (real)train_data.n_examples * flag_max_iter * flag_n_models;
+  printf("%-10s %10s %14s\n", "trainer", "time", "model-ex/s");
+  printf("%-10s %9.2fs %14.0f\n", "serial", times[0], n_seen / times[0]);
+  printf("%-10s %9.2fs %14.0f\n", "batched", times[1], n_seen / times[1]);
+
+  printf("%-6s %10s %10s\n", "model", "serial", "batched");
+  for(int m=0; m<flag_n_models; m++)
+    printf("%-6d %10.4g %10.4g\n", m, ClassificationError(saes[0][m], &train_data, &class_format),
+           ClassificationError(saes[1][m], &train_data, &class_format));
+
+  delete allocator;
+  return(0);
+}
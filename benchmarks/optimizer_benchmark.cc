@@ -0,0 +1,121 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+const char *help = "\
+optimizer_benchmark\n\
+\n\
+This program times the update of each optimizer over a parameter array, with\n\
+the scalar kernels and at each level of the simd_kernels the CPU supports,\n\
+and reports the largest difference with the scalar parameters. \n";
+
+#include <stdio.h>
+#include <math.h>
+
+#include <string>
+
+#include "Allocator.h"
+#include "CmdLine.h"
+#include "Random.h"
+#include "Timer.h"
+
+#include "optimizer.h"
+#include "simd_kernels.h"
+
+using namespace Torch;
+
+real MaxAbsDiff(int n, real *x, real *y)
+{
+  real max_diff = 0.;
+  for(int i=0; i<n; i++)        {
+    real diff = fabs(x[i] - y[i]);
+    if(diff > max_diff)
+      max_diff = diff;
+  }
+  return max_diff;
+}
+
+// ************
+// *** MAIN ***
+// ************
+int main(int argc, char **argv)
+{
+  int flag_n_params;
+  int flag_iterations;
+  real flag_lr;
+  int flag_seed;
+
+  CmdLine cmd;
+  cmd.info(help);
+
+  cmd.addICmdOption("-n_params", &flag_n_params, 1000*784, "number of parameters", true);
+  cmd.addICmdOption("-iterations", &flag_iterations, 100, "number of updates per optimizer and level", true);
+  cmd.addRCmdOption("-lr", &flag_lr, 1e-3, "learning rate", true);
+  cmd.addICmdOption("-seed", &flag_seed, 1, "random seed", true);
+
+  cmd.read(argc, argv);
+
+  Random::manualSeed((long)flag_seed);
+
+  Allocator *allocator = new Allocator;
+
+  int n = flag_n_params;
+  real *init_params = (real*) allocator->alloc(sizeof(real)*n);
+  real *der_params = (real*) allocator->alloc(sizeof(real)*n);
+  real *params = (real*) allocator->alloc(sizeof(real)*n);
+  real *scalar_params = (real*) allocator->alloc(sizeof(real)*n);
+
+  for(int i=0; i<n; i++)        {
+    init_params[i] = Random::boundedUniform(-0.1, 0.1);
+    der_params[i] = Random::boundedUniform(-1., 1.);
+  }
+
+  printf("%d parameters, %d iterations, %d bytes per real\n",
+         n, flag_iterations, (int)sizeof(real));
+
+  const char *names[] = {"sgd", "momentum", "nesterov", "adagrad", "rmsprop", "adam"};
+  SimdKernelsLevel best = SimdKernelsBestLevel();
+  for(int k=0; k<6; k++)        {
+    real scalar_time = 0.;
+    for(int level=SIMD_KERNELS_SCALAR; level<=best; level++)    {
+      SimdKernelsSetLevel((SimdKernelsLevel)level);
+
+      // A new optimizer each time, for a fresh state.
+      Allocator *optimizer_allocator = new Allocator;
+      Optimizer *optimizer = NewOptimizer(optimizer_allocator, names[k]);
+      for(int i=0; i<n; i++)
+        params[i] = init_params[i];
+
+      Timer timer;
+      for(int it=0; it<flag_iterations; it++)
+        optimizer->Update(params, der_params, n, flag_lr);
+      real time = timer.getTime();
+
+      if(level == SIMD_KERNELS_SCALAR)  {
+        scalar_time = time;
+        for(int i=0; i<n; i++)
+          scalar_params[i] = params[i];
+      }
+      printf("%-10s %-8s %10.4f s  %8.3f ns/param  speedup %5.2f  max diff %g\n",
+             names[k], SimdKernelsLevelName((SimdKernelsLevel)level), time,
+             1e9 * time / ((real)flag_iterations * n), scalar_time / time,
+             MaxAbsDiff(n, params, scalar_params));
+      delete optimizer_allocator;
+    }
+  }
+
+  SimdKernelsSetLevel(best);
+
+  delete allocator;
+  return(0);
+}
@@ -0,0 +1,303 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+const char *help = "\
+pipelined_layerwise_benchmark\n\
+\n\
+This program measures the wall-clock time the layerwise unsupervised\n\
+training of a stacked autoencoder takes to bring the reconstruction cost of\n\
+every layer under a target, with the serial schedule (each layer trained\n\
+epoch by epoch until it reaches the target, then the next one) and with the\n\
+pipelined one (all the layers at once, epoch by epoch until they all reach\n\
+it). The costs are measured on the train set between the epochs, out of\n\
+the timings.\n\
+\n\
+It then checks the pipelined schedule against the serial one: both train a\n\
+new (noisy) stacked autoencoder from the same initialization for\n\
+-check_epochs epochs. The weights of every encoder must have moved in both,\n\
+and the cost of each layer must be within -check_tolerance (relative) of\n\
+the serial one.\n";
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "Allocator.h"
+#include "CmdLine.h"
+#include "random_streams.h"
+#include "Timer.h"
+
+#include "MatDataSet.h"
+#include "ClassFormatDataSet.h"
+#include "OneHotClassFormat.h"
+#include "ClassNLLCriterion.h"
+
+#include "stacked_autoencoder.h"
+#include "stacked_autoencoder_trainer.h"
+#include "helpers.h"
+
+using namespace Torch;
+
+StackedAutoencoderTrainer *NewTrainer(Allocator *allocator, int n_inputs, int n_layers,
+                                      int *units_per_hidden_layer, int n_classes,
+                                      DataSet *train_data, OneHotClassFormat *class_format,
+                                      int minibatch_size)
+{
+  StackedAutoencoder *sae = new(allocator) StackedAutoencoder("sae", "sigmoid", true, false,
+                                                              n_inputs, n_layers,
+                                                              units_per_hidden_layer,
+                                                              n_classes, true, false);
+  ClassNLLCriterion *criterion = new(allocator) ClassNLLCriterion(class_format);
+
+  DataSet **unsup_datasets = (DataSet**) allocator->alloc(sizeof(DataSet*)*sae->n_hidden_layers);
+  Criterion **unsup_criterions = (Criterion**) allocator->alloc(sizeof(Criterion*)*sae->n_hidden_layers);
+  Measurer **unsup_measurers = (Measurer**) allocator->alloc(sizeof(Measurer*)*sae->n_hidden_layers);
+  BuildSaeUnsupDataSetsCriteriaMeasurers(allocator, "./", sae, train_data, criterion,
+                                         "xentropy", false, unsup_datasets,
+                                         unsup_criterions, unsup_measurers, false);
+
+  StackedAutoencoderTrainer *trainer = new(allocator) StackedAutoencoderTrainer(sae, criterion, "./", false);
+  trainer->unsup_datasets = unsup_datasets;
+  trainer->unsup_criterions = unsup_criterions;
+  trainer->unsup_measurers = unsup_measurers;
+  trainer->setIOption("minibatch size", minibatch_size);
+  return trainer;
+}
+
+// Mean reconstruction cost of layer #layer# over the train set.
+real LayerCost(StackedAutoencoderTrainer *trainer, int layer)
+{
+  DataSet *data = trainer->unsup_datasets[layer];
+  Criterion *criterion = trainer->unsup_criterions[layer];
+  GradientMachine *mesd = trainer->sae->mesd_machines[layer];
+
+  real cost = 0.;
+  for(int t=0; t<data->n_examples; t++) {
+    data->setExample(t);
+    mesd->forward(data->inputs);
+    criterion->forward(mesd->outputs);
+    cost += criterion->outputs->frames[0][0];
+  }
+  return cost / (real)data->n_examples;
+}
+
+// A copy of #params#, in one array.
+real *CopyParameters(Allocator *allocator, Parameters *params)
+{
+  int size = 0;
+  for(int k=0; k<params->n_data; k++)
+    size += params->size[k];
+  real *copy = (real*) allocator->alloc(sizeof(real)*size);
+  real *ptr = copy;
+  for(int k=0; k<params->n_data; k++)   {
+    memcpy(ptr, params->data[k], sizeof(real)*params->size[k]);
+    ptr += params->size[k];
+  }
+  return copy;
+}
+
+// Largest difference between #params# and the #copy# made by
+// CopyParameters().
+real MaxAbsDiff(Parameters *params, real *copy)
+{
+  real max_diff = 0.;
+  for(int k=0; k<params->n_data; k++)   {
+    for(int j=0; j<params->size[k]; j++)        {
+      real diff = fabs(params->data[k][j] - copy[j]);
+      if(diff > max_diff)
+        max_diff = diff;
+    }
+    copy += params->size[k];
+  }
+  return max_diff;
+}
+
+// ************
+// *** MAIN ***
+// ************
+int main(int argc, char **argv)
+{
+  char *flag_train_data_file;
+  int flag_n_inputs;
+  int flag_n_classes;
+  int flag_n_layers;
+  int flag_n_hidden_units;
+  real flag_target;
+  int flag_max_epochs;
+  int flag_minibatch_size;
+  int flag_snapshot_period;
+  int flag_queue_size;
+  real flag_lr;
+  int flag_max_load;
+  bool flag_binary_mode;
+  int flag_seed;
+  int flag_check_epochs;
+  real flag_check_tolerance;
+
+  CmdLine cmd;
+  cmd.info(help);
+
+  cmd.addSCmdArg("-train_data_file", &flag_train_data_file, "Filename of the training data.");
+  cmd.addICmdArg("-n_inputs", &flag_n_inputs, "number of inputs");
+  cmd.addICmdArg("-n_classes", &flag_n_classes, "number of targets");
+  cmd.addRCmdArg("-target", &flag_target, "reconstruction cost to reach on every layer");
+
+  cmd.addICmdOption("-n_layers", &flag_n_layers, 3, "number of hidden layers", true);
+  cmd.addICmdOption("-n_hidden_units", &flag_n_hidden_units, 1000, "number of hidden units per layer", true);
+  cmd.addICmdOption("-max_epochs", &flag_max_epochs, 20, "max number of epochs per layer", true);
+  cmd.addICmdOption("-minibatch_size", &flag_minibatch_size, 1, "number of examples per parameter update", true);
+  cmd.addICmdOption("-snapshot_period", &flag_snapshot_period, 5000, "examples between the snapshots of an encoder", true);
+  cmd.addICmdOption("-queue_size", &flag_queue_size, 16, "max number of minibatches waiting between two layers", true);
+  cmd.addRCmdOption("-lr", &flag_lr, 0.01, "learning rate", true);
+  cmd.addICmdOption("-max_load", &flag_max_load, -1, "max number of examples to load", true);
+  cmd.addBCmdOption("-binary_mode", &flag_binary_mode, false, "binary mode for files", true);
+  cmd.addICmdOption("-seed", &flag_seed, 1, "model and shuffle seed", true);
+  cmd.addICmdOption("-check_epochs", &flag_check_epochs, 2, "epochs per layer of the check", true);
+  cmd.addRCmdOption("-check_tolerance", &flag_check_tolerance, 0.25, "largest relative difference accepted between the costs of the two schedules", true);
+
+  cmd.read(argc, argv);
+
+  Allocator *data_allocator = new Allocator;
+
+  MatDataSet train_matdata(flag_train_data_file, flag_n_inputs, 1, false,
+                           flag_max_load, flag_binary_mode);
+  ClassFormatDataSet train_data(&train_matdata, flag_n_classes);
+  OneHotClassFormat class_format(&train_data);
+
+  int *units_per_hidden_layer = (int*) data_allocator->alloc(sizeof(int)*flag_n_layers);
+  for(int i=0; i<flag_n_layers; i++)
+    units_per_hidden_layer[i] = flag_n_hidden_units;
+
+  printf("%d train examples, %d layers of %d units, minibatch %d, target cost %g\n",
+         train_data.n_examples, flag_n_layers, flag_n_hidden_units, flag_minibatch_size,
+         flag_target);
+
+  real times[2];
+  int *epochs[2];
+  real *costs[2];
+  for(int pipelined=0; pipelined<2; pipelined++)        {
+    epochs[pipelined] = (int*) data_allocator->alloc(sizeof(int)*flag_n_layers);
+    costs[pipelined] = (real*) data_allocator->alloc(sizeof(real)*flag_n_layers);
+  }
+
+  Timer timer;
+  for(int pipelined=0; pipelined<2; pipelined++)        {
+    Allocator *allocator = new Allocator;
+
+    SetRandomSeed((long)flag_seed);
+    StackedAutoencoderTrainer *trainer = NewTrainer(allocator, flag_n_inputs, flag_n_layers,
+                                                    units_per_hidden_layer, flag_n_classes,
+                                                    &train_data, &class_format,
+                                                    flag_minibatch_size);
+    trainer->setIOption("max iter", 1);
+    trainer->setROption("learning rate", flag_lr);
+    trainer->setROption("end accuracy", 0.);
+
+    times[pipelined] = 0.;
+    for(int i=0; i<flag_n_layers; i++)
+      epochs[pipelined][i] = 0;
+
+    if(!pipelined)      {
+      trainer->layerwise_training = true;
+      for(int i=0; i<flag_n_layers; i++)        {
+        trainer->layerwise_layer = i;
+        do      {
+          timer.reset();
+          trainer->TrainUnsupLayer();
+          times[pipelined] += timer.getTime();
+          epochs[pipelined][i]++;
+          costs[pipelined][i] = LayerCost(trainer, i);
+        } while(costs[pipelined][i] > flag_target && epochs[pipelined][i] < flag_max_epochs);
+      }
+      trainer->layerwise_training = false;
+    }
+    else        {
+      bool reached = false;
+      while(!reached && epochs[pipelined][0] < flag_max_epochs)   {
+        timer.reset();
+        trainer->TrainUnsupLayerwisePipelined(flag_snapshot_period, flag_queue_size);
+        times[pipelined] += timer.getTime();
+
+        reached = true;
+        for(int i=0; i<flag_n_layers; i++)      {
+          epochs[pipelined][i]++;
+          costs[pipelined][i] = LayerCost(trainer, i);
+          if(costs[pipelined][i] > flag_target)
+            reached = false;
+        }
+      }
+    }
+
+    delete allocator;
+  }
+
+  printf("%-8s %12s %10s %12s %10s\n", "layer", "serial ep.", "cost", "pipelined ep.", "cost");
+  for(int i=0; i<flag_n_layers; i++)
+    printf("%-8d %12d %10.4g %12d %10.4g\n", i, epochs[0][i], costs[0][i], epochs[1][i], costs[1][i]);
+  printf("serial %.2fs, pipelined %.2fs, speedup %.2fx\n", times[0], times[1], times[0] / times[1]);
+
+  // === Check ===
+  // The same number of epochs for both schedules.
+  bool *moved[2];
+  for(int pipelined=0; pipelined<2; pipelined++)        {
+    moved[pipelined] = (bool*) data_allocator->alloc(sizeof(bool)*flag_n_layers);
+    Allocator *allocator = new Allocator;
+
+    SetRandomSeed((long)flag_seed);
+    StackedAutoencoderTrainer *trainer = NewTrainer(allocator, flag_n_inputs, flag_n_layers,
+                                                    units_per_hidden_layer, flag_n_classes,
+                                                    &train_data, &class_format,
+                                                    flag_minibatch_size);
+    trainer->setIOption("max iter", flag_check_epochs);
+    trainer->setROption("learning rate", flag_lr);
+    trainer->setROption("end accuracy", 0.);
+
+    real **initial = (real**) allocator->alloc(sizeof(real*)*flag_n_layers);
+    for(int i=0; i<flag_n_layers; i++)
+      initial[i] = CopyParameters(allocator, trainer->sae->encoders[i]->params);
+
+    if(!pipelined)      {
+      trainer->layerwise_training = true;
+      for(int i=0; i<flag_n_layers; i++)        {
+        trainer->layerwise_layer = i;
+        trainer->TrainUnsupLayer();
+      }
+      trainer->layerwise_training = false;
+    }
+    else
+      trainer->TrainUnsupLayerwisePipelined(flag_snapshot_period, flag_queue_size);
+
+    for(int i=0; i<flag_n_layers; i++)  {
+      costs[pipelined][i] = LayerCost(trainer, i);
+      moved[pipelined][i] = MaxAbsDiff(trainer->sae->encoders[i]->params, initial[i]) > 0.;
+    }
+
+    delete allocator;
+  }
+
+  int n_failures = 0;
+  printf("check, %d epochs per layer:\n", flag_check_epochs);
+  for(int i=0; i<flag_n_layers; i++)    {
+    real relative_diff = fabs(costs[1][i] - costs[0][i]) / costs[0][i];
+    bool ok = moved[0][i] && moved[1][i] && relative_diff <= flag_check_tolerance;
+    if(!ok)
+      n_failures++;
+    printf("%s layer %d: serial cost %.4g%s, pipelined cost %.4g%s\n", ok ? "OK  " : "FAIL", i,
+           costs[0][i], moved[0][i] ? "" : " (encoder not trained)",
+           costs[1][i], moved[1][i] ? "" : " (encoder not trained)");
+  }
+
+  delete data_allocator;
+  return(n_failures > 0);
+}
@@ -0,0 +1,198 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+const char *help = "\
+representation_cache_benchmark\n\
+\n\
+This program times the layerwise unsupervised training of each layer of a\n\
+stacked autoencoder without and with the \"cache representations\" option\n\
+(same seed), and reports the time saved on each layer. The time to build\n\
+the cache of a layer is counted in the training of the layer above.\n\
+\n\
+The stacked autoencoder is noisy. The cache only changes what feeds the\n\
+autoencoders, so the program also checks that both runs end with the same\n\
+encoders and decoders (up to -tolerance).\n";
+
+#include <stdio.h>
+#include <math.h>
+
+#include "Allocator.h"
+#include "CmdLine.h"
+#include "random_streams.h"
+#include "Timer.h"
+
+#include "MatDataSet.h"
+#include "ClassFormatDataSet.h"
+#include "OneHotClassFormat.h"
+#include "ClassNLLCriterion.h"
+
+#include "stacked_autoencoder.h"
+#include "stacked_autoencoder_trainer.h"
+#include "helpers.h"
+
+using namespace Torch;
+
+StackedAutoencoderTrainer *NewTrainer(Allocator *allocator, int n_inputs, int n_layers,
+                                      int *units_per_hidden_layer, int n_classes,
+                                      DataSet *train_data, OneHotClassFormat *class_format,
+                                      int minibatch_size, bool cache_representations,
+                                      bool cache_on_disk)
+{
+  StackedAutoencoder *sae = new(allocator) StackedAutoencoder("sae", "sigmoid", true, false,
+                                                              n_inputs, n_layers,
+                                                              units_per_hidden_layer,
+                                                              n_classes, true, false);
+  ClassNLLCriterion *criterion = new(allocator) ClassNLLCriterion(class_format);
+
+  DataSet **unsup_datasets = (DataSet**) allocator->alloc(sizeof(DataSet*)*sae->n_hidden_layers);
+  Criterion **unsup_criterions = (Criterion**) allocator->alloc(sizeof(Criterion*)*sae->n_hidden_layers);
+  Measurer **unsup_measurers = (Measurer**) allocator->alloc(sizeof(Measurer*)*sae->n_hidden_layers);
+  BuildSaeUnsupDataSetsCriteriaMeasurers(allocator, "./", sae, train_data, criterion,
+                                         "xentropy", false, unsup_datasets,
+                                         unsup_criterions, unsup_measurers, false);
+
+  StackedAutoencoderTrainer *trainer = new(allocator) StackedAutoencoderTrainer(sae, criterion, "./", false);
+  trainer->unsup_datasets = unsup_datasets;
+  trainer->unsup_criterions = unsup_criterions;
+  trainer->unsup_measurers = unsup_measurers;
+  trainer->setIOption("minibatch size", minibatch_size);
+  trainer->setBOption("cache representations", cache_representations);
+  trainer->setBOption("cache on disk", cache_on_disk);
+  return trainer;
+}
+
+real MaxAbsDiff(Parameters *a, Parameters *b)
+{
+  real max_diff = 0.;
+  for(int k=0; k<a->n_data; k++)
+    for(int j=0; j<a->size[k]; j++)     {
+      real diff = fabs(a->data[k][j] - b->data[k][j]);
+      if(diff > max_diff)
+        max_diff = diff;
+    }
+  return max_diff;
+}
+
+// ************
+// *** MAIN ***
+// ************
+int main(int argc, char **argv)
+{
+  char *flag_train_data_file;
+  int flag_n_inputs;
+  int flag_n_classes;
+  int flag_n_layers;
+  int flag_n_hidden_units;
+  int flag_max_iter;
+  int flag_minibatch_size;
+  real flag_lr;
+  int flag_max_load;
+  bool flag_binary_mode;
+  int flag_seed;
+  bool flag_cache_on_disk;
+  real flag_tolerance;
+
+  CmdLine cmd;
+  cmd.info(help);
+
+  cmd.addSCmdArg("-train_data_file", &flag_train_data_file, "Filename of the training data.");
+  cmd.addICmdArg("-n_inputs", &flag_n_inputs, "number of inputs");
+  cmd.addICmdArg("-n_classes", &flag_n_classes, "number of targets");
+
+  cmd.addICmdOption("-n_layers", &flag_n_layers, 4, "number of hidden layers", true);
+  cmd.addICmdOption("-n_hidden_units", &flag_n_hidden_units, 1000, "number of hidden units per layer", true);
+  cmd.addICmdOption("-max_iter", &flag_max_iter, 1, "number of epochs per layer", true);
+  cmd.addICmdOption("-minibatch_size", &flag_minibatch_size, 1, "number of examples per parameter update", true);
+  cmd.addRCmdOption("-lr", &flag_lr, 0.01, "learning rate", true);
+  cmd.addICmdOption("-max_load", &flag_max_load, -1, "max number of examples to load", true);
+  cmd.addBCmdOption("-binary_mode", &flag_binary_mode, false, "binary mode for files", true);
+  cmd.addICmdOption("-seed", &flag_seed, 1, "model and shuffle seed", true);
+  cmd.addBCmdOption("-cache_on_disk", &flag_cache_on_disk, false, "memory-mapped caches in the current directory", true);
+  cmd.addRCmdOption("-tolerance", &flag_tolerance, 1e-4, "largest parameter difference accepted between the two runs", true);
+
+  cmd.read(argc, argv);
+
+  Allocator *data_allocator = new Allocator;
+
+  MatDataSet train_matdata(flag_train_data_file, flag_n_inputs, 1, false,
+                           flag_max_load, flag_binary_mode);
+  ClassFormatDataSet train_data(&train_matdata, flag_n_classes);
+  OneHotClassFormat class_format(&train_data);
+
+  int *units_per_hidden_layer = (int*) data_allocator->alloc(sizeof(int)*flag_n_layers);
+  for(int i=0; i<flag_n_layers; i++)
+    units_per_hidden_layer[i] = flag_n_hidden_units;
+
+  printf("%d train examples, %d layers of %d units, %d epochs per layer, minibatch %d, %d bytes per real\n",
+         train_data.n_examples, flag_n_layers, flag_n_hidden_units, flag_max_iter,
+         flag_minibatch_size, (int)sizeof(real));
+
+  real *times[2];
+  for(int cache=0; cache<2; cache++)
+    times[cache] = (real*) data_allocator->alloc(sizeof(real)*flag_n_layers);
+
+  // Both runs are kept for the comparison.
+  Allocator *allocators[2];
+  StackedAutoencoder *saes[2];
+
+  Timer timer;
+  for(int cache=0; cache<2; cache++)  {
+    Allocator *allocator = new Allocator;
+    allocators[cache] = allocator;
+
+    SetRandomSeed((long)flag_seed);
+    StackedAutoencoderTrainer *trainer = NewTrainer(allocator, flag_n_inputs, flag_n_layers,
+                                                    units_per_hidden_layer, flag_n_classes,
+                                                    &train_data, &class_format,
+                                                    flag_minibatch_size, cache, flag_cache_on_disk);
+    trainer->setIOption("max iter", flag_max_iter);
+    trainer->setROption("learning rate", flag_lr);
+    trainer->setROption("end accuracy", 0.);
+
+    trainer->layerwise_training = true;
+    for(int i=0; i<flag_n_layers; i++)  {
+      trainer->layerwise_layer = i;
+      timer.reset();
+      trainer->TrainUnsupLayer();
+      times[cache][i] = timer.getTime();
+    }
+    trainer->FreeRepresentationCaches(0);
+    trainer->layerwise_training = false;
+    saes[cache] = trainer->sae;
+  }
+
+  printf("%-16s %10s %10s %8s\n", "layer", "forwarded", "cached", "saved");
+  for(int i=0; i<flag_n_layers; i++)  {
+    printf("%-16d %9.2fs %9.2fs %7.1f%%\n", i, times[0][i], times[1][i],
+           100. * (times[0][i] - times[1][i]) / times[0][i]);
+  }
+
+  real max_diff = 0.;
+  for(int i=0; i<flag_n_layers; i++)  {
+    real diff = MaxAbsDiff(saes[0]->encoders[i]->params, saes[1]->encoders[i]->params);
+    if(diff > max_diff)
+      max_diff = diff;
+    diff = MaxAbsDiff(saes[0]->decoders[i]->params, saes[1]->decoders[i]->params);
+    if(diff > max_diff)
+      max_diff = diff;
+  }
+  bool ok = max_diff <= flag_tolerance;
+  printf("%s cached against forwarded: largest parameter difference %g\n",
+         ok ? "OK  " : "FAIL", max_diff);
+
+  for(int cache=0; cache<2; cache++)
+    delete allocators[cache];
+  delete data_allocator;
+  return(ok ? 0 : 1);
+}
@@ -0,0 +1,202 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+const char *help = "\
+simd_kernels_benchmark\n\
+\n\
+This program times the TransposedTiedLinear forward product, beta product and\n\
+der_weights update with the original scalar loops and with the simd_kernels\n\
+at each level the CPU supports. \n";
+
+#include <stdio.h>
+#include <math.h>
+
+#include "Allocator.h"
+#include "CmdLine.h"
+#include "Random.h"
+#include "Timer.h"
+
+#include "simd_kernels.h"
+
+using namespace Torch;
+
+// The loops TransposedTiedLinear used before the simd_kernels.
+void ReferenceForward(int n_inputs, int n_outputs, real *weights,
+                      real *f_inputs, real *f_outputs)
+{
+  for(int j=0; j<n_outputs; j++)
+    f_outputs[j] = 0.0;
+  real *weights_ = weights;
+  for(int i=0; i<n_inputs; i++)    {
+    real input_i_ = f_inputs[i];
+    for(int j=0; j<n_outputs; j++)
+      f_outputs[j] += weights_[j] * input_i_;
+    weights_ += n_outputs;
+  }
+}
+
+void ReferenceBackward(int n_inputs, int n_outputs, real multiplier,
+                       real *weights, real *der_weights,
+                       real *f_inputs, real *beta_, real *alpha_)
+{
+  for(int i=0; i<n_inputs; i++)
+    beta_[i] = 0.;
+  real *weights_ = weights;
+  for(int i=0; i<n_inputs; i++)      {
+    for(int j=0; j<n_outputs; j++)
+      beta_[i] += alpha_[j] * weights_[j];
+    weights_ += n_outputs;
+  }
+  for(int i=0; i<n_inputs; i++)
+    beta_[i] *= multiplier;
+
+  real *der_weights_ = der_weights;
+  for(int i=0; i<n_inputs; i++)        {
+    for(int j=0; j<n_outputs; j++)
+      der_weights_[j] += multiplier * alpha_[j] * f_inputs[i];
+    der_weights_ += n_outputs;
+  }
+}
+
+void KernelForward(int n_inputs, int n_outputs, real *weights,
+                   real *f_inputs, real *f_outputs)
+{
+  for(int j=0; j<n_outputs; j++)
+    f_outputs[j] = 0.0;
+  real *weights_ = weights;
+  for(int i=0; i<n_inputs; i++)    {
+    SimdAxpy(n_outputs, f_inputs[i], weights_, f_outputs);
+    weights_ += n_outputs;
+  }
+}
+
+void KernelBackward(int n_inputs, int n_outputs, real multiplier,
+                    real *weights, real *der_weights,
+                    real *f_inputs, real *beta_, real *alpha_)
+{
+  real *weights_ = weights;
+  for(int i=0; i<n_inputs; i++)      {
+    beta_[i] = multiplier * SimdDot(n_outputs, alpha_, weights_);
+    weights_ += n_outputs;
+  }
+
+  real *der_weights_ = der_weights;
+  for(int i=0; i<n_inputs; i++)        {
+    SimdAxpy(n_outputs, multiplier * f_inputs[i], alpha_, der_weights_);
+    der_weights_ += n_outputs;
+  }
+}
+
+real MaxAbsDiff(int n, real *x, real *y)
+{
+  real max_diff = 0.;
+  for(int i=0; i<n; i++)        {
+    real diff = fabs(x[i] - y[i]);
+    if(diff > max_diff)
+      max_diff = diff;
+  }
+  return max_diff;
+}
+
+// ************
+// *** MAIN ***
+// ************
+int main(int argc, char **argv)
+{
+  int flag_n_inputs;
+  int flag_n_outputs;
+  int flag_iterations;
+  int flag_seed;
+
+  CmdLine cmd;
+  cmd.info(help);
+
+  cmd.addICmdOption("-n_inputs", &flag_n_inputs, 1000, "number of inputs of the transposed layer (hidden units)", true);
+  cmd.addICmdOption("-n_outputs", &flag_n_outputs, 784, "number of outputs of the transposed layer (reconstruction)", true);
+  cmd.addICmdOption("-iterations", &flag_iterations, 200, "number of forward/backward passes per kernel", true);
+  cmd.addICmdOption("-seed", &flag_seed, 1, "random seed", true);
+
+  cmd.read(argc, argv);
+
+  Random::manualSeed((long)flag_seed);
+
+  Allocator *allocator = new Allocator;
+
+  int n_inputs = flag_n_inputs;
+  int n_outputs = flag_n_outputs;
+  int n_weights = n_inputs * n_outputs;
+  real multiplier = sqrt((real)n_outputs / (real)n_inputs);
+
+  real *weights = (real*) allocator->alloc(sizeof(real)*n_weights);
+  real *der_weights = (real*) allocator->alloc(sizeof(real)*n_weights);
+  real *ref_der_weights = (real*) allocator->alloc(sizeof(real)*n_weights);
+  real *f_inputs = (real*) allocator->alloc(sizeof(real)*n_inputs);
+  real *beta = (real*) allocator->alloc(sizeof(real)*n_inputs);
+  real *ref_beta = (real*) allocator->alloc(sizeof(real)*n_inputs);
+  real *f_outputs = (real*) allocator->alloc(sizeof(real)*n_outputs);
+  real *ref_f_outputs = (real*) allocator->alloc(sizeof(real)*n_outputs);
+  real *alpha = (real*) allocator->alloc(sizeof(real)*n_outputs);
+
+  real bound = 1./sqrt((real)n_inputs);
+  for(int i=0; i<n_weights; i++)
+    weights[i] = Random::boundedUniform(-bound, bound);
+  for(int i=0; i<n_inputs; i++)
+    f_inputs[i] = Random::uniform();
+  for(int j=0; j<n_outputs; j++)
+    alpha[j] = Random::boundedUniform(-1., 1.);
+
+  printf("layer %d -> %d, %d iterations, %d bytes per real\n",
+         n_inputs, n_outputs, flag_iterations, (int)sizeof(real));
+
+  // Reference
+  for(int i=0; i<n_weights; i++)
+    ref_der_weights[i] = 0.;
+  Timer timer;
+  for(int it=0; it<flag_iterations; it++)       {
+    ReferenceForward(n_inputs, n_outputs, weights, f_inputs, ref_f_outputs);
+    ReferenceBackward(n_inputs, n_outputs, multiplier, weights, ref_der_weights,
+                      f_inputs, ref_beta, alpha);
+  }
+  real ref_time = timer.getTime();
+  printf("%-10s %10.4f s  %10.2f us/pass\n", "reference", ref_time,
+         1e6 * ref_time / flag_iterations);
+
+  // Kernels, at every supported level
+  SimdKernelsLevel best = SimdKernelsBestLevel();
+  for(int level=SIMD_KERNELS_SCALAR; level<=best; level++)      {
+    SimdKernelsSetLevel((SimdKernelsLevel)level);
+
+    for(int i=0; i<n_weights; i++)
+      der_weights[i] = 0.;
+    timer.reset();
+    for(int it=0; it<flag_iterations; it++)     {
+      KernelForward(n_inputs, n_outputs, weights, f_inputs, f_outputs);
+      KernelBackward(n_inputs, n_outputs, multiplier, weights, der_weights,
+                     f_inputs, beta, alpha);
+    }
+    real time = timer.getTime();
+
+    printf("%-10s %10.4f s  %10.2f us/pass  speedup %5.2f  max diff: outputs %g beta %g der_weights %g\n",
+           SimdKernelsLevelName((SimdKernelsLevel)level), time,
+           1e6 * time / flag_iterations, ref_time / time,
+           MaxAbsDiff(n_outputs, f_outputs, ref_f_outputs),
+           MaxAbsDiff(n_inputs, beta, ref_beta),
+           MaxAbsDiff(n_weights, der_weights, ref_der_weights));
+  }
+
+  SimdKernelsSetLevel(best);
+
+  delete allocator;
+  return(0);
+}
@@ -0,0 +1,196 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+const char *help = "\
+sync_sgd_benchmark\n\
+\n\
+This program trains the same denoising stacked autoencoder (supervised and\n\
+unsupervised costs together, same seed, same number of epochs) with the\n\
+synchronous data parallel SGD, on 1, 2, 4, ... up to n_threads threads.\n\
+It reports the speedup and the parallel efficiency of each run, and checks\n\
+that the final parameters are bit-identical to those of the 1 thread run.\n";
+
+#include <stdio.h>
+#include <string.h>
+
+#include "Allocator.h"
+#include "CmdLine.h"
+#include "random_streams.h"
+#include "Timer.h"
+
+#include "MatDataSet.h"
+#include "ClassFormatDataSet.h"
+#include "OneHotClassFormat.h"
+#include "Trainer.h"         // for MeasurerList!
+#include "ClassNLLCriterion.h"
+
+#include "stacked_autoencoder.h"
+#include "stacked_autoencoder_trainer.h"
+#include "helpers.h"
+
+using namespace Torch;
+
+StackedAutoencoderTrainer *NewTrainer(Allocator *allocator, int n_inputs, int n_layers,
+                                      int *units_per_hidden_layer, int n_classes,
+                                      DataSet *train_data, OneHotClassFormat *class_format,
+                                      int minibatch_size, int shard_size)
+{
+  StackedAutoencoder *sae = new(allocator) StackedAutoencoder("sae", "sigmoid", true, false,
+                                                              n_inputs, n_layers,
+                                                              units_per_hidden_layer,
+                                                              n_classes, true, false);
+  ClassNLLCriterion *criterion = new(allocator) ClassNLLCriterion(class_format);
+
+  DataSet **unsup_datasets = (DataSet**) allocator->alloc(sizeof(DataSet*)*sae->n_hidden_layers);
+  Criterion **unsup_criterions = (Criterion**) allocator->alloc(sizeof(Criterion*)*sae->n_hidden_layers);
+  Measurer **unsup_measurers = (Measurer**) allocator->alloc(sizeof(Measurer*)*sae->n_hidden_layers);
+  BuildSaeUnsupDataSetsCriteriaMeasurers(allocator, "./", sae, train_data, criterion,
+                                         "xentropy", false, unsup_datasets,
+                                         unsup_criterions, unsup_measurers, false);
+
+  StackedAutoencoderTrainer *trainer = new(allocator) StackedAutoencoderTrainer(sae, criterion, "./", false);
+  trainer->unsup_datasets = unsup_datasets;
+  trainer->unsup_criterions = unsup_criterions;
+  trainer->unsup_measurers = unsup_measurers;
+  trainer->setIOption("minibatch size", minibatch_size);
+  trainer->setIOption("shard size", shard_size);
+  return trainer;
+}
+
+// ************
+// *** MAIN ***
+// ************
+int main(int argc, char **argv)
+{
+  char *flag_train_data_file;
+  int flag_n_inputs;
+  int flag_n_classes;
+  int flag_n_layers;
+  int flag_n_hidden_units;
+  int flag_n_threads;
+  int flag_max_iter;
+  int flag_minibatch_size;
+  int flag_shard_size;
+  real flag_lr;
+  real flag_unsup_weight;
+  int flag_max_load;
+  bool flag_binary_mode;
+  int flag_seed;
+
+  CmdLine cmd;
+  cmd.info(help);
+
+  cmd.addSCmdArg("-train_data_file", &flag_train_data_file, "Filename of the training data.");
+  cmd.addICmdArg("-n_inputs", &flag_n_inputs, "number of inputs");
+  cmd.addICmdArg("-n_classes", &flag_n_classes, "number of targets");
+
+  cmd.addICmdOption("-n_layers", &flag_n_layers, 2, "number of hidden layers", true);
+  cmd.addICmdOption("-n_hidden_units", &flag_n_hidden_units, 500, "number of hidden units per layer", true);
+  cmd.addICmdOption("-n_threads", &flag_n_threads, 16, "largest number of threads (runs 1, 2, 4, ... up to it)", true);
+  cmd.addICmdOption("-max_iter", &flag_max_iter, 2, "number of epochs per run", true);
+  cmd.addICmdOption("-minibatch_size", &flag_minibatch_size, 128, "number of examples per parameter update", true);
+  cmd.addICmdOption("-shard_size", &flag_shard_size, 8, "number of examples per shard of a minibatch", true);
+  cmd.addRCmdOption("-lr", &flag_lr, 0.01, "learning rate", true);
+  cmd.addRCmdOption("-unsup_weight", &flag_unsup_weight, 1., "weight of the unsupervised costs", true);
+  cmd.addICmdOption("-max_load", &flag_max_load, -1, "max number of examples to load", true);
+  cmd.addBCmdOption("-binary_mode", &flag_binary_mode, false, "binary mode for files", true);
+  cmd.addICmdOption("-seed", &flag_seed, 1, "model and shuffle seed", true);
+
+  cmd.read(argc, argv);
+
+  if(flag_shard_size < 1)
+    error("the shard size must be at least 1");
+
+  Allocator *data_allocator = new Allocator;
+
+  MatDataSet train_matdata(flag_train_data_file, flag_n_inputs, 1, false,
+                           flag_max_load, flag_binary_mode);
+  ClassFormatDataSet train_data(&train_matdata, flag_n_classes);
+  OneHotClassFormat class_format(&train_data);
+
+  int *units_per_hidden_layer = (int*) data_allocator->alloc(sizeof(int)*flag_n_layers);
+  for(int i=0; i<flag_n_layers; i++)
+    units_per_hidden_layer[i] = flag_n_hidden_units;
+
+  printf("%d train examples, %d epochs, minibatch %d, shards of %d, %d bytes per real\n",
+         train_data.n_examples, flag_max_iter, flag_minibatch_size, flag_shard_size,
+         (int)sizeof(real));
+
+  // Parameters after the 1 thread run
+  real *reference_params = NULL;
+  int n_params = 0;
+
+  Timer timer;
+  real one_thread_time = 0.;
+  for(int n_threads=1; n_threads<=flag_n_threads; n_threads*=2)   {
+    Allocator *allocator = new Allocator;
+
+    SetRandomSeed((long)flag_seed);
+    StackedAutoencoderTrainer *trainer = NewTrainer(allocator, flag_n_inputs, flag_n_layers,
+                                                    units_per_hidden_layer, flag_n_classes,
+                                                    &train_data, &class_format,
+                                                    flag_minibatch_size, flag_shard_size);
+    trainer->setIOption("max iter", flag_max_iter);
+    trainer->setROption("learning rate", flag_lr);
+    trainer->setROption("end accuracy", 0.);
+
+    if(n_threads > 1)   {
+      int n_replicas = n_threads - 1;
+      StackedAutoencoderTrainer **replicas = (StackedAutoencoderTrainer**) allocator->alloc(sizeof(StackedAutoencoderTrainer*)*n_replicas);
+      for(int k=0; k<n_replicas; k++)   {
+        ClassFormatDataSet *replica_train_data = new(allocator) ClassFormatDataSet(&train_matdata, flag_n_classes);
+        replicas[k] = NewTrainer(allocator, flag_n_inputs, flag_n_layers,
+                                 units_per_hidden_layer, flag_n_classes,
+                                 replica_train_data, &class_format,
+                                 flag_minibatch_size, flag_shard_size);
+        replicas[k]->replica_train_data = replica_train_data;
+      }
+      trainer->SetReplicas(replicas, n_replicas);
+    }
+
+    MeasurerList measurers;
+    timer.reset();
+    trainer->TrainSupUnsup(&train_data, &measurers, flag_unsup_weight);
+    real time = timer.getTime();
+    if(n_threads == 1)
+      one_thread_time = time;
+
+    // Compare the parameters with those of the 1 thread run.
+    Parameters *params = trainer->sae->sup_unsup_machine->params;
+    if(!reference_params)       {
+      for(int i=0; i<params->n_data; i++)
+        n_params += params->size[i];
+      reference_params = (real*) data_allocator->alloc(sizeof(real)*n_params);
+    }
+    real *ptr = reference_params;
+    bool identical = true;
+    for(int i=0; i<params->n_data; i++) {
+      if(n_threads == 1)
+        memcpy(ptr, params->data[i], sizeof(real)*params->size[i]);
+      else if(memcmp(ptr, params->data[i], sizeof(real)*params->size[i]))
+        identical = false;
+      ptr += params->size[i];
+    }
+
+    real speedup = one_thread_time / time;
+    printf("%2d threads  %8.2f s  %10.1f examples/s  speedup %5.2f  efficiency %5.2f  %s\n",
+           n_threads, time, (real)flag_max_iter * train_data.n_examples / time,
+           speedup, speedup / n_threads, identical ? "identical" : "DIFFERENT");
+
+    delete allocator;
+  }
+
+  delete data_allocator;
+  return(0);
+}
@@ -0,0 +1,151 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+const char *help = "\
+task_pool_benchmark\n\
+\n\
+This program measures how the TaskPool scales on 1, 2, 4, ... up to n_threads\n\
+threads, with three workloads:\n\
+ - gemv: ParallelReduce of the rows of a matrix-vector product (balanced),\n\
+ - skewed: ParallelReduce of chunks whose cost grows with their index, which\n\
+   the threads balance by stealing,\n\
+ - sections: empty ParallelFor sections, for the cost of a section.\n\
+It reports the speedup and the parallel efficiency of each run, and checks\n\
+that the reductions are bit-identical to those of the 1 thread run.\n";
+
+#include <stdio.h>
+#include <string.h>
+
+#include "Allocator.h"
+#include "CmdLine.h"
+#include "Random.h"
+#include "Timer.h"
+
+#include "simd_kernels.h"
+#include "task_pool.h"
+#include "helpers.h"
+
+using namespace Torch;
+
+struct Workload
+{
+  int n_rows;
+  int n_cols;
+  real *matrix;
+  real *x;
+};
+
+// Sum of the rows' products with x.
+static void Gemv(void *arg, int begin, int end, real *partial)
+{
+  Workload *w = (Workload*)arg;
+  for(int r=begin; r<end; r++)
+    partial[0] += SimdDot(w->n_cols, w->matrix + (long)r*w->n_cols, w->x);
+}
+
+// Row r is multiplied (r % 64)+1 times.
+static void Skewed(void *arg, int begin, int end, real *partial)
+{
+  Workload *w = (Workload*)arg;
+  for(int r=begin; r<end; r++)  {
+    real *row = w->matrix + (long)r*w->n_cols;
+    for(int k=0; k<=r%64; k++)
+      partial[0] += SimdDot(w->n_cols, row, w->x);
+  }
+}
+
+static void Nothing(void *arg, int begin, int end)
+{
+}
+
+// ************
+// *** MAIN ***
+// ************
+int main(int argc, char **argv)
+{
+  int flag_n_threads;
+  int flag_n_rows;
+  int flag_n_cols;
+  int flag_chunk_size;
+  int flag_repeats;
+  int flag_n_sections;
+  char *flag_thread_placement;
+  int flag_seed;
+
+  CmdLine cmd;
+  cmd.info(help);
+
+  cmd.addICmdOption("-n_threads", &flag_n_threads, 16, "largest number of threads (runs 1, 2, 4, ... up to it)", true);
+  cmd.addICmdOption("-n_rows", &flag_n_rows, 4096, "number of rows of the matrix", true);
+  cmd.addICmdOption("-n_cols", &flag_n_cols, 1024, "number of columns of the matrix", true);
+  cmd.addICmdOption("-chunk_size", &flag_chunk_size, 16, "number of rows per task", true);
+  cmd.addICmdOption("-repeats", &flag_repeats, 50, "number of reductions per workload and run", true);
+  cmd.addICmdOption("-n_sections", &flag_n_sections, 10000, "number of empty sections per run", true);
+  cmd.addSCmdOption("-thread_placement", &flag_thread_placement, "none", "placement of the threads: none, compact or scatter (NUMA nodes)", true);
+  cmd.addICmdOption("-seed", &flag_seed, 1, "seed of the matrix", true);
+
+  cmd.read(argc, argv);
+
+  Allocator *allocator = new Allocator;
+  Random::manualSeed((long)flag_seed);
+
+  Workload w;
+  w.n_rows = flag_n_rows;
+  w.n_cols = flag_n_cols;
+  w.matrix = (real*)allocator->alloc(sizeof(real)*(long)flag_n_rows*flag_n_cols);
+  w.x = (real*)allocator->alloc(sizeof(real)*flag_n_cols);
+  for(long i=0; i<(long)flag_n_rows*flag_n_cols; i++)
+    w.matrix[i] = Random::boundedUniform(-1., 1.);
+  for(int j=0; j<flag_n_cols; j++)
+    w.x[j] = Random::boundedUniform(-1., 1.);
+
+  const char *names[3] = {"gemv", "skewed", "sections"};
+  real reference[2] = {0., 0.};
+  real base_time[3] = {0., 0., 0.};
+
+  message("%8s %8s %10s %8s %10s %s", "workload", "threads", "time (s)", "speedup", "efficiency", "result");
+  for(int n_threads=1; n_threads<=flag_n_threads; n_threads*=2)   {
+    TaskPool *pool = BuildTaskPool(allocator, n_threads, flag_thread_placement);
+
+    for(int k=0; k<3; k++)      {
+      real result = 0.;
+      Timer timer;
+      if(k < 2)   {
+        for(int r=0; r<flag_repeats; r++)
+          ParallelReduce(pool, w.n_rows, flag_chunk_size, 1, (k == 0 ? Gemv : Skewed), &w, &result);
+      } else    {
+        for(int s=0; s<flag_n_sections; s++)
+          ParallelFor(pool, n_threads, 1, Nothing, NULL);
+      }
+      real time = timer.getTime();
+
+      const char *check = "";
+      if(n_threads == 1)        {
+        base_time[k] = time;
+        if(k < 2)
+          reference[k] = result;
+      } else if(k < 2)
+        check = (result == reference[k] ? "identical" : "DIFFERENT");
+      real speedup = base_time[k] / time;
+      message("%8s %8d %10.3f %8.2f %10.2f %s", names[k], n_threads, time, speedup,
+              speedup / n_threads, check);
+    }
+
+    if(pool)
+      allocator->free(pool);
+  }
+
+  delete allocator;
+  return(0);
+}
@@ -0,0 +1,159 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "block_linear.h"
+#include "lazy_derivatives.h"
+
+namespace Torch {
+
+BlockLinear::BlockLinear(int n_inputs_, int n_outputs_)
+    : Linear(n_inputs_, n_outputs_), init_rng(RANDOM_STREAM_INIT)
+{
+  der_flag = NULL;
+  n_resets = 0;
+
+  // Linear's constructor ran Linear::reset_().
+  reset_();
+}
+
+void BlockLinear::reset_()
+{
+  // A new seed starts the resets over.
+  if(init_rng.Rekey())
+    n_resets = 0;
+  init_rng.SetSubstream(n_resets++);
+
+  real bound = 1./sqrt((real)n_inputs);
+  init_rng.BoundedUniforms(n_inputs*n_outputs, -bound, bound, weights);
+  init_rng.BoundedUniforms(n_outputs, -bound, bound, bias);
+}
+
+void BlockLinear::SetLazyDerivatives()
+{
+  if(!der_flag)
+    der_flag = LazyDerivativesFlag(der_weights);
+}
+
+void BlockLinear::forward(Sequence *inputs)
+{
+  int n_frames = inputs->n_frames;
+  if(n_frames == 1)     {
+    Linear::forward(inputs);
+    return;
+  }
+
+  outputs->resize(n_frames);
+  real **inputs_frames = inputs->frames;
+  real **outputs_frames = outputs->frames;
+
+  real *weights_ = weights;
+  for(int i=0; i<n_outputs; i++)        {
+    real bias_i_ = bias[i];
+    for(int t=0; t<n_frames; t++)       {
+      real *f_inputs = inputs_frames[t];
+      real sum = bias_i_;
+      for(int j=0; j<n_inputs; j++)
+        sum += weights_[j] * f_inputs[j];
+      outputs_frames[t][i] = sum;
+    }
+    weights_ += n_inputs;
+  }
+}
+
+void BlockLinear::backward(Sequence *inputs, Sequence *alpha)
+{
+  int n_frames = inputs->n_frames;
+  bool overwrite = OverwriteDerivatives(der_flag);
+  if(n_frames == 1 && !overwrite)       {
+    Linear::backward(inputs, alpha);
+    return;
+  }
+
+  beta->resize(n_frames);
+  real **inputs_frames = inputs->frames;
+  real **beta_frames = beta->frames;
+  real **alpha_frames = alpha->frames;
+
+  if(!partial_backprop) {
+    for(int t=0; t<n_frames; t++)       {
+      real *beta_ = beta_frames[t];
+      for(int j=0; j<n_inputs; j++)
+        beta_[j] = 0.;
+    }
+  }
+
+  real *weights_ = weights;
+  real *der_weights_ = der_weights;
+  for(int i=0; i<n_outputs; i++)        {
+    for(int t=0; t<n_frames; t++)       {
+      real z = alpha_frames[t][i];
+      real *f_inputs = inputs_frames[t];
+
+      if(!partial_backprop)     {
+        real *beta_ = beta_frames[t];
+        for(int j=0; j<n_inputs; j++)
+          beta_[j] += z * weights_[j];
+      }
+
+      if(t == 0 && overwrite)     {
+        for(int j=0; j<n_inputs; j++)
+          der_weights_[j] = z * f_inputs[j];
+        der_bias[i] = z;
+      } else    {
+        for(int j=0; j<n_inputs; j++)
+          der_weights_[j] += z * f_inputs[j];
+        der_bias[i] += z;
+      }
+    }
+    weights_ += n_inputs;
+    der_weights_ += n_inputs;
+  }
+
+  AddDecayToDerivatives(n_frames);
+}
+
+void BlockLinear::AddDecayToDerivatives(int n_frames)
+{
+  int n_weights = n_inputs*n_outputs;
+
+  if(weight_decay != 0.)        {
+    real decay = n_frames * weight_decay;
+    for(int i=0; i<n_weights; i++)
+      der_weights[i] += decay * weights[i];
+  }
+
+  if(l1_weight_decay != 0.)     {
+    real decay = n_frames * l1_weight_decay;
+    for(int i=0; i<n_weights; i++)      {
+      if(weights[i] > 0.)
+        der_weights[i] += decay;
+      else if(weights[i] < 0.)
+        der_weights[i] -= decay;
+    }
+  }
+
+  if(bias_decay != 0.)  {
+    real decay = n_frames * bias_decay;
+    for(int i=0; i<n_outputs; i++)
+      der_bias[i] += decay * bias[i];
+  }
+}
+
+BlockLinear::~BlockLinear()
+{
+  if(der_flag)
+    ReleaseLazyDerivatives(der_weights);
+}
+
+}
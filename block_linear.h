@@ -0,0 +1,74 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_BLOCK_LINEAR_H_
+#define TORCH_BLOCK_LINEAR_H_
+
+#include "Linear.h"
+#include "random_streams.h"
+
+namespace Torch {
+
+// A Linear layer that processes a sequence of several frames (a minibatch of
+// examples) as a block. Each row of the weight matrix is read once for the
+// whole minibatch instead of once per frame, which turns the per-example
+// matrix-vector products into a matrix-matrix product.
+//
+// With a single frame it behaves exactly like Linear.
+//
+// The decays are applied once per frame, as Linear would if it were given the
+// frames one at a time.
+//
+// After SetLazyDerivatives(), the derivatives can be cleared lazily (see
+// lazy_derivatives.h): the first frame's contribution then overwrites them.
+// Linear keeps der_weights and der_bias in one array, so they share a flag.
+//
+// The parameters are initialized as in Linear, uniform in +-1/sqrt(n_inputs),
+// from the layer's own random stream (see random_streams.h): the n-th
+// reset_() since the seed was set draws the substream n.
+//
+class BlockLinear : public Linear
+{
+  public:
+
+    // Flag of the derivatives when they are cleared lazily.
+    bool *der_flag;
+
+    // Stream of the initial parameters, taken at construction, and the
+    // number of reset_() since the seed was set.
+    RandomStream init_rng;
+    unsigned long long n_resets;
+
+    BlockLinear(int n_inputs_, int n_outputs_);
+
+    // Registers the derivatives to be cleared lazily. Call it once der_weights
+    // points to its final array.
+    void SetLazyDerivatives();
+
+    //-----
+    virtual void forward(Sequence *inputs);
+    virtual void backward(Sequence *inputs, Sequence *alpha);
+
+    // Adds the weight decay, l1 weight decay and bias decay terms to the
+    // derivatives, n_frames times.
+    virtual void AddDecayToDerivatives(int n_frames);
+
+    virtual void reset_();
+
+    virtual ~BlockLinear();
+};
+
+}
+
+#endif  // TORCH_BLOCK_LINEAR_H_
@@ -0,0 +1,202 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "branch_machine.h"
+
+#include <string.h>
+
+#include "task_pool.h"
+
+namespace Torch {
+
+static int SumInputs(int n_branches, GradientMachine **branches)
+{
+  int n = 0;
+  for(int i=0; i<n_branches; i++)
+    n += branches[i]->n_inputs;
+  return n;
+}
+
+static int SumOutputs(int n_branches, GradientMachine **branches)
+{
+  int n = 0;
+  for(int i=0; i<n_branches; i++)
+    n += branches[i]->n_outputs;
+  return n;
+}
+
+BranchMachine::BranchMachine(int n_branches_, GradientMachine **branches_)
+    : GradientMachine(SumInputs(n_branches_, branches_), SumOutputs(n_branches_, branches_), 0)
+{
+  n_branches = n_branches_;
+  branches = (GradientMachine**) allocator->alloc(sizeof(GradientMachine*)*n_branches);
+  branch_inputs = (Sequence**) allocator->alloc(sizeof(Sequence*)*n_branches);
+  branch_alpha = (Sequence**) allocator->alloc(sizeof(Sequence*)*n_branches);
+  inputs_offsets = (int*) allocator->alloc(sizeof(int)*n_branches);
+  outputs_offsets = (int*) allocator->alloc(sizeof(int)*n_branches);
+  branch_tasks = (int*) allocator->alloc(sizeof(int)*n_branches);
+
+  int in_offset = 0;
+  int out_offset = 0;
+  for(int i=0; i<n_branches; i++)       {
+    branches[i] = branches_[i];
+    params->add(branches[i]->params);
+    der_params->add(branches[i]->der_params);
+
+    branch_inputs[i] = new(allocator) Sequence();
+    branch_alpha[i] = new(allocator) Sequence();
+    inputs_offsets[i] = in_offset;
+    outputs_offsets[i] = out_offset;
+    in_offset += branches[i]->n_inputs;
+    out_offset += branches[i]->n_outputs;
+
+    branch_tasks[i] = i;
+  }
+  n_tasks = n_branches;
+
+  pool = GetDefaultTaskPool();
+}
+
+void BranchMachine::RunTogether(GradientMachine *a, GradientMachine *b)
+{
+  // A few branches at most.
+  int task_a = -1;
+  int task_b = -1;
+  for(int i=0; i<n_branches; i++)       {
+    if(branches[i] == a)
+      task_a = branch_tasks[i];
+    if(branches[i] == b)
+      task_b = branch_tasks[i];
+  }
+  if(task_a < 0 || task_b < 0)
+    error("BranchMachine: RunTogether() needs two of the branches");
+  if(task_a == task_b)
+    return;
+
+  // Renumber the tasks from 0, in the order of their first branch.
+  int merged = (task_a < task_b ? task_a : task_b);
+  int removed = (task_a < task_b ? task_b : task_a);
+  for(int i=0; i<n_branches; i++)       {
+    if(branch_tasks[i] == removed)
+      branch_tasks[i] = merged;
+    else if(branch_tasks[i] > removed)
+      branch_tasks[i]--;
+  }
+  n_tasks--;
+}
+
+void BranchMachine::Slice(Sequence *seq, int offset, int size, Sequence *slice)
+{
+  slice->resize(seq->n_frames, false);  // do not allocate memory!
+  slice->frame_size = size;
+  for(int f=0; f<seq->n_frames; f++)
+    slice->frames[f] = seq->frames[f] + offset;
+}
+
+void BranchMachine::ForwardBranch(int i, Sequence *inputs)
+{
+  GradientMachine *branch = branches[i];
+  Slice(inputs, inputs_offsets[i], branch->n_inputs, branch_inputs[i]);
+  branch->forward(branch_inputs[i]);
+
+  for(int f=0; f<inputs->n_frames; f++)
+    memcpy(outputs->frames[f] + outputs_offsets[i], branch->outputs->frames[f], sizeof(real)*branch->n_outputs);
+}
+
+void BranchMachine::BackwardBranch(int i, Sequence *inputs, Sequence *alpha)
+{
+  GradientMachine *branch = branches[i];
+  Slice(inputs, inputs_offsets[i], branch->n_inputs, branch_inputs[i]);
+  Slice(alpha, outputs_offsets[i], branch->n_outputs, branch_alpha[i]);
+  branch->backward(branch_inputs[i], branch_alpha[i]);
+
+  if(!partial_backprop)       {
+    for(int f=0; f<inputs->n_frames; f++)
+      memcpy(beta->frames[f] + inputs_offsets[i], branch->beta->frames[f], sizeof(real)*branch->n_inputs);
+  }
+}
+
+void BranchMachine::RunTask(int t, bool is_forward, Sequence *inputs, Sequence *alpha)
+{
+  for(int i=0; i<n_branches; i++)       {
+    if(branch_tasks[i] != t)
+      continue;
+    if(is_forward)
+      ForwardBranch(i, inputs);
+    else
+      BackwardBranch(i, inputs, alpha);
+  }
+}
+
+struct BranchMachineSection
+{
+  BranchMachine *machine;
+  bool is_forward;
+  Sequence *inputs;
+  Sequence *alpha;
+};
+
+static void RunBranchMachineTask(void *arg, int t)
+{
+  BranchMachineSection *section = (BranchMachineSection*)arg;
+  section->machine->RunTask(t, section->is_forward, section->inputs, section->alpha);
+}
+
+void BranchMachine::forward(Sequence *inputs)
+{
+  outputs->resize(inputs->n_frames);
+
+  if(!pool)     {
+    for(int i=0; i<n_branches; i++)
+      ForwardBranch(i, inputs);
+    return;
+  }
+
+  BranchMachineSection section = { this, true, inputs, NULL };
+  pool->Run(n_tasks, RunBranchMachineTask, &section);
+}
+
+void BranchMachine::backward(Sequence *inputs, Sequence *alpha)
+{
+  if(!partial_backprop)
+    beta->resize(inputs->n_frames);
+
+  if(!pool)     {
+    for(int i=0; i<n_branches; i++)
+      BackwardBranch(i, inputs, alpha);
+    return;
+  }
+
+  BranchMachineSection section = { this, false, inputs, alpha };
+  pool->Run(n_tasks, RunBranchMachineTask, &section);
+}
+
+void BranchMachine::iterInitialize()
+{
+  for(int i=0; i<n_branches; i++)
+    branches[i]->iterInitialize();
+}
+
+void BranchMachine::setPartialBackprop(bool flag)
+{
+  partial_backprop = flag;
+  for(int i=0; i<n_branches; i++)
+    branches[i]->setPartialBackprop(flag);
+}
+
+BranchMachine::~BranchMachine()
+{
+}
+
+}
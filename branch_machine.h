@@ -0,0 +1,89 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_BRANCH_MACHINE_H_
+#define TORCH_BRANCH_MACHINE_H_
+
+#include "GradientMachine.h"
+
+namespace Torch {
+
+class TaskPool;
+
+// Runs independent machines (branches) side by side. The input frames are the
+// concatenation of the branches' inputs and the output frames the
+// concatenation of their outputs, in the order of the branches.
+//
+// Each branch is given its slice of the input frames in place, without a
+// copy. Unlike in a ConnectedMachine, whose first layer machines all see the
+// whole input, the branches can thus hang off different hidden layers, whose
+// outputs are gathered beforehand.
+//
+// With partial backprop, the branches do not compute their beta (and the
+// ones of their first layer machines if they are ConnectedMachines).
+//
+// With a #pool# (see task_pool.h), the branches are forwarded and backwarded
+// as parallel tasks. Branches that share derivatives (tied weights) must be
+// put in the same task with RunTogether(). The Destructive layers draw
+// from their own random streams (see random_streams.h), so the corruption
+// does not depend on the scheduling.
+//
+class BranchMachine : public GradientMachine
+{
+  public:
+    int n_branches;
+    GradientMachine **branches;
+
+    // Slices of the inputs and alpha given to each branch, and the offsets
+    // of its inputs and outputs.
+    Sequence **branch_inputs;
+    Sequence **branch_alpha;
+    int *inputs_offsets;
+    int *outputs_offsets;
+
+    // Parallel tasks, NULL to run the branches in order. Task t runs the
+    // branches of branch_tasks t, in order.
+    TaskPool *pool;
+    int *branch_tasks;
+    int n_tasks;
+
+    // The pool is GetDefaultTaskPool().
+    BranchMachine(int n_branches_, GradientMachine **branches_);
+
+    // Puts the branches #a# and #b# (and the ones already with them) in the
+    // same task.
+    void RunTogether(GradientMachine *a, GradientMachine *b);
+
+    //-----
+    virtual void forward(Sequence *inputs);
+    virtual void backward(Sequence *inputs, Sequence *alpha);
+
+    virtual void iterInitialize();
+    virtual void setPartialBackprop(bool flag=true);
+
+    // Points the frames of #slice# to #seq#'s columns [offset, offset+size).
+    void Slice(Sequence *seq, int offset, int size, Sequence *slice);
+
+    // What the tasks run for branch #i#.
+    void ForwardBranch(int i, Sequence *inputs);
+    void BackwardBranch(int i, Sequence *inputs, Sequence *alpha);
+    // Runs the branches of task #t#, forward or backward.
+    void RunTask(int t, bool is_forward, Sequence *inputs, Sequence *alpha);
+
+    virtual ~BranchMachine();
+};
+
+}
+
+#endif  // TORCH_BRANCH_MACHINE_H_
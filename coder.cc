@@ -14,19 +14,83 @@
 //
 #include "coder.h"
 #include <cassert>
+#include <cstring>
 
 #include "Linear.h"
-#include "Sigmoid.h"
-#include "Tanh.h"
 #include "LogSoftMax.h"
 
+#include "block_linear.h"
 #include "destructive.h"
+#include "fast_math.h"
+#include "fast_math_sigmoid.h"
+#include "fast_math_tanh.h"
 #include "transposed_tied_linear.h"
 #include "nonlinear.h"
 #include "smoothed_linear.h"
+#include "simd_kernels.h"
+#include "philox.h"
+#include "lazy_derivatives.h"
 
 namespace Torch {
 
+// Nonlinearities the fused path knows how to apply.
+enum {
+  FUSED_NONE = 0,
+  FUSED_SIGMOID,
+  FUSED_TANH,
+  FUSED_NONLINEAR
+};
+
+static inline real FusedActivation(int type, real a)
+{
+  switch(type)  {
+    case FUSED_SIGMOID:
+      return 1./(1.+exp(-a));
+    case FUSED_TANH:
+      return tanh(a);
+    case FUSED_NONLINEAR:
+      return 0.5 * (a/(1.0 + fabs(a)) + 1.);
+    default:
+      return a;
+  }
+}
+
+// Derivative of the nonlinearity, from its output y.
+static inline real FusedDerivative(int type, real y)
+{
+  switch(type)  {
+    case FUSED_SIGMOID:
+      return y * (1. - y);
+    case FUSED_TANH:
+      return 1. - y*y;
+    case FUSED_NONLINEAR: {
+      // 1/(1+|a|) = 1-|2y-1|
+      real z = 1. - fabs(2.*y - 1.);
+      return 0.5 * z * z;
+    }
+    default:
+      return 1.;
+  }
+}
+
+// sum_j w[j] * (value - x[j]) over the set bits j of #mask#. Adding it to the
+// product of w and the clean x gives the product of w and the corrupted x,
+// at the cost of one visit per corrupted unit.
+static real MaskedCorrection(int n_mask_words, const unsigned int *mask,
+                             real value, const real *w, const real *x)
+{
+  real sum = 0.;
+  for(int k=0; k<n_mask_words; k++)     {
+    unsigned int bits = mask[k];
+    while(bits)   {
+      int j = (k << 5) + __builtin_ctz(bits);
+      sum += w[j] * (value - x[j]);
+      bits &= bits - 1;
+    }
+  }
+  return sum;
+}
+
 Coder::Coder(int n_inputs_, int n_outputs_, bool is_noisy_,
               Coder *tied_coder_, bool is_transposed_, bool reparametrize_,
               std::string nonlinearity_, bool layer_smoothed_)
@@ -43,6 +107,20 @@ Coder::Coder(int n_inputs_, int n_outputs_, bool is_noisy_,
   BuildDestructiveLayer();
   BuildLinearLayer();
   BuildNonlinearLayer();
+  SetupFusedPath();
+  SetupLazyDerivatives();
+
+  kept_inputs = NULL;
+  kept_pre_activations = NULL;
+  n_kept_frames = 0;
+  n_kept_frames_allocated = 0;
+
+  frozen = false;
+
+  addBOption("fused", &fused, true, "apply corruption, linear and nonlinearity in one pass when possible");
+  addBOption("fast math", &fast_math, GetFastMathDefault(), "the fused path uses the fast_math nonlinearities");
+  addBOption("incremental", &incremental, false, "noisy coder: correct the tied coder's pre-activation on the corrupted units");
+  addBOption("keep pre-activation", &keep_pre_activation, false, "keep the pre-activation for an incremental noisy coder");
 
   // Register the underlying machines' parameters as parameters of this machine
   if(destructive_layer)  {
@@ -93,7 +171,7 @@ void Coder::BuildLinearLayer()
       assert(!layer_smoothed);
 
       // Build a new Linear but have it share the tied coder's weights.
-      linear_layer = new(allocator) Linear(n_inputs, n_outputs);
+      linear_layer = new(allocator) BlockLinear(n_inputs, n_outputs);
 
       linear_layer->allocator->free(linear_layer->params);
       linear_layer->allocator->free(linear_layer->der_params);
@@ -119,7 +197,7 @@ void Coder::BuildLinearLayer()
       if (layer_smoothed)
         linear_layer = new(allocator) SmoothedLinear(n_inputs, n_outputs);
       else
-        linear_layer = new(allocator) Linear(n_inputs, n_outputs);
+        linear_layer = new(allocator) BlockLinear(n_inputs, n_outputs);
     }   else    {
       error("Coder::Coder(...) - weights cannot be transposed unless tied (no code for it)!");
     }
@@ -131,9 +209,9 @@ void Coder::BuildNonlinearLayer()
   if(nonlinearity=="none")    {
     nonlinear_layer = NULL;
   }     else if(nonlinearity=="tanh")    {
-    nonlinear_layer = new(allocator)Tanh(n_outputs);
+    nonlinear_layer = new(allocator)FastMathTanh(n_outputs);
   }     else if(nonlinearity=="sigmoid")        {
-    nonlinear_layer = new(allocator)Sigmoid(n_outputs);
+    nonlinear_layer = new(allocator)FastMathSigmoid(n_outputs);
   }     else if (nonlinearity=="nonlinear")     {
     nonlinear_layer = new(allocator)Nonlinear(n_outputs);
   }     else if(nonlinearity=="logsoftmax")       {
@@ -143,6 +221,51 @@ void Coder::BuildNonlinearLayer()
   }
 }
 
+void Coder::SetupFusedPath()
+{
+  fused_deltas = NULL;
+  n_fused_deltas_frames = 0;
+
+  block_linear_layer = dynamic_cast<BlockLinear*>(linear_layer);
+  transposed_linear_layer = dynamic_cast<TransposedTiedLinear*>(linear_layer);
+
+  if(!block_linear_layer && !transposed_linear_layer)
+    fused_nonlinearity = -1;
+  else if(nonlinearity=="none")
+    fused_nonlinearity = FUSED_NONE;
+  else if(nonlinearity=="sigmoid")
+    fused_nonlinearity = FUSED_SIGMOID;
+  else if(nonlinearity=="tanh")
+    fused_nonlinearity = FUSED_TANH;
+  else if(nonlinearity=="nonlinear")
+    fused_nonlinearity = FUSED_NONLINEAR;
+  else
+    fused_nonlinearity = -1;
+}
+
+// Every layer contributing to the derivatives must know they may be cleared
+// lazily: with tied weights, the tied coder's layer must be a BlockLinear.
+void Coder::SetupLazyDerivatives()
+{
+  if(tied_coder && !tied_coder->block_linear_layer)
+    return;
+
+  if(block_linear_layer)
+    block_linear_layer->SetLazyDerivatives();
+  else if(transposed_linear_layer)
+    transposed_linear_layer->SetLazyDerivatives();
+}
+
+bool Coder::IsFused()
+{
+  return fused && fused_nonlinearity >= 0;
+}
+
+void Coder::SetFrozen(bool flag)
+{
+  frozen = flag;
+}
+
 void Coder::setPartialBackprop(bool flag)
 {
   partial_backprop = flag;
@@ -155,22 +278,119 @@ void Coder::setPartialBackprop(bool flag)
 
 void Coder::forward(Sequence *inputs)
 {
-  if(destructive_layer) {
-    destructive_layer->forward(inputs);
-    linear_layer->forward(destructive_layer->outputs);
+  n_kept_frames = 0;
+  if(KeepsPreActivation())
+    AllocateKept(inputs->n_frames);
+
+  if(IsFused())  {
+    if(transposed_linear_layer)
+      FusedTransposedForward(inputs);
+    else if(!(incremental && IncrementalForward(inputs)))
+      FusedForward(inputs);
   }     else    {
-    linear_layer->forward(inputs);
+    if(destructive_layer) {
+      destructive_layer->forward(inputs);
+      linear_layer->forward(destructive_layer->outputs);
+    }     else    {
+      linear_layer->forward(inputs);
+    }
+
+    if(nonlinear_layer)
+      nonlinear_layer->forward(linear_layer->outputs);
   }
 
-  if(nonlinear_layer)
-    nonlinear_layer->forward(linear_layer->outputs);
+  if(KeepsPreActivation())
+    KeepPreActivation(inputs);
+}
+
+// Only a clean plain coder has a pre-activation a noisy coder can reuse.
+bool Coder::KeepsPreActivation()
+{
+  return keep_pre_activation && !destructive_layer && block_linear_layer;
+}
+
+void Coder::AllocateKept(int n_frames)
+{
+  if(n_frames > n_kept_frames_allocated)        {
+    n_kept_frames_allocated = n_frames;
+    kept_inputs = (real*)realloc(kept_inputs, sizeof(real)*n_inputs*n_kept_frames_allocated);
+    kept_pre_activations = (real*)realloc(kept_pre_activations, sizeof(real)*n_outputs*n_kept_frames_allocated);
+  }
+}
+
+void Coder::KeepPreActivation(Sequence *inputs)
+{
+  int n_frames = inputs->n_frames;
+  for(int t=0; t<n_frames; t++) {
+    memcpy(kept_inputs + t*n_inputs, inputs->frames[t], sizeof(real)*n_inputs);
+    // The fused path writes the pre-activations as it goes.
+    if(!IsFused())
+      memcpy(kept_pre_activations + t*n_outputs, linear_layer->outputs->frames[t], sizeof(real)*n_outputs);
+  }
+  n_kept_frames = n_frames;
+}
+
+bool Coder::IncrementalForward(Sequence *inputs)
+{
+  if(!destructive_layer || !tied_coder || transposed_linear_layer)
+    return false;
+
+  // The kept values are used at most once: the weights may be updated after
+  // this forward.
+  int n_frames = inputs->n_frames;
+  int n_tied_frames = tied_coder->n_kept_frames;
+  tied_coder->n_kept_frames = 0;
+  if(n_tied_frames != n_frames)
+    return false;
+  for(int t=0; t<n_frames; t++)
+    if(memcmp(tied_coder->kept_inputs + t*n_inputs, inputs->frames[t], sizeof(real)*n_inputs))
+      return false;
+
+  outputs->resize(n_frames);
+  real **inputs_frames = inputs->frames;
+  real **outputs_frames = outputs->frames;
+
+  destructive_layer->DrawDestroyed(n_frames);
+  unsigned int *destroyed = destructive_layer->destroyed;
+  int n_mask_words = destructive_layer->n_mask_words;
+  real destruct_value = destructive_layer->destruct_value;
+
+  real *weights_ = linear_layer->weights;
+  real *pre_activations = tied_coder->kept_pre_activations;
+  for(int i=0; i<n_outputs; i++)        {
+    for(int t=0; t<n_frames; t++)       {
+      real a = pre_activations[t*n_outputs+i]
+               + MaskedCorrection(n_mask_words, destroyed + t*n_mask_words,
+                                  destruct_value, weights_, inputs_frames[t]);
+      outputs_frames[t][i] = fast_math ? a : FusedActivation(fused_nonlinearity, a);
+    }
+    weights_ += n_inputs;
+  }
+
+  if(fast_math)
+    FusedFastMathActivation(n_frames);
+  return true;
 }
 
 // Notice that we don't make sure the "upper" layers have partial backprop at
 // false.
 void Coder::backward(Sequence *inputs, Sequence *alpha)
 {
-  if(nonlinear_layer)   {
+  // The weights may be updated after this backward.
+  n_kept_frames = 0;
+
+  // A frozen coder that does not backpropagate has nothing to compute.
+  if(frozen && partial_backprop)        {
+    ClearBeta();
+    return;
+  }
+
+  if(IsFused())  {
+    if(transposed_linear_layer)
+      FusedTransposedBackward(inputs, alpha);
+    else
+      FusedBackward(inputs, alpha);
+  }     else if(nonlinear_layer)   {
     nonlinear_layer->backward(linear_layer->outputs, alpha);
     if(destructive_layer)       {
       linear_layer->backward(destructive_layer->outputs, nonlinear_layer->beta);
@@ -187,13 +407,293 @@ void Coder::backward(Sequence *inputs, Sequence *alpha)
     }
   }
 
-  // clear beta
-  if(partial_backprop)  {
-    for(int i=0; i<beta->n_frames; i++)
-      for(int j=0; j<beta->frame_size; j++)
-        beta->frames[i][j] = 0.0;
+  if(partial_backprop)
+    ClearBeta();
+}
+
+void Coder::ClearBeta()
+{
+  for(int i=0; i<beta->n_frames; i++)
+    for(int j=0; j<beta->frame_size; j++)
+      beta->frames[i][j] = 0.0;
+}
+
+// outputs[t][i] = f(bias[i] + sum_j weights[i][j] * x[t][j]) where x is the
+// input with the corrupted units replaced by the destruction value. The
+// corrupted input is never written: the product is taken with the clean input
+// and corrected on the corrupted units.
+void Coder::FusedForward(Sequence *inputs)
+{
+  int n_frames = inputs->n_frames;
+  outputs->resize(n_frames);
+  real **inputs_frames = inputs->frames;
+  real **outputs_frames = outputs->frames;
+
+  unsigned int *destroyed = NULL;
+  int n_mask_words = 0;
+  real destruct_value = 0.;
+  if(destructive_layer) {
+    destructive_layer->DrawDestroyed(n_frames);
+    destroyed = destructive_layer->destroyed;
+    n_mask_words = destructive_layer->n_mask_words;
+    destruct_value = destructive_layer->destruct_value;
+  }
+
+  real *kept = KeepsPreActivation() ? kept_pre_activations : NULL;
+  real *weights_ = linear_layer->weights;
+  real *bias = linear_layer->bias;
+  for(int i=0; i<n_outputs; i++)        {
+    for(int t=0; t<n_frames; t++)       {
+      real *f_inputs = inputs_frames[t];
+      real sum = SimdDot(n_inputs, weights_, f_inputs);
+      if(destroyed)
+        sum += MaskedCorrection(n_mask_words, destroyed + t*n_mask_words,
+                                destruct_value, weights_, f_inputs);
+      if(kept)
+        kept[t*n_outputs+i] = bias[i] + sum;
+      if(fast_math)
+        outputs_frames[t][i] = bias[i] + sum;
+      else
+        outputs_frames[t][i] = FusedActivation(fused_nonlinearity, bias[i] + sum);
+    }
+    weights_ += n_inputs;
+  }
+
+  if(fast_math)
+    FusedFastMathActivation(n_frames);
+}
+
+// Each row i of the weights is visited once: the derivative of the
+// nonlinearity is computed from the outputs, then the row's der_weights and
+// every frame's beta are updated.
+void Coder::FusedBackward(Sequence *inputs, Sequence *alpha)
+{
+  int n_frames = inputs->n_frames;
+  beta->resize(n_frames);
+  real **inputs_frames = inputs->frames;
+  real **outputs_frames = outputs->frames;
+  real **alpha_frames = alpha->frames;
+  real **beta_frames = beta->frames;
+
+  unsigned int *destroyed = NULL;
+  int n_mask_words = 0;
+  real destruct_value = 0.;
+  if(destructive_layer) {
+    destroyed = destructive_layer->destroyed;
+    n_mask_words = destructive_layer->n_mask_words;
+    destruct_value = destructive_layer->destruct_value;
+  }
+
+  if(!partial_backprop) {
+    for(int t=0; t<n_frames; t++)
+      for(int j=0; j<n_inputs; j++)
+        beta_frames[t][j] = 0.;
+  }
+
+  bool overwrite = !frozen && OverwriteDerivatives(block_linear_layer->der_flag);
+
+  real *weights_ = linear_layer->weights;
+  real *der_weights_ = linear_layer->der_weights;
+  real *der_bias = linear_layer->der_bias;
+  for(int i=0; i<n_outputs; i++)        {
+    for(int t=0; t<n_frames; t++)       {
+      real delta = alpha_frames[t][i] * FusedDerivative(fused_nonlinearity, outputs_frames[t][i]);
+      real *f_inputs = inputs_frames[t];
+
+      if(!frozen)       {
+        if(t == 0 && overwrite) {
+          der_bias[i] = delta;
+          SimdScale(n_inputs, delta, f_inputs, der_weights_);
+        } else  {
+          der_bias[i] += delta;
+          SimdAxpy(n_inputs, delta, f_inputs, der_weights_);
+        }
+        if(destroyed)   {
+          unsigned int *destroyed_ = destroyed + t*n_mask_words;
+          for(int k=0; k<n_mask_words; k++)     {
+            unsigned int bits = destroyed_[k];
+            while(bits) {
+              int j = (k << 5) + __builtin_ctz(bits);
+              der_weights_[j] += delta * (destruct_value - f_inputs[j]);
+              bits &= bits - 1;
+            }
+          }
+        }
+      }
+
+      if(!partial_backprop)
+        SimdAxpy(n_inputs, delta, weights_, beta_frames[t]);
+    }
+    weights_ += n_inputs;
+    der_weights_ += n_inputs;
+  }
+
+  // No gradient flows through the corrupted units.
+  if(destroyed && !partial_backprop)    {
+    for(int t=0; t<n_frames; t++)
+      SimdMaskedSelect(n_inputs, destroyed + t*n_mask_words, 0., beta_frames[t], beta_frames[t]);
   }
 
+  if(!frozen)
+    block_linear_layer->AddDecayToDerivatives(n_frames);
+}
+
+// Same as FusedForward() for the transposed tied weights: row i of the
+// weights holds the contributions of input unit i to all the outputs.
+void Coder::FusedTransposedForward(Sequence *inputs)
+{
+  int n_frames = inputs->n_frames;
+  outputs->resize(n_frames);
+  real **inputs_frames = inputs->frames;
+  real **outputs_frames = outputs->frames;
+
+  unsigned int *destroyed = NULL;
+  int n_mask_words = 0;
+  real destruct_value = 0.;
+  if(destructive_layer) {
+    destructive_layer->DrawDestroyed(n_frames);
+    destroyed = destructive_layer->destroyed;
+    n_mask_words = destructive_layer->n_mask_words;
+    destruct_value = destructive_layer->destruct_value;
+  }
+
+  for(int t=0; t<n_frames; t++) {
+    real *f_outputs = outputs_frames[t];
+    for(int j=0; j<n_outputs; j++)
+      f_outputs[j] = 0.;
+  }
+
+  real *weights_ = linear_layer->weights;
+  for(int i=0; i<n_inputs; i++) {
+    for(int t=0; t<n_frames; t++)       {
+      real input_i_ = inputs_frames[t][i];
+      if(destroyed && MaskBit(destroyed + t*n_mask_words, i))
+        input_i_ = destruct_value;
+      SimdAxpy(n_outputs, input_i_, weights_, outputs_frames[t]);
+    }
+    weights_ += n_outputs;
+  }
+
+  // As TransposedTiedLinear, the bias is only used with the reparametrization.
+  bool reparametrize_ = transposed_linear_layer->reparametrize;
+  real multiplier = transposed_linear_layer->reparametrization_multiplier;
+  real *bias = linear_layer->bias;
+  for(int t=0; t<n_frames; t++) {
+    real *f_outputs = outputs_frames[t];
+    for(int j=0; j<n_outputs; j++)      {
+      real a = f_outputs[j];
+      if(reparametrize_)
+        a = multiplier * a + bias[j];
+      f_outputs[j] = fast_math ? a : FusedActivation(fused_nonlinearity, a);
+    }
+  }
+
+  if(fast_math)
+    FusedFastMathActivation(n_frames);
+}
+
+// Applies the nonlinearity in place on the outputs, with the vectorized
+// fast_math versions.
+void Coder::FusedFastMathActivation(int n_frames)
+{
+  for(int t=0; t<n_frames; t++) {
+    real *f_outputs = outputs->frames[t];
+    switch(fused_nonlinearity)  {
+      case FUSED_SIGMOID:
+        FastSigmoidArray(n_outputs, f_outputs, f_outputs);
+        break;
+      case FUSED_TANH:
+        FastTanhArray(n_outputs, f_outputs, f_outputs);
+        break;
+      case FUSED_NONLINEAR:
+        FastSoftsignArray(n_outputs, f_outputs, f_outputs);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+void Coder::FusedTransposedBackward(Sequence *inputs, Sequence *alpha)
+{
+  int n_frames = inputs->n_frames;
+  beta->resize(n_frames);
+  real **inputs_frames = inputs->frames;
+  real **outputs_frames = outputs->frames;
+  real **alpha_frames = alpha->frames;
+  real **beta_frames = beta->frames;
+
+  unsigned int *destroyed = NULL;
+  int n_mask_words = 0;
+  real destruct_value = 0.;
+  if(destructive_layer) {
+    destroyed = destructive_layer->destroyed;
+    n_mask_words = destructive_layer->n_mask_words;
+    destruct_value = destructive_layer->destruct_value;
+  }
+
+  real multiplier = 1.0;
+  if(transposed_linear_layer->reparametrize)
+    multiplier = transposed_linear_layer->reparametrization_multiplier;
+
+  // The deltas of a frame are used by every row, so they are kept.
+  if(n_frames > n_fused_deltas_frames)  {
+    n_fused_deltas_frames = n_frames;
+    fused_deltas = (real*)realloc(fused_deltas, sizeof(real)*n_outputs*n_fused_deltas_frames);
+  }
+
+  bool overwrite_weights = !frozen && OverwriteDerivatives(transposed_linear_layer->der_weights_flag);
+  bool overwrite_bias = !frozen && OverwriteDerivatives(transposed_linear_layer->der_bias_flag);
+
+  real *der_bias = linear_layer->der_bias;
+  for(int t=0; t<n_frames; t++) {
+    real *deltas_ = fused_deltas + t*n_outputs;
+    real *alpha_ = alpha_frames[t];
+    real *f_outputs = outputs_frames[t];
+    for(int j=0; j<n_outputs; j++)
+      deltas_[j] = alpha_[j] * FusedDerivative(fused_nonlinearity, f_outputs[j]);
+    if(frozen)
+      continue;
+    if(t == 0 && overwrite_bias)        {
+      for(int j=0; j<n_outputs; j++)
+        der_bias[j] = deltas_[j];
+    } else      {
+      for(int j=0; j<n_outputs; j++)
+        der_bias[j] += deltas_[j];
+    }
+  }
+
+  if(overwrite_weights) {
+    real *base_der_bias = transposed_linear_layer->base_linear->der_bias;
+    for(int i=0; i<n_inputs; i++)
+      base_der_bias[i] = 0.;
+  }
+
+  real *weights_ = linear_layer->weights;
+  real *der_weights_ = linear_layer->der_weights;
+  for(int i=0; i<n_inputs; i++) {
+    for(int t=0; t<n_frames; t++)       {
+      real *deltas_ = fused_deltas + t*n_outputs;
+      bool is_destroyed = destroyed && MaskBit(destroyed + t*n_mask_words, i);
+
+      if(!partial_backprop)     {
+        if(is_destroyed)
+          beta_frames[t][i] = 0.;
+        else
+          beta_frames[t][i] = multiplier * SimdDot(n_outputs, deltas_, weights_);
+      }
+
+      real input_i_ = is_destroyed ? destruct_value : inputs_frames[t][i];
+      if(frozen)
+        continue;
+      if(t == 0 && overwrite_weights)
+        SimdScale(n_outputs, multiplier * input_i_, deltas_, der_weights_);
+      else
+        SimdAxpy(n_outputs, multiplier * input_i_, deltas_, der_weights_);
+    }
+    weights_ += n_outputs;
+    der_weights_ += n_outputs;
+  }
 }
 
 void Coder::loadXFile(XFile *file)
@@ -220,6 +720,9 @@ void Coder::saveXFile(XFile *file)
 
 Coder::~Coder()
 {
+  free(fused_deltas);
+  free(kept_inputs);
+  free(kept_pre_activations);
 }
 
 }
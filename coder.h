@@ -21,6 +21,8 @@
 namespace Torch {
 
 class Linear;
+class BlockLinear;
+class TransposedTiedLinear;
 class Destructive;
 
 // A Coder is the building block of an autoencoder.
@@ -29,6 +31,27 @@ class Destructive;
 // See backward(). This is like in ConnectedMachine: the inner machines' inputs
 // are not recomputed from the inputs given in backward.
 //
+// The input sequence may hold several frames, one per example of a minibatch.
+// The linear layers then process the minibatch as a block (see BlockLinear).
+//
+// Fused path: when the linear layer is a BlockLinear or a TransposedTiedLinear
+// and the nonlinearity is "none", "sigmoid", "tanh" or "nonlinear", forward()
+// applies the corruption mask, the weight product and the nonlinearity in one
+// pass and writes the outputs only. backward() computes the nonlinearity
+// derivative from the outputs in the same sweep that accumulates der_weights
+// and beta. The intermediate sequences of the underlying machines are then
+// not used. Set the "fused" option to false to run the underlying machines
+// one after the other instead (for debugging).
+//
+// Incremental noisy path: a noisy coder tied to a clean one (same weights, not
+// transposed) computes the same product on the corrupted input as the clean
+// coder on the clean input, except for the corrupted units. With the
+// "incremental" option, and if the clean coder has "keep pre-activation", the
+// noisy pre-activation is taken from the clean one and corrected on the
+// corrupted units only, so its cost scales with the number of corrupted units.
+// This is only done when the clean coder was forwarded on the very same inputs
+// since its last backward; otherwise the full product is computed.
+//
 class Coder : public GradientMachine
 {
   public:
@@ -45,6 +68,28 @@ class Coder : public GradientMachine
    Linear *linear_layer;
    GradientMachine *nonlinear_layer;
 
+   // Fused path
+   bool fused;
+   bool fast_math;              // see fast_math.h
+   int fused_nonlinearity;      // -1 if this coder cannot be fused
+   BlockLinear *block_linear_layer;
+   TransposedTiedLinear *transposed_linear_layer;
+   real *fused_deltas;          // nonlinearity derivative times alpha, for
+   int n_fused_deltas_frames;   // the transposed layer only
+
+   // Incremental noisy path
+   bool incremental;            // noisy coder: reuse the tied coder's pre-activation
+   bool keep_pre_activation;    // clean coder: keep it for the noisy coder
+   real *kept_inputs;           // inputs and pre-activations of the last
+   real *kept_pre_activations;  // forward, n_kept_frames frames of them (0
+   int n_kept_frames;           // when they were used or may be stale)
+   int n_kept_frames_allocated;
+
+   // A frozen coder's parameters are not trained: the fused paths only
+   // compute beta (nothing if partial backprop), without the derivatives and
+   // the decays. The unfused path still computes them, for nobody.
+   bool frozen;
+
 
    Coder(int n_inputs_, int n_outputs_, bool is_noisy_,
          Coder *tied_coder_, bool is_transposed_, bool reparametrize_, std::string nonlinearity_,
@@ -54,11 +99,33 @@ class Coder : public GradientMachine
    void BuildLinearLayer();
    void BuildNonlinearLayer();
 
+   void SetupFusedPath();
+   // Has the linear layer overwrite derivatives cleared lazily.
+   void SetupLazyDerivatives();
+   virtual void SetFrozen(bool flag=true);
+   void ClearBeta();
+   bool IsFused();
+
    virtual void setPartialBackprop(bool flag=true);
 
    virtual void forward(Sequence *inputs);
    virtual void backward(Sequence *inputs, Sequence *alpha);
 
+   virtual void FusedForward(Sequence *inputs);
+   virtual void FusedBackward(Sequence *inputs, Sequence *alpha);
+   virtual void FusedTransposedForward(Sequence *inputs);
+   virtual void FusedTransposedBackward(Sequence *inputs, Sequence *alpha);
+   virtual void FusedFastMathActivation(int n_frames);
+
+   bool KeepsPreActivation();
+   void AllocateKept(int n_frames);
+   // Keeps a copy of the inputs and pre-activations of the forward that just
+   // ran (see KeepsPreActivation()).
+   virtual void KeepPreActivation(Sequence *inputs);
+   // Forward of a noisy coder from its tied coder's kept pre-activations.
+   // Returns false, without touching the outputs, if they cannot be used.
+   virtual bool IncrementalForward(Sequence *inputs);
+
    virtual void loadXFile(XFile *file);
    virtual void saveXFile(XFile *file);
 
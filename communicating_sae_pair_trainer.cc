@@ -14,9 +14,11 @@
 //
 #include "communicating_sae_pair_trainer.h"
 
+#include <string.h>
 #include <sstream>
 
-#include "Random.h"
+#include "random_streams.h"
+#include "Timer.h"
 #include "OneHotClassFormat.h"
 #include "ClassNLLCriterion.h"
 #include "MSECriterion.h"
@@ -32,6 +34,11 @@
 #include "statistics_measurer.h"
 #include "vectors_angle_measurer.h"
 #include "fake_data_measurer.h"
+#include "optimizer.h"
+#include "simd_kernels.h"
+#include "trainer_group.h"
+#include "lazy_derivatives.h"
+#include "representation_cache.h"
 
 namespace Torch {
 
@@ -43,6 +50,10 @@ CommunicatingSaePairTrainer::CommunicatingSaePairTrainer(std::string expdir_, in
   communication_type = communication_type_;
   profile_local_gradients = profile_local_gradients_;
 
+  addBOption("cache mentor targets", &cache_mentor_targets, false, "mentoring: cache the outputs of the mentor's frozen encoders instead of forwarding them");
+  addBOption("mentor communication only", &mentor_communication_only, true, "mentoring type 2: forward and backward the mentor's communication sub-network only");
+  addBOption("cache on disk", &cache_on_disk, false, "keep the mentor target caches in memory-mapped files in expdir");
+
   // Must be set prior to calling a training function
   first_csae = NULL;
   first_sup_criterion = NULL;
@@ -73,6 +84,19 @@ CommunicatingSaePairTrainer::CommunicatingSaePairTrainer(std::string expdir_, in
   second_comContent_criterions = NULL;
   second_comContent_measurers = NULL;
 
+  mentor_concat_criterion = NULL;
+  student_concat_criterion = NULL;
+  student_criterions = NULL;
+  gradient_profiling_measurers = NULL;
+  saved_grads = NULL;
+  trained_params = NULL;
+  trained_der_params = NULL;
+  n_mentor_target_caches = 0;
+  mentor_target_caches = NULL;
+  mentor_targets = NULL;
+  mentor_hiddens = NULL;
+  mentor_timer = NULL;
+  mentor_epoch_time = 0.;
 }
 
 
@@ -87,10 +111,13 @@ void CommunicatingSaePairTrainer::trainMentoring(DataSet *sup_train_data, Measur
   ss << first_csae->name << " is mentoring " << second_csae->name;
   message(ss.str().c_str());
 
+  if(profile_local_gradients && (minibatch_size > 1 || shard_size > 0))
+    error("CommunicatingSaePairTrainer - cannot profile the local gradients with minibatches.");
+
   // *** Take care of the mentor
   // The mentor is 'first_csae'. It is only trained if communication_type==2.
   // If so only his communication part is trained.
-  Criterion *mentor_concat_criterion = NULL;
+  mentor_concat_criterion = NULL;
   Criterion **mentor_criterions = NULL;
   MeasurerList *mentor_measurers = NULL;
 
@@ -103,15 +130,40 @@ void CommunicatingSaePairTrainer::trainMentoring(DataSet *sup_train_data, Measur
     // Make an array with the criterions
     mentor_criterions = (Criterion**) allocator->alloc(sizeof(Criterion *)*(2*n_communication_layers));
 
-    for(int i=0; i<n_communication_layers; i++)    {
-      mentor_criterions[i] = first_comAgree_criterions[i];
-      mentor_criterions[n_communication_layers+i] = first_comContent_criterions[i];
+    if(mentor_communication_only)       {
+      if(n_communication_layers != first_csae->n_communication_layers)
+        error("CommunicatingSaePairTrainer - the mentor communicates on %d layers, not %d",
+              first_csae->n_communication_layers, n_communication_layers);
+
+      // The speech and the reconstruction of each layer in turn.
+      for(int i=0; i<n_communication_layers; i++)    {
+        mentor_criterions[2*i] = first_comAgree_criterions[i];
+        mentor_criterions[2*i+1] = first_comContent_criterions[i];
+      }
+      mentor_concat_criterion = new(allocator) ConcatCriterion(first_csae->mentor_communication->n_outputs,
+                                                              2*n_communication_layers,
+                                                              mentor_criterions);
+
+      // The encoders' outputs come from the caches or from the encoders alone.
+      mentor_hiddens = new(allocator) Sequence(0, first_csae->mentor_communication->n_inputs);
+      if(cache_mentor_targets)  {
+        CacheMentorTargets(sup_train_data, n_communication_layers);
+        for(int i=0; i<n_communication_layers; i++)
+          first_comContent_datasets[i]->targets = mentor_targets[i];
+      }
+      first_csae->mentor_communication->setPartialBackprop(true);
     }
+    else        {
+      for(int i=0; i<n_communication_layers; i++)    {
+        mentor_criterions[i] = first_comAgree_criterions[i];
+        mentor_criterions[n_communication_layers+i] = first_comContent_criterions[i];
+      }
 
-    // Create the concat criterion.
-    mentor_concat_criterion = new(allocator) ConcatCriterion(first_csae->mentor->n_outputs,
-                                                            2*n_communication_layers,
-                                                            mentor_criterions);
+      // Create the concat criterion.
+      mentor_concat_criterion = new(allocator) ConcatCriterion(first_csae->mentor->n_outputs,
+                                                              2*n_communication_layers,
+                                                              mentor_criterions);
+    }
 
     // Measurers
     mentor_measurers = (MeasurerList*) new(allocator) MeasurerList();
@@ -126,8 +178,8 @@ void CommunicatingSaePairTrainer::trainMentoring(DataSet *sup_train_data, Measur
   }
 
   // *** Student
-  Criterion *student_concat_criterion = NULL;
-  Criterion **student_criterions = NULL;
+  student_concat_criterion = NULL;
+  student_criterions = NULL;
   MeasurerList *student_measurers_all = (MeasurerList*) new(allocator) MeasurerList();
 
   // Weights for weighing different criterions. First criterion, the supervised
@@ -150,8 +202,15 @@ void CommunicatingSaePairTrainer::trainMentoring(DataSet *sup_train_data, Measur
   if(communication_type==0 || communication_type==1)     {
 
     // Set the right targets for the Agreement datasets
-    for(int i=0; i<n_communication_layers; i++)    {
-      second_comAgree_datasets[i]->targets = first_csae->encoders[i]->outputs;
+    if(cache_mentor_targets)    {
+      CacheMentorTargets(sup_train_data, n_communication_layers);
+      for(int i=0; i<n_communication_layers; i++)
+        second_comAgree_datasets[i]->targets = mentor_targets[i];
+    }
+    else        {
+      for(int i=0; i<n_communication_layers; i++)    {
+        second_comAgree_datasets[i]->targets = first_csae->encoders[i]->outputs;
+      }
     }
 
     // Make an array with the criterions
@@ -307,24 +366,56 @@ void CommunicatingSaePairTrainer::trainMentoring(DataSet *sup_train_data, Measur
 
 
   // Shuffling of examples
-  message("call to random is not protected for concurency");
-  if(do_shuffle)        {
-    Random::getShuffledIndices(shuffle, n_train);
+  Shuffle(n_train, shuffle);
+
+  // The measurers on the training set, measured by TrainEpoch().
+  int n_train_meas = first_n_meas[0] + second_n_meas[0];
+  Measurer **train_meas = (Measurer**)allocator->alloc(sizeof(Measurer*)*(n_train_meas+1));
+  for(int i = 0; i < first_n_meas[0]; i++)
+    train_meas[i] = first_meas[0][i];
+  for(int i = 0; i < second_n_meas[0]; i++)
+    train_meas[first_n_meas[0]+i] = second_meas[0][i];
+
+  // The parameters trained with the communication type
+  trained_params = new(allocator) Parameters();
+  trained_der_params = new(allocator) Parameters();
+  if(communication_type==2)     {
+    trained_params->add(first_csae->mentor_communicator->params);
+    trained_der_params->add(first_csae->mentor_communicator->der_params);
   }
-  else  {
-    for(int i = 0; i < n_train; i++)
-      shuffle[i] = i;
+  trained_params->add(StudentMachine()->params);
+  trained_der_params->add(StudentMachine()->der_params);
+  ResolveLazyDerivatives(trained_der_params);
+  if(communication_type==2)
+    ResolveLazyDerivatives(first_csae->mentor_communicator->der_params);
+  ResolveLazyDerivatives(StudentMachine()->der_params);
+
+  // The whole mentor is backpropagated for its communicator only: its
+  // encoders just pass the gradient down.
+  if(communication_type==2 && !mentor_hiddens && freeze_untrained) {
+    for(int i=0; i<n_communication_layers; i++)
+      first_csae->encoders[i]->SetFrozen(true);
   }
 
+  if(shard_size > 0)
+    InitializeShards();
+
   // *** Profiling "local" gradients ***
-  MeasurerList *gradient_profiling_measurers=NULL;
-  real ***saved_grads = NULL;
+  gradient_profiling_measurers = NULL;
+  saved_grads = NULL;
   if(profile_local_gradients)   {
     gradient_profiling_measurers = (MeasurerList*)new(allocator) MeasurerList();
     saved_grads = (real***)allocator->alloc(sizeof(real***)*second_csae->n_hidden_layers);
     ProfileLocalGradInit(second_csae, gradient_profiling_measurers, saved_grads);
   }
 
+  // Only the training loop is timed, not the measures.
+  Timer timer;
+  timer.stop();
+  int n_trained = 0;
+  mentor_timer = new(allocator) Timer();
+  mentor_timer->stop();
+
   while(1)      {
     // Prepare for iteration (epoch)
     if(communication_type==0)   {
@@ -346,102 +437,11 @@ void CommunicatingSaePairTrainer::trainMentoring(DataSet *sup_train_data, Measur
 
     err = 0;
 
-    // - for each example, train -
-    for(int t = 0; t < n_train; t++)    {
-
-      // - Set derivatives to zero -
-      if(communication_type==0) {
-        ClearDerivatives(second_csae->sup_unsup_comA_machine);
-      }
-      else if(communication_type==1)    {
-        ClearDerivatives(second_csae->sup_unsup_comB_machine);
-      }
-      else      {
-        ClearDerivatives(first_csae->mentor_communicator);        // WASTED COMPUTATIONS! We won't bprop to all these.
-        ClearDerivatives(second_csae->sup_unsup_comC_machine);
-      }
-
-      // - Set the example -
-      // This will set the example for the underlying train_sup_data
-      first_unsup_datasets[0]->setExample(shuffle[t]);
-      second_unsup_datasets[0]->setExample(shuffle[t]);
-
-      // - fprop -
-      if(communication_type==0) {
-        first_csae->forward(sup_train_data->inputs);
-        second_csae->sup_unsup_comA_machine->forward(sup_train_data->inputs);
-        student_concat_criterion->forward(second_csae->sup_unsup_comA_machine->outputs);
-      }
-      else if(communication_type==1)    {
-        first_csae->forward(sup_train_data->inputs);
-        second_csae->sup_unsup_comB_machine->forward(sup_train_data->inputs);
-        student_concat_criterion->forward(second_csae->sup_unsup_comB_machine->outputs);
-      }
-      else      {
-        first_csae->mentor->forward(sup_train_data->inputs);
-        second_csae->sup_unsup_comC_machine->forward(sup_train_data->inputs);
-        mentor_concat_criterion->forward(first_csae->mentor->outputs);
-        student_concat_criterion->forward(second_csae->sup_unsup_comC_machine->outputs);
-      }
-
-      // - bprop -
-      if(communication_type==0) {
-        student_concat_criterion->backward(second_csae->sup_unsup_comA_machine->outputs,NULL);
-      } else if(communication_type==1)    {
-        student_concat_criterion->backward(second_csae->sup_unsup_comB_machine->outputs,NULL);
-      }
-      else    {
-        mentor_concat_criterion->backward(first_csae->mentor->outputs, NULL);
-        student_concat_criterion->backward(second_csae->sup_unsup_comC_machine->outputs, NULL);
-      }
-
-      // *** Profile the 4 gradients at each layer ***
-      if(profile_local_gradients)
-        ProfileLocalGradMeasureExample(second_csae, sup_train_data, gradient_profiling_measurers, student_criterions, saved_grads);
-
-      // BACKPROP only communication layers
-      // We don't have the inputs for this machine... Should build them.
-      // Quick fix for now. Bprop all but update only relevant.
-      if(communication_type==0) {
-        second_csae->sup_unsup_comA_machine->backward(sup_train_data->inputs, student_concat_criterion->beta);
-      }
-      else if(communication_type==1)    {
-        second_csae->sup_unsup_comB_machine->backward(sup_train_data->inputs, student_concat_criterion->beta);
-      }
-      else      {
-        first_csae->mentor->backward(sup_train_data->inputs, mentor_concat_criterion->beta);
-        second_csae->sup_unsup_comC_machine->backward(sup_train_data->inputs, student_concat_criterion->beta);
-      }
-
-      // the measurers on the training set
-      for(int i = 0; i < first_n_meas[0]; i++)
-        first_meas[0][i]->measureExample();
-      for(int i = 0; i < second_n_meas[0]; i++)
-        second_meas[0][i]->measureExample();
-
-      // - Update -
-      if(communication_type==0) {
-        UpdateMachine(second_csae->sup_unsup_comA_machine, current_learning_rate);
-      }
-      else if(communication_type==1)    {
-        UpdateMachine(second_csae->sup_unsup_comB_machine, current_learning_rate);
-      }
-      else      {
-        UpdateMachine(first_csae->mentor_communicator, current_learning_rate);
-        UpdateMachine(second_csae->sup_unsup_comC_machine, current_learning_rate);
-      }
-
-      // Note que peut-etre faudrait foutre
-      // un "accumul_erreur" dans la classe Criterion
-      // des fois que ca soit pas une somme...
-      // Mais bon, a priori ca vient d'une integrale,
-      // donc me gonflez pas.
-      // PREVENIR ICI L'UTILISATEUR DE L'UTILITE
-      // DE L'OUTPUT DANS UN CRITERION
-      //err += first_concat_criterion->outputs->frames[0][0];    // ww care about the
-      //student's error
-      err += student_concat_criterion->outputs->frames[0][0];
-    }
+    // - for each minibatch of examples, train -
+    timer.resume();
+    err = RunEpoch(sup_train_data, shuffle, n_train, current_learning_rate, train_meas, n_train_meas);
+    timer.stop();
+    n_trained += n_train;
 
     // trainset measurers
     for(int i = 0; i < first_n_meas[0]; i++)  {
@@ -513,6 +513,47 @@ void CommunicatingSaePairTrainer::trainMentoring(DataSet *sup_train_data, Measur
     }
   }
   free(shuffle);
+  allocator->free(train_meas);
+  current_minibatch_size = 1;
+
+  if(communication_type==2)     {
+    for(int i=0; i<n_communication_layers; i++)
+      first_csae->encoders[i]->SetFrozen(false);
+  }
+
+  ReleaseReplicas();
+
+  if(mentor_hiddens)    {
+    first_csae->mentor_communication->setPartialBackprop(false);
+    allocator->free(mentor_hiddens);
+    mentor_hiddens = NULL;
+  }
+
+  if(n_mentor_target_caches > 0)        {
+    for(int i=0; i<n_communication_layers; i++)  {
+      if(communication_type==2)
+        first_comContent_datasets[i]->targets = first_csae->encoders[i]->outputs;
+      else
+        second_comAgree_datasets[i]->targets = first_csae->encoders[i]->outputs;
+    }
+    FreeMentorTargetCaches();
+  }
+
+  if(timer.getTime() > 0.)
+    message("CommunicatingSaePairTrainer: %g examples/s (minibatch size %d)",
+            (real)n_trained / timer.getTime(), minibatch_size);
+  mentor_epoch_time = 0.;
+  if(n_trained > 0)     {
+    mentor_epoch_time = mentor_timer->getTime() * n_train / n_trained;
+    message("CommunicatingSaePairTrainer: mentor side %g s per epoch", mentor_epoch_time);
+  }
+  allocator->free(mentor_timer);
+  mentor_timer = NULL;
+
+  ForgetLazyDerivatives(trained_der_params);
+  if(communication_type==2)
+    ForgetLazyDerivatives(first_csae->mentor_communicator->der_params);
+  ForgetLazyDerivatives(StudentMachine()->der_params);
 
   // all measurers
   for(int d=0; d<first_n_datas; d++)  {
@@ -537,6 +578,217 @@ void CommunicatingSaePairTrainer::trainMentoring(DataSet *sup_train_data, Measur
 }
 
 
+void CommunicatingSaePairTrainer::CacheMentorTargets(DataSet *data, int n_layers)
+{
+  int n_examples = data->n_examples;
+  n_mentor_target_caches = n_layers;
+  mentor_target_caches = (RepresentationCache**) allocator->alloc(sizeof(RepresentationCache*)*n_layers);
+  mentor_targets = (Sequence**) allocator->alloc(sizeof(Sequence*)*n_layers);
+
+  for(int i=0; i<n_layers; i++) {
+    int n_outputs = first_csae->encoders[i]->n_outputs;
+    std::string filename;
+    if(cache_on_disk)   {
+      std::stringstream ss;
+      ss << expdir << first_csae->name << "_mentor_targets_layer_" << i << ".bin";
+      filename = ss.str();
+    }
+    mentor_target_caches[i] = new(allocator) RepresentationCache(n_examples, n_outputs,
+                                                                 cache_on_disk ? filename.c_str() : NULL);
+    mentor_targets[i] = new(allocator) Sequence(0, n_outputs);
+  }
+
+  std::stringstream ss;
+  ss << first_csae->name << " : caching the mentor targets of " << n_layers << " layers.";
+  message(ss.str().c_str());
+
+  // Same blocks as the training. The clean encoders are deterministic, so
+  // the targets are the ones the mentor would give at each step.
+  int batch_size = (minibatch_size > 1 ? minibatch_size : 1);
+  int *indices = (int*) allocator->alloc(sizeof(int)*batch_size);
+
+  first_csae->setDataSet(data);
+  first_csae->iterInitialize();
+  for(int first=0; first<n_examples; first+=batch_size)   {
+    int n = (n_examples - first < batch_size ? n_examples - first : batch_size);
+    for(int b=0; b<n; b++)
+      indices[b] = first + b;
+
+    SetMinibatch(first_unsup_datasets[0], indices, n);
+    first_csae->forward(data->inputs);
+
+    for(int i=0; i<n_layers; i++)       {
+      Coder *encoder = first_csae->encoders[i];
+      real **outputs_frames = encoder->outputs->frames;
+      for(int b=0; b<n; b++)
+        memcpy(mentor_target_caches[i]->Example(indices[b]), outputs_frames[b],
+               sizeof(real)*encoder->n_outputs);
+    }
+  }
+
+  allocator->free(indices);
+}
+
+void CommunicatingSaePairTrainer::FreeMentorTargetCaches()
+{
+  for(int i=0; i<n_mentor_target_caches; i++)   {
+    allocator->free(mentor_target_caches[i]);
+    allocator->free(mentor_targets[i]);
+  }
+  allocator->free(mentor_target_caches);
+  allocator->free(mentor_targets);
+  n_mentor_target_caches = 0;
+  mentor_target_caches = NULL;
+  mentor_targets = NULL;
+}
+
+void CommunicatingSaePairTrainer::GatherMentorHiddens(DataSet *data, int *indices, int n)
+{
+  mentor_hiddens->resize(n);
+  int offset = 0;
+  for(int i=0; i<first_csae->n_communication_layers; i++)       {
+    Coder *encoder = first_csae->encoders[i];
+    Sequence *hidden;
+    if(n_mentor_target_caches > 0)      {
+      mentor_target_caches[i]->Gather(indices, n, mentor_targets[i]);
+      hidden = mentor_targets[i];
+    }
+    else        {
+      encoder->forward(i == 0 ? data->inputs : first_csae->encoders[i-1]->outputs);
+      hidden = encoder->outputs;
+    }
+
+    for(int b=0; b<n; b++)
+      memcpy(mentor_hiddens->frames[b] + offset, hidden->frames[b], sizeof(real)*encoder->n_outputs);
+    offset += encoder->n_outputs;
+  }
+}
+
+GradientMachine *CommunicatingSaePairTrainer::StudentMachine()
+{
+  if(communication_type==0)
+    return second_csae->sup_unsup_comA_machine;
+  else if(communication_type==1)
+    return second_csae->sup_unsup_comB_machine;
+  else
+    return second_csae->sup_unsup_comC_machine;
+}
+
+real CommunicatingSaePairTrainer::ForwardBackward(DataSet *data, int *indices, int n)
+{
+  GradientMachine *student_machine = StudentMachine();
+
+  // - Set derivatives to zero -
+  if(communication_type==2)
+    ClearDerivatives(first_csae->mentor_communicator);  // We won't bprop to all these: with lazy derivatives they are only zeroed when applied.
+  ClearDerivatives(student_machine);
+
+  // - Set the example(s) -
+  // This will set the example(s) for the underlying train_sup_data
+  if(group)
+    pthread_mutex_lock(&group->data_mutex);
+  if(n_mentor_target_caches == 0)
+    SetMinibatch(first_unsup_datasets[0], indices, n);
+  SetMinibatch(second_unsup_datasets[0], indices, n);
+  if(group)
+    pthread_mutex_unlock(&group->data_mutex);
+
+  // - fprop -
+  // The mentor's criterion needs the student's speech: it goes after the
+  // student's forward.
+  GradientMachine *mentor_machine = NULL;
+  Sequence *mentor_inputs = data->inputs;
+  if(mentor_timer)
+    mentor_timer->resume();
+  if(communication_type==2 && mentor_hiddens)   {
+    GatherMentorHiddens(data, indices, n);
+    mentor_machine = first_csae->mentor_communication;
+    mentor_inputs = mentor_hiddens;
+    mentor_machine->forward(mentor_inputs);
+  }
+  else if(communication_type==2)        {
+    mentor_machine = first_csae->mentor;
+    mentor_machine->forward(mentor_inputs);
+  }
+  else if(n_mentor_target_caches > 0)   {
+    // The agreement targets come from the caches.
+    for(int i=0; i<n_mentor_target_caches; i++)
+      mentor_target_caches[i]->Gather(indices, n, mentor_targets[i]);
+  }
+  else
+    first_csae->forward(data->inputs);
+  if(mentor_timer)
+    mentor_timer->stop();
+
+  student_machine->forward(data->inputs);
+
+  if(mentor_timer)
+    mentor_timer->resume();
+  if(mentor_machine)
+    mentor_concat_criterion->forward(mentor_machine->outputs);
+  if(mentor_timer)
+    mentor_timer->stop();
+  student_concat_criterion->forward(student_machine->outputs);
+
+  // - bprop -
+  if(mentor_machine)
+    mentor_concat_criterion->backward(mentor_machine->outputs, NULL);
+  student_concat_criterion->backward(student_machine->outputs, NULL);
+
+  // *** Profile the 4 gradients at each layer ***
+  if(profile_local_gradients)
+    ProfileLocalGradMeasureExample(second_csae, data, gradient_profiling_measurers, student_criterions, saved_grads);
+
+  // BACKPROP only communication layers. Without mentor_communication we
+  // bprop the whole mentor but update only the relevant parts.
+  if(mentor_machine)    {
+    if(mentor_timer)
+      mentor_timer->resume();
+    mentor_machine->backward(mentor_inputs, mentor_concat_criterion->beta);
+    if(mentor_timer)
+      mentor_timer->stop();
+  }
+  student_machine->backward(data->inputs, student_concat_criterion->beta);
+
+  // Note que peut-etre faudrait foutre
+  // un "accumul_erreur" dans la classe Criterion
+  // des fois que ca soit pas une somme...
+  // Mais bon, a priori ca vient d'une integrale,
+  // donc me gonflez pas.
+  // PREVENIR ICI L'UTILISATEUR DE L'UTILITE
+  // DE L'OUTPUT DANS UN CRITERION
+  //err += first_concat_criterion->outputs->frames[0][0];    // ww care about the
+  //student's error
+  real err = 0;
+  for(int f = 0; f < student_concat_criterion->outputs->n_frames; f++)
+    err += student_concat_criterion->outputs->frames[f][0];
+  return err;
+}
+
+Parameters *CommunicatingSaePairTrainer::TrainedParameters()
+{
+  return trained_params;
+}
+
+Parameters *CommunicatingSaePairTrainer::TrainedDerParameters()
+{
+  return trained_der_params;
+}
+
+void CommunicatingSaePairTrainer::ApplyGradient(real current_learning_rate, int n_examples)
+{
+  if(communication_type==2)
+    UpdateMachine(first_csae->mentor_communicator, current_learning_rate, n_examples);
+  UpdateMachine(StudentMachine(), current_learning_rate, n_examples);
+}
+
+void CommunicatingSaePairTrainer::SetCorruptionStreams(long long first_example)
+{
+  unsigned int key = (unsigned int)GetRandomSeed();
+  first_csae->SetCorruptionStreams(~key, (unsigned long long)first_example);
+  second_csae->SetCorruptionStreams(key, (unsigned long long)first_example);
+}
+
 void CommunicatingSaePairTrainer::train(DataSet *data, MeasurerList *measurers)
 {
   error("CommunicatingSaePairTrainer::train(...) is not implemented");
@@ -545,25 +797,35 @@ void CommunicatingSaePairTrainer::train(DataSet *data, MeasurerList *measurers)
 
 void CommunicatingSaePairTrainer::ClearDerivatives(GradientMachine *gm)
 {
-  Parameters *der_params = gm->der_params;
-  if(der_params)    {
-    for(int i=0; i<der_params->n_data; i++)        {
-      memset(der_params->data[i], 0, sizeof(real)*der_params->size[i]);
-    }
-  }
+  ClearParametersDerivatives(gm->der_params);
 }
 
-void CommunicatingSaePairTrainer::UpdateMachine(GradientMachine *gm, real current_learning_rate)
+void CommunicatingSaePairTrainer::UpdateMachine(GradientMachine *gm, real current_learning_rate, int n_examples)
 {
   // - update -
   Parameters *params = gm->params;
   Parameters *der_params = gm->der_params;
+  real example_learning_rate = current_learning_rate / (real)n_examples;
   if(params)        {
+    bool **flags = LazyDerivativesFlags(der_params);
     for(int i=0; i<params->n_data; i++) {
       real *ptr_params = params->data[i];
       real *ptr_der_params = der_params->data[i];
+      if(n_frozen_arrays && IsFrozen(ptr_der_params))
+        continue;
+      if(flags)
+        SettleDerivatives(ptr_der_params, params->size[i], flags[i]);
+      else
+        SettleDerivatives(ptr_der_params, params->size[i]);
+      if(optimizer)     {
+        // The optimizers get the mean gradient (see StochasticGradientPlus).
+        if(n_examples > 1)
+          SimdScale(params->size[i], 1. / (real)n_examples, ptr_der_params, ptr_der_params);
+        optimizer->Update(ptr_params, ptr_der_params, params->size[i], current_learning_rate);
+        continue;
+      }
       for(int j=0; j<params->size[i]; j++)      {
-        ptr_params[j] -= current_learning_rate * ptr_der_params[j];
+        ptr_params[j] -= example_learning_rate * ptr_der_params[j];
       }
     }
   }
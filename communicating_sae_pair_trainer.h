@@ -28,12 +28,36 @@ namespace Torch {
 class CommunicatingStackedAutoencoder;
 class Criterion;
 class InputAsTargetDataSet;
+class RepresentationCache;
+class Timer;
 
 // This trainer enables training with communication of two stacked
 // autoencoders.
 //
 // Two types od interaction are possible: mentoring and normal training. In
 // mentoring, one SAE is the mentor and the other the student. The 
+//
+// trainMentoring() trains through StochasticGradientPlus::TrainEpoch() with
+// the hooks below, so the "minibatch size" and "shard size" options apply.
+//
+// With communication types 0 and 1 the mentor is not trained: its encoders
+// are only forwarded for the student's agreement targets. With the "cache
+// mentor targets" option, trainMentoring() forwards the mentor once over the
+// training set and keeps the outputs of its communication layers in caches
+// (in memory, or in memory-mapped files in expdir with "cache on disk"). The
+// agreement DataSets' targets are then gathered from the caches by example
+// index instead of forwarding the mentor. Only the master uses the caches:
+// replicas still forward their mentor.
+//
+// With communication type 2 only the mentor's communicator is trained. With
+// "mentor communication only" (the default), the mentor's
+// mentor_communication is forwarded and backwarded on the outputs of its
+// encoders, which are only forwarded (or taken from the caches above, which
+// then also give the content targets). Otherwise the whole mentor is, as
+// the communicator alone does not know its inputs.
+//
+// The time spent on the mentor's side is reported at the end of
+// trainMentoring(), per epoch.
 
 class CommunicatingSaePairTrainer : public StochasticGradientPlus
 {
@@ -41,6 +65,9 @@ class CommunicatingSaePairTrainer : public StochasticGradientPlus
     std::string expdir;
     int communication_type;
     bool profile_local_gradients;
+    bool cache_mentor_targets;
+    bool cache_on_disk;
+    bool mentor_communication_only;
 
     // Must be set prior to calling a training function
     CommunicatingStackedAutoencoder *first_csae;
@@ -77,6 +104,23 @@ class CommunicatingSaePairTrainer : public StochasticGradientPlus
     Measurer **second_comContent_measurers;
 
 
+    // State of trainMentoring(), for the hooks below
+    Criterion *mentor_concat_criterion;
+    Criterion *student_concat_criterion;
+    Criterion **student_criterions;
+    MeasurerList *gradient_profiling_measurers;
+    real ***saved_grads;
+    Parameters *trained_params;         // mentor communicator (type 2) and
+    Parameters *trained_der_params;     // StudentMachine()
+    int n_mentor_target_caches;         // 0 when the mentor is forwarded
+    RepresentationCache **mentor_target_caches;
+    Sequence **mentor_targets;          // agreement targets of the minibatch
+    Sequence *mentor_hiddens;           // inputs of mentor_communication, or NULL
+    Timer *mentor_timer;                // NULL on the replicas
+    // Seconds per epoch spent on the mentor's side by the last
+    // trainMentoring(), 0 before it trains.
+    real mentor_epoch_time;
+
     CommunicatingSaePairTrainer(std::string expdir_, int communication_type_,
                                 bool profile_local_gradients_, XFile* resultsfile_=NULL);
 
@@ -85,11 +129,30 @@ class CommunicatingSaePairTrainer : public StochasticGradientPlus
                                 int n_communication_layers, real the_unsup_criterions_weight,
                                 real the_communication_weight);
 
+    // Forwards the mentor over #data# and caches the outputs of its first
+    // #n_layers# encoders (see "cache mentor targets").
+    virtual void CacheMentorTargets(DataSet *data, int n_layers);
+    virtual void FreeMentorTargetCaches();
+    // Sets mentor_hiddens to the outputs of the mentor's communication
+    // layers' encoders for the #n# examples of #indices#, which #data# holds.
+    virtual void GatherMentorHiddens(DataSet *data, int *indices, int n);
+
+    // The machine of the student trained with the communication type.
+    GradientMachine *StudentMachine();
+
+    // One minibatch (or shard) of mentoring. The corruption streams of the
+    // mentor use the complement of the key of the student's.
+    virtual real ForwardBackward(DataSet *data, int *indices, int n);
+    virtual Parameters *TrainedParameters();
+    virtual Parameters *TrainedDerParameters();
+    virtual void ApplyGradient(real current_learning_rate, int n_examples);
+    virtual void SetCorruptionStreams(long long first_example);
+
     // This is not the right place for this function. It should go in
     // GradientMachine of course.
     virtual void ClearDerivatives(GradientMachine *gm);
 
-    virtual void UpdateMachine(GradientMachine *gm, real current_learning_rate);
+    virtual void UpdateMachine(GradientMachine *gm, real current_learning_rate, int n_examples);
 
     // *** For profiling the local gradients ***
     // Allocates the measurers
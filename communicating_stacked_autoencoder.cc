@@ -73,6 +73,8 @@ CommunicatingStackedAutoencoder::CommunicatingStackedAutoencoder(std::string nam
   sup_unsup_comC_machine = NULL;
   mentor = NULL;
   mentor_communicator = NULL;
+  mentor_branches = NULL;
+  mentor_communication = NULL;
 
   if (communication_type==0)
     BuildSupUnsupComA();
@@ -170,10 +172,10 @@ void CommunicatingStackedAutoencoder::AddComCMachines(ConnectedMachine *mch)
   if(!is_noisy) {
     AddMachines(mch,
                 (GradientMachine**) speakers, (GradientMachine**) encoders);
+    EndBranches(mch);
     mch->addLayer();
 
-    mch->addMachine(outputer);
-    mch->connectOn(encoders[n_hidden_layers-1]);
+    AddBranch(mch, outputer, encoders[n_hidden_layers-1]);
 
     AddUnsupMachines(mch);
 
@@ -187,8 +189,7 @@ void CommunicatingStackedAutoencoder::AddComCMachines(ConnectedMachine *mch)
   // with identity handles, and not add a layer. Speakers directly on last
   // layer.
   else  {
-    mch->addMachine(outputer);
-    mch->connectOn(encoders[n_hidden_layers-1]);
+    AddBranch(mch, outputer, encoders[n_hidden_layers-1]);
 
     AddUnsupMachines(mch);
 
@@ -197,18 +198,20 @@ void CommunicatingStackedAutoencoder::AddComCMachines(ConnectedMachine *mch)
 
     AddMachines(mch,
                 (GradientMachine**) speakerlisteners, (GradientMachine**) encoders);
+
+    // The noisy speakers share the speakers' weights.
+    for(int i=0; i<n_communication_layers; i++)
+      TieBranches(speakers[i], speakerlisteners[i]);
   }
+  EndBranches(mch);
 }
 
 void CommunicatingStackedAutoencoder::AddMachines(ConnectedMachine *mch,
                                                   GradientMachine **addees,
                                                   GradientMachine **connectees)
 {
-  for(int i=0; i<n_communication_layers; i++) {
-  
-    mch->addMachine(addees[i]);
-    mch->connectOn(connectees[i]);
-  }
+  for(int i=0; i<n_communication_layers; i++)
+    AddBranch(mch, addees[i], connectees[i]);
 }
 
 void CommunicatingStackedAutoencoder::BuildSupUnsupComA()
@@ -216,13 +219,13 @@ void CommunicatingStackedAutoencoder::BuildSupUnsupComA()
   sup_unsup_comA_machine = new(allocator) ConnectedMachine();
   AddCoreMachines(sup_unsup_comA_machine);
 
-  sup_unsup_comA_machine->addMachine(outputer);
-  sup_unsup_comA_machine->connectOn(encoders[n_hidden_layers-1]);
+  AddBranch(sup_unsup_comA_machine, outputer, encoders[n_hidden_layers-1]);
 
   AddUnsupMachines(sup_unsup_comA_machine);
 
   AddMachines(sup_unsup_comA_machine,
               (GradientMachine**) hidden_handles, (GradientMachine**) encoders);
+  EndBranches(sup_unsup_comA_machine);
 
   sup_unsup_comA_machine->build();
 }
@@ -233,13 +236,13 @@ void CommunicatingStackedAutoencoder::BuildSupUnsupComB()
 
   AddCoreMachines(sup_unsup_comB_machine);
 
-  sup_unsup_comB_machine->addMachine(outputer);
-  sup_unsup_comB_machine->connectOn(encoders[n_hidden_layers-1]);
+  AddBranch(sup_unsup_comB_machine, outputer, encoders[n_hidden_layers-1]);
 
   AddUnsupMachines(sup_unsup_comB_machine);
 
   AddMachines(sup_unsup_comB_machine,
               (GradientMachine**) speakers, (GradientMachine**) encoders);
+  EndBranches(sup_unsup_comB_machine);
 
   sup_unsup_comB_machine->build();
 }
@@ -299,6 +302,7 @@ void CommunicatingStackedAutoencoder::BuildMentor()
   if(!is_noisy) {
     AddMachines(mentor,
                 (GradientMachine**) speakers, (GradientMachine**) encoders);
+    EndBranches(mentor);
     mentor->addLayer();
 
     AddMachines(mentor,
@@ -316,7 +320,10 @@ void CommunicatingStackedAutoencoder::BuildMentor()
 
     AddMachines(mentor,
                 (GradientMachine**) speakerlisteners, (GradientMachine**) encoders);
+    for(int i=0; i<n_communication_layers; i++)
+      TieBranches(speakers[i], speakerlisteners[i]);
   }
+  EndBranches(mentor);
 
   mentor->build();
 
@@ -328,6 +335,26 @@ void CommunicatingStackedAutoencoder::BuildMentor()
   }
   mentor_communicator->build();
 
+  // Mentor communication, on the encoders' outputs
+  mentor_branches = (ConnectedMachine**) allocator->alloc(sizeof(ConnectedMachine*)*n_communication_layers);
+  for(int i=0; i<n_communication_layers; i++)    {
+    mentor_branches[i] = new(allocator) ConnectedMachine();
+    mentor_branches[i]->addMachine(speakers[i]);
+    if(!is_noisy) {
+      mentor_branches[i]->addLayer();
+      mentor_branches[i]->addMachine(speaker_handles[i]);
+      mentor_branches[i]->connectOn(speakers[i]);
+      mentor_branches[i]->addMachine(listeners[i]);
+      mentor_branches[i]->connectOn(speakers[i]);
+    }
+    else        {
+      mentor_branches[i]->addMachine(speakerlisteners[i]);
+    }
+    mentor_branches[i]->build();
+  }
+  mentor_communication = new(allocator) BranchMachine(n_communication_layers,
+                                                      (GradientMachine**) mentor_branches);
+
 }
 
 void CommunicatingStackedAutoencoder::setL1WeightDecay(real weight_decay)
@@ -348,6 +375,32 @@ void CommunicatingStackedAutoencoder::setDestructionOptions(real destruct_prob,
   warning("CommunicatingStackedAutoencoder::setDestructionOptions - fixme");
 }
 
+void CommunicatingStackedAutoencoder::setFusedCoders(bool fused)
+{
+  StackedAutoencoder::setFusedCoders(fused);
+
+  for(int i=0; i<n_communication_layers; i++)    {
+    if(speakers && speakers[i])
+      speakers[i]->setBOption("fused", fused);
+    if(noisy_speakers && noisy_speakers[i])
+      noisy_speakers[i]->setBOption("fused", fused);
+    if(listeners && listeners[i])
+      listeners[i]->setBOption("fused", fused);
+  }
+}
+
+void CommunicatingStackedAutoencoder::SetCorruptionStreams(unsigned int key, unsigned long long stream)
+{
+  StackedAutoencoder::SetCorruptionStreams(key, stream);
+
+  // The noisy speakers come after the noisy encoders.
+  if(!noisy_speakers)
+    return;
+  for(int i=0; i<n_communication_layers; i++)
+    if(noisy_speakers[i])
+      noisy_speakers[i]->destructive_layer->SetStream(key, (unsigned int)(n_hidden_layers+i), stream);
+}
+
 void CommunicatingStackedAutoencoder::loadXFile(XFile *file)
 {
   if (communication_type==0)
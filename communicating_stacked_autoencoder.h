@@ -19,6 +19,7 @@
 #include "stacked_autoencoder.h"
 #include "coder.h"
 #include "identity.h"
+#include "branch_machine.h"
 
 namespace Torch {
 
@@ -66,6 +67,13 @@ class CommunicatingStackedAutoencoder : public StackedAutoencoder
                                                 // a handle on that params to
                                                 // update so we limit the
                                                 // number of copies
+    // The communication part of the mentor on its own: branch i is speaker i
+    // with what rebuilds the hidden layer from the speech, and takes the
+    // outputs of encoder i as inputs. The inputs of mentor_communication are
+    // the outputs of the communication layers' encoders, concatenated. Its
+    // outputs are the speech and the reconstruction of each layer in turn.
+    ConnectedMachine **mentor_branches;
+    BranchMachine *mentor_communication;
 
     CommunicatingStackedAutoencoder(std::string name_,
                                     std::string nonlinearity_,
@@ -101,6 +109,10 @@ class CommunicatingStackedAutoencoder : public StackedAutoencoder
     virtual void setL1WeightDecay(real weight_decay);
     virtual void setL2WeightDecay(real weight_decay);
     virtual void setDestructionOptions(real destruct_prob, real destruct_value);
+    virtual void setFusedCoders(bool fused);
+    // Also has the noisy speaker of communication layer i corrupt with the
+    // Philox key (#key#, n_hidden_layers+i).
+    virtual void SetCorruptionStreams(unsigned int key, unsigned long long stream);
 
     virtual void loadXFile(XFile *file);
     virtual void saveXFile(XFile *file);
@@ -14,6 +14,8 @@
 //
 #include "concat_criterion.h"
 
+#include "task_pool.h"
+
 namespace Torch {
 
 ConcatCriterion::ConcatCriterion(int n_inputs_,
@@ -37,7 +39,15 @@ ConcatCriterion::ConcatCriterion(int n_inputs_,
             n_inputs, sum_inputs);
   }
 
-  single_criterion_input = new(allocator) Sequence();
+  criterion_inputs = (Sequence**) allocator->alloc(sizeof(Sequence*)*n_criterions);
+  criterion_offsets = (int*) allocator->alloc(sizeof(int)*n_criterions);
+  int offset = 0;
+  for(int i=0; i<n_criterions; i++)     {
+    criterion_inputs[i] = new(allocator) Sequence();
+    criterion_offsets[i] = offset;
+    offset += criterions[i]->n_inputs;
+  }
+  pool = GetDefaultTaskPool();
 
   if(!criterion_weights)  {
     criterion_weights = (real *)allocator->alloc(sizeof(real)*n_criterions);
@@ -65,23 +75,58 @@ void ConcatCriterion::reset()
     criterions[i]->reset();
 }
 
+// Points the frames of #slice# to #seq#'s columns [offset, offset+size).
+static void SliceInputs(Sequence *seq, int offset, int size, Sequence *slice)
+{
+  slice->resize(seq->n_frames,false);       // do not allocate memory!
+  slice->frame_size = size;
+  for(int f=0; f<seq->n_frames; f++)
+    slice->frames[f] = seq->frames[f] + offset;
+}
+
+void ConcatCriterion::ForwardCriterion(int i, Sequence *inputs)
+{
+  SliceInputs(inputs, criterion_offsets[i], criterions[i]->n_inputs, criterion_inputs[i]);
+  criterions[i]->forward(criterion_inputs[i]);
+}
+
+// alphas is NULL OR should be...
+void ConcatCriterion::BackwardCriterion(int i, Sequence *inputs, Sequence *alpha)
+{
+  SliceInputs(inputs, criterion_offsets[i], criterions[i]->n_inputs, criterion_inputs[i]);
+  criterions[i]->backward(criterion_inputs[i], alpha);
+}
+
+struct ConcatCriterionSection
+{
+  ConcatCriterion *criterion;
+  Sequence *inputs;
+  Sequence *alpha;
+};
+
+static void ForwardCriterionTask(void *arg, int i)
+{
+  ConcatCriterionSection *section = (ConcatCriterionSection*)arg;
+  section->criterion->ForwardCriterion(i, section->inputs);
+}
+
+static void BackwardCriterionTask(void *arg, int i)
+{
+  ConcatCriterionSection *section = (ConcatCriterionSection*)arg;
+  section->criterion->BackwardCriterion(i, section->inputs, section->alpha);
+}
+
 // The output contains the weighted sum of the .
 void ConcatCriterion::forward(Sequence *inputs)
 {
   // Start by forwarding each individual criterion
-  int offset=0;
-  single_criterion_input->resize(inputs->n_frames,false);       // do not allocate memory!
-
-  for(int i = 0; i < n_criterions; i++) {
-    // set the input
-    single_criterion_input->frame_size = criterions[i]->n_inputs;
-    for(int f=0; f<inputs->n_frames; f++)       {
-      single_criterion_input->frames[f] = inputs->frames[f] + offset;
-    }
-
-    // forward it
-    criterions[i]->forward(single_criterion_input);
-    offset+=criterions[i]->n_inputs;
+  if(pool)      {
+    ConcatCriterionSection section = { this, inputs, NULL };
+    pool->Run(n_criterions, ForwardCriterionTask, &section);
+  }
+  else  {
+    for(int i = 0; i < n_criterions; i++)
+      ForwardCriterion(i, inputs);
   }
 
   // Now do this machine's actual forward
@@ -101,20 +146,15 @@ void ConcatCriterion::forward(Sequence *inputs)
 void ConcatCriterion::backward(Sequence *inputs, Sequence *alpha)
 {
   // Start by backwarding each individual criterion
-  int offset=0;
-  single_criterion_input->resize(inputs->n_frames,false);
-
-  for(int i=0; i<n_criterions; i++) {
-    // set the input
-    single_criterion_input->frame_size = criterions[i]->n_inputs;
-    for(int f=0; f<inputs->n_frames; f++)       {
-      single_criterion_input->frames[f] = inputs->frames[f] + offset;
-    }
-    offset+=criterions[i]->n_inputs;
-
-    // backward it - alphas is NULL OR should be...
-    criterions[i]->backward(single_criterion_input, alpha);
+  if(pool)      {
+    ConcatCriterionSection section = { this, inputs, alpha };
+    pool->Run(n_criterions, BackwardCriterionTask, &section);
+  }
+  else  {
+    for(int i=0; i<n_criterions; i++)
+      BackwardCriterion(i, inputs, alpha);
   }
+  int offset;
 
   // Now do this machine's actual backward
   int n_frames_ = inputs->n_frames;
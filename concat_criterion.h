@@ -19,6 +19,8 @@
 
 namespace Torch {
 
+class TaskPool;
+
 // ConcatCriterion can be used to concatenate multiple criterions (wow).
 //
 // The output is the weighted sum of the criterions. When doing backward
@@ -27,11 +29,18 @@ namespace Torch {
 // It is different from MultiCriterion in that the criterions each have
 // different inputs.
 //
+// With a #pool# (see task_pool.h), the criterions are forwarded and
+// backwarded as parallel tasks. The pool is GetDefaultTaskPool() when the
+// criterion is built.
+//
 class ConcatCriterion : public Criterion
 {
   public:
 
-    Sequence *single_criterion_input;
+    // The slice of the inputs of each criterion.
+    Sequence **criterion_inputs;
+    int *criterion_offsets;
+    TaskPool *pool;
 
     int n_criterions;
     Criterion **criterions;
@@ -41,6 +50,10 @@ class ConcatCriterion : public Criterion
     ConcatCriterion(int n_inputs_, int n_criterions_, Criterion** criterions_,
                     real *criterion_weights_=NULL);
 
+    // What the tasks run for criterion #i#.
+    void ForwardCriterion(int i, Sequence *inputs);
+    void BackwardCriterion(int i, Sequence *inputs, Sequence *alpha);
+
     //-----
     virtual void forward(Sequence *inputs);
     virtual void backward(Sequence *inputs, Sequence *alpha);
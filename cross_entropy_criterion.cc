@@ -13,6 +13,7 @@
 // limitations under the License.
 //
 #include "cross_entropy_criterion.h"
+#include "fast_math.h"
 
 namespace Torch {
 
@@ -20,6 +21,7 @@ CrossEntropyCriterion::CrossEntropyCriterion(int n_inputs_)
     : Criterion(n_inputs_)
 {
   addBOption("average frame size", &average_frame_size, true, "divided by the frame size");
+  addBOption("fast math", &fast_math, GetFastMathDefault(), "use the fast_math log");
   warning("CrossEntropyCriterion -> numerical issues here?");
 }
 
@@ -28,8 +30,12 @@ void CrossEntropyCriterion::frameForward(int t, real *f_inputs, real *f_outputs)
   real *desired = data->targets->frames[t];
   real err = 0.;
 
-  for(int i=0; i<n_inputs; i++)     {
-    err -= desired[i] * log(f_inputs[i]) + (1.-desired[i]) * log(1.-f_inputs[i]);
+  if(fast_math) {
+    err = FastCrossEntropy(n_inputs, desired, f_inputs);
+  }     else    {
+    for(int i=0; i<n_inputs; i++)     {
+      err -= desired[i] * log(f_inputs[i]) + (1.-desired[i]) * log(1.-f_inputs[i]);
+    }
   }
 
   if(average_frame_size)        {
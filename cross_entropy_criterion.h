@@ -26,10 +26,14 @@ namespace Torch {
 // The number of target frames in #DataSet# must correspond to the number of
 // input frames given to this criterion.
 //
+// With the "fast math" option (defaults to GetFastMathDefault()), the logs
+// are computed with the vectorized approximation of fast_math.h.
+//
 class CrossEntropyCriterion : public Criterion
 {
   public:
     bool average_frame_size;
+    bool fast_math;
 
 
     CrossEntropyCriterion(int n_inputs_);
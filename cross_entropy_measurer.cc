@@ -13,6 +13,7 @@
 // limitations under the License.
 //
 #include "cross_entropy_measurer.h"
+#include "fast_math.h"
 
 namespace Torch {
 
@@ -25,6 +26,7 @@ CrossEntropyMeasurer::CrossEntropyMeasurer(Sequence *inputs_, DataSet *data_, XF
   addBOption("average examples", &average_examples, true, "divided by the number of examples");
   addBOption("average frame size", &average_frame_size, true, "divided by the frame size");
   addBOption("average frames", &average_frames, true, "divided by the number of frames");
+  addBOption("fast math", &fast_math, GetFastMathDefault(), "use the fast_math log");
 }
 
 void CrossEntropyMeasurer::measureExample()
@@ -35,10 +37,16 @@ void CrossEntropyMeasurer::measureExample()
   for(int i=0; i<inputs->n_frames; i++)     {
     real *src_target = desired->frames[i];
     real *src_output = inputs->frames[i];
+    if(fast_math)       {
+      sum += FastCrossEntropy(inputs->frame_size, src_target, src_output);
+      if(isnan(sum))
+        error("CrossEntropyMeasurer::measureExample() - cost is nan");
+      continue;
+    }
     for(int j=0; j<inputs->frame_size; j++) {
-      sum -= src_target[i] * log(src_output[i]) + (1.-src_target[i]) * log(1.-src_output[i]);
+      sum -= src_target[j] * log(src_output[j]) + (1.-src_target[j]) * log(1.-src_output[j]);
       if(isnan(sum))   {
-        error("CrossEntropyMeasurer::measureExample() - cost is nan, output is %f", (float)src_output[i]);
+        error("CrossEntropyMeasurer::measureExample() - cost is nan, output is %f", (float)src_output[j]);
       }
     }
   }
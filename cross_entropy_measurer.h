@@ -24,12 +24,16 @@ namespace Torch {
 // Compute the CrossEntropy between its inputs, and the targets of its
 // associated #DataSet#.
 //
+// With the "fast math" option (defaults to GetFastMathDefault()), the logs
+// are computed with the vectorized approximation of fast_math.h.
+//
 class CrossEntropyMeasurer : public Measurer
 {
   public:
     bool average_examples;
     bool average_frame_size;
     bool average_frames;
+    bool fast_math;
     real internal_error;
     Sequence *inputs;
 
@@ -13,43 +13,67 @@
 // limitations under the License.
 //
 #include "destructive.h"
-#include "Random.h"
+#include "philox.h"
+#include "simd_kernels.h"
 
 namespace Torch {
 
-Destructive::Destructive(int n_units) : GradientMachine(n_units, n_units)
+Destructive::Destructive(int n_units) : GradientMachine(n_units, n_units), rng(RANDOM_STREAM_CORRUPTION)
 {
-  destroyed = (bool*)malloc(sizeof(bool)*n_units);
+  n_mask_words = (n_units+31)/32;
+  destroyed = (unsigned int*)malloc(sizeof(unsigned int)*n_mask_words);
+  n_destroyed_frames = 1;
+
+  n_drawn_frames = 0;
 
   addROption("Destruction probability", &destruct_prob, 0.2, "Probability of setting a unit to the destruction value.");
   addROption("Destruction value", &destruct_value, 0.0, "The value destroyed units are attributed.");
 }
 
-void Destructive::frameForward(int t, real *f_inputs, real *f_outputs)
+void Destructive::AllocateDestroyed(int n_frames)
 {
-  for(int i = 0; i < n_inputs; i++)     {
-    if(Random::uniform()<destruct_prob) {
-      destroyed[i]=true;
-      f_outputs[i]=destruct_value;
-    }   else    {
-      destroyed[i]=false;
-      f_outputs[i]=f_inputs[i];
-    }
+  if(n_frames > n_destroyed_frames)     {
+    n_destroyed_frames = n_frames;
+    destroyed = (unsigned int*)realloc(destroyed, sizeof(unsigned int)*n_mask_words*n_destroyed_frames);
   }
 }
 
+void Destructive::DrawDestroyed(int n_frames)
+{
+  AllocateDestroyed(n_frames);
+
+  // A new seed starts the masks over.
+  if(rng.Rekey())
+    n_drawn_frames = 0;
+
+  for(int t=0; t<n_frames; t++)
+    PhiloxBernoulliMask(rng.key[0], rng.key[1], n_drawn_frames++, n_inputs,
+                        destruct_prob, destroyed + t*n_mask_words);
+}
+
+void Destructive::SetStream(unsigned int k0, unsigned int k1, unsigned long long stream)
+{
+  rng.SetKey(k0, k1);
+  n_drawn_frames = stream;
+}
+
+void Destructive::forward(Sequence *inputs)
+{
+  DrawDestroyed(inputs->n_frames);
+  GradientMachine::forward(inputs);
+}
+
+void Destructive::frameForward(int t, real *f_inputs, real *f_outputs)
+{
+  SimdMaskedSelect(n_inputs, destroyed + t*n_mask_words, destruct_value, f_inputs, f_outputs);
+}
+
 void Destructive::frameBackward(int t, real *f_inputs, real *beta_, real *f_outputs, real *alpha_)
 {
   if(partial_backprop)
     return;
 
-  for(int i = 0; i < n_outputs; i++)    {
-    if(destroyed[i])    {
-      beta_[i]=0.0;
-    }   else    {
-      beta_[i]=alpha_[i];
-    }
-  }
+  SimdMaskedSelect(n_outputs, destroyed + t*n_mask_words, 0., alpha_, beta_);
 }
 
 Destructive::~Destructive()
@@ -16,6 +16,7 @@
 #define TORCH_DESTRUCTIVE_H_
 
 #include "GradientMachine.h"
+#include "random_streams.h"
 
 namespace Torch {
 
@@ -23,15 +24,39 @@ class Destructive : public GradientMachine
 {
   public:
 
-    bool *destroyed;
+    // One row of n_mask_words words per frame of the last forward. Bit i%32
+    // of word i/32 of a row is set when unit i is destroyed (see MaskBit()).
+    unsigned int *destroyed;
+    int n_mask_words;
+    int n_destroyed_frames;
 
     real destruct_prob;
     real destruct_value;
 
+    // The mask of the n-th frame corrupted since the seed was set is drawn
+    // with Philox from the key of #rng# and the substream n, so the
+    // corruption only depends on the seed, on the layer's stream and on the
+    // number of frames already seen (see random_streams.h).
+    RandomStream rng;
+    unsigned long long n_drawn_frames;
+
     Destructive(int n_units);
 
     //-----
 
+    // Makes sure there is a row of mask words for each of #n_frames# frames.
+    virtual void AllocateDestroyed(int n_frames);
+    // Draws the masks of #n_frames# frames without producing the outputs.
+    // forward() draws its masks with this function, so the fused Coder and
+    // the layer give the same corruption for the same random seed.
+    virtual void DrawDestroyed(int n_frames);
+
+    // Sets the key, and the stream of the mask of the next frame. The
+    // synchronous data parallel training (see StochasticGradientPlus) uses
+    // it to make the masks depend on the examples only.
+    virtual void SetStream(unsigned int k0, unsigned int k1, unsigned long long stream);
+
+    virtual void forward(Sequence *inputs);
     virtual void frameForward(int t, real *f_inputs, real *f_outputs);
     virtual void frameBackward(int t, real *f_inputs, real *beta_, real *f_outputs, real *alpha_);
 
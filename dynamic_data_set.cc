@@ -13,6 +13,7 @@
 // limitations under the License.
 //
 #include "dynamic_data_set.h"
+#include "minibatch.h"
 
 namespace Torch {
 
@@ -45,6 +46,9 @@ DynamicDataSet::DynamicDataSet(DataSet *data_,
   }     else    {
     targets = NULL;
   }
+
+  batch_inputs = new(allocator) Sequence(0, data->n_inputs);
+  batch_targets = new(allocator) Sequence(0, data->n_targets);
 }
 
 void DynamicDataSet::getNumberOfFrames(int t_, int *n_input_frames_, int *n_target_frames_)
@@ -73,6 +77,18 @@ void DynamicDataSet::setRealExample(int t, bool set_inputs, bool set_targets)
   real_current_example_index = t;
 }
 
+void DynamicDataSet::setMinibatch(int *indices, int n)
+{
+  if( !dynamic_inputs || !dynamic_targets )     {
+    GatherMinibatch(data, indices, n, batch_inputs, batch_targets);
+    if( !dynamic_inputs )
+      inputs = data->inputs;
+    if( !dynamic_targets )
+      targets = data->targets;
+  }
+  real_current_example_index = -1;
+}
+
 void DynamicDataSet::preProcess(PreProcessing *pre_processing)
 {
   error("DynamicDataSet: pre-processing not supported");
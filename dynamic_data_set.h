@@ -32,9 +32,18 @@ class DynamicDataSet : public DataSet
     Sequence* dynamic_inputs;
     Sequence* dynamic_targets;
 
+    // Hold the frames of the current minibatch (see setMinibatch).
+    Sequence *batch_inputs;
+    Sequence *batch_targets;
+
     DynamicDataSet(DataSet *data_, Sequence* dynamic_inputs_,
                    Sequence* dynamic_outputs_);
 
+    // Sets the n examples in #indices# at once. The non dynamic inputs and
+    // targets then have one frame per example. The dynamic ones hold as many
+    // frames as the machine they monitor was given.
+    virtual void setMinibatch(int *indices, int n);
+
     virtual void getNumberOfFrames(int t_, int *n_input_frames_, int *n_target_frames_);
     virtual void setRealExample(int t, bool set_inputs=true, bool set_targets=true);
     virtual void preProcess(PreProcessing *pre_processing);
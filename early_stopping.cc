@@ -0,0 +1,108 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "early_stopping.h"
+
+#include <string.h>
+
+namespace Torch {
+
+EarlyStopping::EarlyStopping(Measurer *measurer_, int patience_)
+{
+  measurer = measurer_;
+  patience = patience_;
+  addROption("min improvement", &min_improvement, 0., "decrease of the best error that counts as an improvement");
+
+  n_params = 0;
+  best_params = NULL;
+  best_params_sizes = NULL;
+
+  Reset();
+}
+
+void EarlyStopping::Reset()
+{
+  n_epochs = 0;
+  best_epoch = -1;
+  best_error = 0.;
+  n_bad_epochs = 0;
+}
+
+bool EarlyStopping::Observe(GradientMachine *machine)
+{
+  real err = measurer->current_error;
+  int epoch = n_epochs++;
+  if(best_epoch >= 0 && err >= best_error - min_improvement)    {
+    n_bad_epochs++;
+    return false;
+  }
+
+  best_epoch = epoch;
+  best_error = err;
+  n_bad_epochs = 0;
+
+  // The snapshot is allocated on the first improvement.
+  Parameters *params = machine->params;
+  if(!best_params)      {
+    n_params = params->n_data;
+    best_params = (real**)allocator->alloc(sizeof(real*)*n_params);
+    best_params_sizes = (int*)allocator->alloc(sizeof(int)*n_params);
+    for(int i=0; i<n_params; i++)       {
+      best_params_sizes[i] = params->size[i];
+      best_params[i] = (real*)allocator->alloc(sizeof(real)*params->size[i]);
+    }
+  }
+  if(params->n_data != n_params)
+    error("EarlyStopping: the machine does not have the topology of the snapshot");
+
+  for(int i=0; i<n_params; i++) {
+    if(params->size[i] != best_params_sizes[i])
+      error("EarlyStopping: the machine does not have the topology of the snapshot");
+    memcpy(best_params[i], params->data[i], sizeof(real)*params->size[i]);
+  }
+  return true;
+}
+
+bool EarlyStopping::ShouldStop()
+{
+  return patience > 0 && n_bad_epochs >= patience;
+}
+
+bool EarlyStopping::Restore(GradientMachine *machine)
+{
+  if(best_epoch < 0)
+    return false;
+
+  Parameters *params = machine->params;
+  if(params->n_data != n_params)
+    error("EarlyStopping: the machine does not have the topology of the snapshot");
+  for(int i=0; i<n_params; i++) {
+    if(params->size[i] != best_params_sizes[i])
+      error("EarlyStopping: the machine does not have the topology of the snapshot");
+    memcpy(params->data[i], best_params[i], sizeof(real)*params->size[i]);
+  }
+  return true;
+}
+
+bool EarlyStopping::BestIsNotLast()
+{
+  return best_epoch >= 0 && best_epoch < n_epochs-1;
+}
+
+EarlyStopping::~EarlyStopping()
+{
+}
+
+}
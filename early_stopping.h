@@ -0,0 +1,71 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_EARLY_STOPPING_H_
+#define TORCH_EARLY_STOPPING_H_
+
+#include "GradientMachine.h"
+#include "Measurer.h"
+
+namespace Torch {
+
+// Validation-driven early stopping.
+//
+// Observe() is called after each measure of #measurer# (usually the
+// classification error on the validation set): when its current error is the
+// best so far, the parameters of the machine that was measured are copied
+// into an in-memory snapshot. ShouldStop() becomes true after #patience#
+// epochs without improvement, and Restore() puts the best parameters back.
+//
+// An improvement must lower the best error by more than "min improvement".
+class EarlyStopping : public Object
+{
+  public:
+    Measurer *measurer;
+    int patience;
+    real min_improvement;
+
+    // Measures observed since Reset(), the first one being epoch 0.
+    int n_epochs;
+    int best_epoch;             // -1 before the first observation
+    real best_error;
+    int n_bad_epochs;
+
+    // Snapshot of the parameters of best_epoch
+    int n_params;
+    real **best_params;
+    int *best_params_sizes;
+
+    EarlyStopping(Measurer *measurer_, int patience_);
+
+    // Forgets the observations, before a training.
+    virtual void Reset();
+    // Observes the current error of the measurer, which measured #machine#.
+    // Returns true if it is the best one so far.
+    virtual bool Observe(GradientMachine *machine);
+    bool ShouldStop();
+    // Copies the best parameters into #machine#, which must have the
+    // topology of the observed one. Returns false if nothing was observed.
+    virtual bool Restore(GradientMachine *machine);
+    // True if the best parameters are not those of the last observation.
+    // Only the parameters are restored: the state of the optimizer is still
+    // the one of the last epoch.
+    bool BestIsNotLast();
+
+    virtual ~EarlyStopping();
+};
+
+}
+
+#endif  // TORCH_EARLY_STOPPING_H_
@@ -0,0 +1,226 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "fast_math.h"
+
+// The array functions work on 8 values at a time with the GCC vector
+// extensions, and are built for AVX-512, AVX2 and the baseline. The loader
+// picks the best version for the CPU.
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define FAST_MATH_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#define FAST_MATH_INLINE inline __attribute__((always_inline))
+#else
+#define FAST_MATH_CLONES
+#define FAST_MATH_INLINE inline
+#endif
+
+// The 8-wide helpers are always inlined (in each clone). They take their
+// vectors by reference: GCC notes the ABI change of 64-byte vectors passed
+// by value even for inlined functions, and -Wpsabi does not silence it.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+namespace Torch {
+
+static bool fast_math_default = false;
+
+void SetFastMathDefault(bool fast_math)
+{
+  fast_math_default = fast_math;
+}
+
+bool GetFastMathDefault()
+{
+  return fast_math_default;
+}
+
+// --- 8-wide versions of the functions in fast_math.h ---
+// Same computations, with the selects done on vectors. The compiler cannot
+// vectorize the scalar versions itself (it turns the clamps into branches).
+
+typedef double v8df __attribute__((vector_size(64)));
+typedef long long v8di __attribute__((vector_size(64)));
+typedef real v8real __attribute__((vector_size(8*sizeof(real))));
+
+static FAST_MATH_INLINE v8df Splat(double a)
+{
+  v8df v = {a, a, a, a, a, a, a, a};
+  return v;
+}
+
+static FAST_MATH_INLINE v8di SplatInt(long long a)
+{
+  v8di v = {a, a, a, a, a, a, a, a};
+  return v;
+}
+
+static FAST_MATH_INLINE v8df Load8(const real *p)
+{
+  v8real v;
+  memcpy(&v, p, sizeof(v));
+  return __builtin_convertvector(v, v8df);
+}
+
+static FAST_MATH_INLINE void Store8(real *p, const v8df &v)
+{
+  v8real r = __builtin_convertvector(v, v8real);
+  memcpy(p, &r, sizeof(r));
+}
+
+static FAST_MATH_INLINE v8df Exp8(const v8df &x_in)
+{
+  const double log2e = 1.4426950408889634074;
+  const double ln2_hi = 6.93145751953125e-1;
+  const double ln2_lo = 1.42860682030941723212e-6;
+  const double round_magic = 6755399441055744.0;
+
+  v8df x = x_in < Splat(-708.) ? Splat(-708.) : x_in;
+  x = x > Splat(709.) ? Splat(709.) : x;
+
+  v8df k_magic = x * log2e + round_magic;
+  v8df k = k_magic - round_magic;
+  v8df r = (x - k*ln2_hi) - k*ln2_lo;
+
+  v8df p = Splat(1./3628800.);
+  p = p*r + 1./362880.;
+  p = p*r + 1./40320.;
+  p = p*r + 1./5040.;
+  p = p*r + 1./720.;
+  p = p*r + 1./120.;
+  p = p*r + 1./24.;
+  p = p*r + 1./6.;
+  p = p*r + 0.5;
+  p = p*r + 1.;
+  p = p*r + 1.;
+
+  v8di bits = ((v8di)k_magic + 1023) << 52;
+  return p * (v8df)bits;
+}
+
+static FAST_MATH_INLINE v8df Log8(const v8df &x)
+{
+  const double ln2 = 6.93147180559945309417e-1;
+  const double sqrt2 = 1.41421356237309504880;
+  const long long two_52_bits = 0x4330000000000000LL;
+
+  v8di bits = (v8di)x;
+  // The exponent field, converted to double with the 2^52 trick.
+  v8di e_field = (bits >> 52) & 0x7ff;
+  v8df e = (v8df)(e_field | two_52_bits) - (4503599627370496.0 + 1023.);
+  v8df m = (v8df)((bits & 0x000fffffffffffffLL) | 0x3ff0000000000000LL);
+
+  v8di big = m > Splat(sqrt2);
+  m = big ? m*0.5 : m;
+  e = big ? e + 1. : e;
+
+  v8df s = (m - 1.) / (m + 1.);
+  v8df s2 = s*s;
+  v8df p = Splat(1./11.);
+  p = p*s2 + 1./9.;
+  p = p*s2 + 1./7.;
+  p = p*s2 + 1./5.;
+  p = p*s2 + 1./3.;
+  p = p*s2 + 1.;
+
+  v8df result = e*ln2 + 2.*s*p;
+  result = x == Splat(0.) ? Splat(-HUGE_VAL) : result;
+  result = x == Splat(HUGE_VAL) ? x : result;
+  result = x >= Splat(0.) ? result : Splat(NAN);
+  return result;
+}
+
+static FAST_MATH_INLINE v8df Sigmoid8(const v8df &x)
+{
+  return 1. / (1. + Exp8(-x));
+}
+
+static FAST_MATH_INLINE v8df Tanh8(const v8df &x)
+{
+  return 1. - 2. / (1. + Exp8(2.*x));
+}
+
+static FAST_MATH_INLINE v8df Softsign8(const v8df &x)
+{
+  v8df abs_x = x < Splat(0.) ? -x : x;
+  return 0.5 * (x / (1. + abs_x) + 1.);
+}
+
+// Applies #f# 8 values at a time. The last values go through a padded
+// buffer.
+#define FAST_MATH_MAP(f, n, inputs, outputs)            \
+  do    {                                               \
+    int i_ = 0;                                         \
+    for(; i_+8<=(n); i_+=8)                             \
+      Store8((outputs)+i_, f(Load8((inputs)+i_)));      \
+    if(i_ < (n))        {                               \
+      real tmp_[8];                                     \
+      for(int j_=0; j_<8; j_++)                         \
+        tmp_[j_] = (i_+j_<(n)) ? (inputs)[i_+j_] : 0.5; \
+      Store8(tmp_, f(Load8(tmp_)));                     \
+      for(int j_=0; i_+j_<(n); j_++)                    \
+        (outputs)[i_+j_] = tmp_[j_];                    \
+    }                                                   \
+  } while(0)
+
+FAST_MATH_CLONES
+void FastSigmoidArray(int n, real *inputs, real *outputs)
+{
+  FAST_MATH_MAP(Sigmoid8, n, inputs, outputs);
+}
+
+FAST_MATH_CLONES
+void FastTanhArray(int n, real *inputs, real *outputs)
+{
+  FAST_MATH_MAP(Tanh8, n, inputs, outputs);
+}
+
+FAST_MATH_CLONES
+void FastSoftsignArray(int n, real *inputs, real *outputs)
+{
+  FAST_MATH_MAP(Softsign8, n, inputs, outputs);
+}
+
+FAST_MATH_CLONES
+void FastExpArray(int n, real *inputs, real *outputs)
+{
+  FAST_MATH_MAP(Exp8, n, inputs, outputs);
+}
+
+FAST_MATH_CLONES
+void FastLogArray(int n, real *inputs, real *outputs)
+{
+  FAST_MATH_MAP(Log8, n, inputs, outputs);
+}
+
+FAST_MATH_CLONES
+real FastCrossEntropy(int n, real *targets, real *outputs)
+{
+  v8df sum8 = Splat(0.);
+  int i = 0;
+  for(; i+8<=n; i+=8)   {
+    v8df t = Load8(targets+i);
+    v8df o = Load8(outputs+i);
+    sum8 -= t * Log8(o) + (1.-t) * Log8(1.-o);
+  }
+
+  double sum = 0.;
+  for(int j=0; j<8; j++)
+    sum += sum8[j];
+  for(; i<n; i++)
+    sum -= targets[i] * FastLog(outputs[i]) + (1.-targets[i]) * FastLog(1.-outputs[i]);
+  return sum;
+}
+
+}
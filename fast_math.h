@@ -0,0 +1,153 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_FAST_MATH_H_
+#define TORCH_FAST_MATH_H_
+
+#include <string.h>
+#include <math.h>
+#include "general.h"
+
+namespace Torch {
+
+// Approximations of the transcendental functions used by the nonlinear layers
+// and the cross-entropy criterion/measurer.
+//
+// They are branch-free (selects only) so the array versions below vectorize.
+// The computations are done in double whatever real is. Maximum errors,
+// measured against libm with benchmarks/fast_math_benchmark:
+//
+//   FastExp      x in [-708, 709]         relative error < 3e-13
+//                                         (clamped outside)
+//   FastLog      x normal, > 0            absolute error < 2e-11
+//                                         (log(0) = -inf, log(x<0) = nan,
+//                                         log(inf) = inf, log(nan) = nan)
+//   FastSigmoid  all x                    absolute error < 1e-13
+//   FastTanh     all x                    absolute error < 2e-13
+//   FastSoftsign all x                    exact up to rounding
+//
+// exp is reduced to x = k*ln(2) + r with |r| <= ln(2)/2, and the Taylor
+// polynomial of degree 10 gives exp(r). log is reduced to x = 2^e * m with m in
+// [sqrt(1/2), sqrt(2)), and log(m) = 2*atanh((m-1)/(m+1)) is summed up to the
+// 11th power.
+//
+// Whether the layers use them is decided by their "fast math" option. The
+// option defaults to the value given to SetFastMathDefault(), so the mains
+// can switch every layer at once before building the machines.
+
+void SetFastMathDefault(bool fast_math);
+bool GetFastMathDefault();
+
+static inline double FastExp(double x)
+{
+  const double log2e = 1.4426950408889634074;
+  const double ln2_hi = 6.93145751953125e-1;
+  const double ln2_lo = 1.42860682030941723212e-6;
+
+  // 1.5*2^52: adding it rounds to the nearest integer, which is then held
+  // in the low bits of the mantissa.
+  const double round_magic = 6755399441055744.0;
+
+  x = x < -708. ? -708. : x;
+  x = x > 709. ? 709. : x;
+
+  double k_magic = x * log2e + round_magic;
+  double k = k_magic - round_magic;
+  double r = (x - k*ln2_hi) - k*ln2_lo;
+
+  // Taylor, up to r^10/10!
+  double p = 1./3628800.;
+  p = p*r + 1./362880.;
+  p = p*r + 1./40320.;
+  p = p*r + 1./5040.;
+  p = p*r + 1./720.;
+  p = p*r + 1./120.;
+  p = p*r + 1./24.;
+  p = p*r + 1./6.;
+  p = p*r + 0.5;
+  p = p*r + 1.;
+  p = p*r + 1.;
+
+  // 2^k
+  long long bits;
+  memcpy(&bits, &k_magic, sizeof(double));
+  bits = (bits + 1023) << 52;
+  double two_k;
+  memcpy(&two_k, &bits, sizeof(double));
+
+  return p * two_k;
+}
+
+static inline double FastLog(double x)
+{
+  const double ln2 = 6.93147180559945309417e-1;
+  const double sqrt2 = 1.41421356237309504880;
+
+  long long bits;
+  memcpy(&bits, &x, sizeof(double));
+  double e = (double)(((bits >> 52) & 0x7ff) - 1023);
+  bits = (bits & 0x000fffffffffffffLL) | 0x3ff0000000000000LL;
+  double m;
+  memcpy(&m, &bits, sizeof(double));
+
+  bool big = m > sqrt2;
+  m = big ? 0.5*m : m;
+  e = big ? e + 1. : e;
+
+  double s = (m - 1.) / (m + 1.);
+  double s2 = s*s;
+  double p = 1./11.;
+  p = p*s2 + 1./9.;
+  p = p*s2 + 1./7.;
+  p = p*s2 + 1./5.;
+  p = p*s2 + 1./3.;
+  p = p*s2 + 1.;
+
+  double result = e*ln2 + 2.*s*p;
+  result = x == 0. ? -HUGE_VAL : result;
+  result = x == HUGE_VAL ? x : result;
+  result = x >= 0. ? result : NAN;
+  return result;
+}
+
+static inline double FastSigmoid(double x)
+{
+  return 1. / (1. + FastExp(-x));
+}
+
+static inline double FastTanh(double x)
+{
+  return 1. - 2. / (1. + FastExp(2.*x));
+}
+
+// The Nonlinear layer's function.
+static inline double FastSoftsign(double x)
+{
+  return 0.5 * (x / (1. + fabs(x)) + 1.);
+}
+
+// Array versions: outputs[i] = f(inputs[i]). inputs and outputs may be the
+// same array.
+void FastSigmoidArray(int n, real *inputs, real *outputs);
+void FastTanhArray(int n, real *inputs, real *outputs);
+void FastSoftsignArray(int n, real *inputs, real *outputs);
+void FastExpArray(int n, real *inputs, real *outputs);
+void FastLogArray(int n, real *inputs, real *outputs);
+
+// Returns - sum_i targets[i] * log(outputs[i]) + (1-targets[i]) * log(1-outputs[i])
+real FastCrossEntropy(int n, real *targets, real *outputs);
+
+}
+
+#endif  // TORCH_FAST_MATH_H_
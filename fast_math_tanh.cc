@@ -0,0 +1,37 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "fast_math_tanh.h"
+#include "fast_math.h"
+
+namespace Torch {
+
+FastMathTanh::FastMathTanh(int n_units) : Tanh(n_units)
+{
+  addBOption("fast math", &fast_math, GetFastMathDefault(), "use the fast_math approximation");
+}
+
+void FastMathTanh::frameForward(int t, real *f_inputs, real *f_outputs)
+{
+  if(fast_math)
+    FastTanhArray(n_inputs, f_inputs, f_outputs);
+  else
+    Tanh::frameForward(t, f_inputs, f_outputs);
+}
+
+FastMathTanh::~FastMathTanh()
+{
+}
+
+}
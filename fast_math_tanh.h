@@ -0,0 +1,41 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_FAST_MATH_TANH_H_
+#define TORCH_FAST_MATH_TANH_H_
+
+#include "Tanh.h"
+
+namespace Torch {
+
+// A Tanh layer that, when its "fast math" option is set, uses the vectorized
+// approximation of fast_math.h instead of libm. The option defaults to
+// GetFastMathDefault(). The derivative is computed from the outputs, as in
+// Tanh.
+class FastMathTanh : public Tanh
+{
+  public:
+    bool fast_math;
+
+    FastMathTanh(int n_units);
+
+    //-----
+    virtual void frameForward(int t, real *f_inputs, real *f_outputs);
+
+    virtual ~FastMathTanh();
+};
+
+}
+
+#endif  // TORCH_FAST_MATH_TANH_H_
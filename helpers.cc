@@ -17,8 +17,11 @@
 #include <sstream>
 #include <iostream>
 #include <fstream>
+#include <pthread.h>
 #include "Linear.h"
 #include "MemoryXFile.h"
+#include "MatDataSet.h"
+#include "mapped_data_set.h"
 
 namespace Torch {
 
@@ -47,107 +50,130 @@ void AddClassificationMeasurers(Allocator* allocator, std::string expdir,
   XFile* tfile_mentor_test_class; 
 
   // train
-  ss.str("");
-  ss.clear();
-  //ss << expdir << machine->name << "_train_nll.txt";
-  ss << expdir << "train_nll.txt";
-  if (disk_results) {
-    DiskXFile *file_mentor_train_nll = new(allocator) DiskXFile(ss.str().c_str(),"w");
-    tfile_mentor_train_nll = file_mentor_train_nll;
-  }
-  else  {
-    MemoryXFile *file_mentor_train_nll = new(allocator) MemoryXFile();
-    tfile_mentor_train_nll = file_mentor_train_nll;
-  }
+  if(train)  {
+    ss.str("");
+    ss.clear();
+    //ss << expdir << machine->name << "_train_nll.txt";
+    ss << expdir << "train_nll.txt";
+    if (disk_results) {
+      DiskXFile *file_mentor_train_nll = new(allocator) DiskXFile(ss.str().c_str(),"w");
+      tfile_mentor_train_nll = file_mentor_train_nll;
+    }
+    else  {
+      MemoryXFile *file_mentor_train_nll = new(allocator) MemoryXFile();
+      tfile_mentor_train_nll = file_mentor_train_nll;
+    }
 
-  ClassNLLMeasurer *measurer_mentor_train_nll = new(allocator) ClassNLLMeasurer(machine->outputs, train,
-                                                                             class_format, tfile_mentor_train_nll);
-  measurers->addNode(measurer_mentor_train_nll);
-  ss.str("");
-  ss.clear();
-  //ss << expdir << machine->name << "_train_class.txt";
-  ss << expdir << "train_class.txt";
-  if (disk_results) {
-    DiskXFile *file_mentor_train_class = new(allocator) DiskXFile(ss.str().c_str(),"w");
-    tfile_mentor_train_class = file_mentor_train_class;
-  }
-  else {
-    MemoryXFile *file_mentor_train_class = new(allocator) MemoryXFile();
-    tfile_mentor_train_class = file_mentor_train_class;
-  }
+    ClassNLLMeasurer *measurer_mentor_train_nll = new(allocator) ClassNLLMeasurer(machine->outputs, train,
+                                                                               class_format, tfile_mentor_train_nll);
+    // With minibatches, a frame is an example: the sum over the frames is
+    // the sum over the examples, as for the unsup measurers.
+    measurer_mentor_train_nll->setBOption("average frames", false);
+    measurers->addNode(measurer_mentor_train_nll);
+    ss.str("");
+    ss.clear();
+    //ss << expdir << machine->name << "_train_class.txt";
+    ss << expdir << "train_class.txt";
+    if (disk_results) {
+      DiskXFile *file_mentor_train_class = new(allocator) DiskXFile(ss.str().c_str(),"w");
+      tfile_mentor_train_class = file_mentor_train_class;
+    }
+    else {
+      MemoryXFile *file_mentor_train_class = new(allocator) MemoryXFile();
+      tfile_mentor_train_class = file_mentor_train_class;
+    }
 
-  ClassMeasurer *measurer_mentor_train_class = new(allocator) ClassMeasurer(machine->outputs, train,
-                                                                         class_format, tfile_mentor_train_class);
-  measurers->addNode(measurer_mentor_train_class);
+    ClassMeasurer *measurer_mentor_train_class = new(allocator) ClassMeasurer(machine->outputs, train,
+                                                                           class_format, tfile_mentor_train_class);
+    measurers->addNode(measurer_mentor_train_class);
+  }
   // valid
-  ss.str("");
-  ss.clear();
-  //ss << expdir << machine->name << "_valid_nll.txt";
-  ss << expdir << "valid_nll.txt";
+  if(valid)  {
+    ss.str("");
+    ss.clear();
+    //ss << expdir << machine->name << "_valid_nll.txt";
+    ss << expdir << "valid_nll.txt";
 
-  if (disk_results) {
-    DiskXFile *file_mentor_valid_nll = new(allocator) DiskXFile(ss.str().c_str(),"w");
-    tfile_mentor_valid_nll = file_mentor_valid_nll;
-  }
-  else {
-    MemoryXFile *file_mentor_valid_nll = new(allocator) MemoryXFile();
-    tfile_mentor_valid_nll = file_mentor_valid_nll;
-  }
+    if (disk_results) {
+      DiskXFile *file_mentor_valid_nll = new(allocator) DiskXFile(ss.str().c_str(),"w");
+      tfile_mentor_valid_nll = file_mentor_valid_nll;
+    }
+    else {
+      MemoryXFile *file_mentor_valid_nll = new(allocator) MemoryXFile();
+      tfile_mentor_valid_nll = file_mentor_valid_nll;
+    }
 
-  ClassNLLMeasurer *measurer_mentor_valid_nll = new(allocator) ClassNLLMeasurer(machine->outputs, valid,
-                                                                             class_format, tfile_mentor_valid_nll);
-  measurers->addNode(measurer_mentor_valid_nll);
-  ss.str("");
-  ss.clear();
-  //ss << expdir << machine->name << "_valid_class.txt";
-  ss << expdir << "valid_class.txt";
+    ClassNLLMeasurer *measurer_mentor_valid_nll = new(allocator) ClassNLLMeasurer(machine->outputs, valid,
+                                                                               class_format, tfile_mentor_valid_nll);
+    measurers->addNode(measurer_mentor_valid_nll);
+    ss.str("");
+    ss.clear();
+    //ss << expdir << machine->name << "_valid_class.txt";
+    ss << expdir << "valid_class.txt";
 
-  if (disk_results) {
-    DiskXFile *file_mentor_valid_class = new(allocator) DiskXFile(ss.str().c_str(),"w");
-    tfile_mentor_valid_class = file_mentor_valid_class;
-  }
-  else {
-    MemoryXFile  *file_mentor_valid_class = new(allocator) MemoryXFile();
-    tfile_mentor_valid_class = file_mentor_valid_class;
-  }
+    if (disk_results) {
+      DiskXFile *file_mentor_valid_class = new(allocator) DiskXFile(ss.str().c_str(),"w");
+      tfile_mentor_valid_class = file_mentor_valid_class;
+    }
+    else {
+      MemoryXFile  *file_mentor_valid_class = new(allocator) MemoryXFile();
+      tfile_mentor_valid_class = file_mentor_valid_class;
+    }
 
-  ClassMeasurer *measurer_mentor_valid_class = new(allocator) ClassMeasurer(machine->outputs, valid,
-                                                                         class_format, tfile_mentor_valid_class);
-  measurers->addNode(measurer_mentor_valid_class);
-  // test
-  ss.str("");
-  ss.clear();
-  //ss << expdir << machine->name << "_test_nll.txt";
-  ss << expdir << "test_nll.txt";
-  if (disk_results) {
-    DiskXFile *file_mentor_test_nll = new(allocator) DiskXFile(ss.str().c_str(),"w");
-    tfile_mentor_test_nll = file_mentor_test_nll;
-  }
-  else {
-    MemoryXFile  *file_mentor_test_nll  = new(allocator)  MemoryXFile();
-    tfile_mentor_test_nll = file_mentor_test_nll;
+    ClassMeasurer *measurer_mentor_valid_class = new(allocator) ClassMeasurer(machine->outputs, valid,
+                                                                           class_format, tfile_mentor_valid_class);
+    measurers->addNode(measurer_mentor_valid_class);
   }
+  // test
+  if(test)  {
+    ss.str("");
+    ss.clear();
+    //ss << expdir << machine->name << "_test_nll.txt";
+    ss << expdir << "test_nll.txt";
+    if (disk_results) {
+      DiskXFile *file_mentor_test_nll = new(allocator) DiskXFile(ss.str().c_str(),"w");
+      tfile_mentor_test_nll = file_mentor_test_nll;
+    }
+    else {
+      MemoryXFile  *file_mentor_test_nll  = new(allocator)  MemoryXFile();
+      tfile_mentor_test_nll = file_mentor_test_nll;
+    }
 
-  ClassNLLMeasurer *measurer_mentor_test_nll = new(allocator) ClassNLLMeasurer(machine->outputs, test,
-                                                                             class_format, tfile_mentor_test_nll);
-  measurers->addNode(measurer_mentor_test_nll);
-  ss.str("");
-  ss.clear();
-  //ss << expdir << machine->name << "_test_class.txt";
-  ss << expdir << "test_class.txt";
+    ClassNLLMeasurer *measurer_mentor_test_nll = new(allocator) ClassNLLMeasurer(machine->outputs, test,
+                                                                               class_format, tfile_mentor_test_nll);
+    measurers->addNode(measurer_mentor_test_nll);
+    ss.str("");
+    ss.clear();
+    //ss << expdir << machine->name << "_test_class.txt";
+    ss << expdir << "test_class.txt";
   
-  if (disk_results) {
-    DiskXFile *file_mentor_test_class = new(allocator) DiskXFile(ss.str().c_str(),"w");
-    tfile_mentor_test_class = file_mentor_test_class;
-  }
-  else {
-    MemoryXFile  *file_mentor_test_class = new(allocator) MemoryXFile();
-    tfile_mentor_test_class = file_mentor_test_class;
+    if (disk_results) {
+      DiskXFile *file_mentor_test_class = new(allocator) DiskXFile(ss.str().c_str(),"w");
+      tfile_mentor_test_class = file_mentor_test_class;
+    }
+    else {
+      MemoryXFile  *file_mentor_test_class = new(allocator) MemoryXFile();
+      tfile_mentor_test_class = file_mentor_test_class;
+    }
+
+    ClassMeasurer *measurer_mentor_test_class = new(allocator) ClassMeasurer(machine->outputs, test,
+                                                                           class_format, tfile_mentor_test_class);
+    measurers->addNode(measurer_mentor_test_class);
   }
+}
 
-  ClassMeasurer *measurer_mentor_test_class = new(allocator) ClassMeasurer(machine->outputs, test,
-                                                                         class_format, tfile_mentor_test_class);
-  measurers->addNode(measurer_mentor_test_class);
+Measurer* FindClassificationMeasurer(MeasurerList *measurers, DataSet *data, bool nll)
+{
+  // AddClassificationMeasurers adds the nll measurer of a DataSet first.
+  int n_found = 0;
+  for(int i=0; i<measurers->n_nodes; i++)       {
+    if(measurers->nodes[i]->data != data)
+      continue;
+    if(n_found == (nll ? 0 : 1))
+      return measurers->nodes[i];
+    n_found++;
+  }
+  return NULL;
 }
 
 
@@ -164,13 +190,21 @@ Criterion* NewUnsupCriterion(Allocator* allocator, std::string recons_cost, int
 }
 
 
+// Examples have a single frame, so we don't average over frames: with
+// minibatches, a frame is an example and the measurers get a whole minibatch
+// at once.
 Measurer* NewUnsupMeasurer(Allocator* allocator, std::string recons_cost,
                            Sequence *inputs_, DataSet *data_, XFile *file_)
 {
+  Measurer *measurer = NULL;
   if(recons_cost=="xentropy")   {
-    return new(allocator) CrossEntropyMeasurer(inputs_, data_, file_);
+    measurer = new(allocator) CrossEntropyMeasurer(inputs_, data_, file_);
+    measurer->setBOption("average frames", false);
+    return measurer;
   }     else if(recons_cost=="mse")     {
-    return new(allocator) MSEMeasurer(inputs_, data_, file_);
+    measurer = new(allocator) MSEMeasurer(inputs_, data_, file_);
+    measurer->setBOption("average frames", false);
+    return measurer;
   }     else    {
     error("%s is not a valid reconstruction measurer!", recons_cost.c_str());
     return NULL;
@@ -389,13 +423,74 @@ Coder* LoadCoder(Allocator* allocator, std::string filename)
 }
 
 
+Optimizer* BuildOptimizer(Allocator* allocator, std::string name, real momentum,
+                          real rho, real beta1, real beta2, real epsilon)
+{
+  if(name == "sgd")
+    return NULL;
+
+  Optimizer *optimizer = NewOptimizer(allocator, name);
+  if(name == "momentum" || name == "nesterov")  {
+    optimizer->setROption("momentum", momentum);
+  }     else if(name == "rmsprop")      {
+    optimizer->setROption("rho", rho);
+    optimizer->setROption("epsilon", epsilon);
+  }     else if(name == "adam")         {
+    optimizer->setROption("beta1", beta1);
+    optimizer->setROption("beta2", beta2);
+    optimizer->setROption("epsilon", epsilon);
+  }     else    {
+    optimizer->setROption("epsilon", epsilon);
+  }
+  return optimizer;
+}
+
+TaskPool* BuildTaskPool(Allocator* allocator, int n_threads, std::string placement)
+{
+  int placement_;
+  if(placement == "none")
+    placement_ = TASK_POOL_UNPINNED;
+  else if(placement == "compact")
+    placement_ = TASK_POOL_COMPACT;
+  else if(placement == "scatter")
+    placement_ = TASK_POOL_SCATTER;
+  else
+    error("BuildTaskPool(...) - unknown thread placement %s", placement.c_str());
+
+  if(n_threads <= 1)
+    return NULL;
+  return new(allocator) TaskPool(n_threads, placement_);
+}
+
+DataSet* LoadDataSet(Allocator* allocator, std::string format, const char *filename,
+                     int n_inputs, int max_load, bool binary_mode)
+{
+  if(format == "mat")
+    return new(allocator) MatDataSet(filename, n_inputs, 1, false, max_load, binary_mode);
+  else if(format == "mapped")
+    return new(allocator) MappedDataSet(filename, n_inputs, max_load);
+  error("LoadDataSet(...) - unknown data format %s", format.c_str());
+  return NULL;
+}
+
 void SaveCSAE(std::string expdir, std::string type, int n_layers, int n_inputs, int *units_per_hidden_layer, int *units_per_speech_layer,
               int n_classes,
               bool tied_weights, std::string nonlinearity, std::string recons_cost,
               real corrupt_prob, real corrupt_value,
-              CommunicatingStackedAutoencoder *csae)
+              CommunicatingStackedAutoencoder *csae, Optimizer *optimizer)
 {
   std::string model_filename = expdir + type + "model.save";
+  SaveCSAEFile(model_filename, n_layers, n_inputs, units_per_hidden_layer, units_per_speech_layer,
+               n_classes, tied_weights, nonlinearity, recons_cost, corrupt_prob, corrupt_value,
+               csae, optimizer);
+}
+
+void SaveCSAEFile(std::string model_filename, int n_layers, int n_inputs, int *units_per_hidden_layer, int *units_per_speech_layer,
+                  int n_classes,
+                  bool tied_weights, std::string nonlinearity, std::string recons_cost,
+                  real corrupt_prob, real corrupt_value,
+                  CommunicatingStackedAutoencoder *csae, Optimizer *optimizer)
+{
   DiskXFile model_(model_filename.c_str(), "w");
 
   // save whar's necessary to rebuilding the architecture
@@ -436,9 +531,12 @@ void SaveCSAE(std::string expdir, std::string type, int n_layers, int n_inputs,
   model_.taggedWrite(&corrupt_prob, sizeof(real), 1, "corrupt_prob");
   model_.taggedWrite(&corrupt_value, sizeof(real), 1, "corrupt_value");
   csae->saveXFile(&model_);
+  if(optimizer)
+    optimizer->SaveState(&model_, csae->params);
 }
 
-CommunicatingStackedAutoencoder* LoadCSAE(Allocator* allocator, std::string filename)
+CommunicatingStackedAutoencoder* LoadCSAE(Allocator* allocator, std::string filename,
+                                          Optimizer *optimizer)
 {
   int n_layers;
   int n_inputs;
@@ -533,10 +631,49 @@ CommunicatingStackedAutoencoder* LoadCSAE(Allocator* allocator, std::string file
               is_noisy, false, units_per_speech_layer,  communication_type, n_communication_layers);
 
   csae->loadXFile(m);
+  if(optimizer)
+    optimizer->LoadState(m, csae->params);
 
   return csae;
 }
 
+void LoadCSAEParameters(std::string filename, CommunicatingStackedAutoencoder *csae,
+                        Optimizer *optimizer)
+{
+  DiskXFile m(filename.c_str(), "r");
+
+  // Only the sizes are checked. See SaveCSAEFile for the rest of the header.
+  int n_inputs;
+  int n_classes;
+  int n_layers;
+  m.taggedRead(&n_inputs, sizeof(int), 1, "n_inputs");
+  m.taggedRead(&n_classes, sizeof(int), 1, "n_classes");
+  m.taggedRead(&n_layers, sizeof(int), 1, "n_layers");
+  if(n_inputs != csae->n_inputs || n_classes != csae->n_outputs || n_layers != csae->n_hidden_layers)
+    error("LoadCSAEParameters - %s does not have the topology of the model", filename.c_str());
+
+  int *units = (int*)malloc(sizeof(int)*n_layers);
+  m.taggedRead(units, sizeof(int), n_layers, "units_per_hidden_layer");
+  m.taggedRead(units, sizeof(int), n_layers, "units_per_speech_layer");
+  free(units);
+
+  bool flag;
+  int integer;
+  real value;
+  m.taggedRead(&flag, sizeof(bool), 1, "tied_weights");
+  m.taggedRead(&flag, sizeof(bool), 1, "reparametrize_tied");
+  m.taggedRead(&integer, sizeof(int), 1, "communication_type");
+  m.taggedRead(&integer, sizeof(int), 1, "n_communication_layers");
+  m.taggedRead(&integer, sizeof(int), 1, "nonlinearity: 0 tanh, 1 sigmoid, 2 nonlinear");
+  m.taggedRead(&integer, sizeof(int), 1, "recons_cost: 0 xentropy, 1 tanh");
+  m.taggedRead(&value, sizeof(real), 1, "corrupt_prob");
+  m.taggedRead(&value, sizeof(real), 1, "corrupt_value");
+
+  csae->loadXFile(&m);
+  if(optimizer)
+    optimizer->LoadState(&m, csae->params);
+}
+
 void saveWeightMatrix(std::string filename, Coder* the_coder, bool is_transposed)
 {
   // find the first linear machine
@@ -721,23 +858,63 @@ void saveRepresentations(CommunicatingStackedAutoencoder* csae, std::string dir,
 
 }
 
+// Setting the example of DataSets that wrap the same data is not thread
+// safe (see StochasticGradientPlus::SetMinibatch).
+static pthread_mutex_t save_outputs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+struct SaveOutputsSection
+{
+  TaskPool *pool;
+  CommunicatingStackedAutoencoder *csae;
+  DataSet *data;
+  CommunicatingStackedAutoencoder **replicas;
+  DataSet **replica_data;
+  int n_outputs;
+  real *outputs;
+};
+
+static void ForwardOutputs(void *arg, int begin, int end)
+{
+  SaveOutputsSection *section = (SaveOutputsSection*)arg;
+  int slot = (section->pool ? section->pool->Slot() : 0);
+  CommunicatingStackedAutoencoder *csae = (slot == 0 ? section->csae : section->replicas[slot-1]);
+  DataSet *data = (slot == 0 ? section->data : section->replica_data[slot-1]);
+
+  for (int i=begin; i<end; i++) {
+    pthread_mutex_lock(&save_outputs_mutex);
+    data->setExample(i);
+    pthread_mutex_unlock(&save_outputs_mutex);
+    csae->forward(data->inputs);
+
+    memcpy(section->outputs + (long)i*section->n_outputs, csae->outputs->frames[0],
+           sizeof(real)*section->n_outputs);
+  }
+}
+
 void saveOutputs(CommunicatingStackedAutoencoder* csae, DataSet *data, int n_outputs,
-                std::string dir, std::string data_label)
+                std::string dir, std::string data_label, TaskPool *pool,
+                CommunicatingStackedAutoencoder **replicas, DataSet **replica_data)
 {
 
   csae->setDataSet(data);
-  std::stringstream ss_outputs;
-
-  // Iterate over the data, putting the outputs in a stringstream
-  for (int i=0; i<data->n_examples; i++)  {
+  if(pool)      {
+    for (int k=0; k<pool->n_threads-1; k++)     {
+      replicas[k]->params->copy(csae->params);
+      replicas[k]->setDataSet(replica_data[k]);
+    }
+  }
 
-    data->setExample(i);
-    csae->forward(data->inputs);
+  // Forward the data, then put the outputs in a stringstream
+  SaveOutputsSection section = {pool, csae, data, replicas, replica_data, n_outputs, NULL};
+  section.outputs = (real*)Allocator::sysAlloc(sizeof(real)*(long)data->n_examples*n_outputs);
+  ParallelFor(pool, data->n_examples, 64, ForwardOutputs, &section);
 
+  std::stringstream ss_outputs;
+  for (int i=0; i<data->n_examples; i++)  {
     for (int j=0; j<n_outputs; j++)
-      ss_outputs << csae->outputs->frames[0][j] << " ";
-
+      ss_outputs << section.outputs[(long)i*n_outputs+j] << " ";
   }
+  free(section.outputs);
 
   // Save the outputs to a file
   std::ofstream fd_outputs;
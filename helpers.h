@@ -34,6 +34,8 @@
 #include "cross_entropy_measurer.h"
 #include "communicating_sae_pair_trainer.h"
 #include "binner.h"
+#include "optimizer.h"
+#include "task_pool.h"
 
 namespace Torch {
 
@@ -42,11 +44,17 @@ namespace Torch {
 DiskXFile* InitResultsFile(Allocator* allocator,std::string expdir, std::string type);
 
 
+// Adds the nll and classification measurers of #machine# on #train#, #valid#
+// and #test#, in that order. A NULL DataSet gets no measurers.
 void AddClassificationMeasurers(Allocator* allocator, std::string expdir,
                                 MeasurerList *measurers, Machine *machine,
                                 DataSet *train, DataSet *valid, DataSet *test,
                                 ClassFormat *class_format, bool disk_results);
 
+// The nll (or classification) measurer that AddClassificationMeasurers added
+// to #measurers# for #data#, or NULL.
+Measurer* FindClassificationMeasurer(MeasurerList *measurers, DataSet *data, bool nll);
+
 Criterion* NewUnsupCriterion(Allocator* allocator, std::string recons_cost, int size);
 Measurer* NewUnsupMeasurer(Allocator* allocator, std::string recons_cost,
                            Sequence *inputs_, DataSet *data_, XFile *file_);
@@ -91,6 +99,21 @@ void BuildSaeComContentDatasetsCriteriaMeasurers(Allocator *allocator,
                                           int n_communication_layers);
 
 
+// The optimizer #name# (see NewOptimizer) with the hyper-parameters that
+// apply to it, or NULL for plain SGD, which the trainers do themselves.
+Optimizer* BuildOptimizer(Allocator* allocator, std::string name, real momentum,
+                          real rho, real beta1, real beta2, real epsilon);
+
+// A TaskPool of #n_threads# threads placed as #placement# says ("none",
+// "compact" or "scatter", see TaskPoolPlacement), NULL if n_threads <= 1.
+TaskPool* BuildTaskPool(Allocator* allocator, int n_threads, std::string placement);
+
+// The examples of #filename#, with 1 target (the label), as #format# says:
+// "mat" for a MatDataSet file (text, or binary if #binary_mode#), "mapped"
+// for a mapped data set file (see MappedDataSet).
+DataSet* LoadDataSet(Allocator* allocator, std::string format, const char *filename,
+                     int n_inputs, int max_load, bool binary_mode);
+
 void SaveCoder(std::string expdir, std::string filename, Coder *coder);
 Coder* LoadCoder(Allocator* allocator, std::string filename);
 
@@ -98,15 +121,31 @@ void SaveCSAE(std::string expdir, std::string type, int n_layers, int n_inputs,
               int n_classes,
               bool tied_weights, std::string nonlinearity, std::string recons_cost,
               real corrupt_prob, real corrupt_value,
-              CommunicatingStackedAutoencoder *csae);
-
-CommunicatingStackedAutoencoder* LoadCSAE(Allocator* allocator, std::string filename);
+              CommunicatingStackedAutoencoder *csae, Optimizer *optimizer=NULL);
+// SaveCSAE to #model_filename#.
+void SaveCSAEFile(std::string model_filename, int n_layers, int n_inputs, int *units_per_hidden_layer, int *units_per_speech_layer,
+                  int n_classes,
+                  bool tied_weights, std::string nonlinearity, std::string recons_cost,
+                  real corrupt_prob, real corrupt_value,
+                  CommunicatingStackedAutoencoder *csae, Optimizer *optimizer=NULL);
+
+// With an #optimizer#, its state is saved after the model (and loaded).
+CommunicatingStackedAutoencoder* LoadCSAE(Allocator* allocator, std::string filename,
+                                          Optimizer *optimizer=NULL);
+// Loads the parameters saved by SaveCSAE into #csae#, which must have the
+// same architecture.
+void LoadCSAEParameters(std::string filename, CommunicatingStackedAutoencoder *csae,
+                        Optimizer *optimizer=NULL);
 
 void saveWeightMatrices(CommunicatingStackedAutoencoder* csae, std::string dir, bool is_transposed);
 void saveRepresentations(CommunicatingStackedAutoencoder* csae, std::string dir,
                          DataSet *data, int n_examples);
+// With a #pool#, the examples are forwarded by its threads, slot k>0 with
+// replicas[k-1] (same architecture, parameters copied from the csae's) set on
+// replica_data[k-1] (a copy of the data). The file is the same.
 void saveOutputs(CommunicatingStackedAutoencoder* csae, DataSet *data, int n_outputs,
-                std::string dir, std::string data_label);
+                std::string dir, std::string data_label, TaskPool *pool=NULL,
+                CommunicatingStackedAutoencoder **replicas=NULL, DataSet **replica_data=NULL);
 
 void LoadBinners(Allocator* allocator, char* flag_binners_location, CommunicatingStackedAutoencoder *csae, Binner **w_binners, Binner **b_binners);
 void ReInitCsaeFromBinners(CommunicatingStackedAutoencoder *csae, Binner **w_binners, Binner **b_binners);
@@ -13,6 +13,7 @@
 // limitations under the License.
 //
 #include "input_as_target_data_set.h"
+#include "minibatch.h"
 
 namespace Torch {
 
@@ -20,6 +21,9 @@ InputAsTargetDataSet::InputAsTargetDataSet(DataSet *data_)
 {
   data = data_;
   DataSet::init(data->n_examples, data->n_inputs, data->n_inputs);
+
+  batch_inputs = new(allocator) Sequence(0, data->n_inputs);
+  batch_targets = new(allocator) Sequence(0, data->n_targets);
 }
 
 
@@ -41,6 +45,14 @@ void InputAsTargetDataSet::setRealExample(int t, bool set_inputs, bool set_targe
   real_current_example_index = t;
 }
 
+void InputAsTargetDataSet::setMinibatch(int *indices, int n)
+{
+  GatherMinibatch(data, indices, n, batch_inputs, batch_targets);
+  inputs = data->inputs;
+  targets = data->inputs;
+  real_current_example_index = -1;
+}
+
 void InputAsTargetDataSet::preProcess(PreProcessing *pre_processing)
 {
   error("InputAsTargetDataSet: pre-processing not supported");
@@ -31,7 +31,16 @@ class InputAsTargetDataSet : public DataSet
     /// The underlying DataSet.
     DataSet *data;
 
+    // Hold the frames of the current minibatch (see setMinibatch).
+    Sequence *batch_inputs;
+    Sequence *batch_targets;
+
     InputAsTargetDataSet(DataSet *data_);
+
+    // Sets the n examples in #indices# at once. Inputs and targets then
+    // have one frame per example. The underlying DataSet's inputs and
+    // targets are set to the minibatch as well.
+    virtual void setMinibatch(int *indices, int n);
     
     virtual void getNumberOfFrames(int t_, int *n_input_frames_, int *n_target_frames_);
     virtual void setRealExample(int t, bool set_inputs=true, bool set_targets=true);
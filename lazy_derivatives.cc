@@ -0,0 +1,120 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "lazy_derivatives.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace Torch {
+
+// Sorted by address. The registry is only changed when machines are built
+// or destroyed, and searched when the trainers find their flags: the
+// searches only take the lock for reading.
+struct LazyDerivatives
+{
+  real *der;
+  bool *flag;
+  int n_users;
+};
+
+static LazyDerivatives *lazy_derivatives = NULL;
+static int n_lazy_derivatives = 0;
+static pthread_rwlock_t lazy_derivatives_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// Index of #der#, or of where it would be inserted.
+static int LazyDerivativesIndex(real *der)
+{
+  int begin = 0;
+  int end = n_lazy_derivatives;
+  while(begin < end)    {
+    int middle = (begin + end) / 2;
+    if(lazy_derivatives[middle].der < der)
+      begin = middle + 1;
+    else
+      end = middle;
+  }
+  return begin;
+}
+
+// The flags themselves are only freed with the last user of the array, so
+// they outlive the lookup.
+static bool *FindLazyDerivativesFlag(real *der)
+{
+  bool *flag = NULL;
+  pthread_rwlock_rdlock(&lazy_derivatives_lock);
+  int i = LazyDerivativesIndex(der);
+  if(i < n_lazy_derivatives && lazy_derivatives[i].der == der)
+    flag = lazy_derivatives[i].flag;
+  pthread_rwlock_unlock(&lazy_derivatives_lock);
+  return flag;
+}
+
+void FindLazyDerivativesFlags(real **ders, int n, bool **flags)
+{
+  pthread_rwlock_rdlock(&lazy_derivatives_lock);
+  for(int k=0; k<n; k++)        {
+    int i = LazyDerivativesIndex(ders[k]);
+    if(i < n_lazy_derivatives && lazy_derivatives[i].der == ders[k])
+      flags[k] = lazy_derivatives[i].flag;
+    else
+      flags[k] = NULL;
+  }
+  pthread_rwlock_unlock(&lazy_derivatives_lock);
+}
+
+bool *LazyDerivativesFlag(real *der)
+{
+  pthread_rwlock_wrlock(&lazy_derivatives_lock);
+  int i = LazyDerivativesIndex(der);
+  if(i == n_lazy_derivatives || lazy_derivatives[i].der != der) {
+    lazy_derivatives = (LazyDerivatives*)realloc(lazy_derivatives, sizeof(LazyDerivatives)*(n_lazy_derivatives+1));
+    memmove(lazy_derivatives+i+1, lazy_derivatives+i, sizeof(LazyDerivatives)*(n_lazy_derivatives-i));
+    lazy_derivatives[i].der = der;
+    lazy_derivatives[i].flag = (bool*)malloc(sizeof(bool));
+    *lazy_derivatives[i].flag = false;
+    lazy_derivatives[i].n_users = 0;
+    n_lazy_derivatives++;
+  }
+  lazy_derivatives[i].n_users++;
+  bool *flag = lazy_derivatives[i].flag;
+  pthread_rwlock_unlock(&lazy_derivatives_lock);
+  return flag;
+}
+
+void ReleaseLazyDerivatives(real *der)
+{
+  pthread_rwlock_wrlock(&lazy_derivatives_lock);
+  int i = LazyDerivativesIndex(der);
+  if(i < n_lazy_derivatives && lazy_derivatives[i].der == der
+     && --lazy_derivatives[i].n_users == 0)     {
+    free(lazy_derivatives[i].flag);
+    memmove(lazy_derivatives+i, lazy_derivatives+i+1, sizeof(LazyDerivatives)*(n_lazy_derivatives-i-1));
+    n_lazy_derivatives--;
+  }
+  pthread_rwlock_unlock(&lazy_derivatives_lock);
+}
+
+void ClearDerivativesLazily(real *der, int n)
+{
+  ClearDerivativesLazily(der, n, FindLazyDerivativesFlag(der));
+}
+
+void SettleDerivatives(real *der, int n)
+{
+  SettleDerivatives(der, n, FindLazyDerivativesFlag(der));
+}
+
+}
@@ -0,0 +1,89 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_LAZY_DERIVATIVES_H_
+#define TORCH_LAZY_DERIVATIVES_H_
+
+#include <string.h>
+#include "general.h"
+
+namespace Torch {
+
+// Derivatives cleared lazily.
+//
+// The trainers clear the derivatives before each gradient computation, and
+// the backwards then add to them. For the wide layers, that clearing is a
+// full extra pass over the derivatives. Instead, a layer can register the
+// derivative arrays it contributes to: clearing one of them only sets its
+// flag, and the next contribution overwrites it instead of adding to it, and
+// resets the flag.
+//
+// Several layers may contribute to the same array (tied weights). They get
+// the same flag, found by the array's address: the first one to contribute
+// overwrites, the others add.
+//
+// An array may not be contributed to after being cleared: whatever reads
+// derivatives must settle them first (see SettleDerivatives).
+//
+// Layers may register (or release) their arrays while other threads train:
+// the registry is behind a read-write lock. The trainers, which clear the
+// same arrays at every gradient computation, find their flags once (see
+// FindLazyDerivativesFlags) and pass them to the functions below.
+
+// Flag of the derivatives #der#, registered if needed.
+bool *LazyDerivativesFlag(real *der);
+// Unregisters #der# once all the layers that got its flag released it.
+void ReleaseLazyDerivatives(real *der);
+
+// Flags of the #n# arrays #ders# in #flags# (NULL for those not registered),
+// with a single lookup. They stay valid as long as the layers that
+// registered the arrays.
+void FindLazyDerivativesFlags(real **ders, int n, bool **flags);
+
+// Clears the #n# derivatives #der#: sets their flag if they are registered,
+// zeroes them otherwise.
+void ClearDerivativesLazily(real *der, int n);
+// Zeroes the #n# derivatives #der# if they were cleared lazily and have not
+// been contributed to since.
+void SettleDerivatives(real *der, int n);
+
+// For the layers: true if the next contribution to the derivatives of
+// #flag# (which may be NULL) must overwrite them. Resets the flag.
+inline bool OverwriteDerivatives(bool *flag)
+{
+  if(!flag || !*flag)
+    return false;
+  *flag = false;
+  return true;
+}
+
+// The same as above, with the flag of #der# already found (NULL if it is
+// not registered).
+inline void ClearDerivativesLazily(real *der, int n, bool *flag)
+{
+  if(flag)
+    *flag = true;
+  else
+    memset(der, 0, sizeof(real)*n);
+}
+
+inline void SettleDerivatives(real *der, int n, bool *flag)
+{
+  if(OverwriteDerivatives(flag))
+    memset(der, 0, sizeof(real)*n);
+}
+
+}
+
+#endif  // TORCH_LAZY_DERIVATIVES_H_
@@ -22,12 +22,11 @@ This program will train a linear model with a squared error criterion.\n";
 #include <sstream>
 
 #include "Allocator.h"
-#include "Random.h"
+#include "random_streams.h"
 #include "DiskXFile.h"
 #include "CmdLine.h"
 
 #include "MeanVarNorm.h"
-#include "MatDataSet.h"
 #include "ClassFormatDataSet.h"
 #include "OneHotClassFormat.h"
 #include "Measurer.h"
@@ -86,6 +85,7 @@ int main(int argc, char **argv)
   int flag_max_load;
   int flag_max_train_load;
   bool flag_binary_mode;
+  char *flag_data_format;
   bool flag_save_model;
   bool flag_single_results_file;
   bool flag_multiple_results_files;
@@ -123,6 +123,7 @@ int main(int argc, char **argv)
   cmd.addICmdOption("max_load", &flag_max_load, -1, "max number of examples to load for valid and test", true);
   cmd.addICmdOption("max_train_load", &flag_max_train_load, -1, "max number of examples to load for train", true);
   cmd.addBCmdOption("binary_mode", &flag_binary_mode, false, "binary mode for files", true);
+  cmd.addSCmdOption("-data_format", &flag_data_format, "mat", "format of the data files: mat (MatDataSet, see binary_mode) or mapped (see MappedDataSet)", true);
   cmd.addBCmdOption("save_model", &flag_save_model, true, "if true, save the model", true);
   cmd.addBCmdOption("single_results_file", &flag_single_results_file, false, "if true, saves the results into a single file (1 for sup, 1 for unsup, 1 for supunsup)", true);
   cmd.addBCmdOption("multiple_results_files", &flag_multiple_results_files, true, "if true, save results into different files, depending on the cost", true);
@@ -161,24 +162,21 @@ int main(int argc, char **argv)
 
   // To be changed if you want reproducible results for operations that use
   // random numbers BEFORE instantiating the models.
-  if(flag_start_seed == -1)
-    Random::seed();
-  else
-    Random::manualSeed((long)flag_start_seed);
+  SetRandomSeed((long)flag_start_seed);
 
   // === Create the DataSets ===
-  MatDataSet train_matdata(flag_train_data_file, flag_n_inputs,1,false,
-                                 flag_max_train_load, flag_binary_mode);
-  MatDataSet valid_matdata(flag_valid_data_file, flag_n_inputs,1,false,
-                                 flag_max_load, flag_binary_mode);
-  MatDataSet test_matdata(flag_test_data_file, flag_n_inputs,1,false,
-                                flag_max_load, flag_binary_mode);
+  DataSet *train_matdata = LoadDataSet(allocator, flag_data_format, flag_train_data_file, flag_n_inputs,
+                                       flag_max_train_load, flag_binary_mode);
+  DataSet *valid_matdata = LoadDataSet(allocator, flag_data_format, flag_valid_data_file, flag_n_inputs,
+                                       flag_max_load, flag_binary_mode);
+  DataSet *test_matdata = LoadDataSet(allocator, flag_data_format, flag_test_data_file, flag_n_inputs,
+                                      flag_max_load, flag_binary_mode);
   message("Data loaded\n");
   message("Data was loaded as is and was NOT normalized\n");
 
-  ClassFormatDataSet train_data(&train_matdata,flag_n_classes);
-  ClassFormatDataSet valid_data(&valid_matdata,flag_n_classes);
-  ClassFormatDataSet test_data(&test_matdata,flag_n_classes);
+  ClassFormatDataSet train_data(train_matdata,flag_n_classes);
+  ClassFormatDataSet valid_data(valid_matdata,flag_n_classes);
+  ClassFormatDataSet test_data(test_matdata,flag_n_classes);
 
   OneHotClassFormat class_format(&train_data);
 
@@ -186,10 +184,7 @@ int main(int argc, char **argv)
   // === Create the model ===
 
   // Seed before model init. 
-  if(flag_model_seed == -1)
-    Random::seed();
-  else
-    Random::manualSeed((long)flag_model_seed);
+  SetRandomSeed((long)flag_model_seed);
   
   // Last two parameters: communication type and n_communication_layers
   //Coder model(flag_n_inputs, flag_n_classes, false, NULL, false, false, "logsoftmax");
@@ -0,0 +1,71 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+const char *help = "\
+mapped_data_set_converter\n\
+\n\
+This program will convert a MatDataSet file (one label per example)\n\
+to a mapped data set file (see mapped_data_set.h), which the mains\n\
+load with -data_format mapped.\n\
+\n";
+
+#include "CmdLine.h"
+#include "Allocator.h"
+#include "MatDataSet.h"
+#include "mapped_data_set.h"
+
+using namespace Torch;
+
+// ************
+// *** MAIN ***
+// ************
+int main(int argc, char **argv)
+{
+
+  // === The command-line ===
+
+  int flag_n_inputs;
+  char *flag_data_file;
+  char *flag_mapped_file;
+  int flag_max_load;
+  bool flag_binary_mode;
+
+  // Construct the command line
+  CmdLine cmd;
+
+  // Put the help line at the beginning
+  cmd.info(help);
+
+  cmd.addText("\nArguments:");
+
+  cmd.addICmdArg("-n_inputs", &flag_n_inputs, "number of inputs");
+  cmd.addSCmdArg("-data_file", &flag_data_file, "name of the MatDataSet file");
+  cmd.addSCmdArg("-mapped_file", &flag_mapped_file, "name of the mapped data set file to write");
+
+  cmd.addText("\nOptions:");
+  cmd.addICmdOption("max_load", &flag_max_load, -1, "max number of examples to convert", true);
+  cmd.addBCmdOption("binary_mode", &flag_binary_mode, false, "binary mode for files", true);
+
+  // Read the command line
+  cmd.read(argc, argv);
+
+  MatDataSet matdata(flag_data_file, flag_n_inputs, 1, false,
+                     flag_max_load, flag_binary_mode);
+  message("Data loaded\n");
+
+  SaveMappedDataSet(&matdata, flag_mapped_file);
+  message("%d examples written to %s\n", matdata.n_examples, flag_mapped_file);
+
+  return(0);
+}
@@ -36,13 +36,12 @@ communication weights, are fixed during the student's training\n";
 #include <sstream>
 
 #include "Allocator.h"
-#include "Random.h"
+#include "random_streams.h"
 #include "CmdLine.h"
 #include "DiskXFile.h"
 
 #include "MeanVarNorm.h"
 #include "ClassFormatDataSet.h"
-#include "MatDataSet.h"
 #include "OneHotClassFormat.h"
 #include "Measurer.h"
 #include "MSEMeasurer.h"
@@ -59,6 +58,8 @@ communication weights, are fixed during the student's training\n";
 #include "stacked_autoencoder.h"
 #include "communicating_stacked_autoencoder.h"
 #include "stacked_autoencoder_trainer.h"
+#include "fast_math.h"
+#include "task_pool.h"
 #include "communicating_sae_pair_trainer.h"
 #include "helpers.h"
 
@@ -99,10 +100,26 @@ int main(int argc, char **argv)
   int flag_max_iter_ac;
   int flag_max_iter_sc;
   real flag_accuracy;
+  int flag_minibatch_size;
+  int flag_shard_size;
+  bool flag_unfused_coders;
+  bool flag_incremental_noisy;
+  bool flag_fast_math_nonlinearity;
+  int flag_branch_threads;
+  char *flag_thread_placement;
+  bool flag_cache_mentor_targets;
+  bool flag_cache_on_disk;
+  bool flag_mentor_full_backprop;
   real flag_lrate;
   real flag_mentor_lrate;
   real flag_lrate_decay;
   real flag_mentor_lrate_decay;
+  char *flag_lr_optimizer;
+  real flag_lr_momentum;
+  real flag_lr_rho;
+  real flag_lr_beta1;
+  real flag_lr_beta2;
+  real flag_lr_epsilon;
   real flag_l1_decay;
   real flag_l2_decay;
   real flag_bias_decay;
@@ -117,6 +134,7 @@ int main(int argc, char **argv)
   int flag_student_seed;
   int flag_max_load;
   bool flag_binary_mode;
+  char *flag_data_format;
   bool flag_save_model;
   bool flag_single_results_file;
   bool flag_multiple_results_files;
@@ -155,10 +173,26 @@ int main(int argc, char **argv)
   cmd.addICmdOption("-max_iter_ac", &flag_max_iter_ac, 2, "max number of iterations with all the costs", true);
   cmd.addICmdOption("-max_iter_sc", &flag_max_iter_sc, 2, "max number of iterations with only supervised cost", true);
   cmd.addRCmdOption("-accuracy", &flag_accuracy, 1e-5, "end accuracy", true);
+  cmd.addICmdOption("-minibatch_size", &flag_minibatch_size, 1, "number of examples per parameter update (the gradient is averaged)", true);
+  cmd.addICmdOption("-shard_size", &flag_shard_size, 0, "synchronous data parallelism: number of examples per shard of a minibatch, reduced in a fixed order (0 for none)", true);
+  cmd.addBCmdOption("-unfused_coders", &flag_unfused_coders, false, "run the coders' corruption, linear and nonlinear layers separately (debugging)", true);
+  cmd.addBCmdOption("-incremental_noisy", &flag_incremental_noisy, false, "noisy encoders correct the clean encoders' pre-activation on the corrupted units only", true);
+  cmd.addBCmdOption("-fast_math_nonlinearity", &flag_fast_math_nonlinearity, false, "use the fast_math approximations in the nonlinearities and the cross-entropy", true);
+  cmd.addICmdOption("-branch_threads", &flag_branch_threads, 1, "number of threads running the branches hanging off the hidden layers (decoders, outputer, speakers, ...) and their criteria in parallel", true);
+  cmd.addSCmdOption("-thread_placement", &flag_thread_placement, "none", "placement of the threads of the parallel sections: none, compact or scatter (NUMA nodes)", true);
+  cmd.addBCmdOption("-cache_mentor_targets", &flag_cache_mentor_targets, false, "forward the mentor's frozen encoders once and cache their outputs (agreement targets with communication types 0 and 1)", true);
+  cmd.addBCmdOption("-cache_on_disk", &flag_cache_on_disk, false, "keep the mentor target caches in memory-mapped files in the expdir", true);
+  cmd.addBCmdOption("-mentor_full_backprop", &flag_mentor_full_backprop, false, "communication type 2: backprop the whole mentor instead of its communication sub-network", true);
   cmd.addRCmdOption("-lrate", &flag_lrate, 1e-3, "learning rate", true);
   cmd.addRCmdOption("-mentor_lrate", &flag_mentor_lrate, 1e-3, "mentor learning rate", true);
   cmd.addRCmdOption("-lrate_decay", &flag_lrate_decay, 0.0, "learning rate decay", true);
   cmd.addRCmdOption("-mentor_lrate_decay", &flag_mentor_lrate_decay, 0.0, "mentor learning rate decay", true);
+  cmd.addSCmdOption("-lr_optimizer", &flag_lr_optimizer, "sgd", "update rule: sgd, momentum, nesterov, adagrad, rmsprop or adam", true);
+  cmd.addRCmdOption("-lr_momentum", &flag_lr_momentum, 0.9, "momentum of the momentum and nesterov updates", true);
+  cmd.addRCmdOption("-lr_rho", &flag_lr_rho, 0.9, "rmsprop: decay of the average of the squared gradients", true);
+  cmd.addRCmdOption("-lr_beta1", &flag_lr_beta1, 0.9, "adam: decay of the average of the gradients", true);
+  cmd.addRCmdOption("-lr_beta2", &flag_lr_beta2, 0.999, "adam: decay of the average of the squared gradients", true);
+  cmd.addRCmdOption("-lr_epsilon", &flag_lr_epsilon, 1e-6, "adagrad, rmsprop, adam: added to the root of the squared gradients", true);
   cmd.addRCmdOption("-l1_decay", &flag_l1_decay, 0.0, "l1 weight decay", true);
   cmd.addRCmdOption("-l2_decay", &flag_l2_decay, 0.0, "l2 weight decay", true);
   cmd.addRCmdOption("-bias_decay", &flag_bias_decay, 0.0, "bias decay", true);
@@ -174,6 +208,7 @@ int main(int argc, char **argv)
   cmd.addICmdOption("student_seed", &flag_student_seed, 2, "the random seed used just before model initialization (-1 to for random seed)", true);
   cmd.addICmdOption("max_load", &flag_max_load, -1, "max number of examples to load for train", true);
   cmd.addBCmdOption("binary_mode", &flag_binary_mode, false, "binary mode for files", true);
+  cmd.addSCmdOption("-data_format", &flag_data_format, "mat", "format of the data files: mat (MatDataSet, see binary_mode) or mapped (see MappedDataSet)", true);
   cmd.addBCmdOption("save_model", &flag_save_model, true, "if true, save the model", true);
   cmd.addBCmdOption("single_results_file", &flag_single_results_file, false, "if true, saves the results into a single file (1 for sup, 1 for unsup, 1 for supunsup)", true);
   cmd.addBCmdOption("multiple_results_files", &flag_multiple_results_files, true, "if true, save results into different files, depending on the cost", true);
@@ -181,8 +216,14 @@ int main(int argc, char **argv)
   // Read the command line
   cmd.read(argc, argv);
 
+  // Must be set before the machines and criteria are built.
+  SetFastMathDefault(flag_fast_math_nonlinearity);
+
   Allocator *allocator = new Allocator;
 
+  // Also before the machines and criteria are built.
+  SetDefaultTaskPool(BuildTaskPool(allocator, flag_branch_threads, flag_thread_placement));
+
   std::string str_recons_cost = flag_recons_cost;
   std::string str_nonlinearity = flag_nonlinearity;
 
@@ -214,8 +255,14 @@ int main(int argc, char **argv)
      << "-mentor_lr=" << flag_mentor_lrate << "-mentor_dc=" << flag_mentor_lrate_decay
      << "-lr=" << flag_lrate << "-dc=" << flag_lrate_decay << "-l1=" << flag_l1_decay
      << "-l2=" << flag_l2_decay << "-bdk=" << flag_bias_decay << "-uw=" << flag_unsup_weight
-     << "-cAvgFs=" << flag_criter_avg_framesize
-     << "-ss=" << flag_start_seed << "-mens=" << flag_mentor_seed
+     << "-cAvgFs=" << flag_criter_avg_framesize;
+  if (std::string(flag_lr_optimizer) != "sgd")
+    ss << "-opt=" << flag_lr_optimizer;
+  if (flag_minibatch_size > 1)
+    ss << "-mb=" << flag_minibatch_size;
+  if (flag_shard_size > 0)
+    ss << "-shs=" << flag_shard_size;
+  ss << "-ss=" << flag_start_seed << "-mens=" << flag_mentor_seed
      << "-stus=" << flag_student_seed << "/";
   std::string expdir = ss.str();
   
@@ -225,18 +272,15 @@ int main(int argc, char **argv)
     system(command.c_str());
   }
 
-  if(flag_start_seed == -1)
-    Random::seed();
-  else
-    Random::manualSeed((long)flag_start_seed);
+  SetRandomSeed((long)flag_start_seed);
 
   // === Create the DataSet ===
-  MatDataSet train_matdata(flag_train_data_file, flag_n_inputs,1,false,
-                                 flag_max_load, flag_binary_mode);
-  MatDataSet valid_matdata(flag_valid_data_file, flag_n_inputs,1,false,
-                                 flag_max_load, flag_binary_mode);
-  MatDataSet test_matdata(flag_test_data_file, flag_n_inputs,1,false,
-                                flag_max_load, flag_binary_mode);
+  DataSet *train_matdata = LoadDataSet(allocator, flag_data_format, flag_train_data_file, flag_n_inputs,
+                                       flag_max_load, flag_binary_mode);
+  DataSet *valid_matdata = LoadDataSet(allocator, flag_data_format, flag_valid_data_file, flag_n_inputs,
+                                       flag_max_load, flag_binary_mode);
+  DataSet *test_matdata = LoadDataSet(allocator, flag_data_format, flag_test_data_file, flag_n_inputs,
+                                      flag_max_load, flag_binary_mode);
   message("data loaded\n");
 
   //MeanVarNorm mv(&train_matdata,true,false);
@@ -246,9 +290,9 @@ int main(int argc, char **argv)
   //message("data normalized\n");
   message("data is NOT normalized\n");
   
-  ClassFormatDataSet train_data(&train_matdata,flag_n_classes);
-  ClassFormatDataSet valid_data(&valid_matdata,flag_n_classes);
-  ClassFormatDataSet test_data(&test_matdata,flag_n_classes);
+  ClassFormatDataSet train_data(train_matdata,flag_n_classes);
+  ClassFormatDataSet valid_data(valid_matdata,flag_n_classes);
+  ClassFormatDataSet test_data(test_matdata,flag_n_classes);
 
   OneHotClassFormat class_format(&train_data);
 
@@ -264,10 +308,7 @@ int main(int argc, char **argv)
   }
 
   // Seed before veteran init.
-  if(flag_mentor_seed == -1)
-    Random::seed();
-  else
-    Random::manualSeed((long)flag_mentor_seed);
+  SetRandomSeed((long)flag_mentor_seed);
   CommunicatingStackedAutoencoder mentor("mentor", flag_nonlinearity, flag_tied_weights, flag_n_inputs, flag_n_layers,
                                          units_per_hidden_layer, flag_n_classes,
                                          is_noisy, units_per_speech_layer, flag_communication_type,
@@ -277,12 +318,11 @@ int main(int argc, char **argv)
   mentor.setL2WeightDecay(flag_l2_decay);
   mentor.setBiasDecay(flag_bias_decay);
   mentor.setDestructionOptions(flag_corrupt_prob, flag_corrupt_value);
+  mentor.setFusedCoders(!flag_unfused_coders);
+  mentor.setIncrementalNoisyCoders(flag_incremental_noisy);
 
   // Seed before student init.
-  if(flag_student_seed == -1)
-    Random::seed();
-  else
-    Random::manualSeed((long)flag_student_seed);
+  SetRandomSeed((long)flag_student_seed);
   CommunicatingStackedAutoencoder student("student", flag_nonlinearity, flag_tied_weights, flag_n_inputs, flag_n_layers,
                                           units_per_hidden_layer, flag_n_classes,
                                           is_noisy, units_per_speech_layer, flag_communication_type,
@@ -290,6 +330,8 @@ int main(int argc, char **argv)
   student.setL1WeightDecay(flag_l1_decay);
   student.setL2WeightDecay(flag_l2_decay);
   student.setDestructionOptions(flag_corrupt_prob, flag_corrupt_value);
+  student.setFusedCoders(!flag_unfused_coders);
+  student.setIncrementalNoisyCoders(flag_incremental_noisy);
   message("models instanciated.\n");
 
   // === Measurers ===
@@ -410,6 +452,10 @@ int main(int argc, char **argv)
   mentor_trainer.setROption("end accuracy", flag_accuracy);
   mentor_trainer.setROption("learning rate", flag_mentor_lrate);
   mentor_trainer.setROption("learning rate decay", flag_mentor_lrate_decay);
+  mentor_trainer.setIOption("minibatch size", flag_minibatch_size);
+  mentor_trainer.setIOption("shard size", flag_shard_size);
+  mentor_trainer.optimizer = BuildOptimizer(allocator, flag_lr_optimizer, flag_lr_momentum, flag_lr_rho,
+                                            flag_lr_beta1, flag_lr_beta2, flag_lr_epsilon);
 
   DiskXFile* resultsfile = NULL;
 
@@ -482,6 +528,13 @@ int main(int argc, char **argv)
   pair_trainer.setROption("end accuracy", flag_accuracy);
   pair_trainer.setROption("learning rate", flag_lrate);
   pair_trainer.setROption("learning rate decay", flag_lrate_decay);
+  pair_trainer.setIOption("minibatch size", flag_minibatch_size);
+  pair_trainer.setIOption("shard size", flag_shard_size);
+  pair_trainer.setBOption("cache mentor targets", flag_cache_mentor_targets);
+  pair_trainer.setBOption("cache on disk", flag_cache_on_disk);
+  pair_trainer.setBOption("mentor communication only", !flag_mentor_full_backprop);
+  pair_trainer.optimizer = BuildOptimizer(allocator, flag_lr_optimizer, flag_lr_momentum, flag_lr_rho,
+                                          flag_lr_beta1, flag_lr_beta2, flag_lr_epsilon);
     
   if (flag_single_results_file) {
      resultsfile = InitResultsFile(allocator,expdir,"pair");
@@ -502,6 +555,10 @@ int main(int argc, char **argv)
   student_trainer.setROption("end accuracy", flag_accuracy);
   student_trainer.setROption("learning rate", flag_lrate);
   student_trainer.setROption("learning rate decay", flag_lrate_decay);
+  student_trainer.setIOption("minibatch size", flag_minibatch_size);
+  student_trainer.setIOption("shard size", flag_shard_size);
+  student_trainer.optimizer = BuildOptimizer(allocator, flag_lr_optimizer, flag_lr_momentum, flag_lr_rho,
+                                             flag_lr_beta1, flag_lr_beta2, flag_lr_epsilon);
 
   if (flag_single_results_file) {
       resultsfile = InitResultsFile(allocator,expdir,"student");
@@ -518,7 +575,7 @@ int main(int argc, char **argv)
               flag_n_classes,
               flag_tied_weights, flag_nonlinearity, flag_recons_cost,
               flag_corrupt_prob, flag_corrupt_value,
-              &student);
+              &student, student_trainer.optimizer);
   }
 
   free(units_per_hidden_layer);
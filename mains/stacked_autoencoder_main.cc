@@ -20,19 +20,29 @@ This program will train a stacked autoencoder with log-softmax outputs\n\
 for classification. There a three training phases. The first involves all\n\
 the unsupervised costs at the same time. The second involves all the\n\
 unsupervised costs and the supervised cost. The third phase involves only\n\
-the supervised cost.\n";
+the supervised cost.\n\
+\n\
+With -sweep, the data is loaded once and the program runs each point of the\n\
+sweep file (one line of options per point) in its own process, -sweep_jobs\n\
+at once. Each point writes its own expdir, as a separate run would.\n\
+\n\
+With -sweep_batch, the points that differ only by model_seed, -lr_sup,\n\
+-l2_decay and -bias_decay share a process, and their supervised phase is\n\
+trained at once by a ModelBatchTrainer (plain minibatch SGD, the same order\n\
+of the examples for all). They must have no unsupervised phase.\n";
 
 
+#include <stdlib.h>
 #include <string>
 #include <sstream>
+#include <vector>
 
 #include "Allocator.h"
-#include "Random.h"
+#include "random_streams.h"
 #include "DiskXFile.h"
 #include "CmdLine.h"
 
 #include "MeanVarNorm.h"
-#include "MatDataSet.h"
 #include "ClassFormatDataSet.h"
 #include "OneHotClassFormat.h"
 #include "Measurer.h"
@@ -50,12 +60,41 @@ the supervised cost.\n";
 #include "stacked_autoencoder.h"
 #include "communicating_stacked_autoencoder.h"
 #include "stacked_autoencoder_trainer.h"
+#include "fast_math.h"
 #include "helpers.h"
 #include "binner.h"
+#include "async_evaluator.h"
+#include "early_stopping.h"
+#include "pretraining_cache.h"
+#include "sweep.h"
+#include "model_batch_trainer.h"
+#include "task_pool.h"
 
 
 using namespace Torch;
 
+// The options the loaded data depends on, which a sweep point must not change.
+std::string DataOptions(char *train_data_file, char *valid_data_file, char *test_data_file,
+                        int n_inputs, int n_classes, int max_load, int max_train_load,
+                        bool binary_mode, char *data_format)
+{
+  std::stringstream ss;
+  ss << train_data_file << " " << valid_data_file << " " << test_data_file << " "
+     << n_inputs << " " << n_classes << " " << max_load << " " << max_train_load << " "
+     << binary_mode << " " << data_format;
+  return ss.str();
+}
+
+// The value of #option# in the options of a sweep point, or #value# if the
+// point does not set it.
+real SweepPointOption(const std::vector<std::string> &point, const char *option, real value)
+{
+  for(size_t i=0; i+1<point.size(); i++)
+    if(point[i] == option)
+      return (real)atof(point[i+1].c_str());
+  return value;
+}
+
 // ************
 // *** MAIN ***
 // ************
@@ -96,6 +135,27 @@ int main(int argc, char **argv)
   int flag_max_iter_ac;
   int flag_max_iter_sc;
   real flag_accuracy;
+  int flag_minibatch_size;
+  int flag_shard_size;
+  int flag_n_threads;
+  bool flag_cache_representations;
+  bool flag_cache_on_disk;
+  int flag_pipelined_lwu;
+  int flag_pipeline_queue_size;
+  char *flag_pretraining_cache;
+  char *flag_sweep;
+  int flag_sweep_jobs;
+  bool flag_sweep_batch;
+  bool flag_convex_outputer;
+  int flag_convex_outputer_threads;
+  bool flag_async_eval;
+  int flag_early_stopping_patience;
+  bool flag_early_stopping_nll;
+  bool flag_unfused_coders;
+  bool flag_incremental_noisy;
+  bool flag_fast_math_nonlinearity;
+  int flag_branch_threads;
+  char *flag_thread_placement;
 
   real flag_lr_lwu;
   real flag_lr_unsup;
@@ -108,6 +168,13 @@ int main(int argc, char **argv)
   real flag_lr_ft_layer3;
   real flag_lr_ft_layer4;
 
+  char *flag_lr_optimizer;
+  real flag_lr_momentum;
+  real flag_lr_rho;
+  real flag_lr_beta1;
+  real flag_lr_beta2;
+  real flag_lr_epsilon;
+
   real flag_lrate_decay;
   real flag_l1_decay;
   real flag_l2_decay;
@@ -125,6 +192,7 @@ int main(int argc, char **argv)
   int flag_max_load;
   int flag_max_train_load;
   bool flag_binary_mode;
+  char *flag_data_format;
   bool flag_save_model;
   bool flag_save_model_afterinit;
   bool flag_save_model_afterpretraining;
@@ -180,6 +248,24 @@ int main(int argc, char **argv)
   cmd.addICmdOption("-max_iter_ac", &flag_max_iter_ac, 2, "max number of iterations with all the costs (3rd phase)", true);
   cmd.addICmdOption("-max_iter_sc", &flag_max_iter_sc, 2, "max number of iterations with only supervised cost (4th phase)", true);
   cmd.addRCmdOption("-accuracy", &flag_accuracy, 1e-5, "end accuracy", true);
+  cmd.addICmdOption("-minibatch_size", &flag_minibatch_size, 1, "number of examples per parameter update (the gradient is averaged)", true);
+  cmd.addICmdOption("-shard_size", &flag_shard_size, 0, "synchronous data parallelism: number of examples per shard of a minibatch, reduced in a fixed order (0 for none)", true);
+  cmd.addICmdOption("-n_threads", &flag_n_threads, 1, "number of training threads (Hogwild, or synchronous with -shard_size)", true);
+  cmd.addBCmdOption("-cache_representations", &flag_cache_representations, false, "layerwise phase: cache the outputs of the lower encoders instead of forwarding them", true);
+  cmd.addBCmdOption("-cache_on_disk", &flag_cache_on_disk, false, "keep the representation caches in memory-mapped files in the expdir", true);
+  cmd.addICmdOption("-pipelined_lwu", &flag_pipelined_lwu, 0, "experimental: pretrain all the layers at once, refreshing the encoder snapshots every that many examples (0 for the serial layerwise phase)", true);
+  cmd.addICmdOption("-pipeline_queue_size", &flag_pipeline_queue_size, 16, "pipelined layerwise phase: max number of minibatches waiting between two layers", true);
+  cmd.addSCmdOption("-pretraining_cache", &flag_pretraining_cache, "", "directory of pretrained models shared by the runs of a sweep: load the model pretrained with the same options instead of pretraining it (empty for none)", true);
+  cmd.addBCmdOption("-convex_outputer", &flag_convex_outputer, false, "fit the outputer with L-BFGS on cached top features when it is the only layer trained", true);
+  cmd.addICmdOption("-convex_outputer_threads", &flag_convex_outputer_threads, 1, "number of threads of the outputer fit", true);
+  cmd.addICmdOption("-early_stopping_patience", &flag_early_stopping_patience, 0, "supervised phase: stop after this many epochs without a better valid error and keep the best model (0 to train max_iter_sc epochs)", true);
+  cmd.addBCmdOption("-early_stopping_nll", &flag_early_stopping_nll, false, "early stopping watches the valid nll instead of the valid classification error", true);
+  cmd.addBCmdOption("-async_eval", &flag_async_eval, false, "measure the valid and test sets in another thread, with a snapshot of the model, while the next epoch trains", true);
+  cmd.addBCmdOption("-unfused_coders", &flag_unfused_coders, false, "run the coders' corruption, linear and nonlinear layers separately (debugging)", true);
+  cmd.addBCmdOption("-incremental_noisy", &flag_incremental_noisy, false, "noisy encoders correct the clean encoders' pre-activation on the corrupted units only", true);
+  cmd.addBCmdOption("-fast_math_nonlinearity", &flag_fast_math_nonlinearity, false, "use the fast_math approximations in the nonlinearities and the cross-entropy", true);
+  cmd.addICmdOption("-branch_threads", &flag_branch_threads, 1, "number of threads running the branches hanging off the hidden layers (decoders, outputer, speakers, ...) and their criteria in parallel", true);
+  cmd.addSCmdOption("-thread_placement", &flag_thread_placement, "none", "placement of the threads of the parallel sections: none, compact or scatter (NUMA nodes)", true);
 
   cmd.addRCmdOption("-lr_lwu", &flag_lr_lwu, 1e-3, "learning rate layerwise unsup phase", true);
   cmd.addRCmdOption("-lr_unsup", &flag_lr_unsup, 1e-3, "learning rate unsup phase", true);
@@ -193,6 +279,13 @@ int main(int argc, char **argv)
   cmd.addRCmdOption("-lr_ft_layer3", &flag_lr_ft_layer3, 0., "fine tuning layer specific learning rate", true);
   cmd.addRCmdOption("-lr_ft_layer4", &flag_lr_ft_layer4, 0., "fine tuning layer specific learning rate", true);
 
+  cmd.addSCmdOption("-lr_optimizer", &flag_lr_optimizer, "sgd", "update rule: sgd, momentum, nesterov, adagrad, rmsprop or adam", true);
+  cmd.addRCmdOption("-lr_momentum", &flag_lr_momentum, 0.9, "momentum of the momentum and nesterov updates", true);
+  cmd.addRCmdOption("-lr_rho", &flag_lr_rho, 0.9, "rmsprop: decay of the average of the squared gradients", true);
+  cmd.addRCmdOption("-lr_beta1", &flag_lr_beta1, 0.9, "adam: decay of the average of the gradients", true);
+  cmd.addRCmdOption("-lr_beta2", &flag_lr_beta2, 0.999, "adam: decay of the average of the squared gradients", true);
+  cmd.addRCmdOption("-lr_epsilon", &flag_lr_epsilon, 1e-6, "adagrad, rmsprop, adam: added to the root of the squared gradients", true);
+
   cmd.addRCmdOption("-lrate_decay", &flag_lrate_decay, 0.0, "learning rate decay", true);
   cmd.addRCmdOption("-l1_decay", &flag_l1_decay, 0.0, "l1 weight decay", true);
   cmd.addRCmdOption("-l2_decay", &flag_l2_decay, 0.0, "l2 weight decay", true);
@@ -210,12 +303,16 @@ int main(int argc, char **argv)
   cmd.addICmdOption("max_load", &flag_max_load, -1, "max number of examples to load for valid and test", true);
   cmd.addICmdOption("max_train_load", &flag_max_train_load, -1, "max number of examples to load for train", true);
   cmd.addBCmdOption("binary_mode", &flag_binary_mode, false, "binary mode for files", true);
+  cmd.addSCmdOption("-data_format", &flag_data_format, "mat", "format of the data files: mat (MatDataSet, see binary_mode) or mapped (see MappedDataSet)", true);
   cmd.addBCmdOption("save_model", &flag_save_model, true, "if true, save the model", true);
   cmd.addBCmdOption("save_model_afterinit", &flag_save_model_afterinit, true, "if true, save the model after initialization", true);
   cmd.addBCmdOption("save_model_afterpretraining", &flag_save_model_afterpretraining, true, "if true, save the model after pretraining", true);
   cmd.addBCmdOption("save_outputs", &flag_save_outputs, true, "if true, save the model's outputs on the datasets.", true);
   cmd.addBCmdOption("single_results_file", &flag_single_results_file, false, "if true, saves the results into a single file (1 for sup, 1 for unsup, 1 for supunsup)", true);
   cmd.addBCmdOption("multiple_results_files", &flag_multiple_results_files, true, "if true, save results into different files, depending on the cost", true);
+  cmd.addSCmdOption("-sweep", &flag_sweep, "", "file of sweep points, one per line of options added to the command line: the data is loaded once and each point runs in its own process (empty for a single run)", true);
+  cmd.addICmdOption("-sweep_jobs", &flag_sweep_jobs, 1, "sweep: number of points run at once", true);
+  cmd.addBCmdOption("-sweep_batch", &flag_sweep_batch, false, "sweep: train the supervised phase of the points that differ only by model_seed, -lr_sup, -l2_decay and -bias_decay at once, in one process", true);
   cmd.addBCmdOption("selective_layerwise_pretraining", &flag_selective_layerwise_pretraining, false, "if true, only the layers specified by pretrain_layer_N will be pretrained (layerwise!)", true);
 
   cmd.addICmdOption("-pretrain_layer_1", &flag_pretrain_layer_1, 0, "1 = pretrain the 1st layer ", true);
@@ -226,9 +323,42 @@ int main(int argc, char **argv)
   // Read the command line
   cmd.read(argc, argv);
 
-
   Allocator *allocator = new Allocator;
 
+  // === Create the DataSets ===
+  // Before the sweep: its points share them.
+  DataSet *train_matdata = LoadDataSet(allocator, flag_data_format, flag_train_data_file, flag_n_inputs,
+                                       flag_max_train_load, flag_binary_mode);
+  DataSet *valid_matdata = LoadDataSet(allocator, flag_data_format, flag_valid_data_file, flag_n_inputs,
+                                       flag_max_load, flag_binary_mode);
+  DataSet *test_matdata = LoadDataSet(allocator, flag_data_format, flag_test_data_file, flag_n_inputs,
+                                      flag_max_load, flag_binary_mode);
+  message("Data loaded\n");
+
+  // === Sweep ===
+  // Each point (or batch of points) continues below in its own process, with
+  // its own options.
+  const char *batched_options[] = {"model_seed", "-lr_sup", "-l2_decay", "-bias_decay", NULL};
+  std::vector< std::vector<std::string> > batch;
+  if (std::string(flag_sweep) != "") {
+    std::string data_options = DataOptions(flag_train_data_file, flag_valid_data_file, flag_test_data_file,
+                                           flag_n_inputs, flag_n_classes, flag_max_load,
+                                           flag_max_train_load, flag_binary_mode, flag_data_format);
+    if (!RunSweep(&cmd, argc, argv, flag_sweep, flag_sweep_jobs,
+                  flag_sweep_batch ? batched_options : NULL, &batch))
+      return(0);
+    if (DataOptions(flag_train_data_file, flag_valid_data_file, flag_test_data_file,
+                    flag_n_inputs, flag_n_classes, flag_max_load,
+                    flag_max_train_load, flag_binary_mode, flag_data_format) != data_options)
+      error("A sweep point cannot change the data options");
+  }
+
+  // Must be set before the machines and criteria are built.
+  SetFastMathDefault(flag_fast_math_nonlinearity);
+
+  // Also before the machines and criteria are built.
+  SetDefaultTaskPool(BuildTaskPool(allocator, flag_branch_threads, flag_thread_placement));
+
   // check reconstruction cost coherence with transfer function
   std::string str_recons_cost = flag_recons_cost;
   std::string str_nonlinearity = flag_nonlinearity;
@@ -255,65 +385,86 @@ int main(int argc, char **argv)
   if(flag_corrupt_prob>0.0)
     is_noisy = true;
 
-  // Formats the expdir name, where the results and models will be saved
-  std::stringstream ss;
-  ss << flag_expdir_prefix << "csae-task=" << flag_task << "-nl=" << flag_n_layers
-     << "-nhu=" << flag_n_hidden_units
-     << "-tied=" << flag_tied_weights << "-nlin=" << flag_nonlinearity << "-recost=" << flag_recons_cost
-     << "-ns=" << flag_n_speech << "-cprob=" << flag_corrupt_prob
-     << "-ue=" << flag_max_iter_uc
-     << "-cval=" << flag_corrupt_value 
-     << "-ifb=" << flag_init_from_binners
-     << "-rpmt=" << flag_reparametrize_tied
-     << "-fls=" << flag_first_layer_smoothed
-     << "-l1s=" << flag_l1_smoothing_decay
-     << "-l2s=" << flag_l2_smoothing_decay
-     << "-lwe=" << flag_max_iter_lwu 
-     << "-ace=" << flag_max_iter_ac << "-sce=" << flag_max_iter_sc
-     << "-lwu=" << flag_lr_lwu;
-  if (flag_selective_layerwise_pretraining)
-    ss << "-pre=" << flag_pretrain_layer_1  << flag_pretrain_layer_2 << flag_pretrain_layer_3 << flag_pretrain_layer_4;
-  ss << "-lru=" << flag_lr_unsup << "-lrsu=" << flag_lr_supunsup;
-  if (!flag_finetuning_layer_specific)
-    ss << "-lrs=" << flag_lr_sup;
-  else
-    ss << "-lrs=" << flag_lr_ft_layer0 << "-" << flag_lr_ft_layer1 << "-" 
-        << flag_lr_ft_layer2 << "-" << flag_lr_ft_layer3 << "-" << flag_lr_ft_layer4;
-  ss << "-dc=" << flag_lrate_decay << "-l1=" << flag_l1_decay
-     << "-l2=" << flag_l2_decay << "-bdk=" << flag_bias_decay
-     << "-uw=" << flag_unsup_weight
-     << "-uto=" << flag_unsup_trains_outputer
-     << "-ecw=" << flag_eval_criter_weights << "-cFs=" << flag_criter_avg_framesize
-     << "-ss=" << flag_start_seed << "-ms=" << flag_model_seed;
-
-  if (flag_multiple_results_files)
-     ss << "/";
-  else
-     ss << "_";
-
-  std::string expdir = ss.str();
-
-  if (!flag_single_results_file)        {
-    warning("Calling non portable mkdir!");
-    std::string command = "mkdir " + expdir;
-    system(command.c_str());
+  // === Batched sweep points ===
+  // The options of the models of the batch (the flags are those of the first
+  // point).
+  int n_models = (batch.size() > 1 ? (int)batch.size() : 1);
+  std::vector<int> model_seeds(n_models, flag_model_seed);
+  std::vector<real> lrs_sup(n_models, flag_lr_sup);
+  std::vector<real> l2_decays(n_models, flag_l2_decay);
+  std::vector<real> bias_decays(n_models, flag_bias_decay);
+  for (int m=1; m<n_models; m++) {
+    model_seeds[m] = (int)SweepPointOption(batch[m], "model_seed", flag_model_seed);
+    lrs_sup[m] = SweepPointOption(batch[m], "-lr_sup", flag_lr_sup);
+    l2_decays[m] = SweepPointOption(batch[m], "-l2_decay", flag_l2_decay);
+    bias_decays[m] = SweepPointOption(batch[m], "-bias_decay", flag_bias_decay);
   }
 
+  // Formats the expdir name, where the results and models will be saved, for
+  // each model (the first one last, so that the flags end up as they were).
+  std::vector<std::string> expdirs(n_models);
+  for (int m=n_models-1; m>=0; m--) {
+    flag_model_seed = model_seeds[m];
+    flag_lr_sup = lrs_sup[m];
+    flag_l2_decay = l2_decays[m];
+    flag_bias_decay = bias_decays[m];
+
+    std::stringstream ss;
+    ss << flag_expdir_prefix << "csae-task=" << flag_task << "-nl=" << flag_n_layers
+       << "-nhu=" << flag_n_hidden_units
+       << "-tied=" << flag_tied_weights << "-nlin=" << flag_nonlinearity << "-recost=" << flag_recons_cost
+       << "-ns=" << flag_n_speech << "-cprob=" << flag_corrupt_prob
+       << "-ue=" << flag_max_iter_uc
+       << "-cval=" << flag_corrupt_value 
+       << "-ifb=" << flag_init_from_binners
+       << "-rpmt=" << flag_reparametrize_tied
+       << "-fls=" << flag_first_layer_smoothed
+       << "-l1s=" << flag_l1_smoothing_decay
+       << "-l2s=" << flag_l2_smoothing_decay
+       << "-lwe=" << flag_max_iter_lwu 
+       << "-ace=" << flag_max_iter_ac << "-sce=" << flag_max_iter_sc
+       << "-lwu=" << flag_lr_lwu;
+    if (flag_selective_layerwise_pretraining)
+      ss << "-pre=" << flag_pretrain_layer_1  << flag_pretrain_layer_2 << flag_pretrain_layer_3 << flag_pretrain_layer_4;
+    ss << "-lru=" << flag_lr_unsup << "-lrsu=" << flag_lr_supunsup;
+    if (!flag_finetuning_layer_specific)
+      ss << "-lrs=" << flag_lr_sup;
+    else
+      ss << "-lrs=" << flag_lr_ft_layer0 << "-" << flag_lr_ft_layer1 << "-" 
+          << flag_lr_ft_layer2 << "-" << flag_lr_ft_layer3 << "-" << flag_lr_ft_layer4;
+    ss << "-dc=" << flag_lrate_decay << "-l1=" << flag_l1_decay
+       << "-l2=" << flag_l2_decay << "-bdk=" << flag_bias_decay
+       << "-uw=" << flag_unsup_weight
+       << "-uto=" << flag_unsup_trains_outputer
+       << "-ecw=" << flag_eval_criter_weights << "-cFs=" << flag_criter_avg_framesize;
+    if (std::string(flag_lr_optimizer) != "sgd")
+      ss << "-opt=" << flag_lr_optimizer;
+    if (flag_minibatch_size > 1)
+      ss << "-mb=" << flag_minibatch_size;
+    if (flag_shard_size > 0)
+      ss << "-shs=" << flag_shard_size;
+    if (flag_n_threads > 1)
+      ss << "-nt=" << flag_n_threads;
+    ss << "-ss=" << flag_start_seed << "-ms=" << flag_model_seed;
+
+    if (flag_multiple_results_files)
+       ss << "/";
+    else
+       ss << "_";
+
+    expdirs[m] = ss.str();
+
+    if (!flag_single_results_file)      {
+      warning("Calling non portable mkdir!");
+      std::string command = "mkdir " + expdirs[m];
+      system(command.c_str());
+    }
+  }
+  std::string expdir = expdirs[0];
+
   // To be changed if you want reproducible results for operations that use
   // random numbers BEFORE instantiating the models.
-  if(flag_start_seed == -1)
-    Random::seed();
-  else
-    Random::manualSeed((long)flag_start_seed);
-
-  // === Create the DataSets ===
-  MatDataSet train_matdata(flag_train_data_file, flag_n_inputs,1,false,
-                                 flag_max_train_load, flag_binary_mode);
-  MatDataSet valid_matdata(flag_valid_data_file, flag_n_inputs,1,false,
-                                 flag_max_load, flag_binary_mode);
-  MatDataSet test_matdata(flag_test_data_file, flag_n_inputs,1,false,
-                                flag_max_load, flag_binary_mode);
-  message("Data loaded\n");
+  SetRandomSeed((long)flag_start_seed);
 
   //MeanVarNorm mv(&train_matdata,true,false);
   //train_matdata.preProcess(&mv);
@@ -322,9 +473,9 @@ int main(int argc, char **argv)
   //message("data normalized\n");
   message("Data was loaded as is and was NOT normalized\n");
 
-  ClassFormatDataSet train_data(&train_matdata,flag_n_classes);
-  ClassFormatDataSet valid_data(&valid_matdata,flag_n_classes);
-  ClassFormatDataSet test_data(&test_matdata,flag_n_classes);
+  ClassFormatDataSet train_data(train_matdata,flag_n_classes);
+  ClassFormatDataSet valid_data(valid_matdata,flag_n_classes);
+  ClassFormatDataSet test_data(test_matdata,flag_n_classes);
 
   OneHotClassFormat class_format(&train_data);
 
@@ -340,11 +491,99 @@ int main(int argc, char **argv)
     units_per_speech_layer[i] = flag_n_speech;
   }
 
+  // === Train the batch ===
+  // The models of the batch differ only by their seed, supervised learning
+  // rate and decays: one ModelBatchTrainer trains them, each with its own
+  // measurers, and they are saved as the separate runs would.
+  if (n_models > 1) {
+    if (flag_max_iter_lwu || flag_max_iter_uc || flag_max_iter_ac)
+      error("-sweep_batch: only the supervised phase is batched, the points cannot have unsupervised phases");
+    if (flag_n_threads > 1 || flag_async_eval || flag_early_stopping_patience > 0 ||
+        flag_finetuning_layer_specific || flag_first_layer_smoothed || flag_init_from_binners ||
+        std::string(flag_lr_optimizer) != "sgd" || std::string(flag_pretraining_cache) != "")
+      error("-sweep_batch: the batched supervised phase is plain minibatch SGD, without threads, asynchronous evaluation, early stopping, layer specific rates, smoothing, binners or pretraining cache");
+
+    CommunicatingStackedAutoencoder **csaes = (CommunicatingStackedAutoencoder**) allocator->alloc(sizeof(CommunicatingStackedAutoencoder*)*n_models);
+    StackedAutoencoder **saes = (StackedAutoencoder**) allocator->alloc(sizeof(StackedAutoencoder*)*n_models);
+    MeasurerList **measurers = (MeasurerList**) allocator->alloc(sizeof(MeasurerList*)*n_models);
+    XFile **resultsfiles = NULL;
+    if (flag_single_results_file)
+      resultsfiles = (XFile**) allocator->alloc(sizeof(XFile*)*n_models);
+    for (int m=0; m<n_models; m++) {
+      // Seed before model init, as the separate run does.
+      SetRandomSeed((long)model_seeds[m]);
+      csaes[m] = new(allocator) CommunicatingStackedAutoencoder("csae", flag_nonlinearity, flag_tied_weights, flag_reparametrize_tied, flag_n_inputs, flag_n_layers,
+                                                                units_per_hidden_layer, flag_n_classes,
+                                                                is_noisy, flag_first_layer_smoothed, units_per_speech_layer,0,1);
+      csaes[m]->setL1WeightDecay(flag_l1_decay);
+      csaes[m]->setL2WeightDecay(l2_decays[m]);
+      csaes[m]->setBiasDecay(bias_decays[m]);
+      saes[m] = csaes[m];
+
+      measurers[m] = (MeasurerList*) new(allocator) MeasurerList();
+      AddClassificationMeasurers(allocator, expdirs[m], measurers[m], csaes[m],
+                                 &train_data, &valid_data, &test_data,
+                                 &class_format, flag_multiple_results_files);
+      if (flag_single_results_file)
+        resultsfiles[m] = InitResultsFile(allocator,expdirs[m],"sup");
+
+      if (flag_save_model_afterinit) {
+        SaveCSAE(expdirs[m],"afterinit",
+                  flag_n_layers, flag_n_inputs, units_per_hidden_layer, units_per_speech_layer,
+                  flag_n_classes,
+                  flag_tied_weights, flag_nonlinearity, flag_recons_cost,
+                  flag_corrupt_prob, flag_corrupt_value,
+                  csaes[m]);
+      }
+    }
+    message("%d models instanciated.\n", n_models);
+
+    // The models share the order of the examples.
+    SetRandomSeed((long)flag_start_seed);
+    ModelBatchTrainer batch_trainer(saes, n_models, &class_format);
+    batch_trainer.setIOption("max iter", flag_max_iter_sc);
+    batch_trainer.setIOption("minibatch size", flag_minibatch_size);
+    batch_trainer.setROption("learning rate decay", flag_lrate_decay);
+    for (int m=0; m<n_models; m++)
+      batch_trainer.learning_rates[m] = lrs_sup[m];
+    batch_trainer.Train(&train_data, measurers, NULL, resultsfiles);
+
+    DataSet *save_data[3] = {&train_data, &valid_data, &test_data};
+    const char *save_labels[3] = {"train", "valid", "test"};
+    for (int m=0; m<n_models; m++) {
+      if (flag_save_model) {
+        SaveCSAE(expdirs[m],"final",
+                  flag_n_layers, flag_n_inputs, units_per_hidden_layer, units_per_speech_layer,
+                  flag_n_classes,
+                  flag_tied_weights, flag_nonlinearity, flag_recons_cost,
+                  flag_corrupt_prob, flag_corrupt_value,
+                  csaes[m]);
+      }
+      if (flag_save_outputs) {
+        for (int d=0; d<3; d++)
+          saveOutputs(csaes[m], save_data[d], flag_n_classes, expdirs[m], save_labels[d]);
+      }
+    }
+
+    free(units_per_hidden_layer);
+    free(units_per_speech_layer);
+    delete allocator;
+    return(0);
+  }
+
+  // The evaluation replica is built before seeding: the layers take the
+  // indices of their streams at construction, and the replica would take
+  // those of the model. Its parameters are copied from the model's anyway.
+  CommunicatingStackedAutoencoder *csae_eval = NULL;
+  if(flag_async_eval)   {
+    csae_eval = new(allocator) CommunicatingStackedAutoencoder("csae", flag_nonlinearity, flag_tied_weights, flag_reparametrize_tied, flag_n_inputs, flag_n_layers,
+                                                               units_per_hidden_layer, flag_n_classes,
+                                                               is_noisy, flag_first_layer_smoothed, units_per_speech_layer,0,1);
+    csae_eval->setFusedCoders(!flag_unfused_coders);
+  }
+
   // Seed before model init. 
-  if(flag_model_seed == -1)
-    Random::seed();
-  else
-    Random::manualSeed((long)flag_model_seed);
+  SetRandomSeed((long)flag_model_seed);
   
   // Last two parameters: communication type and n_communication_layers
   CommunicatingStackedAutoencoder csae("csae", flag_nonlinearity, flag_tied_weights, flag_reparametrize_tied, flag_n_inputs, flag_n_layers,
@@ -354,15 +593,28 @@ int main(int argc, char **argv)
   csae.setL2WeightDecay(flag_l2_decay);
   csae.setBiasDecay(flag_bias_decay);
   csae.setDestructionOptions(flag_corrupt_prob, flag_corrupt_value);
+  csae.setFusedCoders(!flag_unfused_coders);
+  csae.setIncrementalNoisyCoders(flag_incremental_noisy);
   csae.setSmoothingDecay(flag_l1_smoothing_decay, flag_l2_smoothing_decay);
 
   message("Models instanciated.\n");
 
   // === Measurers ===
+  // With -async_eval, the evaluation replica has the valid and test ones.
   MeasurerList csae_measurers;
-  AddClassificationMeasurers(allocator, expdir, &csae_measurers, &csae,
-                             &train_data, &valid_data, &test_data,
-                             &class_format, flag_multiple_results_files);
+  MeasurerList csae_eval_measurers;
+  if(flag_async_eval)   {
+    AddClassificationMeasurers(allocator, expdir, &csae_measurers, &csae,
+                               &train_data, NULL, NULL,
+                               &class_format, flag_multiple_results_files);
+    AddClassificationMeasurers(allocator, expdir, &csae_eval_measurers, csae_eval,
+                               NULL, &valid_data, &test_data,
+                               &class_format, flag_multiple_results_files);
+  }     else    {
+    AddClassificationMeasurers(allocator, expdir, &csae_measurers, &csae,
+                               &train_data, &valid_data, &test_data,
+                               &class_format, flag_multiple_results_files);
+  }
 
 
   // === Criterion ===
@@ -399,6 +651,63 @@ int main(int argc, char **argv)
 
   csae_trainer.setROption("end accuracy", flag_accuracy);
   csae_trainer.setROption("learning rate decay", flag_lrate_decay);
+  csae_trainer.setIOption("minibatch size", flag_minibatch_size);
+  csae_trainer.setIOption("shard size", flag_shard_size);
+  csae_trainer.setBOption("cache representations", flag_cache_representations);
+  csae_trainer.setBOption("cache on disk", flag_cache_on_disk);
+  csae_trainer.setBOption("convex outputer", flag_convex_outputer);
+  csae_trainer.setIOption("convex outputer threads", flag_convex_outputer_threads);
+  // The replicas use it too, and its state is saved with the model.
+  csae_trainer.optimizer = BuildOptimizer(allocator, flag_lr_optimizer, flag_lr_momentum, flag_lr_rho,
+                                          flag_lr_beta1, flag_lr_beta2, flag_lr_epsilon);
+
+  // === Replicas ===
+  // Each extra thread trains a replica of the csae over its own wrapper of
+  // the train data. Their parameters are replaced by the csae's at each phase.
+  CommunicatingStackedAutoencoder **replica_csaes = NULL;
+  if(flag_n_threads > 1)  {
+    int n_replicas = flag_n_threads - 1;
+    replica_csaes = (CommunicatingStackedAutoencoder**) allocator->alloc(sizeof(CommunicatingStackedAutoencoder*)*n_replicas);
+    StackedAutoencoderTrainer **replica_trainers = (StackedAutoencoderTrainer**) allocator->alloc(sizeof(StackedAutoencoderTrainer*)*n_replicas);
+
+    for(int k=0; k<n_replicas; k++)     {
+      ClassFormatDataSet *replica_train_data = new(allocator) ClassFormatDataSet(train_matdata, flag_n_classes);
+
+      CommunicatingStackedAutoencoder *replica = new(allocator) CommunicatingStackedAutoencoder("csae", flag_nonlinearity, flag_tied_weights, flag_reparametrize_tied, flag_n_inputs, flag_n_layers,
+                                                                                               units_per_hidden_layer, flag_n_classes,
+                                                                                               is_noisy, flag_first_layer_smoothed, units_per_speech_layer,0,1);
+      replica->setL1WeightDecay(flag_l1_decay);
+      replica->setL2WeightDecay(flag_l2_decay);
+      replica->setBiasDecay(flag_bias_decay);
+      replica->setDestructionOptions(flag_corrupt_prob, flag_corrupt_value);
+      replica->setFusedCoders(!flag_unfused_coders);
+      replica->setIncrementalNoisyCoders(flag_incremental_noisy);
+      replica->setSmoothingDecay(flag_l1_smoothing_decay, flag_l2_smoothing_decay);
+      replica_csaes[k] = replica;
+
+      ClassNLLCriterion *replica_criterion = new(allocator) ClassNLLCriterion(&class_format);
+
+      DataSet **replica_unsup_datasets = (DataSet**) allocator->alloc(sizeof(DataSet*)*replica->n_hidden_layers);
+      Criterion **replica_unsup_criterions = (Criterion**) allocator->alloc(sizeof(Criterion*)*replica->n_hidden_layers);
+      Measurer **replica_unsup_measurers = (Measurer**) allocator->alloc(sizeof(Measurer*)*replica->n_hidden_layers);
+      BuildSaeUnsupDataSetsCriteriaMeasurers(allocator, expdir, replica, replica_train_data,
+                                             replica_criterion, flag_recons_cost,
+                                             flag_criter_avg_framesize,
+                                             replica_unsup_datasets, replica_unsup_criterions,
+                                             replica_unsup_measurers, false);
+
+      replica_trainers[k] = new(allocator) StackedAutoencoderTrainer(replica, replica_criterion, expdir, false);
+      replica_trainers[k]->unsup_datasets = replica_unsup_datasets;
+      replica_trainers[k]->unsup_criterions = replica_unsup_criterions;
+      replica_trainers[k]->unsup_measurers = replica_unsup_measurers;
+      replica_trainers[k]->replica_train_data = replica_train_data;
+      replica_trainers[k]->setIOption("minibatch size", flag_minibatch_size);
+      replica_trainers[k]->setIOption("shard size", flag_shard_size);
+    }
+
+    csae_trainer.SetReplicas(replica_trainers, n_replicas);
+    message("%d replicas instanciated.\n", n_replicas);
+  }
 
   DiskXFile* resultsfile = NULL;
   if(flag_profile_gradients)   {
@@ -417,10 +726,58 @@ int main(int argc, char **argv)
               flag_n_classes,
               flag_tied_weights, flag_nonlinearity, flag_recons_cost,
               flag_corrupt_prob, flag_corrupt_value,
-              &csae);
+              &csae, csae_trainer.optimizer);
+  }
+  // === Pretraining cache ===
+  // The key describes everything the model after the layerwise and unsup
+  // phases depends on.
+  PretrainingCache *pretraining_cache = NULL;
+  std::string pretraining_description;
+  std::string pretraining_key;
+  bool is_pretrained = false;
+  if (std::string(flag_pretraining_cache) != "") {
+    if (flag_start_seed == -1 || flag_model_seed == -1)
+      error("The pretraining cache needs fixed seeds");
+
+    std::stringstream pd;
+    pd << "train=" << flag_train_data_file << " mtl=" << flag_max_train_load << " bin=" << flag_binary_mode
+       << " ni=" << flag_n_inputs << " nc=" << flag_n_classes
+       << " nl=" << flag_n_layers << " nhu=" << flag_n_hidden_units << " ns=" << flag_n_speech
+       << " tied=" << flag_tied_weights << " nlin=" << flag_nonlinearity << " recost=" << flag_recons_cost
+       << " cprob=" << flag_corrupt_prob << " cval=" << flag_corrupt_value
+       << " rpmt=" << flag_reparametrize_tied << " fls=" << flag_first_layer_smoothed
+       << " l1s=" << flag_l1_smoothing_decay << " l2s=" << flag_l2_smoothing_decay
+       << " lwe=" << flag_max_iter_lwu << " ue=" << flag_max_iter_uc << " acc=" << flag_accuracy
+       << " lwu=" << flag_lr_lwu << " lru=" << flag_lr_unsup << " dc=" << flag_lrate_decay
+       << " l1=" << flag_l1_decay << " l2=" << flag_l2_decay << " bdk=" << flag_bias_decay
+       << " uto=" << flag_unsup_trains_outputer << " ecw=" << flag_eval_criter_weights
+       << " cFs=" << flag_criter_avg_framesize
+       << " sel=" << flag_selective_layerwise_pretraining << " pre=" << flag_pretrain_layer_1
+       << flag_pretrain_layer_2 << flag_pretrain_layer_3 << flag_pretrain_layer_4
+       << " pbp=" << flag_partial_backprop
+       << " opt=" << flag_lr_optimizer << " mom=" << flag_lr_momentum << " rho=" << flag_lr_rho
+       << " b1=" << flag_lr_beta1 << " b2=" << flag_lr_beta2 << " eps=" << flag_lr_epsilon
+       << " mb=" << flag_minibatch_size << " shs=" << flag_shard_size << " nt=" << flag_n_threads
+       << " plwu=" << flag_pipelined_lwu << " unf=" << flag_unfused_coders
+       << " inc=" << flag_incremental_noisy << " fm=" << flag_fast_math_nonlinearity
+       << " ss=" << flag_start_seed << " ms=" << flag_model_seed;
+    pretraining_description = pd.str();
+    pretraining_key = PretrainingCache::Key(pretraining_description);
+
+    // Held until the model is in the cache.
+    pretraining_cache = new(allocator) PretrainingCache(flag_pretraining_cache);
+    message("Waiting for the pretraining cache lock on %s", pretraining_key.c_str());
+    pretraining_cache->Lock(pretraining_key);
+    if (pretraining_cache->Contains(pretraining_key)) {
+      LoadCSAEParameters(pretraining_cache->Filename(pretraining_key), &csae, csae_trainer.optimizer);
+      pretraining_cache->Unlock();
+      is_pretrained = true;
+      message("Pretrained model %s loaded from the cache", pretraining_key.c_str());
+    }
   }
+
   // --- train using the layerwise unsupervised criterions ---
-  if(flag_max_iter_lwu && !flag_selective_layerwise_pretraining) {
+  if(flag_max_iter_lwu && !flag_selective_layerwise_pretraining && !is_pretrained) {
     csae_trainer.setROption("learning rate", flag_lr_lwu);
     csae_trainer.setIOption("max iter", flag_max_iter_lwu);
  
@@ -429,11 +786,14 @@ int main(int argc, char **argv)
       csae_trainer.resultsfile = resultsfile;
     }
 
-    csae_trainer.TrainUnsupLayerwise();
+    if(flag_pipelined_lwu > 0)
+      csae_trainer.TrainUnsupLayerwisePipelined(flag_pipelined_lwu, flag_pipeline_queue_size);
+    else
+      csae_trainer.TrainUnsupLayerwise();
 
   }
 
-  if(flag_max_iter_lwu && flag_selective_layerwise_pretraining) {
+  if(flag_max_iter_lwu && flag_selective_layerwise_pretraining && !is_pretrained) {
     csae_trainer.setROption("learning rate", flag_lr_lwu);
     csae_trainer.setIOption("max iter", flag_max_iter_lwu);
  
@@ -456,7 +816,7 @@ int main(int argc, char **argv)
 
   // --- train using the unsupervised criterions ---
   // Also train the output layer with the supervised cost.
-  if (flag_max_iter_uc) {
+  if (flag_max_iter_uc && !is_pretrained) {
     csae_trainer.setROption("learning rate", flag_lr_unsup);
     csae_trainer.setIOption("max iter", flag_max_iter_uc);
 
@@ -472,15 +832,38 @@ int main(int argc, char **argv)
       csae_trainer.TrainUnsupNotOutput();
   }
 
+  if (pretraining_cache) {
+    if (!is_pretrained) {
+      SaveCSAEFile(pretraining_cache->StagingFilename(pretraining_key),
+                   flag_n_layers, flag_n_inputs, units_per_hidden_layer, units_per_speech_layer,
+                   flag_n_classes,
+                   flag_tied_weights, flag_nonlinearity, flag_recons_cost,
+                   flag_corrupt_prob, flag_corrupt_value,
+                   &csae, csae_trainer.optimizer);
+      pretraining_cache->Publish(pretraining_key, pretraining_description);
+      pretraining_cache->Unlock();
+    }
+    // The later phases draw the same numbers, whether the model was
+    // pretrained or loaded.
+    SetRandomSeed((long)flag_model_seed + 1);
+  }
+
   if(flag_save_model_afterpretraining) {
     SaveCSAE(expdir,"afterpretraining",
               flag_n_layers, flag_n_inputs, units_per_hidden_layer, units_per_speech_layer,
               flag_n_classes,
               flag_tied_weights, flag_nonlinearity, flag_recons_cost,
               flag_corrupt_prob, flag_corrupt_value,
-              &csae);
+              &csae, csae_trainer.optimizer);
   }
 
+  // The phases below measure csae_measurers: the valid and test sets are
+  // measured by the evaluation replica. The unsupervised phases above only
+  // measure the reconstructions on the training set, and keep their results
+  // layout.
+  if(flag_async_eval)
+    csae_trainer.evaluator = new(allocator) AsyncEvaluator(&csae, csae_eval, &csae_eval_measurers);
+
   // --- train using all individual criterions at once ---
   if (flag_max_iter_ac) {
     csae_trainer.setROption("learning rate", flag_lr_supunsup);
@@ -496,6 +879,11 @@ int main(int argc, char **argv)
   if(flag_profile_gradients)
     csae_trainer.profile_gradients = false;
 
+  // The final model is saved with the state of the optimizer, unless early
+  // stopping rolled its parameters back to an earlier epoch: the state
+  // would be the last epoch's.
+  Optimizer *final_optimizer = csae_trainer.optimizer;
+
   // --- train with only supervised cost ---
   
   // Re-initialize the *MLP* using weight and bias distributions from a binner
@@ -534,7 +922,19 @@ int main(int argc, char **argv)
       csae_trainer.resultsfile = resultsfile;
     }
 
+    // The valid measurer is the evaluation replica's with -async_eval.
+    if (flag_early_stopping_patience > 0) {
+      MeasurerList *valid_measurers = flag_async_eval ? &csae_eval_measurers : &csae_measurers;
+      Measurer *valid_measurer = FindClassificationMeasurer(valid_measurers, &valid_data, flag_early_stopping_nll);
+      if (!valid_measurer)
+        error("No valid measurer for early stopping");
+      csae_trainer.early_stopping = new(allocator) EarlyStopping(valid_measurer, flag_early_stopping_patience);
+    }
+
     csae_trainer.train(&train_data, &csae_measurers);
+    if (csae_trainer.early_stopping && csae_trainer.early_stopping->BestIsNotLast())
+      final_optimizer = NULL;
+    csae_trainer.early_stopping = NULL;
   }
  
 
@@ -545,14 +945,26 @@ int main(int argc, char **argv)
               flag_n_classes,
               flag_tied_weights, flag_nonlinearity, flag_recons_cost,
               flag_corrupt_prob, flag_corrupt_value,
-              &csae);
+              &csae, final_optimizer);
   }
 
   // === Save outputs ===
+  // With the training threads, the replicas forward the examples too.
   if (flag_save_outputs)  {
-    saveOutputs(&csae, &train_data, flag_n_classes, expdir, "train");
-    saveOutputs(&csae, &valid_data, flag_n_classes, expdir, "valid");
-    saveOutputs(&csae, &test_data, flag_n_classes, expdir, "test");
+    TaskPool *save_pool = BuildTaskPool(allocator, flag_n_threads, flag_thread_placement);
+    DataSet *save_matdata[3] = {train_matdata, valid_matdata, test_matdata};
+    DataSet *save_data[3] = {&train_data, &valid_data, &test_data};
+    const char *save_labels[3] = {"train", "valid", "test"};
+    DataSet **replica_data = NULL;
+    if (save_pool)
+      replica_data = (DataSet**) allocator->alloc(sizeof(DataSet*)*(flag_n_threads-1));
+
+    for (int d=0; d<3; d++) {
+      for (int k=0; save_pool && k<flag_n_threads-1; k++)
+        replica_data[k] = new(allocator) ClassFormatDataSet(save_matdata[d], flag_n_classes);
+      saveOutputs(&csae, save_data[d], flag_n_classes, expdir, save_labels[d],
+                  save_pool, replica_csaes, replica_data);
+    }
   }
 
   free(units_per_hidden_layer);
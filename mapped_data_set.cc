@@ -0,0 +1,192 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "mapped_data_set.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Torch {
+
+MappedDataSet::MappedDataSet(const char *filename, int n_inputs_, int max_load)
+{
+  if(sizeof(real) != sizeof(float))
+    error("MappedDataSet: the inputs are float32, real must be float");
+
+  int fd = open(filename, O_RDONLY);
+  if(fd < 0)
+    error("MappedDataSet: cannot open %s", filename);
+  struct stat info;
+  if(fstat(fd, &info) != 0)
+    error("MappedDataSet: cannot stat %s", filename);
+  mapping_size = (size_t)info.st_size;
+  if(mapping_size < MAPPED_DATA_SET_HEADER_SIZE)
+    error("MappedDataSet: %s is not a mapped data set", filename);
+
+  // The mapping holds the file open.
+  mapping = mmap(NULL, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(mapping == MAP_FAILED)
+    error("MappedDataSet: cannot map %s", filename);
+
+  MappedDataSetHeader *header = (MappedDataSetHeader*)mapping;
+  if(strncmp(header->magic, MAPPED_DATA_SET_MAGIC, sizeof(header->magic)) != 0)
+    error("MappedDataSet: %s is not a mapped data set", filename);
+  if(header->byte_order != MAPPED_DATA_SET_BYTE_ORDER)
+    error("MappedDataSet: %s was written with another byte order", filename);
+  if(header->version != MAPPED_DATA_SET_VERSION)
+    error("MappedDataSet: %s has version %d, not %d", filename, header->version, MAPPED_DATA_SET_VERSION);
+  if(header->n_inputs != n_inputs_)
+    error("MappedDataSet: %s has %d inputs, not %d", filename, header->n_inputs, n_inputs_);
+
+  size_t inputs_size = sizeof(float) * (size_t)header->n_examples * (size_t)header->n_inputs;
+  if(mapping_size < MAPPED_DATA_SET_HEADER_SIZE + inputs_size + sizeof(int)*(size_t)header->n_examples)
+    error("MappedDataSet: %s is truncated", filename);
+
+  int n = header->n_examples;
+  if(max_load > 0 && max_load < n)
+    n = max_load;
+  DataSet::init(n, n_inputs_, 1);
+
+  mapped_inputs = (real*)((char*)mapping + MAPPED_DATA_SET_HEADER_SIZE);
+  int *mapped_labels = (int*)((char*)mapping + MAPPED_DATA_SET_HEADER_SIZE + inputs_size);
+  labels = (real*)allocator->alloc(sizeof(real)*n);
+  for(int t=0; t<n; t++)
+    labels[t] = (real)mapped_labels[t];
+
+  // Frames that point to nothing: setRealExample() points them.
+  example_inputs = new(allocator) Sequence(0, n_inputs);
+  example_targets = new(allocator) Sequence(0, 1);
+  example_inputs->resize(1, false);
+  example_targets->resize(1, false);
+  example_inputs->frames[0] = mapped_inputs;
+  example_targets->frames[0] = labels;
+  inputs = example_inputs;
+  targets = example_targets;
+
+  pushed = NULL;
+  n_pushed = 0;
+  n_pushed_allocated = 0;
+}
+
+void MappedDataSet::getNumberOfFrames(int t, int *n_input_frames, int *n_target_frames)
+{
+  if(n_input_frames)
+    *n_input_frames = 1;
+  if(n_target_frames)
+    *n_target_frames = 1;
+}
+
+void MappedDataSet::setRealExample(int t, bool set_inputs, bool set_targets)
+{
+  // GatherMinibatch() redirects inputs and targets to the minibatch.
+  inputs = example_inputs;
+  targets = example_targets;
+  example_inputs->frames[0] = mapped_inputs + (size_t)t*n_inputs;
+  example_targets->frames[0] = labels + t;
+  real_current_example_index = t;
+}
+
+void MappedDataSet::preProcess(PreProcessing *pre_processing)
+{
+  error("MappedDataSet: pre-processing not supported");
+}
+
+void MappedDataSet::pushExample()
+{
+  if(n_pushed == n_pushed_allocated)    {
+    n_pushed_allocated = 2*n_pushed_allocated + 1;
+    pushed = (PushedExample*)allocator->realloc(pushed, sizeof(PushedExample)*n_pushed_allocated);
+  }
+  PushedExample *example = &pushed[n_pushed++];
+  example->inputs = inputs;
+  example->targets = targets;
+  example->input_frame = example_inputs->frames[0];
+  example->target_frame = example_targets->frames[0];
+  example->real_current_example_index = real_current_example_index;
+}
+
+void MappedDataSet::popExample()
+{
+  if(n_pushed == 0)
+    error("MappedDataSet::popExample() - no example was pushed");
+  PushedExample *example = &pushed[--n_pushed];
+  inputs = example->inputs;
+  targets = example->targets;
+  example_inputs->frames[0] = example->input_frame;
+  example_targets->frames[0] = example->target_frame;
+  real_current_example_index = example->real_current_example_index;
+}
+
+MappedDataSet::~MappedDataSet()
+{
+  munmap(mapping, mapping_size);
+}
+
+void SaveMappedDataSet(DataSet *data, const char *filename)
+{
+  if(data->n_targets != 1)
+    error("SaveMappedDataSet: the examples must have 1 target, their label");
+
+  int n_examples = data->n_examples;
+  int n_inputs = data->n_inputs;
+
+  std::string staging = std::string(filename) + ".staging";
+  FILE *file = fopen(staging.c_str(), "wb");
+  if(!file)
+    error("SaveMappedDataSet: cannot create %s", staging.c_str());
+
+  char header_bytes[MAPPED_DATA_SET_HEADER_SIZE];
+  memset(header_bytes, 0, sizeof(header_bytes));
+  MappedDataSetHeader *header = (MappedDataSetHeader*)header_bytes;
+  strncpy(header->magic, MAPPED_DATA_SET_MAGIC, sizeof(header->magic));
+  header->byte_order = MAPPED_DATA_SET_BYTE_ORDER;
+  header->version = MAPPED_DATA_SET_VERSION;
+  header->n_examples = n_examples;
+  header->n_inputs = n_inputs;
+  bool ok = fwrite(header_bytes, 1, sizeof(header_bytes), file) == sizeof(header_bytes);
+
+  // The labels follow all the inputs.
+  float *row = (float*)Allocator::sysAlloc(sizeof(float)*n_inputs);
+  int *file_labels = (int*)Allocator::sysAlloc(sizeof(int)*n_examples);
+  for(int t=0; ok && t<n_examples; t++) {
+    data->setExample(t);
+    if(data->inputs->n_frames != 1 || data->targets->n_frames != 1)
+      error("SaveMappedDataSet: examples must have exactly 1 frame");
+
+    real *frame = data->inputs->frames[0];
+    for(int i=0; i<n_inputs; i++)
+      row[i] = (float)frame[i];
+    ok = fwrite(row, sizeof(float), n_inputs, file) == (size_t)n_inputs;
+    file_labels[t] = (int)data->targets->frames[0][0];
+  }
+  if(ok)
+    ok = fwrite(file_labels, sizeof(int), n_examples, file) == (size_t)n_examples;
+  free(row);
+  free(file_labels);
+
+  if(fclose(file) != 0)
+    ok = false;
+  if(!ok)
+    error("SaveMappedDataSet: cannot write %s", staging.c_str());
+  if(rename(staging.c_str(), filename) != 0)
+    error("SaveMappedDataSet: cannot rename %s to %s", staging.c_str(), filename);
+}
+
+}
@@ -0,0 +1,104 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_MAPPED_DATA_SET_H_
+#define TORCH_MAPPED_DATA_SET_H_
+
+#include "DataSet.h"
+#include "Sequence.h"
+
+namespace Torch {
+
+// The mapped data set file format:
+//   - a header of MAPPED_DATA_SET_HEADER_SIZE bytes (MappedDataSetHeader,
+//     zero padded),
+//   - the inputs, n_examples rows of n_inputs float32,
+//   - the labels, n_examples int32.
+// Numbers are in the byte order of the machine that wrote the file, which
+// the header records.
+#define MAPPED_DATA_SET_MAGIC "DTMAPDS"
+#define MAPPED_DATA_SET_VERSION 1
+#define MAPPED_DATA_SET_HEADER_SIZE 64
+#define MAPPED_DATA_SET_BYTE_ORDER 0x01020304
+
+struct MappedDataSetHeader
+{
+  char magic[8];
+  int byte_order;               // MAPPED_DATA_SET_BYTE_ORDER as written
+  int version;
+  int n_examples;
+  int n_inputs;
+};
+
+// A DataSet of the examples of a mapped data set file, each an input frame
+// and a target frame holding its label (as MatDataSet with 1 target).
+//
+// The file is mapped read-only and shared: the input frames point in the
+// mapping and are not copied, so the processes that use the same file (the
+// points of a sweep, the runs on the same box) share the page cache, and
+// opening it does not read it. Only the labels are converted to reals, when
+// the file is opened.
+//
+// The inputs are float32, so this needs real to be float. The frame of an
+// example stays valid once the next one is set (see GatherMinibatch()).
+class MappedDataSet : public DataSet
+{
+  public:
+    void *mapping;
+    size_t mapping_size;
+    real *mapped_inputs;
+    real *labels;
+
+    // The input and target sequences of the examples, one frame each, which
+    // point in the mapping and in #labels#.
+    Sequence *example_inputs;
+    Sequence *example_targets;
+
+    // Loads the first #max_load# examples (all if -1). #n_inputs_# must be
+    // the one of the file.
+    MappedDataSet(const char *filename, int n_inputs_, int max_load=-1);
+
+    virtual void getNumberOfFrames(int t, int *n_input_frames, int *n_target_frames);
+    virtual void setRealExample(int t, bool set_inputs=true, bool set_targets=true);
+    // Not supported: the mapping is read-only.
+    virtual void preProcess(PreProcessing *pre_processing);
+    virtual void pushExample();
+    virtual void popExample();
+
+    virtual ~MappedDataSet();
+
+  private:
+    // The examples pushed by pushExample().
+    struct PushedExample
+    {
+      Sequence *inputs;
+      Sequence *targets;
+      real *input_frame;
+      real *target_frame;
+      int real_current_example_index;
+    };
+    PushedExample *pushed;
+    int n_pushed;
+    int n_pushed_allocated;
+};
+
+// Writes the examples of #data# (one input frame and a target frame holding
+// the label, as a MatDataSet with 1 target) to a mapped data set file. The
+// file is written next to #filename#, then renamed: a mapped data set file
+// is always complete.
+void SaveMappedDataSet(DataSet *data, const char *filename);
+
+}
+
+#endif  // TORCH_MAPPED_DATA_SET_H_
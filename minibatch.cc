@@ -0,0 +1,48 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "minibatch.h"
+
+namespace Torch {
+
+void GatherMinibatch(DataSet *data, int *indices, int n,
+                     Sequence *batch_inputs, Sequence *batch_targets)
+{
+  batch_inputs->resize(n, false);       // do not allocate memory!
+  batch_targets->resize(n, false);
+
+  bool has_inputs = false;
+  bool has_targets = false;
+  for(int b=0; b<n; b++)        {
+    data->setExample(indices[b]);
+
+    if(data->inputs)    {
+      if(data->inputs->n_frames != 1)
+        error("GatherMinibatch - examples must have exactly 1 frame!");
+      batch_inputs->frames[b] = data->inputs->frames[0];
+      has_inputs = true;
+    }
+    if(data->targets)   {
+      batch_targets->frames[b] = data->targets->frames[0];
+      has_targets = true;
+    }
+  }
+
+  if(has_inputs)
+    data->inputs = batch_inputs;
+  if(has_targets)
+    data->targets = batch_targets;
+}
+
+}
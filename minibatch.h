@@ -0,0 +1,40 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_MINIBATCH_H_
+#define TORCH_MINIBATCH_H_
+
+#include "DataSet.h"
+#include "Sequence.h"
+
+namespace Torch {
+
+// Sets the examples indices[0..n-1] of #data# one after the other and points
+// frame b of #batch_inputs# (#batch_targets#) to the single input (target)
+// frame of example indices[b]. #data#'s inputs and targets are then
+// redirected to the batch sequences, so that machines, criteria and
+// measurers looking at #data# see the whole minibatch.
+//
+// No copy is made. This assumes the examples have 1 frame and that the frame
+// of an example stays valid once the next example is set, which is the case
+// for the memory DataSets (MatDataSet, ClassFormatDataSet, ...).
+//
+// The batch sequences must have been created with the right frame size and
+// no frames: new(allocator) Sequence(0, frame_size).
+void GatherMinibatch(DataSet *data, int *indices, int n,
+                     Sequence *batch_inputs, Sequence *batch_targets);
+
+}
+
+#endif  // TORCH_MINIBATCH_H_
@@ -0,0 +1,400 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "model_batch_trainer.h"
+
+#include <math.h>
+#include <string.h>
+#include "random_streams.h"
+#include "Linear.h"
+#include "simd_kernels.h"
+
+namespace Torch {
+
+// Nonlinearities of the hidden layers
+enum {
+  MODEL_BATCH_SIGMOID = 0,
+  MODEL_BATCH_TANH,
+  MODEL_BATCH_NONLINEAR
+};
+
+static int NonlinearityCode(std::string nonlinearity)
+{
+  if(nonlinearity == "sigmoid")
+    return MODEL_BATCH_SIGMOID;
+  if(nonlinearity == "tanh")
+    return MODEL_BATCH_TANH;
+  if(nonlinearity == "nonlinear")
+    return MODEL_BATCH_NONLINEAR;
+  error("ModelBatchTrainer: unsupported nonlinearity %s", nonlinearity.c_str());
+  return -1;
+}
+
+ModelBatchTrainer::ModelBatchTrainer(StackedAutoencoder **saes_, int n_models_, ClassFormat *class_format_)
+{
+  saes = saes_;
+  n_models = n_models_;
+  class_format = class_format_;
+
+  addIOption("max iter", &max_iter, 1, "number of epochs");
+  addIOption("minibatch size", &minibatch_size, 1, "number of examples per parameter update");
+  addROption("learning rate decay", &learning_rate_decay, 0., "learning rate decay");
+
+  learning_rates = (real*)allocator->alloc(sizeof(real)*n_models);
+  for(int m=0; m<n_models; m++)
+    learning_rates[m] = 0.01;
+
+  StackedAutoencoder *sae = saes[0];
+  n_layers = sae->n_hidden_layers + 1;
+  n_units = (int*)allocator->alloc(sizeof(int)*(n_layers+1));
+  n_units[0] = sae->encoders[0]->n_inputs;
+  for(int l=0; l<sae->n_hidden_layers; l++)
+    n_units[l+1] = sae->encoders[l]->n_outputs;
+  n_units[n_layers] = sae->outputer->n_outputs;
+
+  NonlinearityCode(sae->nonlinearity);
+  for(int m=0; m<n_models; m++) {
+    StackedAutoencoder *sae_m = saes[m];
+    if(sae_m->n_hidden_layers != n_layers-1 || sae_m->nonlinearity != sae->nonlinearity
+       || sae_m->outputer->n_outputs != n_units[n_layers] || sae_m->outputer->nonlinearity != "logsoftmax")
+      error("ModelBatchTrainer: the models do not have the same topology");
+    for(int l=0; l<n_layers-1; l++)
+      if(sae_m->encoders[l]->n_inputs != n_units[l] || sae_m->encoders[l]->n_outputs != n_units[l+1])
+        error("ModelBatchTrainer: the models do not have the same topology");
+    if(sae_m->first_layer_smoothed)
+      error("ModelBatchTrainer: smoothed first layers are not supported");
+  }
+
+  weights = (real**)allocator->alloc(sizeof(real*)*n_layers);
+  biases = (real**)allocator->alloc(sizeof(real*)*n_layers);
+  weight_decays = (real**)allocator->alloc(sizeof(real*)*n_layers);
+  bias_decays = (real**)allocator->alloc(sizeof(real*)*n_layers);
+  for(int l=0; l<n_layers; l++) {
+    weights[l] = (real*)allocator->alloc(sizeof(real)*n_models*n_units[l+1]*n_units[l]);
+    biases[l] = (real*)allocator->alloc(sizeof(real)*n_models*n_units[l+1]);
+    weight_decays[l] = (real*)allocator->alloc(sizeof(real)*n_models);
+    bias_decays[l] = (real*)allocator->alloc(sizeof(real)*n_models);
+  }
+
+  // The minibatch buffers are allocated by Train().
+  inputs = NULL;
+  classes = NULL;
+  outputs = (real**)allocator->alloc(sizeof(real*)*n_layers);
+  deltas = (real**)allocator->alloc(sizeof(real*)*n_layers);
+  for(int l=0; l<n_layers; l++) {
+    outputs[l] = NULL;
+    deltas[l] = NULL;
+  }
+}
+
+// The Linear layer of the layer l of #sae# (the outputer for the last one).
+static Linear *LayerLinear(StackedAutoencoder *sae, int l)
+{
+  if(l < sae->n_hidden_layers)
+    return sae->encoders[l]->linear_layer;
+  return sae->outputer->linear_layer;
+}
+
+void ModelBatchTrainer::Import()
+{
+  bool warned = false;
+  for(int l=0; l<n_layers; l++) {
+    int n_in = n_units[l];
+    int n_out = n_units[l+1];
+    for(int m=0; m<n_models; m++)       {
+      Linear *linear = LayerLinear(saes[m], l);
+      memcpy(weights[l] + m*n_out*n_in, linear->weights, sizeof(real)*n_out*n_in);
+      memcpy(biases[l] + m*n_out, linear->bias, sizeof(real)*n_out);
+      weight_decays[l][m] = linear->weight_decay;
+      bias_decays[l][m] = linear->bias_decay;
+      if(linear->l1_weight_decay != 0. && !warned)      {
+        warning("ModelBatchTrainer: the l1 weight decay is ignored");
+        warned = true;
+      }
+    }
+  }
+}
+
+void ModelBatchTrainer::Export()
+{
+  for(int l=0; l<n_layers; l++) {
+    int n_in = n_units[l];
+    int n_out = n_units[l+1];
+    for(int m=0; m<n_models; m++)       {
+      Linear *linear = LayerLinear(saes[m], l);
+      memcpy(linear->weights, weights[l] + m*n_out*n_in, sizeof(real)*n_out*n_in);
+      memcpy(linear->bias, biases[l] + m*n_out, sizeof(real)*n_out);
+    }
+  }
+}
+
+void ModelBatchTrainer::Train(DataSet *data, MeasurerList **measurers, real *errs,
+                              XFile **resultsfiles)
+{
+  int n_train = data->n_examples;
+  int batch_size = (minibatch_size > 1 ? minibatch_size : 1);
+
+  message("ModelBatchTrainer: training %d models", n_models);
+  Import();
+
+  inputs = (real*)allocator->realloc(inputs, sizeof(real)*batch_size*n_units[0]);
+  classes = (int*)allocator->realloc(classes, sizeof(int)*batch_size);
+  for(int l=0; l<n_layers; l++) {
+    outputs[l] = (real*)allocator->realloc(outputs[l], sizeof(real)*batch_size*n_models*n_units[l+1]);
+    deltas[l] = (real*)allocator->realloc(deltas[l], sizeof(real)*batch_size*n_models*n_units[l+1]);
+  }
+
+  if(measurers) {
+    for(int m=0; m<n_models; m++)
+      if(measurers[m])
+        for(int i=0; i<measurers[m]->n_nodes; i++)
+          measurers[m]->nodes[i]->reset();
+
+    // The measures before training.
+    for(int m=0; m<n_models; m++)       {
+      if(!measurers[m])
+        continue;
+      Measure(saes[m], measurers[m]);
+      if(resultsfiles && resultsfiles[m])
+        WriteResults(data, measurers[m], resultsfiles[m]);
+    }
+  }
+
+  // The same shuffle for all the models.
+  int *shuffle = (int*)Allocator::sysAlloc(sizeof(int)*n_train);
+  RandomStream shuffle_rng(RANDOM_STREAM_SHUFFLE);
+  shuffle_rng.Shuffle(n_train, shuffle);
+
+  real *lrs = (real*)Allocator::sysAlloc(sizeof(real)*n_models);
+  real *epoch_errs = (real*)Allocator::sysAlloc(sizeof(real)*n_models);
+  for(int iter=0; iter<max_iter; iter++)        {
+    for(int m=0; m<n_models; m++)       {
+      lrs[m] = learning_rates[m]/(1.+((real)iter)*learning_rate_decay);
+      epoch_errs[m] = 0.;
+    }
+
+    for(int first=0; first<n_train; first+=batch_size)  {
+      int n = (n_train - first < batch_size ? n_train - first : batch_size);
+      Step(data, shuffle + first, n, lrs, epoch_errs);
+    }
+
+    Export();
+    if(measurers)       {
+      for(int m=0; m<n_models; m++)
+        if(measurers[m])        {
+          Measure(saes[m], measurers[m]);
+          if(resultsfiles && resultsfiles[m])
+            WriteResults(data, measurers[m], resultsfiles[m]);
+        }
+    }
+    print(".");
+  }
+  print("\n");
+
+  if(measurers) {
+    for(int m=0; m<n_models; m++)
+      if(measurers[m])
+        for(int i=0; i<measurers[m]->n_nodes; i++)
+          measurers[m]->nodes[i]->measureEnd();
+  }
+  if(errs)      {
+    for(int m=0; m<n_models; m++)
+      errs[m] = epoch_errs[m] / (real)n_train;
+  }
+
+  free(epoch_errs);
+  free(lrs);
+  free(shuffle);
+}
+
+void ModelBatchTrainer::Step(DataSet *data, int *indices, int n, real *lrs, real *errs)
+{
+  int n_inputs = n_units[0];
+  for(int b=0; b<n; b++)        {
+    data->setExample(indices[b]);
+    memcpy(inputs + b*n_inputs, data->inputs->frames[0], sizeof(real)*n_inputs);
+    classes[b] = class_format->getClass(data->targets->frames[0]);
+  }
+
+  int nonlinearity = NonlinearityCode(saes[0]->nonlinearity);
+  int M = n_models;
+
+  // Forward. The first layer's inputs are the same for all the models, whose
+  // rows then make a single matrix of M*n_out rows.
+  for(int l=0; l<n_layers; l++) {
+    int n_in = n_units[l];
+    int n_out = n_units[l+1];
+    real *outputs_ = outputs[l];
+
+    for(int r=0; r<M*n_out; r++)        {
+      int m = r / n_out;
+      real *w = weights[l] + r*n_in;
+      real bias = biases[l][r];
+      for(int b=0; b<n; b++)
+        outputs_[b*M*n_out + r] = SimdDot(n_in, w, LayerInputs(l, b, m)) + bias;
+    }
+
+    if(l < n_layers-1)  {
+      int size = n*M*n_out;
+      if(nonlinearity == MODEL_BATCH_SIGMOID) {
+        for(int i=0; i<size; i++)
+          outputs_[i] = 1./(1.+exp(-outputs_[i]));
+      } else if(nonlinearity == MODEL_BATCH_TANH)       {
+        for(int i=0; i<size; i++)
+          outputs_[i] = tanh(outputs_[i]);
+      } else    {
+        for(int i=0; i<size; i++)
+          outputs_[i] = 0.5 * (outputs_[i]/(1.0 + fabs(outputs_[i])) + 1.);
+      }
+    }   else    {
+      // Log-softmax, and the derivative of the nll with respect to the
+      // pre-activations: the probabilities minus the one-hot target.
+      for(int b=0; b<n; b++)    {
+        for(int m=0; m<M; m++)  {
+          real *z = outputs_ + (b*M + m)*n_out;
+          real *delta = deltas[l] + (b*M + m)*n_out;
+          real max_z = z[0];
+          for(int j=1; j<n_out; j++)
+            if(z[j] > max_z)
+              max_z = z[j];
+          real sum = 0.;
+          for(int j=0; j<n_out; j++)
+            sum += exp(z[j] - max_z);
+          real log_sum = max_z + log(sum);
+          for(int j=0; j<n_out; j++)    {
+            z[j] -= log_sum;
+            delta[j] = exp(z[j]);
+          }
+          delta[classes[b]] -= 1.;
+          errs[m] -= z[classes[b]];
+        }
+      }
+    }
+  }
+
+  // Backward and update, from the top. The derivatives of the layer below
+  // are computed with the weights before their update.
+  for(int l=n_layers-1; l>=0; l--)      {
+    int n_in = n_units[l];
+    int n_out = n_units[l+1];
+    real *deltas_ = deltas[l];
+
+    if(l > 0)   {
+      real *prev_deltas = deltas[l-1];
+      for(int i=0; i<n*M*n_in; i++)
+        prev_deltas[i] = 0.;
+      for(int r=0; r<M*n_out; r++)      {
+        int m = r / n_out;
+        real *w = weights[l] + r*n_in;
+        for(int b=0; b<n; b++)
+          SimdAxpy(n_in, deltas_[b*M*n_out + r], w, prev_deltas + (b*M + m)*n_in);
+      }
+
+      real *a = outputs[l-1];
+      int size = n*M*n_in;
+      if(nonlinearity == MODEL_BATCH_SIGMOID) {
+        for(int i=0; i<size; i++)
+          prev_deltas[i] *= a[i]*(1.-a[i]);
+      } else if(nonlinearity == MODEL_BATCH_TANH)       {
+        for(int i=0; i<size; i++)
+          prev_deltas[i] *= 1.-a[i]*a[i];
+      } else    {
+        // a = (s+1)/2 with s = z/(1+|z|), and 1/(1+|z|) = 1-|s|.
+        for(int i=0; i<size; i++)       {
+          real c = 1. - fabs(2.*a[i]-1.);
+          prev_deltas[i] *= 0.5*c*c;
+        }
+      }
+    }
+
+    // The decays are applied once per minibatch, as the gradient is.
+    for(int r=0; r<M*n_out; r++)        {
+      int m = r / n_out;
+      real lr = lrs[m];
+      real *w = weights[l] + r*n_in;
+      if(weight_decays[l][m] != 0.)
+        SimdScale(n_in, 1. - lr*weight_decays[l][m], w, w);
+      real der_bias = 0.;
+      for(int b=0; b<n; b++)    {
+        real delta = deltas_[b*M*n_out + r];
+        der_bias += delta;
+        SimdAxpy(n_in, -lr*delta/(real)n, LayerInputs(l, b, m), w);
+      }
+      biases[l][r] -= lr*(der_bias/(real)n + bias_decays[l][m]*biases[l][r]);
+    }
+  }
+}
+
+real *ModelBatchTrainer::LayerInputs(int l, int b, int m)
+{
+  if(l == 0)
+    return inputs + b*n_units[0];
+  return outputs[l-1] + (b*n_models + m)*n_units[l];
+}
+
+void ModelBatchTrainer::Measure(GradientMachine *machine, MeasurerList *measurers)
+{
+  // There are a few measurers at most: a DataSet is measured at its first
+  // measurer.
+  for(int i=0; i<measurers->n_nodes; i++)       {
+    DataSet *dataset = measurers->nodes[i]->data;
+    bool is_new = true;
+    for(int k=0; k<i; k++)
+      if(measurers->nodes[k]->data == dataset)
+        is_new = false;
+    if(!is_new)
+      continue;
+
+    for(int t=0; t<dataset->n_examples; t++)    {
+      dataset->setExample(t);
+      machine->forward(dataset->inputs);
+      for(int k=i; k<measurers->n_nodes; k++)
+        if(measurers->nodes[k]->data == dataset)
+          measurers->nodes[k]->measureExample();
+    }
+    for(int k=i; k<measurers->n_nodes; k++)
+      if(measurers->nodes[k]->data == dataset)
+        measurers->nodes[k]->measureIteration();
+  }
+}
+
+void ModelBatchTrainer::WriteResults(DataSet *data, MeasurerList *measurers, XFile *file)
+{
+  // The order of Trainer::extractMeasurers: the training set, then the other
+  // DataSets in the order they first appear.
+  for(int i=0; i<measurers->n_nodes; i++)
+    if(measurers->nodes[i]->data == data)
+      file->printf("%g ", measurers->nodes[i]->current_error);
+  for(int i=0; i<measurers->n_nodes; i++)       {
+    DataSet *dataset = measurers->nodes[i]->data;
+    bool is_new = (dataset != data);
+    for(int k=0; k<i; k++)
+      if(measurers->nodes[k]->data == dataset)
+        is_new = false;
+    if(!is_new)
+      continue;
+    for(int k=i; k<measurers->n_nodes; k++)
+      if(measurers->nodes[k]->data == dataset)
+        file->printf("%g ", measurers->nodes[k]->current_error);
+  }
+  file->printf("\n");
+  file->flush();
+}
+
+ModelBatchTrainer::~ModelBatchTrainer()
+{
+}
+
+}
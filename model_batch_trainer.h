@@ -0,0 +1,118 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_MODEL_BATCH_TRAINER_H_
+#define TORCH_MODEL_BATCH_TRAINER_H_
+
+#include "Object.h"
+#include "DataSet.h"
+#include "ClassFormat.h"
+#include "Trainer.h"         // for MeasurerList!
+#include "stacked_autoencoder.h"
+
+namespace Torch {
+
+// Trains the supervised network (encoders and logsoftmax outputer, with the
+// nll cost) of #n_models# StackedAutoencoders of the same topology at once,
+// with minibatch SGD.
+//
+// The models see the same examples in the same order, so their first layers
+// share their inputs: their weights are stacked into a single matrix of
+// n_models times n_hidden rows, and the first layer of all the models is one
+// product of that matrix with the minibatch. The layers above are a product
+// per model, over the whole minibatch. Small models then make long loops
+// instead of many short ones.
+//
+// Each model keeps its learning rate (#learning_rates#), its weight and bias
+// decays (those of its Linear layers; the l1 decay is ignored) and its
+// initialization, done by whoever built it (with its own seed). The models'
+// parameters are copied in at the beginning of Train() and copied back after
+// each epoch, when each model's #measurers# measure it on their DataSets.
+//
+// Only the supervised phase is batched. It has no corruption; a noisy model
+// is trained through its clean encoders, as in the supervised phase of
+// StackedAutoencoderTrainer.
+//
+// stacked_autoencoder_main batches the points of a sweep with it
+// (-sweep_batch), when they have no unsupervised phase: the unsupervised
+// phases, and their corruption, still train one model at a time.
+class ModelBatchTrainer : public Object
+{
+  public:
+    int n_models;
+    StackedAutoencoder **saes;
+    ClassFormat *class_format;
+    real *learning_rates;
+
+    int max_iter;
+    int minibatch_size;
+    real learning_rate_decay;
+
+    // Topology: n_units[0] inputs, n_units[l+1] outputs for the layer l, the
+    // outputer being the layer n_layers-1.
+    int n_layers;
+    int *n_units;
+
+    // Layer l: the n_units[l+1] rows of n_units[l] weights of each model, then
+    // the biases of each model.
+    real **weights;
+    real **biases;
+    real **weight_decays;       // per layer and model
+    real **bias_decays;
+
+    // Minibatch: the inputs, then for each layer the outputs of all the
+    // models, example by example (the models one after the other), and the
+    // derivatives of the cost with respect to the pre-activations.
+    real *inputs;
+    int *classes;
+    real **outputs;
+    real **deltas;
+
+    // The SAEs must be built with the same topology.
+    ModelBatchTrainer(StackedAutoencoder **saes_, int n_models_, ClassFormat *class_format_);
+
+    // Trains the models on #data#, whose targets #class_format# understands,
+    // for "max iter" epochs. #measurers# has a list per model, or is NULL;
+    // they measure the models before the first epoch too, as
+    // StochasticGradientPlus does. #resultsfiles#, if not NULL, has a file
+    // (or NULL) per model, which gets a line of errors per measure in the
+    // layout of StochasticGradientPlus::resultsfile. Leaves the mean cost of
+    // each model over the last epoch in #errs# if not NULL.
+    virtual void Train(DataSet *data, MeasurerList **measurers, real *errs=NULL,
+                       XFile **resultsfiles=NULL);
+
+    // Copies the parameters of the models into the stacked arrays, and back.
+    virtual void Import();
+    virtual void Export();
+
+    // One SGD step of each model on the #n# examples of #indices#, model m
+    // with the learning rate lrs[m]. The sum of the costs of model m is added
+    // to errs[m].
+    virtual void Step(DataSet *data, int *indices, int n, real *lrs, real *errs);
+    // Inputs of the layer #l# of the model #m# for the example #b# of the
+    // minibatch.
+    real *LayerInputs(int l, int b, int m);
+    // Has #measurers# measure #machine# (one forward per example of each of
+    // their DataSets).
+    virtual void Measure(GradientMachine *machine, MeasurerList *measurers);
+    // Writes the current errors of #measurers# on a line of #file#: those
+    // on #data# first, then those of each other DataSet.
+    void WriteResults(DataSet *data, MeasurerList *measurers, XFile *file);
+
+    virtual ~ModelBatchTrainer();
+};
+
+}
+
+#endif  // TORCH_MODEL_BATCH_TRAINER_H_
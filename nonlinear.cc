@@ -13,15 +13,22 @@
 // limitations under the License.
 //
 #include "nonlinear.h"
+#include "fast_math.h"
 
 namespace Torch {
 
 Nonlinear::Nonlinear(int n_units) : GradientMachine(n_units, n_units)
 {
+  addBOption("fast math", &fast_math, GetFastMathDefault(), "use the fast_math version");
 }
 
 void Nonlinear::frameForward(int t, real *f_inputs, real *f_outputs)
 {
+  if(fast_math) {
+    FastSoftsignArray(n_inputs, f_inputs, f_outputs);
+    return;
+  }
+
   for(int i = 0; i < n_inputs; i++)     {
     f_outputs[i] = 0.5 * (f_inputs[i]/(1.0 + fabs(f_inputs[i])) + 1.);
   }
@@ -26,9 +26,13 @@ namespace Torch {
 //  Formally speaking, $ouputs[i] = nonlinear(inputs[i])$, where:
 //    nonlinear(x) = 0.5 * ( x / (1 + abs(x)) + 1)
 //  so the output is between 0 and 1.
+//
+//  With the "fast math" option (defaults to GetFastMathDefault()), the
+//  forward uses the vectorized FastSoftsignArray of fast_math.h.
 class Nonlinear : public GradientMachine
 {
   public:
+    bool fast_math;
 
     /// Create a layer with #n_units# units.
     Nonlinear(int n_units);
@@ -0,0 +1,253 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "optimizer.h"
+#include "simd_kernels.h"
+
+#include <math.h>
+
+namespace Torch {
+
+Optimizer::Optimizer()
+{
+  n_groups = 0;
+  group_params = NULL;
+  group_sizes = NULL;
+  group_states = NULL;
+  group_steps = NULL;
+
+  pthread_mutex_init(&groups_mutex, NULL);
+}
+
+// There are a few dozens groups at most.
+int Optimizer::Group(real *params, int n)
+{
+  for(int i=0; i<n_groups; i++)
+    if(group_params[i] == params)
+      return i;
+
+  group_params = (real**)allocator->realloc(group_params, sizeof(real*)*(n_groups+1));
+  group_sizes = (int*)allocator->realloc(group_sizes, sizeof(int)*(n_groups+1));
+  group_states = (real**)allocator->realloc(group_states, sizeof(real*)*(n_groups+1));
+  group_steps = (long long*)allocator->realloc(group_steps, sizeof(long long)*(n_groups+1));
+
+  int state_size = NStateArrays() * n;
+  group_params[n_groups] = params;
+  group_sizes[n_groups] = n;
+  group_states[n_groups] = NULL;
+  if(state_size > 0)    {
+    group_states[n_groups] = (real*)allocator->alloc(sizeof(real)*state_size);
+    for(int j=0; j<state_size; j++)
+      group_states[n_groups][j] = 0.;
+  }
+  group_steps[n_groups] = 0;
+  return n_groups++;
+}
+
+void Optimizer::Update(real *params, real *der_params, int n, real learning_rate)
+{
+  pthread_mutex_lock(&groups_mutex);
+  int g = Group(params, n);
+  long long step = ++group_steps[g];
+  real *state = group_states[g];
+  pthread_mutex_unlock(&groups_mutex);
+
+  UpdateGroup(params, der_params, n, learning_rate, state, step);
+}
+
+void Optimizer::SaveState(XFile *file, Parameters *params)
+{
+  int type = Type();
+  int n_state_arrays = NStateArrays();
+  file->taggedWrite(&type, sizeof(int), 1, "optimizer");
+  file->taggedWrite(&n_state_arrays, sizeof(int), 1, "optimizer state arrays");
+
+  for(int i=0; i<params->n_data; i++)   {
+    pthread_mutex_lock(&groups_mutex);
+    int g = Group(params->data[i], params->size[i]);
+    pthread_mutex_unlock(&groups_mutex);
+
+    file->taggedWrite(&group_steps[g], sizeof(long long), 1, "optimizer steps");
+    if(n_state_arrays > 0)
+      file->taggedWrite(group_states[g], sizeof(real), n_state_arrays*group_sizes[g], "optimizer state");
+  }
+}
+
+void Optimizer::LoadState(XFile *file, Parameters *params)
+{
+  int type;
+  int n_state_arrays;
+  file->taggedRead(&type, sizeof(int), 1, "optimizer");
+  file->taggedRead(&n_state_arrays, sizeof(int), 1, "optimizer state arrays");
+  if(type != Type() || n_state_arrays != NStateArrays())
+    error("Optimizer: the saved state is not the state of this optimizer");
+
+  for(int i=0; i<params->n_data; i++)   {
+    pthread_mutex_lock(&groups_mutex);
+    int g = Group(params->data[i], params->size[i]);
+    pthread_mutex_unlock(&groups_mutex);
+
+    file->taggedRead(&group_steps[g], sizeof(long long), 1, "optimizer steps");
+    if(n_state_arrays > 0)
+      file->taggedRead(group_states[g], sizeof(real), n_state_arrays*group_sizes[g], "optimizer state");
+  }
+}
+
+Optimizer::~Optimizer()
+{
+  pthread_mutex_destroy(&groups_mutex);
+}
+
+// --- SGD ---
+
+SgdOptimizer::SgdOptimizer()
+{
+  addROption("momentum", &momentum, 0., "momentum");
+  addBOption("nesterov", &nesterov, false, "Nesterov's momentum");
+}
+
+void SgdOptimizer::UpdateGroup(real *params, real *der_params, int n, real learning_rate,
+                               real *state, long long step)
+{
+  if(state)
+    SimdMomentumUpdate(n, learning_rate, momentum, nesterov, der_params, state, params);
+  else
+    SimdAxpy(n, -learning_rate, der_params, params);
+}
+
+int SgdOptimizer::NStateArrays()
+{
+  return momentum != 0. ? 1 : 0;
+}
+
+OptimizerType SgdOptimizer::Type()
+{
+  return OPTIMIZER_SGD;
+}
+
+SgdOptimizer::~SgdOptimizer()
+{
+}
+
+// --- AdaGrad ---
+
+AdagradOptimizer::AdagradOptimizer()
+{
+  addROption("epsilon", &epsilon, 1e-6, "added to the root of the sum of squares");
+}
+
+void AdagradOptimizer::UpdateGroup(real *params, real *der_params, int n, real learning_rate,
+                                   real *state, long long step)
+{
+  SimdRmsUpdate(n, learning_rate, 1., 1., epsilon, der_params, state, params);
+}
+
+int AdagradOptimizer::NStateArrays()
+{
+  return 1;
+}
+
+OptimizerType AdagradOptimizer::Type()
+{
+  return OPTIMIZER_ADAGRAD;
+}
+
+AdagradOptimizer::~AdagradOptimizer()
+{
+}
+
+// --- RMSProp ---
+
+RmspropOptimizer::RmspropOptimizer()
+{
+  addROption("rho", &rho, 0.9, "decay of the running average of the squares");
+  addROption("epsilon", &epsilon, 1e-6, "added to the root of the average of the squares");
+}
+
+void RmspropOptimizer::UpdateGroup(real *params, real *der_params, int n, real learning_rate,
+                                   real *state, long long step)
+{
+  SimdRmsUpdate(n, learning_rate, rho, 1. - rho, epsilon, der_params, state, params);
+}
+
+int RmspropOptimizer::NStateArrays()
+{
+  return 1;
+}
+
+OptimizerType RmspropOptimizer::Type()
+{
+  return OPTIMIZER_RMSPROP;
+}
+
+RmspropOptimizer::~RmspropOptimizer()
+{
+}
+
+// --- Adam ---
+
+AdamOptimizer::AdamOptimizer()
+{
+  addROption("beta1", &beta1, 0.9, "decay of the running average of the derivatives");
+  addROption("beta2", &beta2, 0.999, "decay of the running average of the squares");
+  addROption("epsilon", &epsilon, 1e-6, "added to the root of the average of the squares");
+}
+
+void AdamOptimizer::UpdateGroup(real *params, real *der_params, int n, real learning_rate,
+                                real *state, long long step)
+{
+  // The bias corrections of both averages, folded into the learning rate and
+  // epsilon.
+  double correction1 = 1. - pow((double)beta1, (double)step);
+  double correction2 = sqrt(1. - pow((double)beta2, (double)step));
+  SimdAdamUpdate(n, (real)(learning_rate * correction2 / correction1), beta1, beta2,
+                 (real)(epsilon * correction2), der_params, state, state + n, params);
+}
+
+int AdamOptimizer::NStateArrays()
+{
+  return 2;
+}
+
+OptimizerType AdamOptimizer::Type()
+{
+  return OPTIMIZER_ADAM;
+}
+
+AdamOptimizer::~AdamOptimizer()
+{
+}
+
+Optimizer *NewOptimizer(Allocator *allocator, std::string name)
+{
+  if(name == "sgd")
+    return new(allocator) SgdOptimizer();
+  if(name == "momentum" || name == "nesterov")  {
+    Optimizer *optimizer = new(allocator) SgdOptimizer();
+    optimizer->setROption("momentum", 0.9);
+    optimizer->setBOption("nesterov", name == "nesterov");
+    return optimizer;
+  }
+  if(name == "adagrad")
+    return new(allocator) AdagradOptimizer();
+  if(name == "rmsprop")
+    return new(allocator) RmspropOptimizer();
+  if(name == "adam")
+    return new(allocator) AdamOptimizer();
+
+  error("NewOptimizer: unknown optimizer %s", name.c_str());
+  return NULL;
+}
+
+}
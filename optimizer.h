@@ -0,0 +1,147 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_OPTIMIZER_H_
+#define TORCH_OPTIMIZER_H_
+
+#include <pthread.h>
+
+#include <string>
+
+#include "Object.h"
+#include "Parameters.h"
+#include "XFile.h"
+
+namespace Torch {
+
+enum OptimizerType {
+  OPTIMIZER_SGD = 0,
+  OPTIMIZER_ADAGRAD,
+  OPTIMIZER_RMSPROP,
+  OPTIMIZER_ADAM
+};
+
+// Update rule applied by StochasticGradientPlus to the parameters, given
+// their derivatives averaged over the minibatch and a learning rate (already
+// decayed). AdaGrad, RMSProp and Adam are invariant to the scale of the
+// gradient, so their step (and the weight of epsilon) does not depend on the
+// minibatch size.
+//
+// Each parameter array is a group with its own state (velocity, running
+// averages, number of updates), created at its first update and found by the
+// array's address. The trainers pass the shared arrays, so replicas using the
+// master's optimizer update the same state. With Hogwild, like the
+// parameters, the state is updated without locks.
+//
+// The updates are the fused kernels of simd_kernels.h. The options must be
+// set before the first update.
+class Optimizer : public Object
+{
+  public:
+    int n_groups;
+    real **group_params;
+    int *group_sizes;
+    // NStateArrays() arrays of group_sizes[i] reals, one after the other.
+    real **group_states;
+    long long *group_steps;
+
+    Optimizer();
+
+    // Updates the #n# parameters #params# in place with their derivatives
+    // #der_params#.
+    virtual void Update(real *params, real *der_params, int n, real learning_rate);
+
+    // The update of one group. #step# counts the updates, this one included.
+    virtual void UpdateGroup(real *params, real *der_params, int n, real learning_rate,
+                             real *state, long long step) = 0;
+    virtual int NStateArrays() = 0;
+    virtual OptimizerType Type() = 0;
+
+    // Saves (loads) the state of the groups of the arrays of #params#, in
+    // their order. Arrays never updated have a null state.
+    virtual void SaveState(XFile *file, Parameters *params);
+    virtual void LoadState(XFile *file, Parameters *params);
+
+    virtual ~Optimizer();
+
+  private:
+    pthread_mutex_t groups_mutex;
+
+    // Index of the group of #params#, created if needed.
+    int Group(real *params, int n);
+};
+
+// SGD, with momentum if "momentum" > 0, Nesterov's if "nesterov".
+class SgdOptimizer : public Optimizer
+{
+  public:
+    real momentum;
+    bool nesterov;
+
+    SgdOptimizer();
+    virtual void UpdateGroup(real *params, real *der_params, int n, real learning_rate,
+                             real *state, long long step);
+    virtual int NStateArrays();
+    virtual OptimizerType Type();
+    virtual ~SgdOptimizer();
+};
+
+class AdagradOptimizer : public Optimizer
+{
+  public:
+    real epsilon;
+
+    AdagradOptimizer();
+    virtual void UpdateGroup(real *params, real *der_params, int n, real learning_rate,
+                             real *state, long long step);
+    virtual int NStateArrays();
+    virtual OptimizerType Type();
+    virtual ~AdagradOptimizer();
+};
+
+class RmspropOptimizer : public Optimizer
+{
+  public:
+    real rho;
+    real epsilon;
+
+    RmspropOptimizer();
+    virtual void UpdateGroup(real *params, real *der_params, int n, real learning_rate,
+                             real *state, long long step);
+    virtual int NStateArrays();
+    virtual OptimizerType Type();
+    virtual ~RmspropOptimizer();
+};
+
+class AdamOptimizer : public Optimizer
+{
+  public:
+    real beta1;
+    real beta2;
+    real epsilon;
+
+    AdamOptimizer();
+    virtual void UpdateGroup(real *params, real *der_params, int n, real learning_rate,
+                             real *state, long long step);
+    virtual int NStateArrays();
+    virtual OptimizerType Type();
+    virtual ~AdamOptimizer();
+};
+
+// "sgd", "momentum", "nesterov", "adagrad", "rmsprop" or "adam".
+Optimizer *NewOptimizer(Allocator *allocator, std::string name);
+
+}
+
+#endif  // TORCH_OPTIMIZER_H_
@@ -0,0 +1,220 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "philox.h"
+#include "simd_kernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PHILOX_X86
+#include <immintrin.h>
+#endif
+
+namespace Torch {
+
+// A word of a Bernoulli mask is made of the 8 blocks (c, 0, s0, s1),
+// c = first..first+7: bit 4*b + j is set iff output j of block b is below
+// #threshold#.
+static unsigned int MaskWord(unsigned int first, unsigned int s0, unsigned int s1,
+                             unsigned int k0, unsigned int k1,
+                             unsigned long long threshold)
+{
+  unsigned int word = 0;
+  for(int b=0; b<8; b++)        {
+    unsigned int draws[4];
+    Philox4x32(first + b, 0, s0, s1, k0, k1, draws);
+    for(int j=0; j<4; j++)
+      word |= (unsigned int)((unsigned long long)draws[j] < threshold) << (4*b + j);
+  }
+  return word;
+}
+
+#ifdef PHILOX_X86
+
+// Moves bit b of the 8 bits #x# to bit 4*b.
+static inline unsigned int Spread8(unsigned int x)
+{
+  x = (x | (x << 12)) & 0x000F000FU;
+  x = (x | (x << 6)) & 0x03030303U;
+  x = (x | (x << 3)) & 0x11111111U;
+  return x;
+}
+
+// The vector versions keep each 32 bits word of the state in a 64 bits lane,
+// so that _mm*_mul_epu32 gives the full products: 4 blocks per AVX2 vector,
+// 8 per AVX-512 vector. The comparisons are done on the vectors too.
+
+__attribute__((target("avx2")))
+static unsigned int MaskWordAvx2(unsigned int first, unsigned int s0, unsigned int s1,
+                                 unsigned int k0, unsigned int k1,
+                                 unsigned long long threshold)
+{
+  const __m256i m0 = _mm256_set1_epi64x(0xD2511F53LL);
+  const __m256i m1 = _mm256_set1_epi64x(0xCD9E8D57LL);
+  const __m256i low = _mm256_set1_epi64x(0xFFFFFFFFLL);
+  const __m256i thr = _mm256_set1_epi64x((long long)threshold);
+
+  unsigned int lt[4] = {0, 0, 0, 0};
+  for(int h=0; h<2; h++)        {
+    long long f = (long long)first + 4*h;
+    __m256i c0 = _mm256_setr_epi64x(f, f+1, f+2, f+3);
+    __m256i c1 = _mm256_setzero_si256();
+    __m256i c2 = _mm256_set1_epi64x(s0);
+    __m256i c3 = _mm256_set1_epi64x(s1);
+    unsigned int kk0 = k0;
+    unsigned int kk1 = k1;
+
+    for(int r=0; r<10; r++)     {
+      __m256i p0 = _mm256_mul_epu32(c0, m0);
+      __m256i p1 = _mm256_mul_epu32(c2, m1);
+      __m256i n0 = _mm256_xor_si256(_mm256_xor_si256(_mm256_srli_epi64(p1, 32), c1),
+                                    _mm256_set1_epi64x(kk0));
+      __m256i n2 = _mm256_xor_si256(_mm256_xor_si256(_mm256_srli_epi64(p0, 32), c3),
+                                    _mm256_set1_epi64x(kk1));
+      c1 = _mm256_and_si256(p1, low);
+      c3 = _mm256_and_si256(p0, low);
+      c0 = n0;
+      c2 = n2;
+      kk0 += 0x9E3779B9U;
+      kk1 += 0xBB67AE85U;
+    }
+
+    // The lanes hold values below 2^32, the signed comparison is fine.
+    lt[0] |= _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(thr, c0))) << (4*h);
+    lt[1] |= _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(thr, c1))) << (4*h);
+    lt[2] |= _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(thr, c2))) << (4*h);
+    lt[3] |= _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(thr, c3))) << (4*h);
+  }
+
+  return Spread8(lt[0]) | (Spread8(lt[1]) << 1) | (Spread8(lt[2]) << 2) | (Spread8(lt[3]) << 3);
+}
+
+// GCC 12 warns about uninitialized variables inside its own avx512fintrin.h
+// when _mm512_mul_epu32 and _mm512_srli_epi64 are inlined here (a false
+// positive of the header).
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+__attribute__((target("avx512f")))
+static unsigned int MaskWordAvx512(unsigned int first, unsigned int s0, unsigned int s1,
+                                   unsigned int k0, unsigned int k1,
+                                   unsigned long long threshold)
+{
+  const __m512i m0 = _mm512_set1_epi64(0xD2511F53LL);
+  const __m512i m1 = _mm512_set1_epi64(0xCD9E8D57LL);
+  const __m512i low = _mm512_set1_epi64(0xFFFFFFFFLL);
+  const __m512i thr = _mm512_set1_epi64((long long)threshold);
+
+  long long f = first;
+  __m512i c0 = _mm512_setr_epi64(f, f+1, f+2, f+3, f+4, f+5, f+6, f+7);
+  __m512i c1 = _mm512_setzero_si512();
+  __m512i c2 = _mm512_set1_epi64(s0);
+  __m512i c3 = _mm512_set1_epi64(s1);
+
+  for(int r=0; r<10; r++)       {
+    __m512i p0 = _mm512_mul_epu32(c0, m0);
+    __m512i p1 = _mm512_mul_epu32(c2, m1);
+    __m512i n0 = _mm512_xor_si512(_mm512_xor_si512(_mm512_srli_epi64(p1, 32), c1),
+                                  _mm512_set1_epi64(k0));
+    __m512i n2 = _mm512_xor_si512(_mm512_xor_si512(_mm512_srli_epi64(p0, 32), c3),
+                                  _mm512_set1_epi64(k1));
+    c1 = _mm512_and_si512(p1, low);
+    c3 = _mm512_and_si512(p0, low);
+    c0 = n0;
+    c2 = n2;
+    k0 += 0x9E3779B9U;
+    k1 += 0xBB67AE85U;
+  }
+
+  unsigned int lt0 = _mm512_cmplt_epu64_mask(c0, thr);
+  unsigned int lt1 = _mm512_cmplt_epu64_mask(c1, thr);
+  unsigned int lt2 = _mm512_cmplt_epu64_mask(c2, thr);
+  unsigned int lt3 = _mm512_cmplt_epu64_mask(c3, thr);
+  return Spread8(lt0) | (Spread8(lt1) << 1) | (Spread8(lt2) << 2) | (Spread8(lt3) << 3);
+}
+#pragma GCC diagnostic pop
+
+#endif  // PHILOX_X86
+
+// The words are computed with the vector instructions of the simd_kernels
+// level.
+void PhiloxBernoulliMask(unsigned int k0, unsigned int k1, unsigned long long stream,
+                         int n, real prob, unsigned int *mask)
+{
+  // bit set iff draw < threshold, so P(set) = threshold / 2^32
+  unsigned long long threshold;
+  if(prob <= 0.)
+    threshold = 0;
+  else if(prob >= 1.)
+    threshold = 1ULL << 32;
+  else
+    threshold = (unsigned long long)(prob * 4294967296.0);
+
+  unsigned int s0 = (unsigned int)stream;
+  unsigned int s1 = (unsigned int)(stream >> 32);
+
+  unsigned int (*mask_word)(unsigned int, unsigned int, unsigned int,
+                            unsigned int, unsigned int, unsigned long long) = MaskWord;
+#ifdef PHILOX_X86
+  if(SimdKernelsGetLevel() == SIMD_KERNELS_AVX512)
+    mask_word = MaskWordAvx512;
+  else if(SimdKernelsGetLevel() == SIMD_KERNELS_AVX2)
+    mask_word = MaskWordAvx2;
+#endif
+
+  int n_words = (n + 31) / 32;
+  for(int w=0; w<n_words; w++)
+    mask[w] = mask_word((unsigned int)(w*8), s0, s1, k0, k1, threshold);
+
+  if(n % 32)
+    mask[n_words-1] &= (1U << (n % 32)) - 1;
+}
+
+void PhiloxUniform(unsigned int k0, unsigned int k1, unsigned long long stream,
+                   int n, real *outputs)
+{
+  unsigned int s0 = (unsigned int)stream;
+  unsigned int s1 = (unsigned int)(stream >> 32);
+
+  for(int i=0; i<n; i+=4)       {
+    unsigned int draws[4];
+    Philox4x32((unsigned int)(i/4), 0, s0, s1, k0, k1, draws);
+    for(int j=0; j<4 && i+j<n; j++)
+      outputs[i+j] = PhiloxBitsToUniform(draws[j]);
+  }
+}
+
+void PhiloxShuffle(unsigned int k0, unsigned int k1, unsigned long long stream,
+                   int n, int *indices)
+{
+  unsigned int s0 = (unsigned int)stream;
+  unsigned int s1 = (unsigned int)(stream >> 32);
+
+  for(int i=0; i<n; i++)
+    indices[i] = i;
+
+  unsigned int draws[4];
+  int block = -1;
+  for(int i=n-1; i>0; i--)      {
+    if((i-1)/4 != block)        {
+      block = (i-1)/4;
+      Philox4x32((unsigned int)block, 0, s0, s1, k0, k1, draws);
+    }
+    // j uniform in [0,i] (up to a bias of (i+1)/2^32)
+    int j = (int)(((unsigned long long)draws[(i-1)%4] * (unsigned long long)(i+1)) >> 32);
+    int tmp = indices[i];
+    indices[i] = indices[j];
+    indices[j] = tmp;
+  }
+}
+
+}
@@ -0,0 +1,91 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_PHILOX_H_
+#define TORCH_PHILOX_H_
+
+#include "general.h"
+
+namespace Torch {
+
+// Philox4x32-10 counter-based generator (Salmon et al., "Parallel random
+// numbers: as easy as 1, 2, 3", SC 2011).
+//
+// Each (key, counter) pair gives 4 independent 32 bits draws, without any
+// state to carry from one draw to the next. Draws can be made in any order
+// and in parallel, and a stream is reproduced exactly from its key and
+// counter. Here the counter is made of a 64 bits stream number (e.g. the
+// index of the frame being corrupted) and the index of the block of 4 draws
+// in that stream.
+
+static inline void Philox4x32(unsigned int c0, unsigned int c1,
+                              unsigned int c2, unsigned int c3,
+                              unsigned int k0, unsigned int k1,
+                              unsigned int out[4])
+{
+  const unsigned long long m0 = 0xD2511F53ULL;
+  const unsigned long long m1 = 0xCD9E8D57ULL;
+  const unsigned int w0 = 0x9E3779B9U;
+  const unsigned int w1 = 0xBB67AE85U;
+
+  for(int r=0; r<10; r++)       {
+    unsigned long long p0 = m0 * c0;
+    unsigned long long p1 = m1 * c2;
+    unsigned int n0 = (unsigned int)(p1 >> 32) ^ c1 ^ k0;
+    unsigned int n1 = (unsigned int)p1;
+    unsigned int n2 = (unsigned int)(p0 >> 32) ^ c3 ^ k1;
+    unsigned int n3 = (unsigned int)p0;
+    c0 = n0; c1 = n1; c2 = n2; c3 = n3;
+    k0 += w0;
+    k1 += w1;
+  }
+  out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+}
+
+// Sets bit i of #mask# (32 bits per word, ceil(n/32) words) with probability
+// #prob#, for i in [0,n). Draw i is the (i%4)th output of block i/4 of stream
+// #stream#. The unused bits of the last word are cleared.
+void PhiloxBernoulliMask(unsigned int k0, unsigned int k1, unsigned long long stream,
+                         int n, real prob, unsigned int *mask);
+
+// Uniform in [0,1) from a 32 bits draw. A float only holds 24 bits: more
+// would round the largest draws up to 1.
+static inline real PhiloxBitsToUniform(unsigned int bits)
+{
+#ifdef USE_DOUBLE
+  return bits * (1./4294967296.);
+#else
+  return (bits >> 8) * (1.f/16777216.f);
+#endif
+}
+
+// outputs[i] uniform in [0,1), for i in [0,n), from stream #stream# (draw i
+// through PhiloxBitsToUniform).
+void PhiloxUniform(unsigned int k0, unsigned int k1, unsigned long long stream,
+                   int n, real *outputs);
+
+// Random permutation of [0,n) in #indices#, from stream #stream# (Fisher-Yates,
+// draw i-1 picking the position of element i).
+void PhiloxShuffle(unsigned int k0, unsigned int k1, unsigned long long stream,
+                   int n, int *indices);
+
+// Value of bit #i# of a mask made by PhiloxBernoulliMask.
+static inline bool MaskBit(const unsigned int *mask, int i)
+{
+  return (mask[i >> 5] >> (i & 31)) & 1;
+}
+
+}
+
+#endif  // TORCH_PHILOX_H_
@@ -0,0 +1,112 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "pretraining_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Torch {
+
+PretrainingCache::PretrainingCache(const char *dir_)
+{
+  dir = dir_;
+  if(dir.length() > 1 && dir[dir.length()-1] == '/')
+    dir = dir.substr(0, dir.length()-1);
+  if(mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST)
+    error("PretrainingCache: cannot create %s", dir.c_str());
+  lock_fd = -1;
+}
+
+std::string PretrainingCache::Key(std::string description)
+{
+  // 64 bits FNV-1a
+  unsigned long long hash = 14695981039346656037ULL;
+  for(size_t i=0; i<description.length(); i++)  {
+    hash ^= (unsigned char)description[i];
+    hash *= 1099511628211ULL;
+  }
+  char key[17];
+  sprintf(key, "%016llx", hash);
+  return std::string(key);
+}
+
+std::string PretrainingCache::Filename(std::string key)
+{
+  return dir + "/" + key + ".save";
+}
+
+std::string PretrainingCache::StagingFilename(std::string key)
+{
+  return dir + "/" + key + ".save.staging";
+}
+
+bool PretrainingCache::Contains(std::string key)
+{
+  struct stat info;
+  return stat(Filename(key).c_str(), &info) == 0;
+}
+
+void PretrainingCache::Lock(std::string key)
+{
+  if(lock_fd >= 0)
+    error("PretrainingCache: a key is already locked");
+
+  std::string filename = dir + "/" + key + ".lock";
+  lock_fd = open(filename.c_str(), O_RDWR | O_CREAT, 0666);
+  if(lock_fd < 0)
+    error("PretrainingCache: cannot open %s", filename.c_str());
+
+  struct flock lock;
+  memset(&lock, 0, sizeof(lock));
+  lock.l_type = F_WRLCK;
+  lock.l_whence = SEEK_SET;
+  while(fcntl(lock_fd, F_SETLKW, &lock) != 0)   {
+    if(errno != EINTR)
+      error("PretrainingCache: cannot lock %s", filename.c_str());
+  }
+}
+
+void PretrainingCache::Unlock()
+{
+  // Closing the file releases the lock.
+  if(lock_fd >= 0)
+    close(lock_fd);
+  lock_fd = -1;
+}
+
+void PretrainingCache::Publish(std::string key, std::string description)
+{
+  std::string filename = dir + "/" + key + ".txt";
+  FILE *file = fopen(filename.c_str(), "w");
+  if(file)      {
+    fprintf(file, "%s\n", description.c_str());
+    fclose(file);
+  }
+
+  if(rename(StagingFilename(key).c_str(), Filename(key).c_str()) != 0)
+    error("PretrainingCache: cannot publish %s", Filename(key).c_str());
+}
+
+PretrainingCache::~PretrainingCache()
+{
+  Unlock();
+}
+
+}
@@ -0,0 +1,62 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_PRETRAINING_CACHE_H_
+#define TORCH_PRETRAINING_CACHE_H_
+
+#include <string>
+#include "Object.h"
+
+namespace Torch {
+
+// A directory of pretrained models shared by the runs of a sweep.
+//
+// A model is stored under a key, the hash of a description of everything
+// that affects the pretraining (see Key()). Runs that only differ in the
+// later phases then share the model pretrained by the first of them.
+//
+// Lock() takes an exclusive lock (fcntl, so it also holds over NFS) on the
+// key, which is released by Unlock() or when the process ends. The run that
+// finds the key missing keeps the lock while it pretrains, so the others wait
+// for its model instead of pretraining it again. The model is written to a
+// staging file, then renamed: a model file is always complete.
+class PretrainingCache : public Object
+{
+  public:
+    std::string dir;
+    int lock_fd;                // -1 when no key is locked
+
+    // Creates #dir_# if needed.
+    PretrainingCache(const char *dir_);
+
+    // 16 hex digits hash of #description#.
+    static std::string Key(std::string description);
+
+    std::string Filename(std::string key);
+    std::string StagingFilename(std::string key);
+    bool Contains(std::string key);
+
+    // Blocks until the lock on #key# is taken.
+    virtual void Lock(std::string key);
+    virtual void Unlock();
+    // Moves the staging file of #key# to its place, next to the #description#
+    // the key was computed from (for humans).
+    virtual void Publish(std::string key, std::string description);
+
+    virtual ~PretrainingCache();
+};
+
+}
+
+#endif  // TORCH_PRETRAINING_CACHE_H_
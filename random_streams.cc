@@ -0,0 +1,135 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "random_streams.h"
+#include "Random.h"
+#include "philox.h"
+
+namespace Torch {
+
+static long random_seed = 0;
+static int random_seed_generation = 0;
+static int next_stream_index[N_RANDOM_STREAM_PURPOSES];
+
+void SetRandomSeed(long seed)
+{
+  if(seed == -1)
+    Random::seed();
+  else
+    Random::manualSeed(seed);
+  random_seed = Random::getInitialSeed();
+
+  random_seed_generation++;
+  for(int i=0; i<N_RANDOM_STREAM_PURPOSES; i++)
+    next_stream_index[i] = 0;
+}
+
+long GetRandomSeed()
+{
+  return random_seed;
+}
+
+RandomStream::RandomStream(int purpose_, int index_)
+{
+  purpose = purpose_;
+  if(purpose < 0 || purpose >= N_RANDOM_STREAM_PURPOSES)
+    error("RandomStream: unknown purpose %d", purpose);
+  index = (index_ >= 0 ? index_ : __sync_fetch_and_add(&next_stream_index[purpose], 1));
+
+  key[0] = key[1] = 0;
+  generation = -1;
+  SetSubstream(0);
+}
+
+bool RandomStream::Rekey()
+{
+  if(generation == random_seed_generation)
+    return false;
+
+  // The key is the first block of the counter (purpose, index) under the
+  // seed.
+  unsigned int draws[4];
+  unsigned long long seed = (unsigned long long)random_seed;
+  Philox4x32((unsigned int)purpose, (unsigned int)index, 0, 0,
+             (unsigned int)seed, (unsigned int)(seed >> 32), draws);
+  key[0] = draws[0];
+  key[1] = draws[1];
+  generation = random_seed_generation;
+  SetSubstream(0);
+  return true;
+}
+
+void RandomStream::SetKey(unsigned int k0, unsigned int k1)
+{
+  key[0] = k0;
+  key[1] = k1;
+  generation = random_seed_generation;
+  SetSubstream(0);
+}
+
+void RandomStream::SetSubstream(unsigned long long n)
+{
+  substream = n;
+  block = 0;
+  n_buffered = 0;
+}
+
+unsigned int RandomStream::Bits()
+{
+  Rekey();
+  if(n_buffered == 0)   {
+    // Counter as in PhiloxUniform()
+    Philox4x32(block++, 0, (unsigned int)substream, (unsigned int)(substream >> 32),
+               key[0], key[1], buffer);
+    n_buffered = 4;
+  }
+  return buffer[4 - n_buffered--];
+}
+
+real RandomStream::Uniform()
+{
+  return PhiloxBitsToUniform(Bits());
+}
+
+real RandomStream::BoundedUniform(real a, real b)
+{
+  return a + (b - a) * Uniform();
+}
+
+void RandomStream::BoundedUniforms(int n, real a, real b, real *outputs)
+{
+  Rekey();
+  int i = 0;
+  // What is left of the current block, then whole blocks.
+  for(; i<n && n_buffered>0; i++)
+    outputs[i] = a + (b - a) * PhiloxBitsToUniform(buffer[4 - n_buffered--]);
+  for(; i+4<=n; i+=4)   {
+    unsigned int draws[4];
+    Philox4x32(block++, 0, (unsigned int)substream, (unsigned int)(substream >> 32),
+               key[0], key[1], draws);
+    for(int j=0; j<4; j++)
+      outputs[i+j] = a + (b - a) * PhiloxBitsToUniform(draws[j]);
+  }
+  for(; i<n; i++)
+    outputs[i] = BoundedUniform(a, b);
+}
+
+void RandomStream::Shuffle(int n, int *indices)
+{
+  Rekey();
+  PhiloxShuffle(key[0], key[1], substream, n, indices);
+  SetSubstream(substream + 1);
+}
+
+}
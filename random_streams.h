@@ -0,0 +1,92 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_RANDOM_STREAMS_H_
+#define TORCH_RANDOM_STREAMS_H_
+
+#include "general.h"
+
+namespace Torch {
+
+// What a stream is drawn for. Streams of different purposes are independent
+// even when they have the same index.
+enum RandomStreamPurpose {
+  RANDOM_STREAM_INIT = 0,       // initial parameters, one stream per layer
+  RANDOM_STREAM_CORRUPTION,     // masks of the Destructive layers, one per layer
+  RANDOM_STREAM_SHUFFLE,        // orders of the examples, one per trainer
+  RANDOM_STREAM_SAMPLING,       // other draws (Binner, ...)
+  N_RANDOM_STREAM_PURPOSES
+};
+
+// Seeds the random streams, and Random, which the machines of Torch itself
+// still use. A #seed# of -1 takes one from the time, as Random::seed().
+//
+// The streams take their key from the seed the first time they draw after
+// it is set, and start over. The indices given to the streams built
+// afterwards start over at 0: a model built after the same seed gets the
+// same streams, in a sweep as in a single run.
+void SetRandomSeed(long seed);
+long GetRandomSeed();
+
+// Seedable counter-based random stream (Philox, see philox.h).
+//
+// The key of a stream is derived from the seed, its purpose and its index
+// (the layer, the trainer, ...). Draws are made in blocks of 4 by the
+// counter (substream, block): draw n of a substream only depends on the
+// seed, the stream, the substream and n. It does not depend on the other
+// streams, nor on the thread that draws it, so the threads can draw from
+// their own streams, or from substreams numbered after the work they do (the
+// frames, the chunks of a ParallelFor), and get the same numbers whatever
+// the number of threads. A stream object itself is not thread safe.
+class RandomStream
+{
+  public:
+    int purpose;
+    int index;
+    unsigned int key[2];
+    // The current substream and the next block of 4 draws in it.
+    unsigned long long substream;
+    unsigned int block;
+    unsigned int buffer[4];
+    int n_buffered;
+    // Of the seed the key was derived from.
+    int generation;
+
+    // With #index_# -1, the next index of the purpose since the last seed.
+    RandomStream(int purpose_, int index_=-1);
+
+    // Takes the key of the current seed and starts over if the seed was
+    // set since the last draw. Returns true if it did.
+    bool Rekey();
+    // Sets the key until the next seed, and starts over.
+    void SetKey(unsigned int k0, unsigned int k1);
+    // Moves to the start of substream #n#.
+    void SetSubstream(unsigned long long n);
+
+    // Next 32 random bits of the substream.
+    unsigned int Bits();
+    // Uniform in [0,1), and in [a,b).
+    real Uniform();
+    real BoundedUniform(real a, real b);
+    // The next #n# draws at once: outputs[i] uniform in [a,b).
+    void BoundedUniforms(int n, real a, real b, real *outputs);
+
+    // Random permutation of [0,n), from the next substream (see
+    // PhiloxShuffle()).
+    void Shuffle(int n, int *indices);
+};
+
+}
+
+#endif  // TORCH_RANDOM_STREAMS_H_
@@ -0,0 +1,62 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "representation_cache.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace Torch {
+
+RepresentationCache::RepresentationCache(int n_examples_, int frame_size_, const char *filename)
+{
+  n_examples = n_examples_;
+  frame_size = frame_size_;
+  n_bytes = sizeof(real) * (size_t)n_examples * frame_size;
+  is_mapped = (filename != NULL);
+
+  if(!is_mapped)        {
+    data = (real*)allocator->alloc(n_bytes);
+    return;
+  }
+
+  int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if(fd < 0)
+    error("RepresentationCache: cannot create %s", filename);
+  if(ftruncate(fd, n_bytes) != 0)
+    error("RepresentationCache: cannot grow %s to %ld bytes", filename, (long)n_bytes);
+  void *mapping = mmap(NULL, n_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(mapping == MAP_FAILED)
+    error("RepresentationCache: cannot map %s", filename);
+  close(fd);
+  unlink(filename);
+  data = (real*)mapping;
+}
+
+void RepresentationCache::Gather(int *indices, int n, Sequence *seq)
+{
+  seq->resize(n);
+  for(int b=0; b<n; b++)
+    memcpy(seq->frames[b], Example(indices[b]), sizeof(real)*frame_size);
+}
+
+RepresentationCache::~RepresentationCache()
+{
+  if(is_mapped)
+    munmap(data, n_bytes);
+}
+
+}
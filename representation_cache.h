@@ -0,0 +1,50 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_REPRESENTATION_CACHE_H_
+#define TORCH_REPRESENTATION_CACHE_H_
+
+#include <stddef.h>
+
+#include "Object.h"
+#include "Sequence.h"
+
+namespace Torch {
+
+// The representations of the examples of a DataSet, one frame of
+// #frame_size# reals per example, kept in memory or in a memory-mapped file.
+class RepresentationCache : public Object
+{
+  public:
+    int n_examples;
+    int frame_size;
+    real *data;
+    size_t n_bytes;
+    bool is_mapped;
+
+    // In a memory-mapped file #filename# if not NULL, in memory otherwise.
+    // The file is removed right away: it only lives as long as the mapping.
+    RepresentationCache(int n_examples_, int frame_size_, const char *filename=NULL);
+
+    real *Example(int t) { return data + (size_t)t * frame_size; }
+    // Copies the representations of the #n# examples of #indices# in the
+    // frames of #seq#, which is resized to n frames.
+    void Gather(int *indices, int n, Sequence *seq);
+
+    virtual ~RepresentationCache();
+};
+
+}
+
+#endif  // TORCH_REPRESENTATION_CACHE_H_
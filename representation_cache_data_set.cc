@@ -0,0 +1,45 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "representation_cache_data_set.h"
+
+namespace Torch {
+
+RepresentationCacheDataSet::RepresentationCacheDataSet(DataSet *data_,
+                                                       RepresentationCache *cache_,
+                                                       Sequence *representations)
+    : DynamicDataSet(data_, representations, representations)
+{
+  cache = cache_;
+  if(cache->n_examples != data->n_examples || cache->frame_size != representations->frame_size)
+    error("RepresentationCacheDataSet: the cache does not match the DataSet");
+}
+
+void RepresentationCacheDataSet::setMinibatch(int *indices, int n)
+{
+  cache->Gather(indices, n, dynamic_inputs);
+  real_current_example_index = -1;
+}
+
+void RepresentationCacheDataSet::setRealExample(int t, bool set_inputs, bool set_targets)
+{
+  cache->Gather(&t, 1, dynamic_inputs);
+  real_current_example_index = t;
+}
+
+RepresentationCacheDataSet::~RepresentationCacheDataSet()
+{
+}
+
+}
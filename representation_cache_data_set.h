@@ -0,0 +1,45 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_REPRESENTATION_CACHE_DATA_SET_H_
+#define TORCH_REPRESENTATION_CACHE_DATA_SET_H_
+
+#include "dynamic_data_set.h"
+#include "representation_cache.h"
+
+namespace Torch {
+
+// Wraps a DataSet whose examples have their representations in a cache.
+// Setting examples copies their representations in #representations#, which
+// is both the inputs and the targets. Giving it the outputs of the machine
+// that computed the representations, whatever monitors them (a
+// DynamicDataSet for example) sees them as if that machine had been
+// forwarded.
+class RepresentationCacheDataSet : public DynamicDataSet
+{
+  public:
+    RepresentationCache *cache;
+
+    RepresentationCacheDataSet(DataSet *data_, RepresentationCache *cache_,
+                               Sequence *representations);
+
+    virtual void setMinibatch(int *indices, int n);
+    virtual void setRealExample(int t, bool set_inputs=true, bool set_targets=true);
+
+    virtual ~RepresentationCacheDataSet();
+};
+
+}
+
+#endif // TORCH_REPRESENTATION_CACHE_DATA_SET_H_
@@ -0,0 +1,102 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "representation_queue.h"
+
+#include <string.h>
+
+namespace Torch {
+
+RepresentationQueue::RepresentationQueue(int n_slots_, int frame_size_)
+{
+  n_slots = n_slots_;
+  frame_size = frame_size_;
+  if(n_slots < 1)
+    error("RepresentationQueue: need at least 1 slot");
+
+  slots = (Sequence**)allocator->alloc(sizeof(Sequence*)*n_slots);
+  for(int i=0; i<n_slots; i++)
+    slots[i] = new(allocator) Sequence(0, frame_size);
+  first = 0;
+  n_full = 0;
+  closed = false;
+
+  pthread_mutex_init(&mutex, NULL);
+  pthread_cond_init(&not_empty, NULL);
+  pthread_cond_init(&not_full, NULL);
+}
+
+static void CopyFrames(Sequence *from, Sequence *to)
+{
+  to->resize(from->n_frames);
+  for(int t=0; t<from->n_frames; t++)
+    memcpy(to->frames[t], from->frames[t], sizeof(real)*from->frame_size);
+}
+
+void RepresentationQueue::Push(Sequence *batch)
+{
+  pthread_mutex_lock(&mutex);
+  while(n_full == n_slots)
+    pthread_cond_wait(&not_full, &mutex);
+  int last = (first + n_full) % n_slots;
+  pthread_mutex_unlock(&mutex);
+
+  // Only the producer writes the free slots.
+  CopyFrames(batch, slots[last]);
+
+  pthread_mutex_lock(&mutex);
+  n_full++;
+  pthread_cond_signal(&not_empty);
+  pthread_mutex_unlock(&mutex);
+}
+
+bool RepresentationQueue::Pop(Sequence *batch)
+{
+  pthread_mutex_lock(&mutex);
+  while(n_full == 0 && !closed)
+    pthread_cond_wait(&not_empty, &mutex);
+  if(n_full == 0)       {
+    pthread_mutex_unlock(&mutex);
+    return false;
+  }
+  int oldest = first;
+  pthread_mutex_unlock(&mutex);
+
+  // Only the consumer reads the full slots.
+  CopyFrames(slots[oldest], batch);
+
+  pthread_mutex_lock(&mutex);
+  first = (oldest + 1) % n_slots;
+  n_full--;
+  pthread_cond_signal(&not_full);
+  pthread_mutex_unlock(&mutex);
+  return true;
+}
+
+void RepresentationQueue::Close()
+{
+  pthread_mutex_lock(&mutex);
+  closed = true;
+  pthread_cond_broadcast(&not_empty);
+  pthread_mutex_unlock(&mutex);
+}
+
+RepresentationQueue::~RepresentationQueue()
+{
+  pthread_cond_destroy(&not_full);
+  pthread_cond_destroy(&not_empty);
+  pthread_mutex_destroy(&mutex);
+}
+
+}
@@ -0,0 +1,58 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_REPRESENTATION_QUEUE_H_
+#define TORCH_REPRESENTATION_QUEUE_H_
+
+#include <pthread.h>
+
+#include "Object.h"
+#include "Sequence.h"
+
+namespace Torch {
+
+// A bounded queue of minibatches of representations (sequences of one frame
+// per example) between a producer thread and a consumer thread. The
+// minibatches are copied in and out of #n_slots# preallocated sequences.
+class RepresentationQueue : public Object
+{
+  public:
+    int n_slots;
+    int frame_size;
+    Sequence **slots;
+    int first;          // slot of the oldest minibatch
+    int n_full;
+    bool closed;
+
+    RepresentationQueue(int n_slots_, int frame_size_);
+
+    // Copies #batch# in the queue, blocking while it is full.
+    void Push(Sequence *batch);
+    // Copies the oldest minibatch in #batch# (resized), blocking while the
+    // queue is empty. Returns false if it is empty and closed.
+    bool Pop(Sequence *batch);
+    // No more minibatches will be pushed.
+    void Close();
+
+    virtual ~RepresentationQueue();
+
+  private:
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+};
+
+}
+
+#endif  // TORCH_REPRESENTATION_QUEUE_H_
@@ -0,0 +1,746 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "simd_kernels.h"
+
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+namespace Torch {
+
+// --- Scalar ---
+
+static void ScalarAxpy(int n, real a, const real *x, real *y)
+{
+  for(int i=0; i<n; i++)
+    y[i] += a * x[i];
+}
+
+static void ScalarScale(int n, real a, const real *x, real *y)
+{
+  for(int i=0; i<n; i++)
+    y[i] = a * x[i];
+}
+
+static real ScalarDot(int n, const real *x, const real *y)
+{
+  real sum = 0.;
+  for(int i=0; i<n; i++)
+    sum += x[i] * y[i];
+  return sum;
+}
+
+static void ScalarMaskedSelect(int n, const unsigned int *mask, real value,
+                               const real *x, real *y)
+{
+  for(int i=0; i<n; i++)
+    y[i] = ((mask[i >> 5] >> (i & 31)) & 1) ? value : x[i];
+}
+
+static void ScalarMomentumUpdate(int n, real learning_rate, real momentum, bool nesterov,
+                                 const real *g, real *v, real *p)
+{
+  for(int i=0; i<n; i++)        {
+    v[i] = momentum * v[i] - learning_rate * g[i];
+    if(nesterov)
+      p[i] += momentum * v[i] - learning_rate * g[i];
+    else
+      p[i] += v[i];
+  }
+}
+
+static void ScalarRmsUpdate(int n, real learning_rate, real decay, real scale, real epsilon,
+                            const real *g, real *s, real *p)
+{
+  for(int i=0; i<n; i++)        {
+    s[i] = decay * s[i] + scale * g[i] * g[i];
+    p[i] -= learning_rate * g[i] / (sqrt(s[i]) + epsilon);
+  }
+}
+
+static void ScalarAdamUpdate(int n, real learning_rate, real beta1, real beta2, real epsilon,
+                             const real *g, real *m, real *v, real *p)
+{
+  for(int i=0; i<n; i++)        {
+    m[i] = beta1 * m[i] + (1. - beta1) * g[i];
+    v[i] = beta2 * v[i] + (1. - beta2) * g[i] * g[i];
+    p[i] -= learning_rate * m[i] / (sqrt(v[i]) + epsilon);
+  }
+}
+
+#ifdef SIMD_KERNELS_X86
+
+// --- AVX2 ---
+
+#ifdef USE_DOUBLE
+
+__attribute__((target("avx2,fma")))
+static void Avx2Axpy(int n, real a, const real *x, real *y)
+{
+  __m256d va = _mm256_set1_pd(a);
+  int i = 0;
+  for(; i+8<=n; i+=8)   {
+    __m256d y0 = _mm256_loadu_pd(y+i);
+    __m256d y1 = _mm256_loadu_pd(y+i+4);
+    y0 = _mm256_fmadd_pd(va, _mm256_loadu_pd(x+i), y0);
+    y1 = _mm256_fmadd_pd(va, _mm256_loadu_pd(x+i+4), y1);
+    _mm256_storeu_pd(y+i, y0);
+    _mm256_storeu_pd(y+i+4, y1);
+  }
+  for(; i<n; i++)
+    y[i] += a * x[i];
+}
+
+__attribute__((target("avx2,fma")))
+static void Avx2Scale(int n, real a, const real *x, real *y)
+{
+  __m256d va = _mm256_set1_pd(a);
+  int i = 0;
+  for(; i+4<=n; i+=4)   {
+    _mm256_storeu_pd(y+i, _mm256_mul_pd(va, _mm256_loadu_pd(x+i)));
+  }
+  for(; i<n; i++)
+    y[i] = a * x[i];
+}
+
+__attribute__((target("avx2,fma")))
+static real Avx2Dot(int n, const real *x, const real *y)
+{
+  __m256d s0 = _mm256_setzero_pd();
+  __m256d s1 = _mm256_setzero_pd();
+  int i = 0;
+  for(; i+8<=n; i+=8)   {
+    s0 = _mm256_fmadd_pd(_mm256_loadu_pd(x+i), _mm256_loadu_pd(y+i), s0);
+    s1 = _mm256_fmadd_pd(_mm256_loadu_pd(x+i+4), _mm256_loadu_pd(y+i+4), s1);
+  }
+  s0 = _mm256_add_pd(s0, s1);
+  real tmp[4];
+  _mm256_storeu_pd(tmp, s0);
+  real sum = (tmp[0] + tmp[1]) + (tmp[2] + tmp[3]);
+  for(; i<n; i++)
+    sum += x[i] * y[i];
+  return sum;
+}
+
+__attribute__((target("avx2,fma")))
+static void Avx2MaskedSelect(int n, const unsigned int *mask, real value,
+                             const real *x, real *y)
+{
+  const __m256i bits = _mm256_setr_epi64x(1, 2, 4, 8);
+  __m256d vv = _mm256_set1_pd(value);
+  int i = 0;
+  for(; i+4<=n; i+=4)   {
+    long long m = (mask[i >> 5] >> (i & 31)) & 0xF;
+    __m256i lanes = _mm256_cmpeq_epi64(_mm256_and_si256(_mm256_set1_epi64x(m), bits), bits);
+    __m256d vy = _mm256_blendv_pd(_mm256_loadu_pd(x+i), vv, _mm256_castsi256_pd(lanes));
+    _mm256_storeu_pd(y+i, vy);
+  }
+  for(; i<n; i++)
+    y[i] = ((mask[i >> 5] >> (i & 31)) & 1) ? value : x[i];
+}
+
+#else
+
+__attribute__((target("avx2,fma")))
+static void Avx2Axpy(int n, real a, const real *x, real *y)
+{
+  __m256 va = _mm256_set1_ps(a);
+  int i = 0;
+  for(; i+16<=n; i+=16) {
+    __m256 y0 = _mm256_loadu_ps(y+i);
+    __m256 y1 = _mm256_loadu_ps(y+i+8);
+    y0 = _mm256_fmadd_ps(va, _mm256_loadu_ps(x+i), y0);
+    y1 = _mm256_fmadd_ps(va, _mm256_loadu_ps(x+i+8), y1);
+    _mm256_storeu_ps(y+i, y0);
+    _mm256_storeu_ps(y+i+8, y1);
+  }
+  for(; i<n; i++)
+    y[i] += a * x[i];
+}
+
+__attribute__((target("avx2,fma")))
+static void Avx2Scale(int n, real a, const real *x, real *y)
+{
+  __m256 va = _mm256_set1_ps(a);
+  int i = 0;
+  for(; i+8<=n; i+=8)   {
+    _mm256_storeu_ps(y+i, _mm256_mul_ps(va, _mm256_loadu_ps(x+i)));
+  }
+  for(; i<n; i++)
+    y[i] = a * x[i];
+}
+
+__attribute__((target("avx2,fma")))
+static real Avx2Dot(int n, const real *x, const real *y)
+{
+  __m256 s0 = _mm256_setzero_ps();
+  __m256 s1 = _mm256_setzero_ps();
+  int i = 0;
+  for(; i+16<=n; i+=16) {
+    s0 = _mm256_fmadd_ps(_mm256_loadu_ps(x+i), _mm256_loadu_ps(y+i), s0);
+    s1 = _mm256_fmadd_ps(_mm256_loadu_ps(x+i+8), _mm256_loadu_ps(y+i+8), s1);
+  }
+  s0 = _mm256_add_ps(s0, s1);
+  real tmp[8];
+  _mm256_storeu_ps(tmp, s0);
+  real sum = ((tmp[0] + tmp[1]) + (tmp[2] + tmp[3]))
+           + ((tmp[4] + tmp[5]) + (tmp[6] + tmp[7]));
+  for(; i<n; i++)
+    sum += x[i] * y[i];
+  return sum;
+}
+
+__attribute__((target("avx2,fma")))
+static void Avx2MaskedSelect(int n, const unsigned int *mask, real value,
+                             const real *x, real *y)
+{
+  const __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+  __m256 vv = _mm256_set1_ps(value);
+  int i = 0;
+  for(; i+8<=n; i+=8)   {
+    int m = (mask[i >> 5] >> (i & 31)) & 0xFF;
+    __m256i lanes = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(m), bits), bits);
+    __m256 vy = _mm256_blendv_ps(_mm256_loadu_ps(x+i), vv, _mm256_castsi256_ps(lanes));
+    _mm256_storeu_ps(y+i, vy);
+  }
+  for(; i<n; i++)
+    y[i] = ((mask[i >> 5] >> (i & 31)) & 1) ? value : x[i];
+}
+
+#endif  // USE_DOUBLE
+
+// Optimizer updates (the tail goes to the scalar kernels)
+
+#ifdef USE_DOUBLE
+
+__attribute__((target("avx2,fma")))
+static void Avx2MomentumUpdate(int n, real learning_rate, real momentum, bool nesterov,
+                               const real *g, real *v, real *p)
+{
+  // p += a*v + b*g covers both cases.
+  __m256d vmu = _mm256_set1_pd(momentum);
+  __m256d vnlr = _mm256_set1_pd(-learning_rate);
+  __m256d va = _mm256_set1_pd(nesterov ? momentum : 1.);
+  __m256d vb = _mm256_set1_pd(nesterov ? -learning_rate : 0.);
+  int i = 0;
+  for(; i+4<=n; i+=4)   {
+    __m256d vg = _mm256_loadu_pd(g+i);
+    __m256d vv = _mm256_fmadd_pd(vmu, _mm256_loadu_pd(v+i), _mm256_mul_pd(vnlr, vg));
+    __m256d vp = _mm256_fmadd_pd(va, vv, _mm256_loadu_pd(p+i));
+    vp = _mm256_fmadd_pd(vb, vg, vp);
+    _mm256_storeu_pd(v+i, vv);
+    _mm256_storeu_pd(p+i, vp);
+  }
+  ScalarMomentumUpdate(n-i, learning_rate, momentum, nesterov, g+i, v+i, p+i);
+}
+
+__attribute__((target("avx2,fma")))
+static void Avx2RmsUpdate(int n, real learning_rate, real decay, real scale, real epsilon,
+                          const real *g, real *s, real *p)
+{
+  __m256d vdecay = _mm256_set1_pd(decay);
+  __m256d vscale = _mm256_set1_pd(scale);
+  __m256d veps = _mm256_set1_pd(epsilon);
+  __m256d vlr = _mm256_set1_pd(learning_rate);
+  int i = 0;
+  for(; i+4<=n; i+=4)   {
+    __m256d vg = _mm256_loadu_pd(g+i);
+    __m256d vs = _mm256_mul_pd(vdecay, _mm256_loadu_pd(s+i));
+    vs = _mm256_fmadd_pd(_mm256_mul_pd(vscale, vg), vg, vs);
+    __m256d vstep = _mm256_div_pd(vg, _mm256_add_pd(_mm256_sqrt_pd(vs), veps));
+    _mm256_storeu_pd(s+i, vs);
+    __m256d vp = _mm256_fnmadd_pd(vlr, vstep, _mm256_loadu_pd(p+i));
+    _mm256_storeu_pd(p+i, vp);
+  }
+  ScalarRmsUpdate(n-i, learning_rate, decay, scale, epsilon, g+i, s+i, p+i);
+}
+
+__attribute__((target("avx2,fma")))
+static void Avx2AdamUpdate(int n, real learning_rate, real beta1, real beta2, real epsilon,
+                           const real *g, real *m, real *v, real *p)
+{
+  __m256d vb1 = _mm256_set1_pd(beta1);
+  __m256d vb1c = _mm256_set1_pd(1. - beta1);
+  __m256d vb2 = _mm256_set1_pd(beta2);
+  __m256d vb2c = _mm256_set1_pd(1. - beta2);
+  __m256d veps = _mm256_set1_pd(epsilon);
+  __m256d vlr = _mm256_set1_pd(learning_rate);
+  int i = 0;
+  for(; i+4<=n; i+=4)   {
+    __m256d vg = _mm256_loadu_pd(g+i);
+    __m256d vm = _mm256_mul_pd(vb1, _mm256_loadu_pd(m+i));
+    __m256d vv = _mm256_mul_pd(vb2, _mm256_loadu_pd(v+i));
+    vm = _mm256_fmadd_pd(vb1c, vg, vm);
+    vv = _mm256_fmadd_pd(_mm256_mul_pd(vb2c, vg), vg, vv);
+    __m256d vstep = _mm256_div_pd(vm, _mm256_add_pd(_mm256_sqrt_pd(vv), veps));
+    _mm256_storeu_pd(m+i, vm);
+    _mm256_storeu_pd(v+i, vv);
+    __m256d vp = _mm256_fnmadd_pd(vlr, vstep, _mm256_loadu_pd(p+i));
+    _mm256_storeu_pd(p+i, vp);
+  }
+  ScalarAdamUpdate(n-i, learning_rate, beta1, beta2, epsilon, g+i, m+i, v+i, p+i);
+}
+
+#else
+
+__attribute__((target("avx2,fma")))
+static void Avx2MomentumUpdate(int n, real learning_rate, real momentum, bool nesterov,
+                               const real *g, real *v, real *p)
+{
+  // p += a*v + b*g covers both cases.
+  __m256 vmu = _mm256_set1_ps(momentum);
+  __m256 vnlr = _mm256_set1_ps(-learning_rate);
+  __m256 va = _mm256_set1_ps(nesterov ? momentum : 1.);
+  __m256 vb = _mm256_set1_ps(nesterov ? -learning_rate : 0.);
+  int i = 0;
+  for(; i+8<=n; i+=8)   {
+    __m256 vg = _mm256_loadu_ps(g+i);
+    __m256 vv = _mm256_fmadd_ps(vmu, _mm256_loadu_ps(v+i), _mm256_mul_ps(vnlr, vg));
+    __m256 vp = _mm256_fmadd_ps(va, vv, _mm256_loadu_ps(p+i));
+    vp = _mm256_fmadd_ps(vb, vg, vp);
+    _mm256_storeu_ps(v+i, vv);
+    _mm256_storeu_ps(p+i, vp);
+  }
+  ScalarMomentumUpdate(n-i, learning_rate, momentum, nesterov, g+i, v+i, p+i);
+}
+
+__attribute__((target("avx2,fma")))
+static void Avx2RmsUpdate(int n, real learning_rate, real decay, real scale, real epsilon,
+                          const real *g, real *s, real *p)
+{
+  __m256 vdecay = _mm256_set1_ps(decay);
+  __m256 vscale = _mm256_set1_ps(scale);
+  __m256 veps = _mm256_set1_ps(epsilon);
+  __m256 vlr = _mm256_set1_ps(learning_rate);
+  int i = 0;
+  for(; i+8<=n; i+=8)   {
+    __m256 vg = _mm256_loadu_ps(g+i);
+    __m256 vs = _mm256_mul_ps(vdecay, _mm256_loadu_ps(s+i));
+    vs = _mm256_fmadd_ps(_mm256_mul_ps(vscale, vg), vg, vs);
+    __m256 vstep = _mm256_div_ps(vg, _mm256_add_ps(_mm256_sqrt_ps(vs), veps));
+    _mm256_storeu_ps(s+i, vs);
+    __m256 vp = _mm256_fnmadd_ps(vlr, vstep, _mm256_loadu_ps(p+i));
+    _mm256_storeu_ps(p+i, vp);
+  }
+  ScalarRmsUpdate(n-i, learning_rate, decay, scale, epsilon, g+i, s+i, p+i);
+}
+
+__attribute__((target("avx2,fma")))
+static void Avx2AdamUpdate(int n, real learning_rate, real beta1, real beta2, real epsilon,
+                           const real *g, real *m, real *v, real *p)
+{
+  __m256 vb1 = _mm256_set1_ps(beta1);
+  __m256 vb1c = _mm256_set1_ps(1. - beta1);
+  __m256 vb2 = _mm256_set1_ps(beta2);
+  __m256 vb2c = _mm256_set1_ps(1. - beta2);
+  __m256 veps = _mm256_set1_ps(epsilon);
+  __m256 vlr = _mm256_set1_ps(learning_rate);
+  int i = 0;
+  for(; i+8<=n; i+=8)   {
+    __m256 vg = _mm256_loadu_ps(g+i);
+    __m256 vm = _mm256_mul_ps(vb1, _mm256_loadu_ps(m+i));
+    __m256 vv = _mm256_mul_ps(vb2, _mm256_loadu_ps(v+i));
+    vm = _mm256_fmadd_ps(vb1c, vg, vm);
+    vv = _mm256_fmadd_ps(_mm256_mul_ps(vb2c, vg), vg, vv);
+    __m256 vstep = _mm256_div_ps(vm, _mm256_add_ps(_mm256_sqrt_ps(vv), veps));
+    _mm256_storeu_ps(m+i, vm);
+    _mm256_storeu_ps(v+i, vv);
+    __m256 vp = _mm256_fnmadd_ps(vlr, vstep, _mm256_loadu_ps(p+i));
+    _mm256_storeu_ps(p+i, vp);
+  }
+  ScalarAdamUpdate(n-i, learning_rate, beta1, beta2, epsilon, g+i, m+i, v+i, p+i);
+}
+
+#endif  // USE_DOUBLE
+
+// --- AVX-512 ---
+// The tail is handled with a mask, so there is no scalar remainder loop.
+
+#ifdef USE_DOUBLE
+
+__attribute__((target("avx512f")))
+static void Avx512Axpy(int n, real a, const real *x, real *y)
+{
+  __m512d va = _mm512_set1_pd(a);
+  int i = 0;
+  for(; i+8<=n; i+=8)   {
+    __m512d vy = _mm512_loadu_pd(y+i);
+    vy = _mm512_fmadd_pd(va, _mm512_loadu_pd(x+i), vy);
+    _mm512_storeu_pd(y+i, vy);
+  }
+  if(i < n)     {
+    __mmask8 mask = (__mmask8)((1u << (n-i)) - 1);
+    __m512d vy = _mm512_maskz_loadu_pd(mask, y+i);
+    vy = _mm512_fmadd_pd(va, _mm512_maskz_loadu_pd(mask, x+i), vy);
+    _mm512_mask_storeu_pd(y+i, mask, vy);
+  }
+}
+
+__attribute__((target("avx512f")))
+static void Avx512Scale(int n, real a, const real *x, real *y)
+{
+  __m512d va = _mm512_set1_pd(a);
+  int i = 0;
+  for(; i+8<=n; i+=8)
+    _mm512_storeu_pd(y+i, _mm512_mul_pd(va, _mm512_loadu_pd(x+i)));
+  if(i < n)     {
+    __mmask8 mask = (__mmask8)((1u << (n-i)) - 1);
+    _mm512_mask_storeu_pd(y+i, mask, _mm512_mul_pd(va, _mm512_maskz_loadu_pd(mask, x+i)));
+  }
+}
+
+__attribute__((target("avx512f")))
+static real Avx512Dot(int n, const real *x, const real *y)
+{
+  __m512d s = _mm512_setzero_pd();
+  int i = 0;
+  for(; i+8<=n; i+=8)
+    s = _mm512_fmadd_pd(_mm512_loadu_pd(x+i), _mm512_loadu_pd(y+i), s);
+  if(i < n)     {
+    __mmask8 mask = (__mmask8)((1u << (n-i)) - 1);
+    s = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(mask, x+i),
+                        _mm512_maskz_loadu_pd(mask, y+i), s);
+  }
+  real tmp[8];
+  _mm512_storeu_pd(tmp, s);
+  return ((tmp[0] + tmp[1]) + (tmp[2] + tmp[3]))
+       + ((tmp[4] + tmp[5]) + (tmp[6] + tmp[7]));
+}
+
+__attribute__((target("avx512f")))
+static void Avx512MaskedSelect(int n, const unsigned int *mask, real value,
+                               const real *x, real *y)
+{
+  __m512d vv = _mm512_set1_pd(value);
+  int i = 0;
+  for(; i+8<=n; i+=8)   {
+    __mmask8 m = (__mmask8)(mask[i >> 5] >> (i & 31));
+    _mm512_storeu_pd(y+i, _mm512_mask_blend_pd(m, _mm512_loadu_pd(x+i), vv));
+  }
+  if(i < n)     {
+    __mmask8 tail = (__mmask8)((1u << (n-i)) - 1);
+    __mmask8 m = (__mmask8)(mask[i >> 5] >> (i & 31));
+    __m512d vy = _mm512_mask_blend_pd(m, _mm512_maskz_loadu_pd(tail, x+i), vv);
+    _mm512_mask_storeu_pd(y+i, tail, vy);
+  }
+}
+
+#else
+
+__attribute__((target("avx512f")))
+static void Avx512Axpy(int n, real a, const real *x, real *y)
+{
+  __m512 va = _mm512_set1_ps(a);
+  int i = 0;
+  for(; i+16<=n; i+=16) {
+    __m512 vy = _mm512_loadu_ps(y+i);
+    vy = _mm512_fmadd_ps(va, _mm512_loadu_ps(x+i), vy);
+    _mm512_storeu_ps(y+i, vy);
+  }
+  if(i < n)     {
+    __mmask16 mask = (__mmask16)((1u << (n-i)) - 1);
+    __m512 vy = _mm512_maskz_loadu_ps(mask, y+i);
+    vy = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(mask, x+i), vy);
+    _mm512_mask_storeu_ps(y+i, mask, vy);
+  }
+}
+
+__attribute__((target("avx512f")))
+static void Avx512Scale(int n, real a, const real *x, real *y)
+{
+  __m512 va = _mm512_set1_ps(a);
+  int i = 0;
+  for(; i+16<=n; i+=16)
+    _mm512_storeu_ps(y+i, _mm512_mul_ps(va, _mm512_loadu_ps(x+i)));
+  if(i < n)     {
+    __mmask16 mask = (__mmask16)((1u << (n-i)) - 1);
+    _mm512_mask_storeu_ps(y+i, mask, _mm512_mul_ps(va, _mm512_maskz_loadu_ps(mask, x+i)));
+  }
+}
+
+__attribute__((target("avx512f")))
+static real Avx512Dot(int n, const real *x, const real *y)
+{
+  __m512 s = _mm512_setzero_ps();
+  int i = 0;
+  for(; i+16<=n; i+=16)
+    s = _mm512_fmadd_ps(_mm512_loadu_ps(x+i), _mm512_loadu_ps(y+i), s);
+  if(i < n)     {
+    __mmask16 mask = (__mmask16)((1u << (n-i)) - 1);
+    s = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, x+i),
+                        _mm512_maskz_loadu_ps(mask, y+i), s);
+  }
+  real tmp[16];
+  _mm512_storeu_ps(tmp, s);
+  real sum = 0.;
+  for(int k=0; k<16; k++)
+    sum += tmp[k];
+  return sum;
+}
+
+__attribute__((target("avx512f")))
+static void Avx512MaskedSelect(int n, const unsigned int *mask, real value,
+                               const real *x, real *y)
+{
+  __m512 vv = _mm512_set1_ps(value);
+  int i = 0;
+  for(; i+16<=n; i+=16) {
+    __mmask16 m = (__mmask16)(mask[i >> 5] >> (i & 31));
+    _mm512_storeu_ps(y+i, _mm512_mask_blend_ps(m, _mm512_loadu_ps(x+i), vv));
+  }
+  if(i < n)     {
+    __mmask16 tail = (__mmask16)((1u << (n-i)) - 1);
+    __mmask16 m = (__mmask16)(mask[i >> 5] >> (i & 31));
+    __m512 vy = _mm512_mask_blend_ps(m, _mm512_maskz_loadu_ps(tail, x+i), vv);
+    _mm512_mask_storeu_ps(y+i, tail, vy);
+  }
+}
+
+#endif  // USE_DOUBLE
+
+// Optimizer updates (every load and store is masked, the last ones to the
+// tail)
+
+#ifdef USE_DOUBLE
+
+__attribute__((target("avx512f")))
+static void Avx512MomentumUpdate(int n, real learning_rate, real momentum, bool nesterov,
+                                 const real *g, real *v, real *p)
+{
+  // p += a*v + b*g covers both cases.
+  __m512d vmu = _mm512_set1_pd(momentum);
+  __m512d vnlr = _mm512_set1_pd(-learning_rate);
+  __m512d va = _mm512_set1_pd(nesterov ? momentum : 1.);
+  __m512d vb = _mm512_set1_pd(nesterov ? -learning_rate : 0.);
+  for(int i=0; i<n; i+=8)    {
+    __mmask8 mask = n-i >= 8 ? (__mmask8)0xFF : (__mmask8)((1u << (n-i)) - 1);
+    __m512d vg = _mm512_maskz_loadu_pd(mask, g+i);
+    __m512d vv = _mm512_fmadd_pd(vmu, _mm512_maskz_loadu_pd(mask, v+i), _mm512_mul_pd(vnlr, vg));
+    __m512d vp = _mm512_fmadd_pd(va, vv, _mm512_maskz_loadu_pd(mask, p+i));
+    vp = _mm512_fmadd_pd(vb, vg, vp);
+    _mm512_mask_storeu_pd(v+i, mask, vv);
+    _mm512_mask_storeu_pd(p+i, mask, vp);
+  }
+}
+
+__attribute__((target("avx512f")))
+static void Avx512RmsUpdate(int n, real learning_rate, real decay, real scale, real epsilon,
+                            const real *g, real *s, real *p)
+{
+  __m512d vdecay = _mm512_set1_pd(decay);
+  __m512d vscale = _mm512_set1_pd(scale);
+  __m512d veps = _mm512_set1_pd(epsilon);
+  __m512d vlr = _mm512_set1_pd(learning_rate);
+  for(int i=0; i<n; i+=8)    {
+    __mmask8 mask = n-i >= 8 ? (__mmask8)0xFF : (__mmask8)((1u << (n-i)) - 1);
+    __m512d vg = _mm512_maskz_loadu_pd(mask, g+i);
+    __m512d vs = _mm512_mul_pd(vdecay, _mm512_maskz_loadu_pd(mask, s+i));
+    vs = _mm512_fmadd_pd(_mm512_mul_pd(vscale, vg), vg, vs);
+    __m512d vstep = _mm512_div_pd(vg, _mm512_add_pd(_mm512_maskz_sqrt_pd(mask, vs), veps));
+    _mm512_mask_storeu_pd(s+i, mask, vs);
+    __m512d vp = _mm512_fnmadd_pd(vlr, vstep, _mm512_maskz_loadu_pd(mask, p+i));
+    _mm512_mask_storeu_pd(p+i, mask, vp);
+  }
+}
+
+__attribute__((target("avx512f")))
+static void Avx512AdamUpdate(int n, real learning_rate, real beta1, real beta2, real epsilon,
+                             const real *g, real *m, real *v, real *p)
+{
+  __m512d vb1 = _mm512_set1_pd(beta1);
+  __m512d vb1c = _mm512_set1_pd(1. - beta1);
+  __m512d vb2 = _mm512_set1_pd(beta2);
+  __m512d vb2c = _mm512_set1_pd(1. - beta2);
+  __m512d veps = _mm512_set1_pd(epsilon);
+  __m512d vlr = _mm512_set1_pd(learning_rate);
+  for(int i=0; i<n; i+=8)    {
+    __mmask8 mask = n-i >= 8 ? (__mmask8)0xFF : (__mmask8)((1u << (n-i)) - 1);
+    __m512d vg = _mm512_maskz_loadu_pd(mask, g+i);
+    __m512d vm = _mm512_mul_pd(vb1, _mm512_maskz_loadu_pd(mask, m+i));
+    __m512d vv = _mm512_mul_pd(vb2, _mm512_maskz_loadu_pd(mask, v+i));
+    vm = _mm512_fmadd_pd(vb1c, vg, vm);
+    vv = _mm512_fmadd_pd(_mm512_mul_pd(vb2c, vg), vg, vv);
+    __m512d vstep = _mm512_div_pd(vm, _mm512_add_pd(_mm512_maskz_sqrt_pd(mask, vv), veps));
+    _mm512_mask_storeu_pd(m+i, mask, vm);
+    _mm512_mask_storeu_pd(v+i, mask, vv);
+    __m512d vp = _mm512_fnmadd_pd(vlr, vstep, _mm512_maskz_loadu_pd(mask, p+i));
+    _mm512_mask_storeu_pd(p+i, mask, vp);
+  }
+}
+
+#else
+
+__attribute__((target("avx512f")))
+static void Avx512MomentumUpdate(int n, real learning_rate, real momentum, bool nesterov,
+                                 const real *g, real *v, real *p)
+{
+  // p += a*v + b*g covers both cases.
+  __m512 vmu = _mm512_set1_ps(momentum);
+  __m512 vnlr = _mm512_set1_ps(-learning_rate);
+  __m512 va = _mm512_set1_ps(nesterov ? momentum : 1.);
+  __m512 vb = _mm512_set1_ps(nesterov ? -learning_rate : 0.);
+  for(int i=0; i<n; i+=16)    {
+    __mmask16 mask = n-i >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (n-i)) - 1);
+    __m512 vg = _mm512_maskz_loadu_ps(mask, g+i);
+    __m512 vv = _mm512_fmadd_ps(vmu, _mm512_maskz_loadu_ps(mask, v+i), _mm512_mul_ps(vnlr, vg));
+    __m512 vp = _mm512_fmadd_ps(va, vv, _mm512_maskz_loadu_ps(mask, p+i));
+    vp = _mm512_fmadd_ps(vb, vg, vp);
+    _mm512_mask_storeu_ps(v+i, mask, vv);
+    _mm512_mask_storeu_ps(p+i, mask, vp);
+  }
+}
+
+__attribute__((target("avx512f")))
+static void Avx512RmsUpdate(int n, real learning_rate, real decay, real scale, real epsilon,
+                            const real *g, real *s, real *p)
+{
+  __m512 vdecay = _mm512_set1_ps(decay);
+  __m512 vscale = _mm512_set1_ps(scale);
+  __m512 veps = _mm512_set1_ps(epsilon);
+  __m512 vlr = _mm512_set1_ps(learning_rate);
+  for(int i=0; i<n; i+=16)    {
+    __mmask16 mask = n-i >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (n-i)) - 1);
+    __m512 vg = _mm512_maskz_loadu_ps(mask, g+i);
+    __m512 vs = _mm512_mul_ps(vdecay, _mm512_maskz_loadu_ps(mask, s+i));
+    vs = _mm512_fmadd_ps(_mm512_mul_ps(vscale, vg), vg, vs);
+    __m512 vstep = _mm512_div_ps(vg, _mm512_add_ps(_mm512_maskz_sqrt_ps(mask, vs), veps));
+    _mm512_mask_storeu_ps(s+i, mask, vs);
+    __m512 vp = _mm512_fnmadd_ps(vlr, vstep, _mm512_maskz_loadu_ps(mask, p+i));
+    _mm512_mask_storeu_ps(p+i, mask, vp);
+  }
+}
+
+__attribute__((target("avx512f")))
+static void Avx512AdamUpdate(int n, real learning_rate, real beta1, real beta2, real epsilon,
+                             const real *g, real *m, real *v, real *p)
+{
+  __m512 vb1 = _mm512_set1_ps(beta1);
+  __m512 vb1c = _mm512_set1_ps(1. - beta1);
+  __m512 vb2 = _mm512_set1_ps(beta2);
+  __m512 vb2c = _mm512_set1_ps(1. - beta2);
+  __m512 veps = _mm512_set1_ps(epsilon);
+  __m512 vlr = _mm512_set1_ps(learning_rate);
+  for(int i=0; i<n; i+=16)    {
+    __mmask16 mask = n-i >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (n-i)) - 1);
+    __m512 vg = _mm512_maskz_loadu_ps(mask, g+i);
+    __m512 vm = _mm512_mul_ps(vb1, _mm512_maskz_loadu_ps(mask, m+i));
+    __m512 vv = _mm512_mul_ps(vb2, _mm512_maskz_loadu_ps(mask, v+i));
+    vm = _mm512_fmadd_ps(vb1c, vg, vm);
+    vv = _mm512_fmadd_ps(_mm512_mul_ps(vb2c, vg), vg, vv);
+    __m512 vstep = _mm512_div_ps(vm, _mm512_add_ps(_mm512_maskz_sqrt_ps(mask, vv), veps));
+    _mm512_mask_storeu_ps(m+i, mask, vm);
+    _mm512_mask_storeu_ps(v+i, mask, vv);
+    __m512 vp = _mm512_fnmadd_ps(vlr, vstep, _mm512_maskz_loadu_ps(mask, p+i));
+    _mm512_mask_storeu_ps(p+i, mask, vp);
+  }
+}
+
+#endif  // USE_DOUBLE
+
+#endif  // SIMD_KERNELS_X86
+
+// --- Dispatch ---
+
+void (*SimdAxpy)(int n, real a, const real *x, real *y) = ScalarAxpy;
+void (*SimdScale)(int n, real a, const real *x, real *y) = ScalarScale;
+real (*SimdDot)(int n, const real *x, const real *y) = ScalarDot;
+void (*SimdMaskedSelect)(int n, const unsigned int *mask, real value,
+                         const real *x, real *y) = ScalarMaskedSelect;
+void (*SimdMomentumUpdate)(int n, real learning_rate, real momentum, bool nesterov,
+                           const real *g, real *v, real *p) = ScalarMomentumUpdate;
+void (*SimdRmsUpdate)(int n, real learning_rate, real decay, real scale, real epsilon,
+                      const real *g, real *s, real *p) = ScalarRmsUpdate;
+void (*SimdAdamUpdate)(int n, real learning_rate, real beta1, real beta2, real epsilon,
+                       const real *g, real *m, real *v, real *p) = ScalarAdamUpdate;
+
+static SimdKernelsLevel simd_kernels_level = SIMD_KERNELS_SCALAR;
+
+SimdKernelsLevel SimdKernelsBestLevel()
+{
+#ifdef SIMD_KERNELS_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f"))
+    return SIMD_KERNELS_AVX512;
+  if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return SIMD_KERNELS_AVX2;
+#endif
+  return SIMD_KERNELS_SCALAR;
+}
+
+SimdKernelsLevel SimdKernelsGetLevel()
+{
+  return simd_kernels_level;
+}
+
+SimdKernelsLevel SimdKernelsSetLevel(SimdKernelsLevel level)
+{
+  SimdKernelsLevel best = SimdKernelsBestLevel();
+  if(level > best)
+    level = best;
+
+  switch(level) {
+#ifdef SIMD_KERNELS_X86
+    case SIMD_KERNELS_AVX512:
+      SimdAxpy = Avx512Axpy;
+      SimdScale = Avx512Scale;
+      SimdDot = Avx512Dot;
+      SimdMaskedSelect = Avx512MaskedSelect;
+      SimdMomentumUpdate = Avx512MomentumUpdate;
+      SimdRmsUpdate = Avx512RmsUpdate;
+      SimdAdamUpdate = Avx512AdamUpdate;
+      break;
+    case SIMD_KERNELS_AVX2:
+      SimdAxpy = Avx2Axpy;
+      SimdScale = Avx2Scale;
+      SimdDot = Avx2Dot;
+      SimdMaskedSelect = Avx2MaskedSelect;
+      SimdMomentumUpdate = Avx2MomentumUpdate;
+      SimdRmsUpdate = Avx2RmsUpdate;
+      SimdAdamUpdate = Avx2AdamUpdate;
+      break;
+#endif
+    default:
+      level = SIMD_KERNELS_SCALAR;
+      SimdAxpy = ScalarAxpy;
+      SimdScale = ScalarScale;
+      SimdDot = ScalarDot;
+      SimdMaskedSelect = ScalarMaskedSelect;
+      SimdMomentumUpdate = ScalarMomentumUpdate;
+      SimdRmsUpdate = ScalarRmsUpdate;
+      SimdAdamUpdate = ScalarAdamUpdate;
+  }
+  simd_kernels_level = level;
+  return level;
+}
+
+const char *SimdKernelsLevelName(SimdKernelsLevel level)
+{
+  switch(level) {
+    case SIMD_KERNELS_AVX512:
+      return "avx512";
+    case SIMD_KERNELS_AVX2:
+      return "avx2";
+    default:
+      return "scalar";
+  }
+}
+
+// Select the best kernels when the program starts.
+static SimdKernelsLevel simd_kernels_startup_level = SimdKernelsSetLevel(SimdKernelsBestLevel());
+
+}
@@ -0,0 +1,88 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_SIMD_KERNELS_H_
+#define TORCH_SIMD_KERNELS_H_
+
+#include "general.h"
+
+namespace Torch {
+
+// Vector kernels used by the inner loops of the linear layers.
+//
+// The implementation is chosen once, at startup, from what the CPU supports:
+// AVX-512, AVX2 (with FMA) or plain scalar loops. The scalar kernels are the
+// loops the layers used to have, so a run with SIMD_KERNELS_SCALAR gives the
+// old results bit for bit, with one exception: a reparametrized
+// TransposedTiedLinear now folds the multiplier into the input
+// ((m*x[i])*alpha[j] instead of (m*alpha[j])*x[i]), which rounds its
+// der_weights differently.
+
+enum SimdKernelsLevel {
+  SIMD_KERNELS_SCALAR = 0,
+  SIMD_KERNELS_AVX2,
+  SIMD_KERNELS_AVX512
+};
+
+// y[i] += a*x[i], for i in [0,n)
+extern void (*SimdAxpy)(int n, real a, const real *x, real *y);
+
+// y[i] = a*x[i], for i in [0,n)
+extern void (*SimdScale)(int n, real a, const real *x, real *y);
+
+// Returns sum_i x[i]*y[i], for i in [0,n)
+extern real (*SimdDot)(int n, const real *x, const real *y);
+
+// y[i] = value if bit i of #mask# is set, x[i] otherwise, for i in [0,n).
+// The mask has 32 bits per word, bit i is bit i%32 of mask[i/32] (see
+// philox.h). x and y may be the same array.
+extern void (*SimdMaskedSelect)(int n, const unsigned int *mask, real value,
+                                const real *x, real *y);
+
+// Fused optimizer updates (see optimizer.h), in place over the n parameters
+// #p#, their derivatives #g# and the optimizer's state.
+
+// Momentum: v[i] = momentum*v[i] - learning_rate*g[i], then p[i] += v[i], or
+// with #nesterov#, p[i] += momentum*v[i] - learning_rate*g[i].
+extern void (*SimdMomentumUpdate)(int n, real learning_rate, real momentum, bool nesterov,
+                                  const real *g, real *v, real *p);
+
+// Scaling by a running sum of squares: s[i] = decay*s[i] + scale*g[i]^2, then
+// p[i] -= learning_rate*g[i]/(sqrt(s[i])+epsilon). AdaGrad has decay=scale=1,
+// RMSProp decay=rho, scale=1-rho.
+extern void (*SimdRmsUpdate)(int n, real learning_rate, real decay, real scale, real epsilon,
+                             const real *g, real *s, real *p);
+
+// Adam, without the bias corrections (fold them into learning_rate and
+// epsilon): m[i] = beta1*m[i] + (1-beta1)*g[i],
+// v[i] = beta2*v[i] + (1-beta2)*g[i]^2, then
+// p[i] -= learning_rate*m[i]/(sqrt(v[i])+epsilon).
+extern void (*SimdAdamUpdate)(int n, real learning_rate, real beta1, real beta2, real epsilon,
+                              const real *g, real *m, real *v, real *p);
+
+// Best level supported by this CPU (and this build).
+SimdKernelsLevel SimdKernelsBestLevel();
+
+// The level currently in use.
+SimdKernelsLevel SimdKernelsGetLevel();
+
+// Select the kernels of a given level. Falls back to the best supported level
+// if #level# is not supported. Returns the level actually selected.
+SimdKernelsLevel SimdKernelsSetLevel(SimdKernelsLevel level);
+
+const char *SimdKernelsLevelName(SimdKernelsLevel level);
+
+}
+
+#endif  // TORCH_SIMD_KERNELS_H_
@@ -17,7 +17,7 @@
 
 namespace Torch {
 
-SmoothedLinear::SmoothedLinear(int n_inputs_, int n_outputs_) : Linear(n_inputs_, n_outputs_)
+SmoothedLinear::SmoothedLinear(int n_inputs_, int n_outputs_) : BlockLinear(n_inputs_, n_outputs_)
 {
   warning("SmoothedLinear - Assuming input is a square image!");
   input_sub_unit_size = (int) sqrt(n_inputs);
@@ -31,7 +31,18 @@ SmoothedLinear::SmoothedLinear(int n_inputs_, int n_outputs_) : Linear(n_inputs_
 void SmoothedLinear::frameBackward(int t, real *f_inputs, real *beta_, real *f_outputs, real *alpha_)
 {
   Linear::frameBackward(t, f_inputs, beta_, f_outputs, alpha_);
+  AddSmoothingDecay(1);
+}
+
+// Called by BlockLinear::backward when a minibatch is processed as a block.
+void SmoothedLinear::AddDecayToDerivatives(int n_frames)
+{
+  BlockLinear::AddDecayToDerivatives(n_frames);
+  AddSmoothingDecay(n_frames);
+}
 
+void SmoothedLinear::AddSmoothingDecay(int n_frames)
+{
   // Apply smoothing weight decay.
   if (l1_smoothing_weight_decay != 0. || l2_smoothing_weight_decay != 0.)  {
     real *src_ = params->data[0];
@@ -47,6 +58,9 @@ void SmoothedLinear::frameBackward(int t, real *f_inputs, real *beta_, real *f_o
     if (l2_smoothing_weight_decay > 0.0)
       is_l2_decayed = true;
 
+    real l1_decay = n_frames * l1_smoothing_weight_decay;
+    real l2_decay = n_frames * l2_smoothing_weight_decay;
+
     // the gradient will be SUBSTRACTED. We add negative the correction to it.
     for(int i=0; i<n_outputs; i++) {
       for (int j=0; j<input_n_sub_units; j++) {
@@ -59,13 +73,13 @@ void SmoothedLinear::frameBackward(int t, real *f_inputs, real *beta_, real *f_o
 
             if (is_l1_decayed)  {
               if(delta<0.0)
-                dest_[offset] -= l1_smoothing_weight_decay;
+                dest_[offset] -= l1_decay;
               else
-                dest_[offset] += l1_smoothing_weight_decay;
+                dest_[offset] += l1_decay;
             }
 
             if (is_l2_decayed)
-              dest_[offset] += l2_smoothing_weight_decay * delta;
+              dest_[offset] += l2_decay * delta;
           }
 
           // from right
@@ -74,13 +88,13 @@ void SmoothedLinear::frameBackward(int t, real *f_inputs, real *beta_, real *f_o
 
             if(is_l1_decayed) {
               if(delta<0.0)
-                dest_[offset] -= l1_smoothing_weight_decay;
+                dest_[offset] -= l1_decay;
               else
-                dest_[offset] += l1_smoothing_weight_decay;
+                dest_[offset] += l1_decay;
             }
 
             if (is_l2_decayed)
-              dest_[offset] += l2_smoothing_weight_decay * delta;
+              dest_[offset] += l2_decay * delta;
           }
 
           // from top
@@ -89,13 +103,13 @@ void SmoothedLinear::frameBackward(int t, real *f_inputs, real *beta_, real *f_o
 
             if(is_l1_decayed) {
               if(delta<0.0)
-                dest_[offset] -= l1_smoothing_weight_decay;
+                dest_[offset] -= l1_decay;
               else
-                dest_[offset] += l1_smoothing_weight_decay;
+                dest_[offset] += l1_decay;
             }
 
             if (is_l2_decayed)
-              dest_[offset] += l2_smoothing_weight_decay * delta;
+              dest_[offset] += l2_decay * delta;
           }
 
           // from bottom
@@ -104,13 +118,13 @@ void SmoothedLinear::frameBackward(int t, real *f_inputs, real *beta_, real *f_o
 
             if (is_l1_decayed) {
               if (delta < 0.0)
-                dest_[offset] -= l1_smoothing_weight_decay;
+                dest_[offset] -= l1_decay;
               else
-                dest_[offset] += l1_smoothing_weight_decay;
+                dest_[offset] += l1_decay;
             }
 
             if (is_l2_decayed)
-              dest_[offset] += l2_smoothing_weight_decay * delta;
+              dest_[offset] += l2_decay * delta;
           }
 
           //
@@ -15,14 +15,14 @@
 #ifndef TORCH_SMOOTHED_LINEAR_H_
 #define TORCH_SMOOTHED_LINEAR_H_
 
-#include "Linear.h"
+#include "block_linear.h"
 
 namespace Torch {
 
 // A modified Linear Layer with a weight decay that tries to maintain
 // neighbouring weights of a neuron close. Assumes the input is a square
 // (NxN) image.
-class SmoothedLinear : public Linear
+class SmoothedLinear : public BlockLinear
 {
   public:
     int input_sub_unit_size;
@@ -35,6 +35,10 @@ class SmoothedLinear : public Linear
 
     //-----
     virtual void frameBackward(int t, real *f_inputs, real *beta_, real *f_outputs, real *alpha_);
+    virtual void AddDecayToDerivatives(int n_frames);
+
+    // Adds the smoothing weight decay to the derivatives, n_frames times.
+    void AddSmoothingDecay(int n_frames);
 
     virtual ~SmoothedLinear();
 };
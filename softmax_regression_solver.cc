@@ -0,0 +1,290 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "softmax_regression_solver.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "simd_kernels.h"
+#include "task_pool.h"
+
+namespace Torch {
+
+SoftmaxRegressionSolver::SoftmaxRegressionSolver(int n_inputs_, int n_classes_)
+{
+  n_inputs = n_inputs_;
+  n_classes = n_classes_;
+  n_params = n_classes * (n_inputs + 1);
+
+  addIOption("max iter", &max_iter, 200, "max number of L-BFGS iterations");
+  addIOption("history", &history, 10, "number of L-BFGS correction pairs");
+  addIOption("n threads", &n_threads, 1, "number of threads computing the cost");
+  addROption("gradient tolerance", &gradient_tolerance, 1e-5, "stop when no gradient component exceeds it");
+  addROption("weight decay", &weight_decay, 0., "L2 decay of the weights");
+  addROption("bias decay", &bias_decay, 0., "L2 decay of the bias");
+
+  features = NULL;
+  classes = NULL;
+  n_examples = 0;
+  thread_gradients = NULL;
+  pool = NULL;
+}
+
+double SoftmaxRegressionSolver::PartialCost(real *params, int first, int last, real *gradient)
+{
+  real *weights = params;
+  real *der_weights = gradient;
+  real *der_bias = gradient + n_classes * n_inputs;
+  real *bias = params + n_classes * n_inputs;
+  real *scores_ = (real*)Allocator::sysAlloc(sizeof(real)*n_classes);
+
+  memset(gradient, 0, sizeof(real)*n_params);
+  double nll = 0.;
+  for(int t=first; t<last; t++) {
+    real *x = features + (long)t * n_inputs;
+
+    for(int c=0; c<n_classes; c++)
+      scores_[c] = bias[c] + SimdDot(n_inputs, weights + c*n_inputs, x);
+    real max_score = scores_[0];
+    for(int c=1; c<n_classes; c++)
+      if(scores_[c] > max_score)
+        max_score = scores_[c];
+    double sum = 0.;
+    for(int c=0; c<n_classes; c++)
+      sum += exp(scores_[c] - max_score);
+    double log_sum = max_score + log(sum);
+    nll += log_sum - scores_[classes[t]];
+
+    // d nll / d score_c = p_c - [c == class]
+    for(int c=0; c<n_classes; c++)      {
+      real delta = (real)exp(scores_[c] - log_sum);
+      if(c == classes[t])
+        delta -= 1.;
+      der_bias[c] += delta;
+      SimdAxpy(n_inputs, delta, x, der_weights + c*n_inputs);
+    }
+  }
+
+  free(scores_);
+  return nll;
+}
+
+struct SoftmaxRegressionThread
+{
+  SoftmaxRegressionSolver *solver;
+  real *params;
+  int first;
+  int last;
+  real *gradient;
+  double nll;
+};
+
+static void RunPartialCost(void *arg, int k)
+{
+  SoftmaxRegressionThread *thread = (SoftmaxRegressionThread*)arg + k;
+  thread->nll = thread->solver->PartialCost(thread->params, thread->first, thread->last,
+                                            thread->gradient);
+}
+
+real SoftmaxRegressionSolver::Cost(real *params, real *gradient, real *nll)
+{
+  int n_ranges = (n_threads < n_examples ? n_threads : n_examples);
+  if(n_ranges < 1)
+    n_ranges = 1;
+
+  SoftmaxRegressionThread *threads = (SoftmaxRegressionThread*)Allocator::sysAlloc(sizeof(SoftmaxRegressionThread)*n_ranges);
+  for(int k=0; k<n_ranges; k++) {
+    threads[k].solver = this;
+    threads[k].params = params;
+    threads[k].first = (int)((long long)n_examples * k / n_ranges);
+    threads[k].last = (int)((long long)n_examples * (k+1) / n_ranges);
+    threads[k].gradient = (k == 0 ? gradient : thread_gradients[k]);
+  }
+  if(pool)
+    pool->Run(n_ranges, RunPartialCost, threads);
+  else
+    RunPartialCost(threads, 0);
+
+  // Fixed order
+  double total_nll = threads[0].nll;
+  for(int k=1; k<n_ranges; k++) {
+    total_nll += threads[k].nll;
+    SimdAxpy(n_params, 1., threads[k].gradient, gradient);
+  }
+  free(threads);
+
+  real scale = 1. / (real)n_examples;
+  for(int i=0; i<n_params; i++)
+    gradient[i] *= scale;
+  total_nll *= scale;
+
+  int n_weights = n_classes * n_inputs;
+  double decay = 0.;
+  if(weight_decay != 0.)        {
+    decay += 0.5 * weight_decay * SimdDot(n_weights, params, params);
+    SimdAxpy(n_weights, weight_decay, params, gradient);
+  }
+  if(bias_decay != 0.)  {
+    decay += 0.5 * bias_decay * SimdDot(n_classes, params + n_weights, params + n_weights);
+    SimdAxpy(n_classes, bias_decay, params + n_weights, gradient + n_weights);
+  }
+
+  if(nll)
+    *nll = (real)total_nll;
+  return (real)(total_nll + decay);
+}
+
+real SoftmaxRegressionSolver::Fit(real *features_, int *classes_, int n_examples_, real *params)
+{
+  features = features_;
+  classes = classes_;
+  n_examples = n_examples_;
+  if(n_examples < 1)
+    error("SoftmaxRegressionSolver: no examples");
+
+  thread_gradients = (real**)allocator->alloc(sizeof(real*)*n_threads);
+  for(int k=1; k<n_threads; k++)
+    thread_gradients[k] = (real*)allocator->alloc(sizeof(real)*n_params);
+  // The threads wait between the iterations.
+  if(n_threads > 1)
+    pool = new(allocator) TaskPool(n_threads);
+
+  // L-BFGS: #history# pairs s = x_{k+1} - x_k, y = g_{k+1} - g_k, in a ring.
+  int m = history;
+  real *s = (real*)allocator->alloc(sizeof(real)*m*n_params);
+  real *y = (real*)allocator->alloc(sizeof(real)*m*n_params);
+  real *rho = (real*)allocator->alloc(sizeof(real)*m);
+  real *alpha = (real*)allocator->alloc(sizeof(real)*m);
+  real *gradient = (real*)allocator->alloc(sizeof(real)*n_params);
+  real *new_params = (real*)allocator->alloc(sizeof(real)*n_params);
+  real *new_gradient = (real*)allocator->alloc(sizeof(real)*n_params);
+  real *direction = (real*)allocator->alloc(sizeof(real)*n_params);
+  real *s_new = (real*)allocator->alloc(sizeof(real)*n_params);
+  real *y_new = (real*)allocator->alloc(sizeof(real)*n_params);
+  int n_pairs = 0;
+  int newest = -1;
+
+  real nll;
+  real cost = Cost(params, gradient, &nll);
+  int iter;
+  for(iter=0; iter<max_iter; iter++)    {
+    real max_gradient = 0.;
+    for(int i=0; i<n_params; i++)
+      if(fabs(gradient[i]) > max_gradient)
+        max_gradient = fabs(gradient[i]);
+    if(max_gradient < gradient_tolerance)
+      break;
+
+    // Two-loop recursion: direction = -H gradient
+    for(int i=0; i<n_params; i++)
+      direction[i] = -gradient[i];
+    for(int j=0; j<n_pairs; j++)        {
+      int p = (newest - j + m) % m;
+      alpha[p] = rho[p] * SimdDot(n_params, s + p*n_params, direction);
+      SimdAxpy(n_params, -alpha[p], y + p*n_params, direction);
+    }
+    if(n_pairs > 0)     {
+      real *y_newest = y + newest*n_params;
+      real gamma = 1. / (rho[newest] * SimdDot(n_params, y_newest, y_newest));
+      for(int i=0; i<n_params; i++)
+        direction[i] *= gamma;
+    }
+    for(int j=n_pairs-1; j>=0; j--)     {
+      int p = (newest - j + m) % m;
+      real beta = rho[p] * SimdDot(n_params, y + p*n_params, direction);
+      SimdAxpy(n_params, alpha[p] - beta, s + p*n_params, direction);
+    }
+
+    real slope = SimdDot(n_params, gradient, direction);
+    if(slope >= 0.)     {
+      // Not a descent direction: restart from the gradient.
+      n_pairs = 0;
+      for(int i=0; i<n_params; i++)
+        direction[i] = -gradient[i];
+      slope = SimdDot(n_params, gradient, direction);
+    }
+
+    // Backtracking line search (Armijo). The first step is scaled to the
+    // gradient, the next ones start from 1.
+    real step = 1.;
+    if(iter == 0)
+      step = 1. / sqrt(-slope);
+    real new_cost, new_nll;
+    int n_backtracks = 0;
+    while(1)    {
+      for(int i=0; i<n_params; i++)
+        new_params[i] = params[i] + step * direction[i];
+      new_cost = Cost(new_params, new_gradient, &new_nll);
+      if(new_cost <= cost + 1e-4 * step * slope || ++n_backtracks > 30)
+        break;
+      step *= 0.5;
+    }
+    if(new_cost > cost)
+      break;
+
+    // New correction pair, if the curvature is positive. It only enters the
+    // ring once accepted, so a rejected pair leaves the oldest one alive.
+    for(int i=0; i<n_params; i++)       {
+      s_new[i] = new_params[i] - params[i];
+      y_new[i] = new_gradient[i] - gradient[i];
+    }
+    real sy = SimdDot(n_params, s_new, y_new);
+    if(sy > 0.) {
+      int next = (newest + 1) % m;
+      memcpy(s + next*n_params, s_new, sizeof(real)*n_params);
+      memcpy(y + next*n_params, y_new, sizeof(real)*n_params);
+      rho[next] = 1. / sy;
+      newest = next;
+      if(n_pairs < m)
+        n_pairs++;
+    }
+
+    real decrease = cost - new_cost;
+    memcpy(params, new_params, sizeof(real)*n_params);
+    memcpy(gradient, new_gradient, sizeof(real)*n_params);
+    cost = new_cost;
+    nll = new_nll;
+    if(decrease <= 1e-10 * (fabs(cost) > 1. ? fabs(cost) : 1.))
+      break;
+  }
+
+  message("SoftmaxRegressionSolver: cost %g (nll %g) after %d iterations", cost, nll, iter);
+
+  allocator->free(y_new);
+  allocator->free(s_new);
+  allocator->free(direction);
+  allocator->free(new_gradient);
+  allocator->free(new_params);
+  allocator->free(gradient);
+  allocator->free(alpha);
+  allocator->free(rho);
+  allocator->free(y);
+  allocator->free(s);
+  for(int k=1; k<n_threads; k++)
+    allocator->free(thread_gradients[k]);
+  allocator->free(thread_gradients);
+  thread_gradients = NULL;
+  if(pool)
+    allocator->free(pool);
+  pool = NULL;
+
+  return nll;
+}
+
+SoftmaxRegressionSolver::~SoftmaxRegressionSolver()
+{
+}
+
+}
@@ -0,0 +1,81 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_SOFTMAX_REGRESSION_SOLVER_H_
+#define TORCH_SOFTMAX_REGRESSION_SOLVER_H_
+
+#include "Object.h"
+
+namespace Torch {
+
+class TaskPool;
+
+// Fits a softmax regression (a Linear layer followed by a LogSoftMax,
+// trained with a ClassNLLCriterion) on fixed features with L-BFGS.
+//
+// The cost is the mean negative log-likelihood of the examples, plus
+// "weight decay"/2 times the squared norm of the weights and "bias decay"/2
+// times that of the bias: the cost SGD minimizes with the same decays on the
+// Linear layer. It is convex, so the solver goes to the optimum instead of
+// taking a fixed number of epochs.
+//
+// Each iteration computes the cost and its gradient over all the examples,
+// split in "n threads" ranges whose partial sums are added in a fixed order,
+// so the result does not depend on the scheduling. The ranges are the tasks
+// of a TaskPool kept for the fit.
+class SoftmaxRegressionSolver : public Object
+{
+  public:
+    int n_inputs;
+    int n_classes;
+    int n_params;               // weights then bias, as in Linear
+
+    int max_iter;
+    int history;
+    int n_threads;
+    real gradient_tolerance;
+    real weight_decay;
+    real bias_decay;
+
+    // The problem being solved
+    real *features;
+    int *classes;
+    int n_examples;
+
+    SoftmaxRegressionSolver(int n_inputs_, int n_classes_);
+
+    // Minimizes the cost over the #n_examples_# examples of #features_#
+    // (n_inputs reals each, one after the other) and #classes_#, starting
+    // from #params# (the n_classes rows of n_inputs weights, then the bias, as
+    // in Linear's params) and leaving the solution there. Returns the mean
+    // negative log-likelihood of the solution.
+    virtual real Fit(real *features_, int *classes_, int n_examples_, real *params);
+
+    // The cost at #params#, its gradient in #gradient#, and the mean
+    // negative log-likelihood in #nll# if not NULL.
+    virtual real Cost(real *params, real *gradient, real *nll);
+    // Sum of the negative log-likelihoods of the examples [first, last), and
+    // the sum of their gradients in #gradient#.
+    virtual double PartialCost(real *params, int first, int last, real *gradient);
+
+    virtual ~SoftmaxRegressionSolver();
+
+  private:
+    real **thread_gradients;
+    TaskPool *pool;
+};
+
+}
+
+#endif  // TORCH_SOFTMAX_REGRESSION_SOLVER_H_
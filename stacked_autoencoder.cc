@@ -17,6 +17,8 @@
 #include "identity.h"
 #include "destructive.h"
 #include "smoothed_linear.h"
+#include "branch_machine.h"
+#include "task_pool.h"
 
 namespace Torch {
 
@@ -38,6 +40,13 @@ StackedAutoencoder::StackedAutoencoder(std::string name_,
   nonlinearity = nonlinearity_;
   first_layer_smoothed = first_layer_smoothed_;
 
+  parallel_branches = (GetDefaultTaskPool() != NULL);
+  n_pending_branches = 0;
+  pending_branches = NULL;
+  pending_sources = NULL;
+  n_pending_ties = 0;
+  pending_ties = NULL;
+
   // the topology
   n_hidden_layers = n_hidden_layers_;
 
@@ -80,7 +89,8 @@ void StackedAutoencoder::BuildCoders()
     }
   }
 
-  // noisy encoder
+  // noisy encoder, tied to the clean one. With setIncrementalNoisyCoders(),
+  // it reuses the clean encoder's pre-activation when both see the same input.
   if(is_noisy)  {
     noisy_encoders = (Coder**)allocator->alloc(sizeof(Coder*)*n_hidden_layers);
 
@@ -205,31 +215,76 @@ void StackedAutoencoder::AddEncodersUpToIncluded(ConnectedMachine* mch, int inde
 
 }
 
+// The autoencoders go after the encoders: in a forward, encoders[i] has seen
+// the input of noisy_encoders[i] by the time the latter runs, which the
+// incremental noisy coders rely on.
 void StackedAutoencoder::AddUnsupMachines(ConnectedMachine* mch)
 {
   for(int i=0; i<n_hidden_layers; i++) {
     // Just plug the decoder into the single encoder
     if(!is_noisy)  {
-     mch->addMachine(decoders[i]);
-     mch->connectOn(encoders[i]);
+     AddBranch(mch, decoders[i], encoders[i]);
     // Use the autoencoder (it's noisy)
     }     else    {
       // Connect
       if(i>0)        {
-       mch->addMachine(autoencoders[i]);
-       mch->connectOn(encoders[i-1]);
+       AddBranch(mch, autoencoders[i], encoders[i-1]);
       }   else    {
         // The first layer requires a special procedure, actually a big hack. The
         // reason is it can't be connected on the input. It must be added on the
         // first layer.
-        mch->addMachine(autoencoders[i]);
-        mch->connectOn(input_handle_machine);
+        AddBranch(mch, autoencoders[i], input_handle_machine);
       }
     }
   }
 
 }
 
+void StackedAutoencoder::AddBranch(ConnectedMachine* mch, GradientMachine *machine, GradientMachine *source)
+{
+  if(!parallel_branches)        {
+    mch->addMachine(machine);
+    mch->connectOn(source);
+    return;
+  }
+
+  pending_branches = (GradientMachine**) allocator->realloc(pending_branches, sizeof(GradientMachine*)*(n_pending_branches+1));
+  pending_sources = (GradientMachine**) allocator->realloc(pending_sources, sizeof(GradientMachine*)*(n_pending_branches+1));
+  pending_branches[n_pending_branches] = machine;
+  pending_sources[n_pending_branches] = source;
+  n_pending_branches++;
+}
+
+void StackedAutoencoder::TieBranches(GradientMachine *a, GradientMachine *b)
+{
+  if(!parallel_branches)
+    return;
+
+  pending_ties = (GradientMachine**) allocator->realloc(pending_ties, sizeof(GradientMachine*)*2*(n_pending_ties+1));
+  pending_ties[2*n_pending_ties] = a;
+  pending_ties[2*n_pending_ties+1] = b;
+  n_pending_ties++;
+}
+
+// The BranchMachine's inputs are the sources' outputs, which the
+// ConnectedMachine concatenates in the order of the connections.
+void StackedAutoencoder::EndBranches(ConnectedMachine* mch)
+{
+  if(n_pending_branches == 0)
+    return;
+
+  BranchMachine *branch_machine = new(allocator) BranchMachine(n_pending_branches, pending_branches);
+  for(int i=0; i<n_pending_ties; i++)
+    branch_machine->RunTogether(pending_ties[2*i], pending_ties[2*i+1]);
+
+  mch->addMachine(branch_machine);
+  for(int i=0; i<n_pending_branches; i++)
+    mch->connectOn(pending_sources[i]);
+
+  n_pending_branches = 0;
+  n_pending_ties = 0;
+}
+
 // In the noisy case, we musn't add the last encoder as it does not get used.
 // This would cause a segfault in ConnectedMachine during backprop, because the
 // node would have no alpha_links.
@@ -261,6 +316,7 @@ void StackedAutoencoder::BuildUnsupMachine()
   }
 
   AddUnsupMachines(unsup_machine);
+  EndBranches(unsup_machine);
 
   unsup_machine->build();
 }
@@ -274,11 +330,11 @@ void StackedAutoencoder::BuildSupUnsupMachine()
   // Build the final layer of sup_unsup_machine.
   // We can't call FCL because if only 1 layer, then there might be an identity
   // layer on the previous layer. We wouldn't want to connect to it.
-  sup_unsup_machine->addMachine(outputer);
-  sup_unsup_machine->connectOn(encoders[n_hidden_layers-1]);
+  AddBranch(sup_unsup_machine, outputer, encoders[n_hidden_layers-1]);
 
   // Add the reconstruction of the input and hidden layers (except last)
   AddUnsupMachines(sup_unsup_machine);
+  EndBranches(sup_unsup_machine);
 
   sup_unsup_machine->build();
 }
@@ -345,6 +401,37 @@ void StackedAutoencoder::setSmoothingDecay(real l1_smoothing_decay, real l2_smoo
   }
 }
 
+void StackedAutoencoder::setFusedCoders(bool fused)
+{
+  for(int i=0; i<n_hidden_layers; i++) {
+    encoders[i]->setBOption("fused", fused);
+    decoders[i]->setBOption("fused", fused);
+    if(is_noisy)
+      noisy_encoders[i]->setBOption("fused", fused);
+  }
+  outputer->setBOption("fused", fused);
+}
+
+void StackedAutoencoder::setIncrementalNoisyCoders(bool incremental)
+{
+  if(!is_noisy)
+    return;
+
+  for(int i=0; i<n_hidden_layers; i++) {
+    encoders[i]->setBOption("keep pre-activation", incremental);
+    noisy_encoders[i]->setBOption("incremental", incremental);
+  }
+}
+
+void StackedAutoencoder::SetCorruptionStreams(unsigned int key, unsigned long long stream)
+{
+  if(!is_noisy)
+    return;
+
+  for(int i=0; i<n_hidden_layers; i++)
+    noisy_encoders[i]->destructive_layer->SetStream(key, (unsigned int)i, stream);
+}
+
 void StackedAutoencoder::loadXFile(XFile *file)
 {
   sup_unsup_machine->loadXFile(file);
@@ -22,6 +22,7 @@
 namespace Torch {
 
 class Identity;
+class BranchMachine;
 //class Linear;
 //class Destructive;
 //class Nonlinear;
@@ -33,6 +34,12 @@ class Coder;
 // but also has decoders for reconstruction at each layer. See the full_sae
 // attribute.
 //
+// The machines hanging off the hidden layers (outputer, decoders, ...) are
+// independent branches of the last layer of the machines built here. If
+// there is a default task pool (see task_pool.h) when the autoencoder is
+// built, the machines of such a layer are added as one BranchMachine, and
+// forwarded and backwarded in parallel. Otherwise they are added one by one.
+//
 class StackedAutoencoder : public ConnectedMachine
 {
   public:
@@ -80,6 +87,14 @@ class StackedAutoencoder : public ConnectedMachine
                                                 // the resonstructed units
                                                 // y, \hat{x}, \hat{h1}, \hat{h2}, ...
 
+    // The branches of the layer being built, with parallel branches.
+    bool parallel_branches;
+    int n_pending_branches;
+    GradientMachine **pending_branches;
+    GradientMachine **pending_sources;
+    int n_pending_ties;
+    GradientMachine **pending_ties;     // pairs
+
     StackedAutoencoder(std::string name_,
                        std::string nonlinearity_,
                        bool tied_weights_,
@@ -95,6 +110,15 @@ class StackedAutoencoder : public ConnectedMachine
     virtual void AddCoreMachines(ConnectedMachine* mch);
     virtual void AddEncodersUpToIncluded(ConnectedMachine* mch, int index_up_to_included, bool add_input_handle);
     virtual void AddUnsupMachines(ConnectedMachine* mch);
+    // Adds #machine# to the current layer of #mch#, connected on #source#.
+    // With parallel branches, the machines are kept until EndBranches(),
+    // which adds them as one BranchMachine. It must be called before the
+    // layer is closed (addLayer() or build()).
+    virtual void AddBranch(ConnectedMachine* mch, GradientMachine *machine, GradientMachine *source);
+    // The branches #a# and #b# of the current layer share derivatives: they
+    // must run in the same task.
+    virtual void TieBranches(GradientMachine *a, GradientMachine *b);
+    virtual void EndBranches(ConnectedMachine* mch);
     virtual void BuildCoders();
     virtual void BuildAutoencoders();
     virtual void BuildMesdMachines();
@@ -108,6 +132,14 @@ class StackedAutoencoder : public ConnectedMachine
     virtual void setBiasDecay(real bias_decay);
     virtual void setDestructionOptions(real destruct_prob, real destruct_value);
     virtual void setSmoothingDecay(real l1_smoothing_decay, real l2_smoothing_decay);
+    // Sets the "fused" option of all the coders (see Coder).
+    virtual void setFusedCoders(bool fused);
+    // Has the noisy encoders derive their pre-activation from the clean
+    // encoders' (see Coder). Only useful if is_noisy.
+    virtual void setIncrementalNoisyCoders(bool incremental);
+    // Has the noisy encoder of layer i corrupt its next frames with the
+    // Philox key (#key#, i), starting at stream #stream# (see Destructive).
+    virtual void SetCorruptionStreams(unsigned int key, unsigned long long stream);
 
     // Saves-loads the parameters. Currently the rest of the save is in
     // helpers (the topology).
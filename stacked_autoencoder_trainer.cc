@@ -17,6 +17,7 @@
 #include <sstream>
 #include <iostream>
 #include <cassert>
+#include <pthread.h>
 
 #include "OneHotClassFormat.h"
 #include "Measurer.h"
@@ -25,7 +26,10 @@
 #include "ClassNLLMeasurer.h"
 #include "GradientCheckMeasurer.cc"
 #include "MSECriterion.h"
+#include "ClassNLLCriterion.h"
+#include "Linear.h"
 #include "DiskXFile.h"
+#include "random_streams.h"
 #include "input_as_target_data_set.h"
 #include "dynamic_data_set.h"
 #include "cross_entropy_criterion.h"
@@ -37,6 +41,12 @@
 
 #include "statistics_measurer.h"
 #include "vectors_angle_measurer.h"
+#include "trainer_group.h"
+#include "lazy_derivatives.h"
+#include "representation_cache.h"
+#include "representation_cache_data_set.h"
+#include "representation_queue.h"
+#include "softmax_regression_solver.h"
 
 namespace Torch {
 
@@ -84,6 +94,152 @@ StackedAutoencoderTrainer::StackedAutoencoderTrainer(StackedAutoencoder *machine
   saved_grads = NULL;
 
   gradient_angle_measurers = NULL;
+
+  replicas = NULL;
+  n_replicas = 0;
+  replica_train_data = NULL;
+  in_replicated_phase = false;
+
+  addBOption("cache representations", &cache_representations, false, "layerwise training: cache the outputs of the lower encoders instead of forwarding them");
+  addBOption("cache on disk", &cache_on_disk, false, "keep the representation caches in memory-mapped files in expdir");
+  representation_caches = (RepresentationCache**) allocator->alloc(sizeof(RepresentationCache*)*sae->n_hidden_layers);
+  for(int i=0; i<sae->n_hidden_layers; i++)
+    representation_caches[i] = NULL;
+  layer_params = NULL;
+  layer_der_params = NULL;
+
+  addBOption("convex outputer", &convex_outputer, false, "fit the outputer with L-BFGS on cached features when it is the only layer trained");
+  addIOption("convex outputer threads", &convex_outputer_threads, 1, "number of threads of the outputer fit");
+  addIOption("convex outputer max iter", &convex_outputer_max_iter, 200, "max number of L-BFGS iterations of the outputer fit");
+}
+
+void StackedAutoencoderTrainer::train(DataSet *data, MeasurerList *measurers)
+{
+  SaeTrainerPhase phase = {SAE_PHASE_SUPERVISED, NULL, false, 0, 0., data, measurers};
+  if(convex_outputer && OnlyTrainsOutputer())  {
+    FitOutputer(data, measurers);
+    return;
+  }
+  if(ReplicatePhase(&phase))
+    return;
+
+  StochasticGradientPlus::train(data, measurers);
+}
+
+void StackedAutoencoderTrainer::SetReplicas(StackedAutoencoderTrainer **replicas_, int n)
+{
+  replicas = replicas_;
+  n_replicas = n;
+
+  group = new(allocator) TrainerGroup(n_replicas+1);
+  group_rank = 0;
+
+  // sup_unsup_machine holds all the parameters the phases train.
+  for(int k=0; k<n_replicas; k++)       {
+    replicas[k]->group = group;
+    replicas[k]->group_rank = k+1;
+    replicas[k]->ShareParameters(replicas[k]->sae->sup_unsup_machine->params,
+                                 sae->sup_unsup_machine->params);
+  }
+}
+
+void StackedAutoencoderTrainer::SetCorruptionStreams(long long first_example)
+{
+  sae->SetCorruptionStreams((unsigned int)GetRandomSeed(), (unsigned long long)first_example);
+}
+
+struct SaeTrainerPhaseThread
+{
+  StackedAutoencoderTrainer *trainer;
+  SaeTrainerPhase phase;
+};
+
+static void *RunPhaseThread(void *arg)
+{
+  SaeTrainerPhaseThread *thread = (SaeTrainerPhaseThread*)arg;
+  thread->trainer->RunPhase(&thread->phase);
+  return NULL;
+}
+
+bool StackedAutoencoderTrainer::ReplicatePhase(SaeTrainerPhase *phase)
+{
+  if(n_replicas == 0 || in_replicated_phase)
+    return false;
+
+  if(do_eval_criterion_weights || profile_gradients)
+    error("StackedAutoencoderTrainer: the replicas do not support the criterion weights evaluation "
+          "or the gradient profiling");
+
+  pthread_t *threads = (pthread_t*)allocator->alloc(sizeof(pthread_t)*n_replicas);
+  SaeTrainerPhaseThread *args = (SaeTrainerPhaseThread*)allocator->alloc(sizeof(SaeTrainerPhaseThread)*n_replicas);
+  MeasurerList no_measurers;
+
+  in_replicated_phase = true;
+  for(int k=0; k<n_replicas; k++)       {
+    StackedAutoencoderTrainer *replica = replicas[k];
+
+    // The replicas follow the master's epochs and learning rate. Only what
+    // their own updates and minibatches depend on is copied.
+    replica->minibatch_size = minibatch_size;
+    replica->shard_size = shard_size;
+    replica->optimizer = optimizer;
+    replica->lazy_derivatives = lazy_derivatives;
+    replica->freeze_untrained = freeze_untrained;
+    replica->is_finetuning = is_finetuning;
+    for(int i=0; i<sae->n_hidden_layers+1; i++)
+      replica->finetuning_learning_rates[i] = finetuning_learning_rates[i];
+    replica->in_replicated_phase = true;
+
+    args[k].trainer = replica;
+    args[k].phase = *phase;
+    if(phase->data)
+      args[k].phase.data = replica->replica_train_data;
+    if(phase->measurers)
+      args[k].phase.measurers = &no_measurers;
+    pthread_create(&threads[k], NULL, RunPhaseThread, &args[k]);
+  }
+
+  RunPhase(phase);
+
+  for(int k=0; k<n_replicas; k++)       {
+    pthread_join(threads[k], NULL);
+    replicas[k]->in_replicated_phase = false;
+  }
+  in_replicated_phase = false;
+
+  allocator->free(threads);
+  allocator->free(args);
+  return true;
+}
+
+void StackedAutoencoderTrainer::RunPhase(SaeTrainerPhase *phase)
+{
+  switch(phase->type)   {
+    case SAE_PHASE_SUPERVISED:
+      train(phase->data, phase->measurers);
+      break;
+    case SAE_PHASE_UNSUP_LAYERWISE:
+      TrainUnsupLayerwise();
+      break;
+    case SAE_PHASE_SELECTIVE_UNSUP_LAYERWISE:
+      TrainSelectiveUnsupLayerwise(phase->pretrain_list);
+      break;
+    case SAE_PHASE_SELECTIVE_UNSUP:
+      TrainSelectiveUnsup(phase->pretrain_list, phase->partial_backprop);
+      break;
+    case SAE_PHASE_SUPERVISED_TOP_K_LAYERS:
+      TrainSupervisedTopKLayers(phase->data, phase->measurers, phase->top_k_layers);
+      break;
+    case SAE_PHASE_UNSUP_NOT_OUTPUT:
+      TrainUnsupNotOutput();
+      break;
+    case SAE_PHASE_UNSUP:
+      TrainUnsup(phase->data, phase->measurers);
+      break;
+    case SAE_PHASE_SUP_UNSUP:
+      TrainSupUnsup(phase->data, phase->measurers, phase->unsup_criterions_weight);
+      break;
+  }
 }
 
 
@@ -142,6 +298,7 @@ real StackedAutoencoderTrainer::EvalHessian(GradientMachine *the_gm, Criterion*
     // measure
     int index = 0;
     for(int j=0; j<der_params->n_data; j++)     {
+      SettleDerivatives(der_params->data[j], der_params->size[j]);
       for(int k=0; k<der_params->size[j]; k++)  {
         if(fabs(der_params->data[j][k])>10.0)
           std::cout << "Param group " << j << " of size "<< der_params->size[j] << ". "
@@ -247,13 +404,17 @@ void StackedAutoencoderTrainer::fpropbprop(DataSet *data)
     StochasticGradientPlus::fpropbprop(data);
   }
   else if(layerwise_training)   {
-    // forward the mesd
-    sae->mesd_machines[layerwise_layer]->forward(data->inputs);
+    // forward the mesd (or the autoencoder, if the inputs are cached outputs
+    // of the lower encoders)
+    machine->forward(data->inputs);
     criterion->forward(machine->outputs);
 
-    // backward only the autoencoder
+    // backward only the autoencoder, from the outputs of the encoder below
     criterion->backward(machine->outputs, NULL);
-    sae->autoencoders[layerwise_layer]->backward(data->inputs, criterion->beta);
+    if(layerwise_layer > 0)
+      sae->autoencoders[layerwise_layer]->backward(sae->encoders[layerwise_layer-1]->outputs, criterion->beta);
+    else
+      sae->autoencoders[layerwise_layer]->backward(data->inputs, criterion->beta);
   }
   else if(topK_training)    {
     // Full forward
@@ -286,10 +447,10 @@ void StackedAutoencoderTrainer::fpropbprop(DataSet *data)
   }
 }
 
-void StackedAutoencoderTrainer::UpdateMachine(GradientMachine *gm, real current_learning_rate)
+void StackedAutoencoderTrainer::UpdateMachine(GradientMachine *gm, real current_learning_rate, int n_examples)
 {
   if (!is_finetuning)
-    StochasticGradientPlus::UpdateMachine(gm, current_learning_rate);
+    StochasticGradientPlus::UpdateMachine(gm, current_learning_rate, n_examples);
   // We are fine-tuning. The machine is the sae and we want to apply a specific
   // learning rate to each layer.
   else  {
@@ -297,16 +458,57 @@ void StackedAutoencoderTrainer::UpdateMachine(GradientMachine *gm, real current_
 
     for (int i=0; i<sae->n_hidden_layers; i++)  {
       if (finetuning_learning_rates[i] > 0.)
-        StochasticGradientPlus::UpdateMachine(sae->encoders[i], finetuning_learning_rates[i]);
+        StochasticGradientPlus::UpdateMachine(sae->encoders[i], finetuning_learning_rates[i], n_examples);
     }
     if (finetuning_learning_rates[sae->n_hidden_layers] > 0.)
-      StochasticGradientPlus::UpdateMachine(sae->outputer, finetuning_learning_rates[sae->n_hidden_layers]);
+      StochasticGradientPlus::UpdateMachine(sae->outputer, finetuning_learning_rates[sae->n_hidden_layers], n_examples);
   }
 }
 
+Parameters *StackedAutoencoderTrainer::TrainedParameters()
+{
+  if(layer_params)
+    return layer_params;
+  return StochasticGradientPlus::TrainedParameters();
+}
+
+Parameters *StackedAutoencoderTrainer::TrainedDerParameters()
+{
+  if(layer_der_params)
+    return layer_der_params;
+  return StochasticGradientPlus::TrainedDerParameters();
+}
+
+void StackedAutoencoderTrainer::ApplyGradient(real current_learning_rate, int n_examples)
+{
+  if(layer_params)
+    UpdateParameters(layer_params, layer_der_params, current_learning_rate, n_examples);
+  else
+    StochasticGradientPlus::ApplyGradient(current_learning_rate, n_examples);
+}
+
+void StackedAutoencoderTrainer::LayerParameters(GradientMachine *autoencoder, int layer,
+                                                Parameters **params, Parameters **der_params)
+{
+  *params = NULL;
+  *der_params = NULL;
+  if(!sae->is_noisy)
+    return;
+
+  *params = new(allocator) Parameters();
+  *der_params = new(allocator) Parameters();
+  (*params)->add(sae->encoders[layer]->params);
+  (*der_params)->add(sae->encoders[layer]->der_params);
+  (*params)->add(autoencoder->params);
+  (*der_params)->add(autoencoder->der_params);
+}
+
 // TODO set autoencoder to do partial bprop
 void StackedAutoencoderTrainer::TrainUnsupLayerwise()
 {
+  SaeTrainerPhase phase = {SAE_PHASE_UNSUP_LAYERWISE, NULL, false, 0, 0., NULL, NULL};
+  if(ReplicatePhase(&phase))
+    return;
 
   layerwise_training = true;
 
@@ -315,11 +517,15 @@ void StackedAutoencoderTrainer::TrainUnsupLayerwise()
     TrainUnsupLayer();
   }
 
+  FreeRepresentationCaches(0);
   layerwise_training = false;
 }
 
 void StackedAutoencoderTrainer::TrainSelectiveUnsupLayerwise(int* pretrain_list)
 {
+  SaeTrainerPhase phase = {SAE_PHASE_SELECTIVE_UNSUP_LAYERWISE, pretrain_list, false, 0, 0., NULL, NULL};
+  if(ReplicatePhase(&phase))
+    return;
 
   layerwise_training = true;
 
@@ -327,22 +533,29 @@ void StackedAutoencoderTrainer::TrainSelectiveUnsupLayerwise(int* pretrain_list)
     std::stringstream ss;
     if (pretrain_list[i]==1)  {
        ss << sae->name << " : (selective) unsupervised training of layer " << layerwise_layer << ". No bprop to lower layers.";
-       message(ss.str().c_str());
+       if(group_rank == 0)
+         message(ss.str().c_str());
        layerwise_layer = i;
        TrainUnsupLayer();
     }
     else {
        ss << sae->name << " : NO Unsupervised training of layer " << layerwise_layer << "!!";
-       message(ss.str().c_str());
+       if(group_rank == 0)
+         message(ss.str().c_str());
     }
 
   }
 
+  FreeRepresentationCaches(0);
   layerwise_training = false;
 }
 
 void StackedAutoencoderTrainer::TrainSelectiveUnsup(int* pretrain_list, bool partial_backprop)
 {
+  SaeTrainerPhase phase = {SAE_PHASE_SELECTIVE_UNSUP, pretrain_list, partial_backprop, 0, 0., NULL, NULL};
+  if(ReplicatePhase(&phase))
+    return;
+
   // Find the topmost trained layer
   int index_topmost_trained = -1;
   int n_layers_to_train = 0;
@@ -377,10 +590,10 @@ void StackedAutoencoderTrainer::TrainSelectiveUnsup(int* pretrain_list, bool par
     // (this can save some computations).
     sae->encoders[i]->setPartialBackprop(partial_backprop);
     // This means it will not update its beta. However, a ConnectedMachine
-    // that it is part of will use the beta. Hence, we must resize it
-    // and clear it. The HACK is that we assume sequences of 1 frame.
+    // that it is part of will use the beta. Hence, we must resize it to the
+    // minibatch (one frame per example) and clear it.
     if (partial_backprop) {
-      //sae->encoders[i]->beta->resize(1); 
+      sae->encoders[i]->beta->resize(minibatch_size);
       ClearSequence(sae->encoders[i]->beta);
     }
 
@@ -394,7 +607,7 @@ void StackedAutoencoderTrainer::TrainSelectiveUnsup(int* pretrain_list, bool par
         // Do we want to backpropagate the gradient to the lower layers?
         sae->autoencoders[i]->setPartialBackprop(partial_backprop);
         if (partial_backprop) {
-          //sae->autoencoders[i]->beta->resize(1);
+          sae->autoencoders[i]->beta->resize(minibatch_size);
           ClearSequence(sae->autoencoders[i]->beta);
         }
 
@@ -417,7 +630,8 @@ void StackedAutoencoderTrainer::TrainSelectiveUnsup(int* pretrain_list, bool par
 
   std::stringstream ss;
   ss << sae->name << " : selectively training with unsupervised costs - not training the outputer.";
-  message(ss.str().c_str());
+  if(group_rank == 0)
+    message(ss.str().c_str());
 
   // *** Set up a ConcatCriterion
   Criterion **the_criterions = (Criterion **) allocator->alloc(sizeof(Criterion*)*(n_layers_to_train));
@@ -489,7 +703,8 @@ void StackedAutoencoderTrainer::TrainUnsupLayer()
   std::stringstream ss;
   ss << sae->name << " : unsupervised training of layer " << layerwise_layer
      << ". No bprop to lower layers.";
-  message(ss.str().c_str());
+  if(group_rank == 0)
+    message(ss.str().c_str());
 
   // This will be used by the train function: setData, iterInitialize,
   // clearDerivatives and updateMachine. That's actually not ideal, as we only
@@ -499,21 +714,329 @@ void StackedAutoencoderTrainer::TrainUnsupLayer()
   MeasurerList the_measurers;
   the_measurers.addNode(unsup_measurers[layerwise_layer]);
 
-  train(unsup_datasets[layerwise_layer], &the_measurers);
+  // The lower encoders are only forwarded.
+  if(freeze_untrained)
+    FreezeEncoders(layerwise_layer);
+
+  if(cache_representations && layerwise_layer > 0)    {
+    // The cached DataSet fills the outputs of the encoder below, which the
+    // unsup DataSet of this layer takes as targets. Only the autoencoder is
+    // forwarded.
+    Coder *lower_encoder = sae->encoders[layerwise_layer-1];
+    RepresentationCacheDataSet cached_data(unsup_datasets[layerwise_layer],
+                                           CachedRepresentations(layerwise_layer-1),
+                                           lower_encoder->outputs);
+    FakeDataMeasurer cached_measurer(&cached_data, unsup_measurers[layerwise_layer]);
+    MeasurerList cached_measurers;
+    cached_measurers.addNode(&cached_measurer);
+
+    machine = sae->autoencoders[layerwise_layer];
+    LayerParameters(sae->autoencoders[layerwise_layer], layerwise_layer, &layer_params, &layer_der_params);
+    train(&cached_data, &cached_measurers);
+  }
+  else  {
+    LayerParameters(machine, layerwise_layer, &layer_params, &layer_der_params);
+    train(unsup_datasets[layerwise_layer], &the_measurers);
+  }
+
+  if(layer_params)      {
+    allocator->free(layer_params);
+    allocator->free(layer_der_params);
+    layer_params = NULL;
+    layer_der_params = NULL;
+  }
+
+  // This layer's outputs changed.
+  FreeRepresentationCaches(layerwise_layer);
 
+  ThawEncoders();
   machine = sae;
   criterion = sup_criterion;
 }
 
+RepresentationCache *StackedAutoencoderTrainer::CachedRepresentations(int layer)
+{
+  if(representation_caches[layer])
+    return representation_caches[layer];
+
+  // From the inputs for the first encoder, from the cache below otherwise.
+  RepresentationCache *lower_cache = NULL;
+  if(layer > 0)
+    lower_cache = CachedRepresentations(layer-1);
+
+  DataSet *data = unsup_datasets[0];
+  Coder *encoder = sae->encoders[layer];
+  int n_examples = data->n_examples;
+
+  std::string filename;
+  if(cache_on_disk)     {
+    std::stringstream ss;
+    ss << expdir << sae->name << "_representations_layer_" << layer << ".bin";
+    filename = ss.str();
+  }
+  RepresentationCache *cache = new(allocator) RepresentationCache(n_examples, encoder->n_outputs,
+                                                                  cache_on_disk ? filename.c_str() : NULL);
+
+  std::stringstream ss;
+  ss << sae->name << " : caching the representations of layer " << layer << ".";
+  if(group_rank == 0)
+    message(ss.str().c_str());
+
+  // Same blocks as the training.
+  int batch_size = (minibatch_size > 1 ? minibatch_size : 1);
+  int *indices = (int*) allocator->alloc(sizeof(int)*batch_size);
+  Sequence *lower_outputs = new(allocator) Sequence(0, (lower_cache ? lower_cache->frame_size : 0));
+
+  for(int first=0; first<n_examples; first+=batch_size)   {
+    int n = (n_examples - first < batch_size ? n_examples - first : batch_size);
+    for(int b=0; b<n; b++)
+      indices[b] = first + b;
+
+    if(lower_cache)     {
+      lower_cache->Gather(indices, n, lower_outputs);
+      encoder->forward(lower_outputs);
+    }
+    else        {
+      SetMinibatch(data, indices, n);
+      encoder->forward(data->inputs);
+    }
+
+    real **outputs_frames = encoder->outputs->frames;
+    for(int b=0; b<n; b++)
+      memcpy(cache->Example(indices[b]), outputs_frames[b], sizeof(real)*encoder->n_outputs);
+  }
+
+  allocator->free(lower_outputs);
+  allocator->free(indices);
+
+  representation_caches[layer] = cache;
+  return cache;
+}
+
+void StackedAutoencoderTrainer::FreeRepresentationCaches(int first_layer)
+{
+  for(int i=first_layer; i<sae->n_hidden_layers; i++)   {
+    if(representation_caches[i])        {
+      allocator->free(representation_caches[i]);
+      representation_caches[i] = NULL;
+    }
+  }
+}
+
+struct SaePipelineStageThread
+{
+  StackedAutoencoderTrainer *trainer;
+  SaePipelineStage *stage;
+};
+
+static void *RunPipelineStageThread(void *arg)
+{
+  SaePipelineStageThread *thread = (SaePipelineStageThread*)arg;
+  thread->trainer->TrainPipelineStage(thread->stage);
+  return NULL;
+}
+
+static void CopyParameters(Parameters *from, Parameters *to)
+{
+  if(from->n_data != to->n_data)
+    error("CopyParameters: different topologies");
+  for(int i=0; i<from->n_data; i++)
+    memcpy(to->data[i], from->data[i], sizeof(real)*from->size[i]);
+}
+
+void StackedAutoencoderTrainer::TrainUnsupLayerwisePipelined(int snapshot_period, int queue_size)
+{
+  if(n_replicas > 0)
+    error("StackedAutoencoderTrainer: the pipelined layerwise training does not support replicas");
+  if(max_iter <= 0)
+    error("StackedAutoencoderTrainer: the pipelined layerwise training needs a max iter");
+
+  int n_layers = sae->n_hidden_layers;
+  int n_train = unsup_datasets[0]->n_examples;
+
+  std::stringstream ss;
+  ss << sae->name << " : pipelined unsupervised training of the " << n_layers << " layers.";
+  if(group_rank == 0)
+    message(ss.str().c_str());
+
+  // The threads may not allocate from this allocator. They draw from the
+  // streams of their own layers.
+  SaePipelineStage *stages = (SaePipelineStage*) allocator->alloc(sizeof(SaePipelineStage)*n_layers);
+  SaePipelineStageThread *args = (SaePipelineStageThread*) allocator->alloc(sizeof(SaePipelineStageThread)*n_layers);
+  pthread_t *threads = (pthread_t*) allocator->alloc(sizeof(pthread_t)*n_layers);
+
+  for(int i=0; i<n_layers; i++) {
+    SaePipelineStage *stage = &stages[i];
+    Coder *encoder = sae->encoders[i];
+    stage->layer = i;
+    stage->snapshot_period = snapshot_period;
+    stage->err = 0.;
+    LayerParameters(sae->autoencoders[i], i, &stage->params, &stage->der_params);
+    ResolveLazyDerivatives(stage->params ? stage->der_params : sae->autoencoders[i]->der_params);
+
+    if(i == 0)  {
+      stage->data = unsup_datasets[0];
+      stage->shuffle = (int*) allocator->alloc(sizeof(int)*n_train);
+      stage->inputs = NULL;
+      stage->in_queue = NULL;
+    }
+    else        {
+      stage->inputs = new(allocator) Sequence(0, encoder->n_inputs);
+      stage->data = new(allocator) DynamicDataSet(unsup_datasets[i], stage->inputs, stage->inputs);
+      stage->shuffle = NULL;
+      stage->in_queue = stages[i-1].out_queue;
+      unsup_criterions[i]->setDataSet(stage->data);
+    }
+
+    if(i < n_layers-1)  {
+      stage->out_queue = new(allocator) RepresentationQueue(queue_size, encoder->n_outputs);
+      stage->snapshot = new(allocator) Coder(encoder->n_inputs, encoder->n_outputs, false, NULL,
+                                             false, false, encoder->nonlinearity, encoder->layer_smoothed);
+      stage->snapshot->setBOption("fused", encoder->fused);
+      stage->snapshot->setBOption("fast math", encoder->fast_math);
+      CopyParameters(encoder->params, stage->snapshot->params);
+    }
+    else        {
+      stage->out_queue = NULL;
+      stage->snapshot = NULL;
+    }
+  }
+
+  // The corruption keys must not be drawn in the threads.
+  SetCorruptionStreams(n_seen_examples);
+
+  for(int i=0; i<n_layers; i++) {
+    args[i].trainer = this;
+    args[i].stage = &stages[i];
+    pthread_create(&threads[i], NULL, RunPipelineStageThread, &args[i]);
+  }
+  for(int i=0; i<n_layers; i++)
+    pthread_join(threads[i], NULL);
+  n_seen_examples += (long long)max_iter * n_train;
+
+  for(int i=0; i<n_layers; i++) {
+    SaePipelineStage *stage = &stages[i];
+    std::stringstream ss;
+    ss << sae->name << " : layer " << i << " cost over the last epoch: " << stage->err;
+    if(group_rank == 0)
+      message(ss.str().c_str());
+
+    if(i == 0)
+      allocator->free(stage->shuffle);
+    else        {
+      unsup_criterions[i]->setDataSet(unsup_datasets[i]);
+      allocator->free(stage->data);
+      allocator->free(stage->inputs);
+    }
+    if(stage->out_queue)        {
+      allocator->free(stage->out_queue);
+      allocator->free(stage->snapshot);
+    }
+    ForgetLazyDerivatives(stage->params ? stage->der_params : sae->autoencoders[i]->der_params);
+    if(stage->params)   {
+      allocator->free(stage->params);
+      allocator->free(stage->der_params);
+    }
+  }
+
+  allocator->free(threads);
+  allocator->free(args);
+  allocator->free(stages);
+}
+
+void StackedAutoencoderTrainer::TrainPipelineStage(SaePipelineStage *stage)
+{
+  GradientMachine *autoencoder = sae->autoencoders[stage->layer];
+  Parameters *params = (stage->params ? stage->params : autoencoder->params);
+  Parameters *der_params = (stage->params ? stage->der_params : autoencoder->der_params);
+  Criterion *the_criterion = unsup_criterions[stage->layer];
+  Coder *encoder = sae->encoders[stage->layer];
+  DataSet *data = stage->data;
+  int n_train = data->n_examples;
+
+  real current_learning_rate = learning_rate;
+  real err = 0.;
+  int epoch = 0;
+  int t = 0;                    // first layer: position in the shuffle
+  long long n_seen = 0;
+  long long n_since_snapshot = 0;
+
+  while(1)
+  {
+    // The next minibatch: from the shuffle for the first layer, from the
+    // layer below otherwise.
+    int n;
+    Sequence *inputs;
+    if(!stage->in_queue)        {
+      if(epoch >= max_iter)
+        break;
+      if(t == 0)
+        Shuffle(n_train, stage->shuffle);
+      n = (n_train - t < minibatch_size ? n_train - t : minibatch_size);
+      SetMinibatch(data, &stage->shuffle[t], n);
+      t = (t + n < n_train ? t + n : 0);
+      inputs = data->inputs;
+    }
+    else        {
+      if(!stage->in_queue->Pop(stage->inputs))
+        break;
+      n = stage->inputs->n_frames;
+      inputs = stage->inputs;
+    }
+
+    ClearParametersDerivatives(der_params);
+    autoencoder->forward(inputs);
+    the_criterion->forward(autoencoder->outputs);
+    the_criterion->backward(autoencoder->outputs, NULL);
+    autoencoder->backward(inputs, the_criterion->beta);
+    for(int f = 0; f < the_criterion->outputs->n_frames; f++)
+      err += the_criterion->outputs->frames[f][0];
+    UpdateParameters(params, der_params, current_learning_rate, n);
+
+    if(stage->out_queue)        {
+      n_since_snapshot += n;
+      if(n_since_snapshot >= stage->snapshot_period)    {
+        CopyParameters(encoder->params, stage->snapshot->params);
+        n_since_snapshot = 0;
+      }
+      stage->snapshot->forward(inputs);
+      stage->out_queue->Push(stage->snapshot->outputs);
+    }
+
+    // The minibatches of the first layer do not straddle epochs, nor those
+    // it passes up.
+    n_seen += n;
+    if(n_seen % n_train == 0)   {
+      stage->err = err / (real)n_train;
+      err = 0.;
+      epoch++;
+      current_learning_rate = learning_rate/(1.+((real)(epoch))*learning_rate_decay);
+    }
+  }
+
+  if(stage->out_queue)
+    stage->out_queue->Close();
+}
+
 // Could gain in efficiency by setting the bottommost encoder to do partial bprop.
 void StackedAutoencoderTrainer::TrainSupervisedTopKLayers(DataSet *supervised_train_data,
                                               MeasurerList *measurers,
                                               int top_k_layers)
 {
+  SaeTrainerPhase phase = {SAE_PHASE_SUPERVISED_TOP_K_LAYERS, NULL, false, top_k_layers, 0.,
+                           supervised_train_data, measurers};
+  if(convex_outputer && top_k_layers == 1)      {
+    FitOutputer(supervised_train_data, measurers);
+    return;
+  }
+  if(ReplicatePhase(&phase))
+    return;
+
   // Inform user
   std::stringstream ss;
   ss << sae->name << " : training top " << top_k_layers << " layers.";
-  message(ss.str().c_str());
+  if(group_rank == 0)
+    message(ss.str().c_str());
 
   assert( top_k_layers>0 && top_k_layers<=sae->n_hidden_layers+1 );
 
@@ -523,18 +1046,119 @@ void StackedAutoencoderTrainer::TrainSupervisedTopKLayers(DataSet *supervised_tr
   machine = sae;
   criterion = sup_criterion;
 
+  // The encoders below the top k layers are only forwarded.
+  if(freeze_untrained)
+    FreezeEncoders(sae->n_hidden_layers + 1 - top_k_layers);
+
   train(supervised_train_data, measurers);
 
+  ThawEncoders();
   topK_training = false;
 }
 
+bool StackedAutoencoderTrainer::OnlyTrainsOutputer()
+{
+  if(machine != sae || !is_finetuning)
+    return false;
+  for(int i=0; i<sae->n_hidden_layers; i++)
+    if(finetuning_learning_rates[i] > 0.)
+      return false;
+  return true;
+}
+
+void StackedAutoencoderTrainer::FitOutputer(DataSet *supervised_train_data, MeasurerList *measurers)
+{
+  ClassNLLCriterion *nll_criterion = dynamic_cast<ClassNLLCriterion*>(sup_criterion);
+  Coder *outputer = sae->outputer;
+  if(!nll_criterion || outputer->nonlinearity != "logsoftmax")
+    error("StackedAutoencoderTrainer: the convex outputer needs a logsoftmax outputer and a ClassNLLCriterion");
+  Linear *linear = outputer->linear_layer;
+  if(linear->l1_weight_decay != 0.)
+    warning("StackedAutoencoderTrainer: the convex outputer ignores the l1 weight decay");
+
+  std::stringstream ss;
+  ss << sae->name << " : fitting the outputer on the top features.";
+  if(group_rank == 0)
+    message(ss.str().c_str());
+
+  DataSet *data = supervised_train_data;
+  int n_examples = data->n_examples;
+  int n_features = outputer->n_inputs;
+
+  std::string filename;
+  if(cache_on_disk)     {
+    std::stringstream ss;
+    ss << expdir << sae->name << "_outputer_features.bin";
+    filename = ss.str();
+  }
+  RepresentationCache *features = new(allocator) RepresentationCache(n_examples, n_features,
+                                                                     cache_on_disk ? filename.c_str() : NULL);
+  int *classes = (int*) allocator->alloc(sizeof(int)*n_examples);
+
+  // The encoders process blocks of examples.
+  int batch_size = (minibatch_size > 1 ? minibatch_size : 1);
+  Sequence *batch = new(allocator) Sequence(0, data->n_inputs);
+  for(int first=0; first<n_examples; first+=batch_size)   {
+    int n = (n_examples - first < batch_size ? n_examples - first : batch_size);
+    batch->resize(n);
+    for(int b=0; b<n; b++)      {
+      data->setExample(first + b);
+      memcpy(batch->frames[b], data->inputs->frames[0], sizeof(real)*data->n_inputs);
+      classes[first + b] = nll_criterion->class_format->getClass(data->targets->frames[0]);
+    }
+
+    Sequence *inputs = batch;
+    for(int i=0; i<sae->n_hidden_layers; i++)   {
+      sae->encoders[i]->forward(inputs);
+      inputs = sae->encoders[i]->outputs;
+    }
+    for(int b=0; b<n; b++)
+      memcpy(features->Example(first + b), inputs->frames[b], sizeof(real)*n_features);
+  }
+
+  // Starts from the current outputer.
+  SoftmaxRegressionSolver solver(n_features, outputer->n_outputs);
+  solver.setIOption("n threads", convex_outputer_threads);
+  solver.setIOption("max iter", convex_outputer_max_iter);
+  solver.setROption("weight decay", linear->weight_decay);
+  solver.setROption("bias decay", linear->bias_decay);
+  solver.Fit(features->data, classes, n_examples, linear->params->data[0]);
+
+  allocator->free(batch);
+  allocator->free(classes);
+  allocator->free(features);
+
+  machine = sae;
+  test(measurers);
+}
+
+void StackedAutoencoderTrainer::FreezeEncoders(int n_frozen)
+{
+  for(int i=0; i<n_frozen; i++) {
+    sae->encoders[i]->SetFrozen(true);
+    FreezeParameters(sae->encoders[i]->der_params);
+  }
+}
+
+void StackedAutoencoderTrainer::ThawEncoders()
+{
+  for(int i=0; i<sae->n_hidden_layers; i++)
+    sae->encoders[i]->SetFrozen(false);
+  ThawParameters();
+}
+
 //--------------
 
 void StackedAutoencoderTrainer::TrainUnsupNotOutput()
 {
+  SaeTrainerPhase phase = {SAE_PHASE_UNSUP_NOT_OUTPUT, NULL, false, 0, 0., NULL, NULL};
+  if(ReplicatePhase(&phase))
+    return;
+
   std::stringstream ss;
   ss << sae->name << " : training with unsupervised costs - not training the outputer.";
-  message(ss.str().c_str());
+  if(group_rank == 0)
+    message(ss.str().c_str());
 
   // *** Set up a ConcatCriterion
   Criterion **the_criterions = (Criterion **) allocator->alloc(sizeof(Criterion *)*(sae->n_hidden_layers));
@@ -586,17 +1210,21 @@ void StackedAutoencoderTrainer::TrainUnsupNotOutput()
 void StackedAutoencoderTrainer::TrainUnsup(DataSet *supervised_train_data,
                                               MeasurerList *measurers)
 {
+  SaeTrainerPhase phase = {SAE_PHASE_UNSUP, NULL, false, 0, 0., supervised_train_data, measurers};
+  if(ReplicatePhase(&phase))
+    return;
 
   std::stringstream ss;
   ss << sae->name << " : training with unsupervised costs and training the outputer (ignore next line).";
-  message(ss.str().c_str());
+  if(group_rank == 0)
+    message(ss.str().c_str());
 
   // Set the outputer to do partial backprop
   // This means it will not update its beta. However, a ConnectedMachine
-  // that it is part of will use the beta. Hence, we must resize it
-  // and clear it. The HACK is that we assume sequences of 1 frame.
+  // that it is part of will use the beta. Hence, we must resize it to the
+  // minibatch (one frame per example) and clear it.
   sae->outputer->setPartialBackprop(true);
-  sae->outputer->beta->resize(1);
+  sae->outputer->beta->resize(minibatch_size);
   ClearSequence(sae->outputer->beta);
 
   // Train
@@ -611,9 +1239,15 @@ void StackedAutoencoderTrainer::TrainSupUnsup(DataSet *supervised_train_data,
                                               MeasurerList *measurers,
                                               real the_unsup_criterions_weight)
 {
+  SaeTrainerPhase phase = {SAE_PHASE_SUP_UNSUP, NULL, false, 0, the_unsup_criterions_weight,
+                           supervised_train_data, measurers};
+  if(ReplicatePhase(&phase))
+    return;
+
   std::stringstream ss;
   ss << sae->name << " : training with supervised and unsupervised costs";
-  message(ss.str().c_str());
+  if(group_rank == 0)
+    message(ss.str().c_str());
 
   sup_dataset = supervised_train_data;
 
@@ -649,7 +1283,8 @@ void StackedAutoencoderTrainer::TrainSupUnsup(DataSet *supervised_train_data,
   // We're assuming the first two measurers have DataSets that are train
   // DataSets. TODO - Replace this with a call to extract...
   MeasurerList the_measurers;
-  warning("HACK - Assuming the first 2 measurers are on the trainset. Wrapping them!");
+  if(group_rank == 0)
+    warning("HACK - Assuming the first 2 measurers are on the trainset. Wrapping them!");
   for(int i=0; i<measurers->n_nodes; i++)   {
     if(i<2)     {
       FakeDataMeasurer *faker_measurer = new(allocator) FakeDataMeasurer(unsup_datasets[0], measurers->nodes[i]);
@@ -683,6 +1318,9 @@ void StackedAutoencoderTrainer::ProfileGradientsInitialize()
   if(sae->is_noisy)
     error("Cannot profile gradients in noisy case. The decoder isn't plugged "
           "into the encoder, but into the noisy_encoder.");
+  if(minibatch_size > 1)
+    error("Cannot profile gradients with minibatches. The saved gradients "
+          "are those of a single example.");
 
   profile_gradients = true;
 
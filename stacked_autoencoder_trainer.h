@@ -28,6 +28,56 @@ namespace Torch {
 
 class StackedAutoencoder;
 class Measurer;
+class RepresentationCache;
+class RepresentationQueue;
+class Coder;
+
+// The training phases, for running them on replicas.
+enum SaeTrainerPhaseType {
+  SAE_PHASE_SUPERVISED = 0,
+  SAE_PHASE_UNSUP_LAYERWISE,
+  SAE_PHASE_SELECTIVE_UNSUP_LAYERWISE,
+  SAE_PHASE_SELECTIVE_UNSUP,
+  SAE_PHASE_SUPERVISED_TOP_K_LAYERS,
+  SAE_PHASE_UNSUP_NOT_OUTPUT,
+  SAE_PHASE_UNSUP,
+  SAE_PHASE_SUP_UNSUP
+};
+
+// A phase and its arguments. #data# and #measurers# are the master's: the
+// replicas use their replica_train_data and no measurers.
+struct SaeTrainerPhase
+{
+  SaeTrainerPhaseType type;
+  int *pretrain_list;
+  bool partial_backprop;
+  int top_k_layers;
+  real unsup_criterions_weight;
+  DataSet *data;
+  MeasurerList *measurers;
+};
+
+// A layer of the pipelined layerwise training, trained in its own thread.
+// It trains the autoencoder of #layer# on #data# (the unsup DataSet for the
+// first layer, a DynamicDataSet over #inputs# filled from #in_queue#
+// otherwise) and feeds #out_queue# with the outputs of #snapshot#, a copy of
+// its encoder refreshed every #snapshot_period# examples.
+struct SaePipelineStage
+{
+  int layer;
+  DataSet *data;
+  int *shuffle;                         // first layer only
+  Sequence *inputs;
+  RepresentationQueue *in_queue;        // NULL for the first layer
+  RepresentationQueue *out_queue;       // NULL for the top layer
+  Coder *snapshot;
+  int snapshot_period;
+  real err;                             // mean cost over the last epoch
+  // The parameters trained, when the autoencoder's own are not enough (see
+  // StackedAutoencoderTrainer::LayerParameters()), or NULL.
+  Parameters *params;
+  Parameters *der_params;
+};
 
 // Trainer for a StackedAutoencoder
 //
@@ -55,6 +105,35 @@ class Measurer;
 // 'criterion' holds the supervised criterion. The class contains many
 // functions that optimize many criteria at once.
 //
+// With SetReplicas(), each training phase (train() included) runs at the
+// same time on the trainers of replicas of the sae, one thread each, which
+// share the sae's parameters, Hogwild or synchronously depending on the
+// "shard size" (see StochasticGradientPlus). A
+// replica is a StackedAutoencoder of the same topology with its own unsup
+// DataSets, criteria and measurers, over its own copy of the supervised
+// train DataSet wrapper (replica_train_data).
+//
+// With the "cache representations" option, the layerwise training of layer
+// i > 0 does not forward the lower encoders: it trains the autoencoder on the
+// outputs of encoder i-1, computed once for the whole train set (in memory,
+// or in a memory-mapped file in expdir with "cache on disk"). The cache holds
+// the clean outputs; a noisy autoencoder still corrupts them on the fly. The
+// replicas do not use the caches.
+//
+// With the "convex outputer" option, the supervised phases that only train
+// the outputer (the top layer of TrainSupervisedTopKLayers(), or fine-tuning
+// with null learning rates for all the encoders) compute the top features
+// once and fit the outputer on them with a SoftmaxRegressionSolver instead
+// of SGD. The measurers are only measured once, at the end.
+//
+// TrainUnsupLayerwisePipelined() is an experimental schedule of the layerwise
+// training where all the layers train at the same time, one thread each.
+// The first layer goes through the epochs. Each layer passes the
+// representations of the minibatches it trained on to the layer above,
+// through a bounded queue. They are computed by a snapshot of its encoder,
+// so the layer above trains on features that lag behind but only change
+// every few thousand examples.
+//
 class StackedAutoencoderTrainer : public StochasticGradientPlus
 {
  public:
@@ -81,6 +160,27 @@ class StackedAutoencoderTrainer : public StochasticGradientPlus
 
     real *finetuning_learning_rates;
 
+    // Replicas
+    StackedAutoencoderTrainer **replicas;
+    int n_replicas;
+    DataSet *replica_train_data;        // replicas only
+    bool in_replicated_phase;
+
+    // Layerwise representation caches
+    bool cache_representations;
+    bool cache_on_disk;
+    RepresentationCache **representation_caches;  // outputs of encoder i, or NULL
+
+    // The parameters the layerwise training of a noisy layer trains (see
+    // LayerParameters()), NULL in the other phases.
+    Parameters *layer_params;
+    Parameters *layer_der_params;
+
+    // Convex outputer
+    bool convex_outputer;
+    int convex_outputer_threads;
+    int convex_outputer_max_iter;
+
     // Gradient profiling
     bool profile_gradients;
     MeasurerList *upper_gradient_measurers;     // gradient from upper encoder
@@ -103,6 +203,16 @@ class StackedAutoencoderTrainer : public StochasticGradientPlus
                                        bool do_eval_criterion_weights_=false,
                                        XFile* resultsfile_=NULL);
 
+    virtual void train(DataSet *data, MeasurerList *measurers);
+
+    // #replicas_# train replicas of the sae in #n# other threads.
+    virtual void SetReplicas(StackedAutoencoderTrainer **replicas_, int n);
+    // Runs #phase# here and on the replicas, and returns true, unless there
+    // are no replicas or this is already running in a replicated phase.
+    virtual bool ReplicatePhase(SaeTrainerPhase *phase);
+    virtual void RunPhase(SaeTrainerPhase *phase);
+    virtual void SetCorruptionStreams(long long first_example);
+
     virtual real EvalHessian(GradientMachine *the_gm, Criterion* the_criterion, DataSet *the_data, int n_samples);
     virtual void ClearSequence(Sequence *seq);
 
@@ -111,15 +221,51 @@ class StackedAutoencoderTrainer : public StochasticGradientPlus
     virtual void IterInitialize();
     virtual void IterFinalize();
     virtual void fpropbprop(DataSet *data);
-    virtual void UpdateMachine(GradientMachine *gm, real current_learning_rate);
+    virtual void UpdateMachine(GradientMachine *gm, real current_learning_rate, int n_examples);
+    virtual Parameters *TrainedParameters();
+    virtual Parameters *TrainedDerParameters();
+    virtual void ApplyGradient(real current_learning_rate, int n_examples);
+
+    // The parameters trained with #autoencoder#, a machine ending with the
+    // autoencoder of #layer#: its own, and the encoder's when the sae is
+    // noisy, as the noisy encoder's linear layer is tied to the encoder's and
+    // owns no parameters. Leaves NULL if the machine's own are enough.
+    virtual void LayerParameters(GradientMachine *autoencoder, int layer,
+                                 Parameters **params, Parameters **der_params);
 
     virtual void TrainSelectiveUnsupLayerwise(int* pretrain_list);
     virtual void TrainSelectiveUnsup(int* pretrain_list, bool partial_backprop);
     virtual void TrainUnsupLayerwise();
     virtual void TrainUnsupLayer();
+
+    // Returns the cache of the outputs of encoder #layer#, computing it (and
+    // the caches below it) if needed.
+    virtual RepresentationCache *CachedRepresentations(int layer);
+    // Frees the caches of the outputs of encoder #first_layer# and above,
+    // which the training of encoder #first_layer# makes stale.
+    virtual void FreeRepresentationCaches(int first_layer);
+
+    // All the layers at once, each for "max iter" epochs. The snapshots of
+    // the encoders are refreshed every #snapshot_period# examples, and at
+    // most #queue_size# minibatches wait between two layers. No measurers,
+    // no replicas.
+    virtual void TrainUnsupLayerwisePipelined(int snapshot_period, int queue_size);
+    // The thread of a layer.
+    virtual void TrainPipelineStage(SaePipelineStage *stage);
     virtual void TrainSupervisedTopKLayers(DataSet *supervised_train_data,
                                   MeasurerList *measurers, int top_k_layers);
 
+    // True if the supervised training only trains the outputer.
+    bool OnlyTrainsOutputer();
+    // Fits the outputer on the top features of #supervised_train_data# (see
+    // the "convex outputer" option), then measures #measurers#.
+    virtual void FitOutputer(DataSet *supervised_train_data, MeasurerList *measurers);
+
+    // Freezes the #n_frozen# bottom encoders, for the phases that do not
+    // backpropagate to them.
+    virtual void FreezeEncoders(int n_frozen);
+    virtual void ThawEncoders();
+
     virtual void TrainUnsupNotOutput();
     virtual void TrainUnsup(DataSet *data, MeasurerList *measurers);
     virtual void TrainSupUnsup(DataSet *data, MeasurerList *measurers,
@@ -14,20 +14,72 @@
 //
 
 #include "stochastic_gradient_plus.h"
-#include "Random.h"
+#include "Timer.h"
+
+#include "input_as_target_data_set.h"
+#include "dynamic_data_set.h"
+#include "minibatch.h"
+#include "trainer_group.h"
+#include "optimizer.h"
+#include "random_streams.h"
+#include "simd_kernels.h"
+#include "lazy_derivatives.h"
+#include "async_evaluator.h"
+#include "early_stopping.h"
 
 namespace Torch {
 
 StochasticGradientPlus::StochasticGradientPlus(GradientMachine *machine_, Criterion *criterion_, XFile* resultsfile_)
-    : StochasticGradient(machine_, criterion_)
+    : StochasticGradient(machine_, criterion_), shuffle_rng(RANDOM_STREAM_SHUFFLE, 0)
 {
   resultsfile = resultsfile_;
+
+  addIOption("minibatch size", &minibatch_size, 1, "number of examples per parameter update");
+  current_minibatch_size = 1;
+  addIOption("shard size", &shard_size, 0, "synchronous data parallelism: number of examples per shard of a minibatch (0 for Hogwild)");
+  addBOption("lazy derivatives", &lazy_derivatives, true, "clear the derivatives the layers overwrite lazily instead of zeroing them");
+  addBOption("freeze untrained", &freeze_untrained, true, "freeze the parameters a training phase does not train");
+  n_seen_examples = 0;
+  optimizer = NULL;
+
+  minibatch_inputs = new(allocator) Sequence();
+  minibatch_targets = new(allocator) Sequence();
+
+  group = NULL;
+  group_rank = 0;
+  n_shared_arrays = 0;
+  own_arrays = NULL;
+  shared_arrays = NULL;
+  shared_array_sizes = NULL;
+
+  n_frozen_arrays = 0;
+  frozen_arrays = NULL;
+
+  n_lazy_der_params = 0;
+  lazy_der_params = NULL;
+  lazy_flags = NULL;
+
+  evaluator = NULL;
+  early_stopping = NULL;
+  stop_early = false;
 }
 
 
 void StochasticGradientPlus::train(DataSet *data, MeasurerList *measurers)
 {
+  if(group && group_rank > 0)       {
+    machine->setDataSet(data);
+    criterion->setDataSet(data);
+    criterion->reset();
+    TrainReplica(data);
+    return;
+  }
+
   message("StochasticGradient: training");
+  if(group && group->n_threads > 1)
+    message("StochasticGradientPlus: %s with %d threads, the training set measurers only see "
+            "the examples of the first thread", shard_size > 0 ? "synchronous" : "Hogwild",
+            group->n_threads);
 
   int iter = 0;
   real err = 0;
@@ -35,6 +87,9 @@ void StochasticGradientPlus::train(DataSet *data, MeasurerList *measurers)
   real current_learning_rate = learning_rate;
   int n_train = data->n_examples;
 
+  if(minibatch_size < 1)
+    error("StochasticGradientPlus: minibatch size must be at least 1");
+
   machine->setDataSet(data);
   criterion->setDataSet(data);
 
@@ -51,11 +106,26 @@ void StochasticGradientPlus::train(DataSet *data, MeasurerList *measurers)
   int n_datas;
   Allocator *allocator_ = extractMeasurers(measurers, data, &datas, &meas, &n_meas, &n_datas);
 
+  // The evaluator measures the other DataSets.
+  int n_measured_datas = n_datas;
+  if(evaluator) {
+    n_measured_datas = 1;
+    evaluator->Reset();
+    evaluator->early_stopping = early_stopping;
+  }
+  stop_early = false;
+  if(early_stopping)
+    early_stopping->Reset();
+
   // Shuffling of examples
   int *shuffle = (int *)Allocator::sysAlloc(n_train*sizeof(int));
   Shuffle(n_train, shuffle);
 
+  if(shard_size > 0)
+    InitializeShards();
+
   TrainInitialize();
+  ResolveLazyDerivatives(TrainedDerParameters());
 
   // ---------- Ugly hack in order to get the measures BEFORE training
    IterInitialize();
@@ -63,7 +133,7 @@ void StochasticGradientPlus::train(DataSet *data, MeasurerList *measurers)
 
   // Measure on datasets other than the train dataset
   // le data 0 est le train dans tous les cas...
-  for(int julie = 0; julie < n_datas; julie++)        {
+  for(int julie = 0; julie < n_measured_datas; julie++)        {
     DataSet *dataset = datas[julie];
 
     for(int t = 0; t < dataset->n_examples; t++)
@@ -80,7 +150,9 @@ void StochasticGradientPlus::train(DataSet *data, MeasurerList *measurers)
   }
 
   IterFinalize();
-  if (resultsfile) {
+  if(evaluator)
+    EvaluateAsync(meas[0], n_meas[0]);
+  else if (resultsfile) {
     // Writing all the errors to a results files. Assumes 
     // - that each used measurer has a filed called "internal_error" 
     // (which is the case for most standard measurers which return
@@ -99,8 +171,14 @@ void StochasticGradientPlus::train(DataSet *data, MeasurerList *measurers)
     resultsfile->printf("\n");
     resultsfile->flush();
   }
+  if(early_stopping && !evaluator)
+    ObserveEarlyStopping();
   //---------- End of ugly hack
 
+  // Only the training loop is timed, not the measures.
+  Timer timer;
+  timer.stop();
+  int n_trained = 0;
 
   while(1)
   {
@@ -110,33 +188,17 @@ void StochasticGradientPlus::train(DataSet *data, MeasurerList *measurers)
     criterion->iterInitialize();
     err = 0;
 
-    for(int t = 0; t < n_train; t++)
-    {
-
-      ClearDerivatives((GradientMachine*)machine);
-
-      data->setExample(shuffle[t]);
-
-      fpropbprop(data);
-
-      for(int i = 0; i < n_meas[0]; i++)
-        meas[0][i]->measureExample();
-
-      UpdateMachine((GradientMachine*)machine, current_learning_rate);
-
-      // Note que peut-etre faudrait foutre un "accumul_erreur" dans la classe
-      // Criterion des fois que ca soit pas une somme... Mais bon, a priori ca
-      // vient d'une integrale, donc me gonflez pas. PREVENIR ICI L'UTILISATEUR
-      // DE L'UTILITE DE L'OUTPUT DANS UN CRITERION
-      err += criterion->outputs->frames[0][0];
-    }
+    timer.resume();
+    err = RunEpoch(data, shuffle, n_train, current_learning_rate, meas[0], n_meas[0]);
+    timer.stop();
+    n_trained += n_train;
 
     for(int i = 0; i < n_meas[0]; i++)
       meas[0][i]->measureIteration();
 
     // Measure on datasets other than the train dataset
     // le data 0 est le train dans tous les cas...
-    for(int julie = 1; julie < n_datas; julie++)        {
+    for(int julie = 1; julie < n_measured_datas; julie++)        {
       DataSet *dataset = datas[julie];
 
       for(int t = 0; t < dataset->n_examples; t++)
@@ -153,7 +215,9 @@ void StochasticGradientPlus::train(DataSet *data, MeasurerList *measurers)
     }
 
     IterFinalize();
-    if (resultsfile) {
+    if(evaluator)
+      EvaluateAsync(meas[0], n_meas[0]);
+    else if (resultsfile) {
       // Writing all the errors to a results files. Assumes 
       // - that each used measurer has a filed called "internal_error" 
       // (which is the case for most standard measurers which return
@@ -172,10 +236,19 @@ void StochasticGradientPlus::train(DataSet *data, MeasurerList *measurers)
       resultsfile->printf("\n");
       resultsfile->flush();
     }
+    if(early_stopping && !evaluator)
+      ObserveEarlyStopping();
 
     print(".");
     err /= (real)(n_train);
 
+    if(stop_early)      {
+      print("\n");
+      message("StochasticGradientPlus: no improvement for %d epochs, stopping early",
+              early_stopping->patience);
+      break;
+    }
+
     // break from accuracy threshold?
     if(fabs(prev_err - err) < end_accuracy)     {
       print("\n");
@@ -195,27 +268,317 @@ void StochasticGradientPlus::train(DataSet *data, MeasurerList *measurers)
 
   }
   free(shuffle);
+  current_minibatch_size = 1;
+
+  ReleaseReplicas();
+
+  if(timer.getTime() > 0.)
+    message("StochasticGradientPlus: %g examples/s (minibatch size %d)",
+            (real)n_trained / timer.getTime(), minibatch_size);
 
-  for(int julie = 0; julie < n_datas; julie++)  {
+  for(int julie = 0; julie < n_measured_datas; julie++)  {
     for(int i = 0; i < n_meas[julie]; i++)
       meas[julie][i]->measureEnd();
   }
+  if(evaluator)
+    evaluator->Finish();
 
+  // With an evaluator, the snapshot is of its replica.
+  if(early_stopping && early_stopping->Restore(evaluator ? evaluator->source : (GradientMachine*)machine))
+    message("StochasticGradientPlus: restored the parameters of epoch %d (error %g)",
+            early_stopping->best_epoch, early_stopping->best_error);
+
+  ForgetLazyDerivatives(TrainedDerParameters());
   TrainFinalize();
 
   delete allocator_;
 }
 
+void StochasticGradientPlus::EvaluateAsync(Measurer **train_measurers, int n_train_measurers)
+{
+  real *train_errs = (real*)Allocator::sysAlloc(sizeof(real)*(n_train_measurers > 0 ? n_train_measurers : 1));
+  for(int i = 0; i < n_train_measurers; i++)
+    train_errs[i] = train_measurers[i]->current_error;
+  // The worker observes for early_stopping: decide once it is idle.
+  evaluator->Wait();
+  if(early_stopping)
+    stop_early = early_stopping->ShouldStop();
+  evaluator->Evaluate(train_errs, n_train_measurers, resultsfile);
+  free(train_errs);
+}
+
+void StochasticGradientPlus::ObserveEarlyStopping()
+{
+  early_stopping->Observe((GradientMachine*)machine);
+  stop_early = early_stopping->ShouldStop();
+}
+
+void StochasticGradientPlus::TrainReplica(DataSet *data)
+{
+  // Parameters the phase does not train may have changed since the last one.
+  PullSharedParameters(NULL);
+  ResolveLazyDerivatives(TrainedDerParameters());
+
+  while(1)
+  {
+    group->Wait();
+    if(group->stop)
+      break;
+
+    ((GradientMachine *)machine)->iterInitialize();
+    criterion->iterInitialize();
+
+    group->errs[group_rank] = TrainEpoch(data, group->shuffle, group->n_train, group->first_example,
+                                         group->learning_rate, NULL, 0);
+    group->Wait();
+  }
+  current_minibatch_size = 1;
+  ForgetLazyDerivatives(TrainedDerParameters());
+}
+
+real StochasticGradientPlus::RunEpoch(DataSet *data, int *shuffle, int n_train, real current_learning_rate,
+                                      Measurer **train_measurers, int n_train_measurers)
+{
+  real err = 0;
+  long long first_example = n_seen_examples;
+  n_seen_examples += n_train;
+
+  if(!group)
+    return TrainEpoch(data, shuffle, n_train, first_example, current_learning_rate,
+                      train_measurers, n_train_measurers);
+
+  // Publish the epoch, train on it with the replicas, wait for them.
+  group->shuffle = shuffle;
+  group->n_train = n_train;
+  group->learning_rate = current_learning_rate;
+  group->first_example = first_example;
+  group->next_example = 0;
+  group->Wait();
+  group->errs[0] = TrainEpoch(data, shuffle, n_train, first_example, current_learning_rate,
+                              train_measurers, n_train_measurers);
+  group->Wait();
+  for(int i = 0; i < group->n_threads; i++)
+    err += group->errs[i];
+  return err;
+}
+
+void StochasticGradientPlus::ReleaseReplicas()
+{
+  if(!group)
+    return;
+
+  group->stop = true;
+  group->Wait();
+  group->stop = false;
+}
+
+real StochasticGradientPlus::TrainEpoch(DataSet *data, int *shuffle, int n_train, long long first_example,
+                                        real current_learning_rate, Measurer **train_measurers,
+                                        int n_train_measurers)
+{
+  real err = 0;
+  bool hogwild = group && shard_size <= 0;
+
+  int t = 0;
+  while(1)
+  {
+    if(hogwild)
+      t = group->NextExamples(minibatch_size);
+    if(t >= n_train)
+      break;
+
+    current_minibatch_size = minibatch_size;
+    if(t + current_minibatch_size > n_train)
+      current_minibatch_size = n_train - t;
+
+    if(shard_size > 0)  {
+      err += ShardedGradient(data, &shuffle[t], current_minibatch_size, first_example + t,
+                             train_measurers, n_train_measurers);
+    }   else    {
+      if(n_shared_arrays)
+        PullSharedParameters(TrainedParameters());
+
+      // Note que peut-etre faudrait foutre un "accumul_erreur" dans la classe
+      // Criterion des fois que ca soit pas une somme... Mais bon, a priori ca
+      // vient d'une integrale, donc me gonflez pas. PREVENIR ICI L'UTILISATEUR
+      // DE L'UTILITE DE L'OUTPUT DANS UN CRITERION
+      err += ForwardBackward(data, &shuffle[t], current_minibatch_size);
+
+      for(int i = 0; i < n_train_measurers; i++)
+        train_measurers[i]->measureExample();
+    }
+
+    // The gradient is summed over the minibatch, the update averages it.
+    if(shard_size <= 0 || group_rank == 0)
+      ApplyGradient(current_learning_rate, current_minibatch_size);
+
+    // The replicas wait for the update before pulling the parameters.
+    if(shard_size > 0)
+      group->Wait();
+
+    if(!hogwild)
+      t += minibatch_size;
+  }
+
+  return err;
+}
+
+real StochasticGradientPlus::ForwardBackward(DataSet *data, int *indices, int n)
+{
+  ClearParametersDerivatives(TrainedDerParameters());
+
+  if(group) {
+    pthread_mutex_lock(&group->data_mutex);
+    SetMinibatch(data, indices, n);
+    pthread_mutex_unlock(&group->data_mutex);
+  }   else    {
+    SetMinibatch(data, indices, n);
+  }
+
+  fpropbprop(data);
+
+  real err = 0;
+  for(int f = 0; f < criterion->outputs->n_frames; f++)
+    err += criterion->outputs->frames[f][0];
+  return err;
+}
+
+Parameters *StochasticGradientPlus::TrainedParameters()
+{
+  return ((GradientMachine*)machine)->params;
+}
+
+Parameters *StochasticGradientPlus::TrainedDerParameters()
+{
+  return ((GradientMachine*)machine)->der_params;
+}
+
+void StochasticGradientPlus::ApplyGradient(real current_learning_rate, int n_examples)
+{
+  UpdateMachine((GradientMachine*)machine, current_learning_rate, n_examples);
+}
+
+void StochasticGradientPlus::SetCorruptionStreams(long long first_example)
+{
+}
+
+void StochasticGradientPlus::InitializeShards()
+{
+  if(!group)    {
+    group = new(allocator) TrainerGroup(1);
+    group_rank = 0;
+  }
+
+  int derivatives_size = 0;
+  Parameters *der_params = TrainedDerParameters();
+  if(der_params)        {
+    for(int i=0; i<der_params->n_data; i++)
+      derivatives_size += der_params->size[i];
+  }
+
+  group->AllocateShards((minibatch_size + shard_size - 1) / shard_size, derivatives_size);
+}
+
+real StochasticGradientPlus::ShardedGradient(DataSet *data, int *indices, int n, long long first_example,
+                                             Measurer **train_measurers, int n_train_measurers)
+{
+  int n_ranks = group->n_threads;
+  int n_shards = (n + shard_size - 1) / shard_size;
+  Parameters *der_params = TrainedDerParameters();
+  real **shard_derivatives = group->shard_derivatives;
+  bool **flags = LazyDerivativesFlags(der_params);
+
+  if(n_shared_arrays)
+    PullSharedParameters(TrainedParameters());
+
+  // The shards of this rank
+  for(int s = group_rank; s < n_shards; s += n_ranks)   {
+    int first = s * shard_size;
+    int n_shard = n - first < shard_size ? n - first : shard_size;
+
+    SetCorruptionStreams(first_example + first);
+    group->shard_errs[s] = ForwardBackward(data, &indices[first], n_shard);
+
+    for(int i = 0; i < n_train_measurers; i++)
+      train_measurers[i]->measureExample();
+
+    real *ptr = shard_derivatives[s];
+    for(int i=0; i<der_params->n_data; i++)     {
+      if(flags)
+        SettleDerivatives(der_params->data[i], der_params->size[i], flags[i]);
+      else
+        SettleDerivatives(der_params->data[i], der_params->size[i]);
+      memcpy(ptr, der_params->data[i], sizeof(real)*der_params->size[i]);
+      ptr += der_params->size[i];
+    }
+  }
+  group->Wait();
+
+  // Tree reduction of the shards into shard 0, in an order that does not
+  // depend on the number of ranks. Each rank reduces a slice of the
+  // derivatives.
+  int size = group->derivatives_size;
+  int begin = (int)((long long)size * group_rank / n_ranks);
+  int end = (int)((long long)size * (group_rank+1) / n_ranks);
+  for(int stride = 1; stride < n_shards; stride *= 2)   {
+    for(int s = 0; s + stride < n_shards; s += 2*stride)
+      SimdAxpy(end - begin, 1., shard_derivatives[s+stride] + begin, shard_derivatives[s] + begin);
+  }
+  group->Wait();
+
+  if(group_rank > 0)
+    return 0;
+
+  real *ptr = shard_derivatives[0];
+  for(int i=0; i<der_params->n_data; i++)       {
+    memcpy(der_params->data[i], ptr, sizeof(real)*der_params->size[i]);
+    ptr += der_params->size[i];
+  }
+
+  real err = 0;
+  for(int s = 0; s < n_shards; s++)
+    err += group->shard_errs[s];
+  return err;
+}
+
 void StochasticGradientPlus::Shuffle(int n_train, int *shuffle)
 {
-  if(do_shuffle)
-    Random::getShuffledIndices(shuffle, n_train);
-  else  {
+  // The order of an epoch only depends on the seed and on the examples seen
+  // before it: the ranks of a synchronous group draw the same one.
+  if(do_shuffle)        {
+    shuffle_rng.Rekey();
+    shuffle_rng.SetSubstream((unsigned long long)n_seen_examples);
+    shuffle_rng.Shuffle(n_train, shuffle);
+  } else  {
     for(int i=0; i<n_train; i++)
       shuffle[i] = i;
   }
 }
 
+void StochasticGradientPlus::SetMinibatch(DataSet *data, int *indices, int n)
+{
+  if(n == 1)    {
+    data->setExample(indices[0]);
+    return;
+  }
+
+  InputAsTargetDataSet *input_as_target_data = dynamic_cast<InputAsTargetDataSet*>(data);
+  if(input_as_target_data)      {
+    input_as_target_data->setMinibatch(indices, n);
+    return;
+  }
+
+  DynamicDataSet *dynamic_data = dynamic_cast<DynamicDataSet*>(data);
+  if(dynamic_data)      {
+    dynamic_data->setMinibatch(indices, n);
+    return;
+  }
+
+  minibatch_inputs->frame_size = data->n_inputs;
+  minibatch_targets->frame_size = data->n_targets;
+  GatherMinibatch(data, indices, n, minibatch_inputs, minibatch_targets);
+}
+
 void StochasticGradientPlus::IterInitialize()
 {
 }
@@ -243,29 +606,164 @@ void StochasticGradientPlus::fpropbprop(DataSet *data)
 
 void StochasticGradientPlus::ClearDerivatives(GradientMachine *gm)
 {
-  Parameters *der_params = gm->der_params;
+  ClearParametersDerivatives(gm->der_params);
+}
+
+void StochasticGradientPlus::ClearParametersDerivatives(Parameters *der_params)
+{
   if(der_params)    {
+    bool **flags = LazyDerivativesFlags(der_params);
     for(int i=0; i<der_params->n_data; i++)        {
-      memset(der_params->data[i], 0, sizeof(real)*der_params->size[i]);
+      if(n_frozen_arrays && IsFrozen(der_params->data[i]))
+        continue;
+      if(flags)
+        ClearDerivativesLazily(der_params->data[i], der_params->size[i], flags[i]);
+      else if(lazy_derivatives)
+        ClearDerivativesLazily(der_params->data[i], der_params->size[i]);
+      else
+        memset(der_params->data[i], 0, sizeof(real)*der_params->size[i]);
     }
   }
 }
 
-void StochasticGradientPlus::UpdateMachine(GradientMachine *gm, real current_learning_rate)
+void StochasticGradientPlus::UpdateMachine(GradientMachine *gm, real current_learning_rate, int n_examples)
+{
+  UpdateParameters(gm->params, gm->der_params, current_learning_rate, n_examples);
+}
+
+void StochasticGradientPlus::UpdateParameters(Parameters *params, Parameters *der_params,
+                                              real current_learning_rate, int n_examples)
 {
-  Parameters *params = gm->params;
-  Parameters *der_params = gm->der_params;
+  real example_learning_rate = current_learning_rate / (real)n_examples;
   if(params)        {
+    bool **flags = LazyDerivativesFlags(der_params);
     for(int i=0; i<params->n_data; i++) {
-      real *ptr_params = params->data[i];
       real *ptr_der_params = der_params->data[i];
+      if(n_frozen_arrays && IsFrozen(ptr_der_params))
+        continue;
+      real *ptr_params = SharedArray(params->data[i]);
+      if(flags)
+        SettleDerivatives(ptr_der_params, params->size[i], flags[i]);
+      else
+        SettleDerivatives(ptr_der_params, params->size[i]);
+      if(optimizer)     {
+        // AdaGrad, RMSProp and Adam are invariant to the scale of the
+        // gradient: give them the mean, not the sum.
+        if(n_examples > 1)
+          SimdScale(params->size[i], 1. / (real)n_examples, ptr_der_params, ptr_der_params);
+        optimizer->Update(ptr_params, ptr_der_params, params->size[i], current_learning_rate);
+        continue;
+      }
       for(int j=0; j<params->size[i]; j++)      {
-        ptr_params[j] -= current_learning_rate * ptr_der_params[j];
+        ptr_params[j] -= example_learning_rate * ptr_der_params[j];
       }
     }
   }
 }
 
+void StochasticGradientPlus::ResolveLazyDerivatives(Parameters *der_params)
+{
+  if(!lazy_derivatives || !der_params || LazyDerivativesFlags(der_params))
+    return;
+  bool **flags = (bool**)allocator->alloc(sizeof(bool*)*(der_params->n_data > 0 ? der_params->n_data : 1));
+  FindLazyDerivativesFlags(der_params->data, der_params->n_data, flags);
+  lazy_der_params = (Parameters**)allocator->realloc(lazy_der_params, sizeof(Parameters*)*(n_lazy_der_params+1));
+  lazy_flags = (bool***)allocator->realloc(lazy_flags, sizeof(bool**)*(n_lazy_der_params+1));
+  lazy_der_params[n_lazy_der_params] = der_params;
+  lazy_flags[n_lazy_der_params] = flags;
+  n_lazy_der_params++;
+}
+
+void StochasticGradientPlus::ForgetLazyDerivatives(Parameters *der_params)
+{
+  for(int k=0; k<n_lazy_der_params; k++)        {
+    if(lazy_der_params[k] != der_params)
+      continue;
+    allocator->free(lazy_flags[k]);
+    n_lazy_der_params--;
+    lazy_der_params[k] = lazy_der_params[n_lazy_der_params];
+    lazy_flags[k] = lazy_flags[n_lazy_der_params];
+    return;
+  }
+}
+
+// A trainer resolves a few sets at most.
+bool **StochasticGradientPlus::LazyDerivativesFlags(Parameters *der_params)
+{
+  for(int k=0; k<n_lazy_der_params; k++)
+    if(lazy_der_params[k] == der_params)
+      return lazy_flags[k];
+  return NULL;
+}
+
+void StochasticGradientPlus::FreezeParameters(Parameters *der_params)
+{
+  frozen_arrays = (real**)allocator->realloc(frozen_arrays, sizeof(real*)*(n_frozen_arrays+der_params->n_data));
+  for(int i=0; i<der_params->n_data; i++)       {
+    if(!IsFrozen(der_params->data[i]))
+      frozen_arrays[n_frozen_arrays++] = der_params->data[i];
+  }
+}
+
+void StochasticGradientPlus::ThawParameters()
+{
+  n_frozen_arrays = 0;
+}
+
+// There are a few dozens arrays at most.
+bool StochasticGradientPlus::IsFrozen(real *der)
+{
+  for(int i=0; i<n_frozen_arrays; i++)
+    if(frozen_arrays[i] == der)
+      return true;
+  return false;
+}
+
+void StochasticGradientPlus::ShareParameters(Parameters *own, Parameters *shared)
+{
+  if(own->n_data != shared->n_data)
+    error("StochasticGradientPlus: cannot share parameters of machines with different topologies");
+
+  int n = n_shared_arrays + own->n_data;
+  own_arrays = (real**)allocator->realloc(own_arrays, sizeof(real*)*n);
+  shared_arrays = (real**)allocator->realloc(shared_arrays, sizeof(real*)*n);
+  shared_array_sizes = (int*)allocator->realloc(shared_array_sizes, sizeof(int)*n);
+
+  for(int i=0; i<own->n_data; i++)      {
+    if(own->size[i] != shared->size[i])
+      error("StochasticGradientPlus: cannot share parameters of machines with different topologies");
+    if(SharedArray(own->data[i]) != own->data[i])
+      continue;
+    own_arrays[n_shared_arrays] = own->data[i];
+    shared_arrays[n_shared_arrays] = shared->data[i];
+    shared_array_sizes[n_shared_arrays] = own->size[i];
+    n_shared_arrays++;
+  }
+}
+
+// There are a few dozens arrays at most.
+real *StochasticGradientPlus::SharedArray(real *own)
+{
+  for(int i=0; i<n_shared_arrays; i++)
+    if(own_arrays[i] == own)
+      return shared_arrays[i];
+  return own;
+}
+
+void StochasticGradientPlus::PullSharedParameters(Parameters *params)
+{
+  if(!params)   {
+    for(int i=0; i<n_shared_arrays; i++)
+      memcpy(own_arrays[i], shared_arrays[i], sizeof(real)*shared_array_sizes[i]);
+    return;
+  }
+
+  for(int i=0; i<params->n_data; i++)   {
+    real *shared = SharedArray(params->data[i]);
+    if(shared != params->data[i])
+      memcpy(params->data[i], shared, sizeof(real)*params->size[i]);
+  }
+}
 
 StochasticGradientPlus::~StochasticGradientPlus()
 {
@@ -21,18 +21,122 @@
 #include "DataSet.h"
 #include "Criterion.h"
 #include "XFile.h"
+#include "random_streams.h"
 
 namespace Torch {
 
+class TrainerGroup;
+class Optimizer;
+class AsyncEvaluator;
+class EarlyStopping;
+
+// Adds hooks to StochasticGradient and minibatches.
+//
+// With the "minibatch size" option set to B > 1, B training examples are set
+// at once (see SetMinibatch), forwarded and backwarded as B frames of a single
+// sequence, and the summed gradient is applied once, scaled by 1/B.
+//
+// Several trainers can train together, each in its own thread, as a
+// TrainerGroup. The master (rank 0) trains the machine that owns the
+// parameters and runs train() as usual. The other ranks train replicas of
+// that machine: same topology, but their own outputs, beta and derivatives.
+// Their train() only follows the master's epochs until the master stops.
+// Only the master measures. Its measurers on the training set only see the
+// examples it trained on itself.
+//
+// Hogwild (the default): the ranks take minibatches from the master's
+// shuffle. Before each minibatch a replica copies the shared parameters of
+// its machine into its own, and it applies its update to the shared ones
+// directly, without locks.
+//
+// Synchronous ("shard size" S > 0): each minibatch is split into shards of
+// S examples, dealt to the ranks. The gradient of each shard is computed
+// apart, the shard gradients are summed pairwise in a fixed tree order and
+// the master applies the sum with a single update. The shuffle and the
+// corruption of the examples (see SetCorruptionStreams) only depend on the
+// seed (see SetRandomSeed()), so for a given S the training is bit-identical whatever
+// the number of threads, one included.
+//
+// The update rule is #optimizer# (see optimizer.h), plain SGD if NULL.
+//
+// With the "lazy derivatives" option, ClearDerivatives() only flags the
+// derivatives the layers know to overwrite (see lazy_derivatives.h), and
+// whatever reads them settles them first. The flags of the derivatives a
+// training clears are found once, when it starts (see
+// ResolveLazyDerivatives).
+//
+// With an #evaluator# (see async_evaluator.h), only the measurers on the
+// training set are measured by train(). After the measures of each epoch
+// (and the ones before training), the evaluator snapshots the machine and
+// measures the other DataSets on its worker thread while the next epoch
+// trains. The evaluator then writes the lines of the results file.
+//
+// With an #early_stopping# (see early_stopping.h), the measures before
+// training and after each epoch are observed, and the training stops when it
+// says so. The best parameters are then restored. With an evaluator, it
+// observes the replica on its worker, and the decision made after an epoch
+// only knows the evaluations of the epochs before: the training may run one
+// epoch more than the patience.
+//
+// Parameter groups (arrays) can be frozen: ClearDerivatives() and
+// UpdateMachine() skip their derivatives, which nothing may read while they
+// are frozen.
 class StochasticGradientPlus : public StochasticGradient
 {
   public:
+    int minibatch_size;
+    // Size of the minibatch being processed (the last one may be smaller).
+    int current_minibatch_size;
+    int shard_size;
+    // Examples trained on by the previous epochs, over all the calls to
+    // train().
+    long long n_seen_examples;
+    // NULL for plain SGD. Replicas use their master's.
+    Optimizer *optimizer;
+    bool lazy_derivatives;
+    bool freeze_untrained;
+    // Measures the DataSets other than the training set, or NULL.
+    AsyncEvaluator *evaluator;
+    // Stops the training when the validation error stops improving, or NULL.
+    EarlyStopping *early_stopping;
+    // Set after the measures of an epoch when early_stopping says to stop.
+    bool stop_early;
+    // Orders of the epochs, one substream per epoch.
+    RandomStream shuffle_rng;
+
     StochasticGradientPlus(GradientMachine *machine_, Criterion *criterion_, XFile* resultsfile_);
 
     virtual void train(DataSet *data, MeasurerList *measurers);
+    // Replicas: train() follows the master's epochs.
+    virtual void TrainReplica(DataSet *data);
+    // Trains on the minibatches of #shuffle# (all of them, or those left by
+    // the other ranks with Hogwild) and returns the sum of the criterion's
+    // outputs. #first_example# is the number of examples seen before the
+    // epoch.
+    virtual real TrainEpoch(DataSet *data, int *shuffle, int n_train, long long first_example,
+                            real current_learning_rate, Measurer **train_measurers,
+                            int n_train_measurers);
+    // Master: TrainEpoch() with the replicas, if any. Returns the sum of the
+    // criterion's outputs over the whole epoch.
+    virtual real RunEpoch(DataSet *data, int *shuffle, int n_train, real current_learning_rate,
+                          Measurer **train_measurers, int n_train_measurers);
+    // Master: lets the replicas return from train().
+    virtual void ReleaseReplicas();
+    // Has the evaluator measure the snapshot of the machine and write the
+    // results file line, given the #train_measurers# measured so far.
+    // Also decides whether to stop early, from the evaluations done so far.
+    virtual void EvaluateAsync(Measurer **train_measurers, int n_train_measurers);
+    // Without an evaluator: has early_stopping observe the machine's
+    // measures and decides whether to stop.
+    virtual void ObserveEarlyStopping();
 
     virtual void Shuffle(int n_train, int *shuffle);
 
+    // Sets the n examples in #indices# of #data#. With n > 1, data's inputs
+    // and targets (and those of the DataSets it wraps) get one frame per
+    // example.
+    virtual void SetMinibatch(DataSet *data, int *indices, int n);
+
     virtual void IterInitialize();
     virtual void IterFinalize();
 
@@ -41,12 +145,94 @@ class StochasticGradientPlus : public StochasticGradient
 
     virtual void fpropbprop(DataSet *data);
 
+    // One gradient computation: clears the derivatives, sets the #n#
+    // examples of #indices# and fprop/bprops them. Returns the sum of the
+    // criterion's outputs.
+    virtual real ForwardBackward(DataSet *data, int *indices, int n);
+    // The parameters ForwardBackward() computes the derivatives of, and
+    // their derivatives.
+    virtual Parameters *TrainedParameters();
+    virtual Parameters *TrainedDerParameters();
+    // Applies the derivatives of the trained parameters, summed over
+    // #n_examples# examples.
+    virtual void ApplyGradient(real current_learning_rate, int n_examples);
+
+    // Synchronous mode: the corruption of the example #first_example#
+    // (counted over all the epochs) and of the following ones must only
+    // depend on their number (see StackedAutoencoder::SetCorruptionStreams).
+    // Nothing to do for machines without corruption.
+    virtual void SetCorruptionStreams(long long first_example);
+    // Synchronous mode: makes sure a group (of one if training alone) has
+    // room for the gradients of the shards of a minibatch.
+    virtual void InitializeShards();
+    // Synchronous mode: leaves in TrainedDerParameters() (master only) the
+    // sum of the gradients of the shards of the #n# examples of #indices#,
+    // the first one being example #first_example#. Returns the sum of the
+    // criterion's outputs (0 but on the master).
+    virtual real ShardedGradient(DataSet *data, int *indices, int n, long long first_example,
+                                 Measurer **train_measurers, int n_train_measurers);
+
     virtual void ClearDerivatives(GradientMachine *gm);
-    virtual void UpdateMachine(GradientMachine *gm, real current_learning_rate);
+    // Updates the parameters of #gm# from their derivatives, summed over
+    // #n_examples# examples. Plain SGD divides the learning rate by
+    // n_examples, an optimizer is given the mean gradient and the learning
+    // rate as is.
+    virtual void UpdateMachine(GradientMachine *gm, real current_learning_rate, int n_examples);
+    // The same for a set of parameters that is not a machine's.
+    void ClearParametersDerivatives(Parameters *der_params);
+    void UpdateParameters(Parameters *params, Parameters *der_params,
+                          real current_learning_rate, int n_examples);
+
+    // Lazy derivatives: finds the flags of the arrays of #der_params# once,
+    // for ClearParametersDerivatives() and UpdateParameters(), until
+    // ForgetLazyDerivatives(). Not while other threads train with this
+    // trainer.
+    void ResolveLazyDerivatives(Parameters *der_params);
+    void ForgetLazyDerivatives(Parameters *der_params);
+    // Flags of the arrays of #der_params#, or NULL if they were not resolved.
+    bool **LazyDerivativesFlags(Parameters *der_params);
+
+    // Freezes the parameter groups of the derivatives #der_params#.
+    virtual void FreezeParameters(Parameters *der_params);
+    // Thaws all the frozen parameter groups.
+    virtual void ThawParameters();
+    // True if the parameter group of the derivatives #der# is frozen.
+    bool IsFrozen(real *der);
+
+    // Replicas: pairs the arrays of #own# with those of #shared#, which must
+    // come from a machine of the same topology.
+    virtual void ShareParameters(Parameters *own, Parameters *shared);
+    // Shared array paired with #own#, or #own# if it is not shared.
+    real *SharedArray(real *own);
+    // Copies the shared arrays into the arrays of #params# (all the paired
+    // arrays if NULL).
+    virtual void PullSharedParameters(Parameters *params);
 
     virtual ~StochasticGradientPlus();
 
     XFile* resultsfile;
+
+    // Hold the frames of the minibatch of a DataSet that is not a wrapper
+    // knowing how to set minibatches.
+    Sequence *minibatch_inputs;
+    Sequence *minibatch_targets;
+
+    // Training with other threads
+    TrainerGroup *group;        // NULL when training alone
+    int group_rank;
+    int n_shared_arrays;
+    real **own_arrays;
+    real **shared_arrays;
+    int *shared_array_sizes;
+
+    // Derivatives of the frozen parameter groups
+    int n_frozen_arrays;
+    real **frozen_arrays;
+
+    // Derivatives whose lazy flags are resolved, and their flags
+    int n_lazy_der_params;
+    Parameters **lazy_der_params;
+    bool ***lazy_flags;
 };
 
 }
@@ -0,0 +1,183 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "sweep.h"
+#include "CmdOption.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+
+namespace Torch {
+
+// True if #token# is the name of one of the options of #cmd#, as opposed to
+// a value. Some options have no leading dash (model_seed, max_load, ...).
+static bool IsOptionName(CmdLine *cmd, const std::string &token)
+{
+  for(int s=0; s<cmd->n_master_switches; s++)   {
+    for(int i=0; i<cmd->n_cmd_options[s]; i++) {
+      CmdOption *option = cmd->cmd_options[s][i];
+      if(option->isOption() && token == option->name)
+        return true;
+    }
+  }
+  return false;
+}
+
+static bool IsBatchedOption(const std::string &token, const char **batched_options)
+{
+  for(int i=0; batched_options && batched_options[i]; i++)
+    if(token == batched_options[i])
+      return true;
+  return false;
+}
+
+// The options of a point without the values of the batched ones: the points
+// of a batch have the same key.
+static std::string BatchKey(const std::vector<std::string> &tokens, const char **batched_options)
+{
+  std::string key;
+  for(size_t i=0; i<tokens.size(); i++)       {
+    key += tokens[i] + " ";
+    if(IsBatchedOption(tokens[i], batched_options))
+      i++;
+  }
+  return key;
+}
+
+// Waits for a child and returns false if it failed.
+static bool WaitChild()
+{
+  int status;
+  pid_t pid = wait(&status);
+  if(pid < 0)
+    error("RunSweep: wait failed");
+  if(WIFEXITED(status) && WEXITSTATUS(status) == 0)
+    return true;
+  warning("RunSweep: process %d failed", (int)pid);
+  return false;
+}
+
+bool RunSweep(CmdLine *cmd, int argc, char **argv, const char *sweep_filename, int n_jobs,
+              const char **batched_options, std::vector< std::vector<std::string> > *batch)
+{
+  std::ifstream file(sweep_filename);
+  if(!file.is_open())
+    error("RunSweep: cannot open %s", sweep_filename);
+
+  std::vector< std::vector<std::string> > points;
+  std::string line;
+  while(std::getline(file, line))       {
+    std::stringstream ss(line);
+    std::vector<std::string> tokens;
+    std::string token;
+    while(ss >> token)
+      tokens.push_back(token);
+    if(tokens.empty() || tokens[0][0] == '#')
+      continue;
+
+    for(size_t i=0; i<tokens.size(); i++)       {
+      if(!IsOptionName(cmd, tokens[i]))
+        continue;
+      for(int j=1; j<argc; j++)
+        if(tokens[i] == argv[j])
+          error("RunSweep: %s is both on the command line and in %s", argv[j], sweep_filename);
+    }
+    points.push_back(tokens);
+  }
+
+  // The batches, in the order of their first point.
+  std::vector< std::vector<int> > batches;
+  std::vector<std::string> batch_keys;
+  for(size_t p=0; p<points.size(); p++) {
+    std::string key = BatchKey(points[p], batched_options);
+    size_t b = 0;
+    while(batched_options && b < batches.size() && batch_keys[b] != key)
+      b++;
+    if(!batched_options || b == batches.size())       {
+      batches.push_back(std::vector<int>());
+      batch_keys.push_back(key);
+      b = batches.size()-1;
+    }
+    batches[b].push_back((int)p);
+  }
+
+  if(n_jobs < 1)
+    n_jobs = 1;
+  message("RunSweep: %d points in %d processes, %d at once", (int)points.size(),
+          (int)batches.size(), n_jobs);
+
+  int n_running = 0;
+  int n_failed = 0;
+  for(size_t b=0; b<batches.size(); b++)        {
+    if(n_running == n_jobs)     {
+      if(!WaitChild())
+        n_failed++;
+      n_running--;
+    }
+
+    // What is buffered would be written by the child too.
+    fflush(NULL);
+    pid_t pid = fork();
+    if(pid < 0)
+      error("RunSweep: cannot fork");
+
+    if(pid == 0)        {
+      if(batch) {
+        batch->clear();
+        for(size_t i=0; i<batches[b].size(); i++)
+          batch->push_back(points[batches[b][i]]);
+      }
+
+      // The point's options come before those of the command line, which
+      // end with its arguments.
+      std::vector<std::string> &tokens = points[batches[b][0]];
+      int child_argc = argc + (int)tokens.size();
+      char **child_argv = (char**)Allocator::sysAlloc(sizeof(char*)*(child_argc+1));
+      child_argv[0] = argv[0];
+      for(size_t i=0; i<tokens.size(); i++)
+        child_argv[1+i] = strdup(tokens[i].c_str());
+      for(int j=1; j<argc; j++)
+        child_argv[tokens.size()+j] = argv[j];
+      child_argv[child_argc] = NULL;
+
+      cmd->read(child_argc, child_argv);
+      return true;
+    }
+
+    if(batches[b].size() > 1)
+      message("RunSweep: %d points from point %d in process %d", (int)batches[b].size(),
+              batches[b][0], (int)pid);
+    else
+      message("RunSweep: point %d in process %d", batches[b][0], (int)pid);
+    n_running++;
+  }
+
+  while(n_running > 0)  {
+    if(!WaitChild())
+      n_failed++;
+    n_running--;
+  }
+  if(n_failed > 0)
+    warning("RunSweep: %d of the %d processes failed", n_failed, (int)batches.size());
+  return false;
+}
+
+}
@@ -0,0 +1,52 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_SWEEP_H_
+#define TORCH_SWEEP_H_
+
+#include <string>
+#include <vector>
+
+#include "CmdLine.h"
+
+namespace Torch {
+
+// Runs the points of a sweep in child processes, up to #n_jobs# at once.
+//
+// #sweep_filename# has one point per line: options that are added to the
+// command line #argc#, #argv# (blank lines and lines starting with '#' are
+// skipped). The options #cmd# knows, with or without a leading dash, must
+// not be on the command line already.
+//
+// Whatever the caller loaded before is shared by the children, copy on write,
+// so the datasets are read once for the whole sweep. The points run in
+// processes rather than threads because Random and the current example of
+// the DataSets are global to a process.
+//
+// Returns true in each child, once #cmd# has read the child's command line:
+// the child then runs its point as a normal run. Returns false in the parent,
+// once all the children have exited.
+//
+// With #batched_options# (option names, NULL terminated), the points that set
+// the same options, with the same values but for the batched ones, form a
+// batch run by a single child: #cmd# reads the command line of its first
+// point, and #batch# gets the options of all its points, in the order of the
+// file. A point alone in its batch runs as without them.
+bool RunSweep(CmdLine *cmd, int argc, char **argv, const char *sweep_filename, int n_jobs,
+              const char **batched_options=NULL,
+              std::vector< std::vector<std::string> > *batch=NULL);
+
+}
+
+#endif  // TORCH_SWEEP_H_
@@ -0,0 +1,503 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "task_pool.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+
+namespace Torch {
+
+static TaskPool *default_task_pool = NULL;
+
+void SetDefaultTaskPool(TaskPool *pool)
+{
+  default_task_pool = pool;
+}
+
+TaskPool *GetDefaultTaskPool()
+{
+  return default_task_pool;
+}
+
+// The tasks [begin, end) left to a thread. The owner takes them from the
+// front and the thieves from the back, under #lock#. One cache line each.
+struct TaskDeque
+{
+  int begin;
+  int end;
+  int lock;
+  char padding[64 - 3*sizeof(int)];
+};
+
+static void LockDeque(TaskDeque *deque)
+{
+  while(__sync_lock_test_and_set(&deque->lock, 1))      {
+    while(deque->lock)
+      ;
+  }
+}
+
+static void UnlockDeque(TaskDeque *deque)
+{
+  __sync_lock_release(&deque->lock);
+}
+
+// Set in the worker threads, and in a thread running a section: Run() then
+// runs the tasks inline.
+static __thread bool in_section = false;
+// The pool and slot of the section the thread runs.
+static __thread TaskPool *section_pool = NULL;
+static __thread int section_slot = 0;
+
+struct TaskPoolWorker
+{
+  TaskPool *pool;
+  int slot;
+};
+
+static void *RunWorker(void *arg)
+{
+  TaskPoolWorker *worker = (TaskPoolWorker*)arg;
+  in_section = true;
+  section_pool = worker->pool;
+  section_slot = worker->slot;
+  worker->pool->Work(worker->slot);
+  return NULL;
+}
+
+// Adds the cpus of a sysfs cpu list ("0-3,8,10-11") to #cpus#.
+static int ParseCpuList(const char *list, int *cpus, int max_cpus)
+{
+  int n = 0;
+  const char *p = list;
+  while(*p && n < max_cpus)     {
+    int first, last, len;
+    if(sscanf(p, "%d%n", &first, &len) != 1)
+      break;
+    p += len;
+    last = first;
+    if(*p == '-')       {
+      if(sscanf(p+1, "%d%n", &last, &len) != 1)
+        break;
+      p += 1+len;
+    }
+    for(int c=first; c<=last && n<max_cpus; c++)
+      cpus[n++] = c;
+    if(*p == ',')
+      p++;
+    else
+      break;
+  }
+  return n;
+}
+
+// The cpu of each of the #n# threads, -1 to leave them unpinned.
+static void PlaceThreads(int placement, int n, int *cpus)
+{
+  for(int slot=0; slot<n; slot++)
+    cpus[slot] = -1;
+
+  cpu_set_t allowed;
+  if(placement == TASK_POOL_UNPINNED || sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    return;
+
+  int allowed_cpus[CPU_SETSIZE];
+  int n_allowed = 0;
+  for(int cpu=0; cpu<CPU_SETSIZE; cpu++)
+    if(CPU_ISSET(cpu, &allowed))
+      allowed_cpus[n_allowed++] = cpu;
+  if(n_allowed == 0)
+    return;
+
+  if(placement == TASK_POOL_SCATTER)    {
+    // The allowed cpus of each node. The threads take the nodes in turn.
+    const int max_nodes = 64;
+    int *node_cpus = (int*)Allocator::sysAlloc(sizeof(int)*max_nodes*CPU_SETSIZE);
+    int n_node_cpus[max_nodes];
+    int n_nodes = 0;
+    for(int node=0; node<max_nodes; node++)     {
+      char filename[128], list[4096];
+      sprintf(filename, "/sys/devices/system/node/node%d/cpulist", node);
+      FILE *file = fopen(filename, "r");
+      if(!file)
+        break;
+      if(!fgets(list, sizeof(list), file))
+        list[0] = '\0';
+      fclose(file);
+
+      int node_list[CPU_SETSIZE];
+      int n_list = ParseCpuList(list, node_list, CPU_SETSIZE);
+      int *cpus_ = node_cpus + n_nodes*CPU_SETSIZE;
+      n_node_cpus[n_nodes] = 0;
+      for(int i=0; i<n_list; i++)
+        if(node_list[i] < CPU_SETSIZE && CPU_ISSET(node_list[i], &allowed))
+          cpus_[n_node_cpus[n_nodes]++] = node_list[i];
+      if(n_node_cpus[n_nodes] > 0)
+        n_nodes++;
+    }
+
+    if(n_nodes > 1)     {
+      for(int slot=0; slot<n; slot++)   {
+        int node = slot % n_nodes;
+        cpus[slot] = node_cpus[node*CPU_SETSIZE + (slot / n_nodes) % n_node_cpus[node]];
+      }
+      free(node_cpus);
+      return;
+    }
+    free(node_cpus);
+  }
+
+  // Compact, or a single node.
+  for(int slot=0; slot<n; slot++)
+    cpus[slot] = allowed_cpus[slot % n_allowed];
+}
+
+TaskPool::TaskPool(int n_threads_, int placement_)
+{
+  n_threads = (n_threads_ > 1 ? n_threads_ : 1);
+  placement = placement_;
+
+  pthread_mutex_init(&run_mutex, NULL);
+  pthread_mutex_init(&mutex, NULL);
+  pthread_cond_init(&start_cond, NULL);
+  pthread_cond_init(&done_cond, NULL);
+
+  section_task = NULL;
+  section_arg = NULL;
+  generation = 0;
+  open = false;
+  n_working = 0;
+  stop = false;
+
+  deques = (TaskDeque*) allocator->alloc(sizeof(TaskDeque)*n_threads);
+  for(int i=0; i<n_threads; i++)        {
+    deques[i].begin = 0;
+    deques[i].end = 0;
+    deques[i].lock = 0;
+  }
+
+  cpus = (int*) allocator->alloc(sizeof(int)*n_threads);
+  // cpus[0] is left to the calling thread, which is not pinned: the threads
+  // it creates afterwards (trainer replicas, evaluators, ...) would inherit
+  // its mask.
+  PlaceThreads(placement, n_threads, cpus);
+  threads = (pthread_t*) allocator->alloc(sizeof(pthread_t)*n_threads);
+  TaskPoolWorker *workers = (TaskPoolWorker*) allocator->alloc(sizeof(TaskPoolWorker)*n_threads);
+  for(int i=1; i<n_threads; i++)        {
+    workers[i].pool = this;
+    workers[i].slot = i;
+    if(pthread_create(&threads[i], NULL, RunWorker, &workers[i]) != 0)
+      error("TaskPool: cannot create thread %d", i);
+  }
+}
+
+int TaskPool::Slot()
+{
+  return (section_pool == this ? section_slot : 0);
+}
+
+void TaskPool::Pin(int slot)
+{
+  int cpu = cpus[slot];
+  if(cpu < 0)
+    return;
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+    warning("TaskPool: cannot pin thread %d to cpu %d", slot, cpu);
+}
+
+bool TaskPool::Steal(int slot)
+{
+  for(int k=1; k<n_threads; k++)        {
+    TaskDeque *victim = &deques[(slot+k) % n_threads];
+    if(victim->end - victim->begin <= 0)
+      continue;
+
+    LockDeque(victim);
+    int left = victim->end - victim->begin;
+    if(left <= 0)       {
+      UnlockDeque(victim);
+      continue;
+    }
+    int end = victim->end;
+    victim->end -= (left+1)/2;
+    int begin = victim->end;
+    UnlockDeque(victim);
+
+    TaskDeque *own = &deques[slot];
+    LockDeque(own);
+    own->begin = begin;
+    own->end = end;
+    UnlockDeque(own);
+    return true;
+  }
+  return false;
+}
+
+void TaskPool::RunTasks(int slot, TaskFunction task, void *arg)
+{
+  TaskDeque *own = &deques[slot];
+  do    {
+    while(1)    {
+      LockDeque(own);
+      if(own->begin >= own->end)        {
+        UnlockDeque(own);
+        break;
+      }
+      int i = own->begin++;
+      UnlockDeque(own);
+      task(arg, i);
+    }
+  } while(Steal(slot));
+}
+
+void TaskPool::Run(int n_tasks, TaskFunction task, void *arg)
+{
+  if(n_tasks <= 1 || n_threads <= 1 || in_section || pthread_mutex_trylock(&run_mutex) != 0)    {
+    for(int i=0; i<n_tasks; i++)
+      task(arg, i);
+    return;
+  }
+
+  pthread_mutex_lock(&mutex);
+  section_task = task;
+  section_arg = arg;
+  for(int i=0; i<n_threads; i++)        {
+    deques[i].begin = (int)((long long)n_tasks * i / n_threads);
+    deques[i].end = (int)((long long)n_tasks * (i+1) / n_threads);
+  }
+  open = true;
+  generation++;
+  pthread_cond_broadcast(&start_cond);
+  pthread_mutex_unlock(&mutex);
+
+  in_section = true;
+  section_pool = this;
+  section_slot = 0;
+  RunTasks(0, task, arg);
+  section_pool = NULL;
+  in_section = false;
+
+  // No thread joins once all the deques are empty (the threads that did not
+  // join had theirs stolen), and the ones that joined are done when they
+  // leave.
+  pthread_mutex_lock(&mutex);
+  open = false;
+  while(n_working > 0)
+    pthread_cond_wait(&done_cond, &mutex);
+  pthread_mutex_unlock(&mutex);
+
+  pthread_mutex_unlock(&run_mutex);
+}
+
+void TaskPool::Work(int slot)
+{
+  Pin(slot);
+
+  int seen_generation = 0;
+  pthread_mutex_lock(&mutex);
+  while(1)      {
+    while(!stop && generation == seen_generation)
+      pthread_cond_wait(&start_cond, &mutex);
+    if(stop)
+      break;
+    seen_generation = generation;
+    if(!open)
+      continue;
+
+    TaskFunction task = section_task;
+    void *arg = section_arg;
+    n_working++;
+    pthread_mutex_unlock(&mutex);
+
+    RunTasks(slot, task, arg);
+
+    pthread_mutex_lock(&mutex);
+    if(--n_working == 0)
+      pthread_cond_signal(&done_cond);
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+TaskPool::~TaskPool()
+{
+  pthread_mutex_lock(&mutex);
+  stop = true;
+  pthread_cond_broadcast(&start_cond);
+  pthread_mutex_unlock(&mutex);
+  for(int i=1; i<n_threads; i++)
+    pthread_join(threads[i], NULL);
+
+  pthread_cond_destroy(&done_cond);
+  pthread_cond_destroy(&start_cond);
+  pthread_mutex_destroy(&mutex);
+  pthread_mutex_destroy(&run_mutex);
+}
+
+//-----
+
+struct ParallelForSection
+{
+  int n;
+  int chunk_size;
+  RangeFunction body;
+  ReduceFunction reduce_body;
+  void *arg;
+  int n_values;
+  real *partials;
+};
+
+static void RunParallelForChunk(void *arg, int chunk)
+{
+  ParallelForSection *section = (ParallelForSection*)arg;
+  int begin = chunk * section->chunk_size;
+  int end = begin + section->chunk_size;
+  if(end > section->n)
+    end = section->n;
+  section->body(section->arg, begin, end);
+}
+
+static void RunParallelReduceChunk(void *arg, int chunk)
+{
+  ParallelForSection *section = (ParallelForSection*)arg;
+  int begin = chunk * section->chunk_size;
+  int end = begin + section->chunk_size;
+  if(end > section->n)
+    end = section->n;
+  real *partial = section->partials + (long)chunk * section->n_values;
+  for(int i=0; i<section->n_values; i++)
+    partial[i] = 0.;
+  section->reduce_body(section->arg, begin, end, partial);
+}
+
+static int NChunks(int n, int *chunk_size)
+{
+  if(*chunk_size < 1)
+    *chunk_size = 1;
+  return (n + *chunk_size - 1) / *chunk_size;
+}
+
+void ParallelFor(TaskPool *pool, int n, int chunk_size, RangeFunction body, void *arg)
+{
+  ParallelForSection section;
+  int n_chunks = NChunks(n, &chunk_size);
+  section.n = n;
+  section.chunk_size = chunk_size;
+  section.body = body;
+  section.arg = arg;
+
+  if(pool)
+    pool->Run(n_chunks, RunParallelForChunk, &section);
+  else  {
+    for(int k=0; k<n_chunks; k++)
+      RunParallelForChunk(&section, k);
+  }
+}
+
+void ParallelReduce(TaskPool *pool, int n, int chunk_size, int n_values,
+                    ReduceFunction body, void *arg, real *result)
+{
+  ParallelForSection section;
+  int n_chunks = NChunks(n, &chunk_size);
+  section.n = n;
+  section.chunk_size = chunk_size;
+  section.reduce_body = body;
+  section.arg = arg;
+  section.n_values = n_values;
+  section.partials = (real*)Allocator::sysAlloc(sizeof(real)*n_values*(n_chunks > 0 ? n_chunks : 1));
+
+  if(pool)
+    pool->Run(n_chunks, RunParallelReduceChunk, &section);
+  else  {
+    for(int k=0; k<n_chunks; k++)
+      RunParallelReduceChunk(&section, k);
+  }
+
+  // Fixed order
+  for(int i=0; i<n_values; i++)
+    result[i] = 0.;
+  for(int k=0; k<n_chunks; k++) {
+    real *partial = section.partials + (long)k * n_values;
+    for(int i=0; i<n_values; i++)
+      result[i] += partial[i];
+  }
+  free(section.partials);
+}
+
+//-----
+
+// The scratch memory of a thread, freed by the key's destructor when it
+// exits.
+struct ThreadArena
+{
+  Allocator *allocator;
+  void *scratch[N_THREAD_SCRATCH];
+  size_t scratch_size[N_THREAD_SCRATCH];
+};
+
+static pthread_key_t thread_arena_key;
+static pthread_once_t thread_arena_once = PTHREAD_ONCE_INIT;
+
+static void FreeThreadArena(void *arg)
+{
+  ThreadArena *arena = (ThreadArena*)arg;
+  delete arena->allocator;
+  free(arena);
+}
+
+static void CreateThreadArenaKey()
+{
+  pthread_key_create(&thread_arena_key, FreeThreadArena);
+}
+
+static ThreadArena *GetThreadArena()
+{
+  pthread_once(&thread_arena_once, CreateThreadArenaKey);
+  ThreadArena *arena = (ThreadArena*)pthread_getspecific(thread_arena_key);
+  if(!arena)    {
+    arena = (ThreadArena*)Allocator::sysAlloc(sizeof(ThreadArena));
+    arena->allocator = new Allocator;
+    for(int i=0; i<N_THREAD_SCRATCH; i++)       {
+      arena->scratch[i] = NULL;
+      arena->scratch_size[i] = 0;
+    }
+    pthread_setspecific(thread_arena_key, arena);
+  }
+  return arena;
+}
+
+void *ThreadScratch(int key, size_t size)
+{
+  if(key < 0 || key >= N_THREAD_SCRATCH)
+    error("ThreadScratch: no scratch %d", key);
+
+  ThreadArena *arena = GetThreadArena();
+  if(size > arena->scratch_size[key])   {
+    arena->scratch[key] = arena->allocator->realloc(arena->scratch[key], size);
+    arena->scratch_size[key] = size;
+  }
+  return arena->scratch[key];
+}
+
+Allocator *ThreadAllocator()
+{
+  return GetThreadArena()->allocator;
+}
+
+}
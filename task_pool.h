@@ -0,0 +1,139 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_TASK_POOL_H_
+#define TORCH_TASK_POOL_H_
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "Object.h"
+
+namespace Torch {
+
+typedef void (*TaskFunction)(void *arg, int task);
+
+// Runs body(arg, begin, end) on a chunk [begin, end) of a ParallelFor.
+typedef void (*RangeFunction)(void *arg, int begin, int end);
+// Adds the contribution of the chunk [begin, end) of a ParallelReduce to
+// #partial# (n_values reals, zero on entry).
+typedef void (*ReduceFunction)(void *arg, int begin, int end, real *partial);
+
+// Where a TaskPool puts its threads.
+enum TaskPoolPlacement {
+  TASK_POOL_UNPINNED = 0,       // where the kernel wants
+  TASK_POOL_COMPACT,            // thread i on the i-th cpu the process may use
+  TASK_POOL_SCATTER             // dealt round-robin to the NUMA nodes
+};
+
+struct TaskDeque;
+
+// A pool of threads running the independent tasks of a parallel section.
+//
+// Run() deals the tasks to the pool's threads and to the calling thread as
+// contiguous ranges, one per thread (its deque). A thread takes the tasks of
+// its own range from the front, and when it is empty steals the back half of
+// the range of another thread. Run() returns once all the tasks are done.
+// The threads sleep between the sections.
+//
+// One section runs at a time. Run() runs the tasks in the calling thread,
+// in order, when the pool is already running a section: from another thread
+// (the replicas of a TrainerGroup for example), or from one of its tasks
+// (nested sections).
+//
+// With a placement other than TASK_POOL_UNPINNED, the pool's threads are
+// pinned to one cpu each, the first cpu of the placement being left to the
+// calling thread, whose own affinity is not changed. Memory is placed
+// on the node of the thread that touches it first, so what a task allocates
+// in its ThreadScratch()/ThreadAllocator() stays local to its thread.
+class TaskPool : public Object
+{
+  public:
+    // The calling thread included.
+    int n_threads;
+    int placement;
+
+    TaskPool(int n_threads_, int placement_=TASK_POOL_UNPINNED);
+
+    // Runs task(arg, i) for i in [0, n_tasks).
+    void Run(int n_tasks, TaskFunction task, void *arg);
+
+    // Index of the calling thread in the section of this pool it runs: 0 for
+    // the thread that called Run(), 1 to n_threads-1 for the pool's threads.
+    // Tasks use it to pick per-thread objects (replicas of a machine, ...).
+    // It is 0 outside of the pool's sections, and nested sections run inline
+    // keep the index of the thread running them.
+    int Slot();
+
+    // The worker threads' loop.
+    void Work(int slot);
+
+    virtual ~TaskPool();
+
+  private:
+    pthread_t *threads;
+    int *cpus;                          // of each thread, -1 if not pinned
+    pthread_mutex_t run_mutex;          // held by the section running
+    pthread_mutex_t mutex;
+    pthread_cond_t start_cond;
+    pthread_cond_t done_cond;
+
+    // The current section, set under #mutex#.
+    TaskFunction section_task;
+    void *section_arg;
+    TaskDeque *deques;                  // one per thread
+    int generation;
+    bool open;                          // threads may still join the section
+    int n_working;                      // threads in the section
+    bool stop;
+
+    // Runs the tasks of #slot#'s deque, then the ones it steals, until all
+    // the deques are empty.
+    void RunTasks(int slot, TaskFunction task, void *arg);
+    bool Steal(int slot);
+    void Pin(int slot);
+};
+
+// The pool of the machines and criteria built afterwards (see BranchMachine
+// and ConcatCriterion) and of the analysis tools, NULL (the default) to run
+// them sequentially. The mains set it before building the machines.
+void SetDefaultTaskPool(TaskPool *pool);
+TaskPool *GetDefaultTaskPool();
+
+// Runs body over [0, n) in chunks of #chunk_size#, as parallel tasks of
+// #pool# (in order if NULL). The chunks only depend on n and chunk_size.
+void ParallelFor(TaskPool *pool, int n, int chunk_size, RangeFunction body, void *arg);
+
+// Sums the contributions of the chunks of [0, n) (see ParallelFor) to
+// #n_values# reals in #result#. Each chunk gets its own partial sum, and the
+// partial sums are added in the order of the chunks: the result only depends
+// on n and chunk_size, not on the pool or the scheduling.
+void ParallelReduce(TaskPool *pool, int n, int chunk_size, int n_values,
+                    ReduceFunction body, void *arg, real *result);
+
+// Per-thread scratch memory for the tasks: Torch objects like Sequence keep
+// the state of their last use and cannot be shared by concurrent tasks.
+//
+// ThreadScratch() returns #size# bytes private to the calling thread, valid
+// until its next call with the same #key# (in [0, N_THREAD_SCRATCH)).
+// ThreadAllocator() is an Allocator private to the calling thread, for the
+// objects it keeps from one section to the next. Both are freed when the
+// thread exits.
+#define N_THREAD_SCRATCH 4
+void *ThreadScratch(int key, size_t size);
+Allocator *ThreadAllocator();
+
+}
+
+#endif  // TORCH_TASK_POOL_H_
@@ -0,0 +1,81 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "trainer_group.h"
+
+namespace Torch {
+
+TrainerGroup::TrainerGroup(int n_threads_)
+{
+  n_threads = n_threads_;
+  if(n_threads < 1)
+    error("TrainerGroup: need at least 1 thread");
+
+  shuffle = NULL;
+  n_train = 0;
+  learning_rate = 0.;
+  first_example = 0;
+  stop = false;
+  next_example = 0;
+
+  errs = (real*)allocator->alloc(sizeof(real)*n_threads);
+  for(int i=0; i<n_threads; i++)
+    errs[i] = 0.;
+
+  n_shards = 0;
+  derivatives_size = 0;
+  shard_derivatives = NULL;
+  shard_errs = NULL;
+
+  pthread_mutex_init(&data_mutex, NULL);
+  pthread_barrier_init(&barrier, NULL, n_threads);
+}
+
+void TrainerGroup::Wait()
+{
+  pthread_barrier_wait(&barrier);
+}
+
+int TrainerGroup::NextExamples(int n)
+{
+  int t = __sync_fetch_and_add(&next_example, n);
+  return t < n_train ? t : n_train;
+}
+
+void TrainerGroup::AllocateShards(int n_shards_, int derivatives_size_)
+{
+  if(n_shards_ <= n_shards && derivatives_size_ == derivatives_size)
+    return;
+
+  for(int s=0; s<n_shards; s++)
+    allocator->free(shard_derivatives[s]);
+
+  if(n_shards_ > n_shards)      {
+    shard_derivatives = (real**)allocator->realloc(shard_derivatives, sizeof(real*)*n_shards_);
+    shard_errs = (real*)allocator->realloc(shard_errs, sizeof(real)*n_shards_);
+    n_shards = n_shards_;
+  }
+  derivatives_size = derivatives_size_;
+
+  for(int s=0; s<n_shards; s++)
+    shard_derivatives[s] = (real*)allocator->alloc(sizeof(real)*derivatives_size);
+}
+
+TrainerGroup::~TrainerGroup()
+{
+  pthread_barrier_destroy(&barrier);
+  pthread_mutex_destroy(&data_mutex);
+}
+
+}
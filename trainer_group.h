@@ -0,0 +1,90 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_TRAINER_GROUP_H_
+#define TORCH_TRAINER_GROUP_H_
+
+#include <pthread.h>
+
+#include "Object.h"
+
+namespace Torch {
+
+// State shared by a group of trainers training together, one thread each
+// (see StochasticGradientPlus).
+//
+// The trainer of rank 0 (the master) owns the machine whose parameters are
+// shared. The other ranks train replicas of it in their own threads. At each
+// epoch the master publishes a shuffle of the examples and a learning rate.
+//
+// Hogwild: every rank takes minibatches from the shuffle through an atomic
+// counter until the epoch is exhausted, and writes its updates to the shared
+// parameters without any lock.
+//
+// Synchronous: every rank goes through all the minibatches. The shards of
+// each minibatch are dealt to the ranks, which leave their gradients in
+// #shard_derivatives#, and the master applies their reduction.
+class TrainerGroup : public Object
+{
+  public:
+    int n_threads;
+
+    // Published by the master before each epoch.
+    int *shuffle;
+    int n_train;
+    real learning_rate;
+    // Number of examples trained on before this epoch (numbers the
+    // corruption streams in the synchronous mode).
+    long long first_example;
+    bool stop;
+
+    // Index in the shuffle of the next example to train on.
+    int next_example;
+
+    // Sum of the criterion outputs of each rank over the epoch.
+    real *errs;
+
+    // Gradients and sums of the criterion outputs of the shards of the
+    // current minibatch, in the synchronous mode.
+    int n_shards;
+    int derivatives_size;
+    real **shard_derivatives;
+    real *shard_errs;
+
+    // Setting the examples of the underlying DataSets is not thread safe
+    // (see StochasticGradientPlus::SetMinibatch).
+    pthread_mutex_t data_mutex;
+
+    TrainerGroup(int n_threads_);
+
+    // Blocks until all the ranks have called it.
+    void Wait();
+
+    // Returns the first of #n# consecutive positions in the shuffle to
+    // train on, or n_train if the epoch is over.
+    int NextExamples(int n);
+
+    // Makes room for the gradients of #n_shards_# shards, of
+    // #derivatives_size_# reals each.
+    void AllocateShards(int n_shards_, int derivatives_size_);
+
+    virtual ~TrainerGroup();
+
+  private:
+    pthread_barrier_t barrier;
+};
+
+}
+
+#endif  // TORCH_TRAINER_GROUP_H_
@@ -14,13 +14,14 @@
 //
 
 #include "transposed_tied_linear.h"
-#include "Random.h"
+#include "simd_kernels.h"
+#include "lazy_derivatives.h"
 
 namespace Torch {
 
 TransposedTiedLinear::TransposedTiedLinear(int n_inputs_, int n_outputs_, Linear* base_linear_,
                                             bool reparametrize_)
-    : Linear(n_inputs_, n_outputs_)
+    : Linear(n_inputs_, n_outputs_), init_rng(RANDOM_STREAM_INIT)
 {
   base_linear = base_linear_;
 
@@ -41,9 +42,113 @@ TransposedTiedLinear::TransposedTiedLinear(int n_inputs_, int n_outputs_, Linear
   bias = params->data[0]; //(real*)malloc(sizeof(real)*(n_outputs));
   der_bias = der_params->data[0];
 
+  der_weights_flag = NULL;
+  der_bias_flag = NULL;
+
+  n_resets = 0;
   reset_();
 }
 
+void TransposedTiedLinear::SetLazyDerivatives()
+{
+  if(der_weights_flag)
+    return;
+  der_weights_flag = LazyDerivativesFlag(der_weights);
+  der_bias_flag = LazyDerivativesFlag(der_bias);
+}
+
+void TransposedTiedLinear::forward(Sequence *inputs)
+{
+  int n_frames = inputs->n_frames;
+  if(n_frames == 1)     {
+    Linear::forward(inputs);
+    return;
+  }
+
+  outputs->resize(n_frames);
+  real **inputs_frames = inputs->frames;
+  real **outputs_frames = outputs->frames;
+
+  for(int t=0; t<n_frames; t++) {
+    real *f_outputs = outputs_frames[t];
+    for(int j=0; j<n_outputs; j++)
+      f_outputs[j] = 0.0;
+  }
+
+  // Each row of the (tied) weights is read once for all the frames.
+  real *weights_ = weights;
+  for(int i=0; i<n_inputs; i++)    {
+    for(int t=0; t<n_frames; t++)
+      SimdAxpy(n_outputs, inputs_frames[t][i], weights_, outputs_frames[t]);
+    weights_ += n_outputs;
+  }
+
+  if (reparametrize)  {
+    for(int t=0; t<n_frames; t++)       {
+      real *f_outputs = outputs_frames[t];
+      for(int j=0; j<n_outputs; j++)  {
+        f_outputs[j] *= reparametrization_multiplier;
+        f_outputs[j] += bias[j];
+      }
+    }
+  }
+}
+
+void TransposedTiedLinear::backward(Sequence *inputs, Sequence *alpha)
+{
+  int n_frames = inputs->n_frames;
+  bool overwrite_weights = OverwriteDerivatives(der_weights_flag);
+  bool overwrite_bias = OverwriteDerivatives(der_bias_flag);
+  if(n_frames == 1 && !overwrite_weights && !overwrite_bias)    {
+    Linear::backward(inputs, alpha);
+    return;
+  }
+
+  beta->resize(n_frames);
+  real **inputs_frames = inputs->frames;
+  real **beta_frames = beta->frames;
+  real **alpha_frames = alpha->frames;
+
+  real multiplier = 1.0;
+  if (reparametrize)
+    multiplier = reparametrization_multiplier;
+
+  for(int t=0; t<n_frames; t++) {
+    real *alpha_ = alpha_frames[t];
+    if(t == 0 && overwrite_bias)        {
+      for(int j=0; j<n_outputs; j++)
+        der_bias[j] = alpha_[j];
+    } else      {
+      for(int j=0; j<n_outputs; j++)
+        der_bias[j] += alpha_[j];
+    }
+  }
+
+  if(overwrite_weights) {
+    real *base_der_bias = base_linear->der_bias;
+    for(int i=0; i<n_inputs; i++)
+      base_der_bias[i] = 0.;
+  }
+
+  real *weights_ = weights;
+  real *der_weights_ = der_weights;
+  for(int i=0; i<n_inputs; i++)        {
+    for(int t=0; t<n_frames; t++)       {
+      real *alpha_ = alpha_frames[t];
+
+      if(!partial_backprop)
+        beta_frames[t][i] = multiplier * SimdDot(n_outputs, alpha_, weights_);
+
+      if(t == 0 && overwrite_weights)
+        SimdScale(n_outputs, multiplier * inputs_frames[t][i], alpha_, der_weights_);
+      else
+        SimdAxpy(n_outputs, multiplier * inputs_frames[t][i], alpha_, der_weights_);
+    }
+    weights_ += n_outputs;
+    der_weights_ += n_outputs;
+  }
+}
+
 void TransposedTiedLinear::frameForward(int t, real *f_inputs, real *f_outputs)
 {
   for(int i=0; i<n_outputs; i++)    {
@@ -52,12 +157,8 @@ void TransposedTiedLinear::frameForward(int t, real *f_inputs, real *f_outputs)
   }
 
   real *weights_ = weights;
-  real input_i_;
   for(int i=0; i<n_inputs; i++)    {
-    input_i_ = f_inputs[i];
-    for(int j=0; j< n_outputs; j++) {
-      f_outputs[j] += weights_[j] * input_i_;
-    }
+    SimdAxpy(n_outputs, f_inputs[i], weights_, f_outputs);
     weights_ += n_outputs;
   }
 
@@ -71,22 +172,16 @@ void TransposedTiedLinear::frameForward(int t, real *f_inputs, real *f_outputs)
 
 void TransposedTiedLinear::frameBackward(int t, real *f_inputs, real *beta_, real *f_outputs, real *alpha_)
 {
-  if(!partial_backprop) {
-    for(int i=0; i<n_inputs; i++)   {
-      beta_[i]=0.;
-    }
+  real multiplier = 1.0;
+  if (reparametrize)
+    multiplier = reparametrization_multiplier;
 
+  if(!partial_backprop) {
     real *weights_ = weights;
     for(int i=0; i<n_inputs; i++)      {
-      for(int j=0; j<n_outputs; j++)
-        beta_[i] += alpha_[j] * weights_[j];
+      beta_[i] = multiplier * SimdDot(n_outputs, alpha_, weights_);
       weights_ += n_outputs;
     }
-
-    if (reparametrize)  {
-      for(int i=0; i<n_inputs; i++)
-        beta_[i] *= reparametrization_multiplier;
-    }
   }
 
   //  --------------------
@@ -94,23 +189,11 @@ void TransposedTiedLinear::frameBackward(int t, real *f_inputs, real *beta_, rea
     der_bias[i] += alpha_[i];
   }
 
-  // derive wrt weights
-  if (!reparametrize) {
-    real *der_weights_ = der_weights;
-    for(int i=0; i<n_inputs; i++)        {
-      for(int j=0; j<n_outputs; j++)      {
-        der_weights_[j] += alpha_[j] * f_inputs[i];
-      }
-      der_weights_ += n_outputs;
-    }
-  } else  {
-    real *der_weights_ = der_weights;
-    for(int i=0; i<n_inputs; i++)        {
-      for(int j=0; j<n_outputs; j++)      {
-        der_weights_[j] += reparametrization_multiplier * alpha_[j] * f_inputs[i];
-      }
-      der_weights_ += n_outputs;
-    }
+  // derive wrt weights (rank-1 update)
+  real *der_weights_ = der_weights;
+  for(int i=0; i<n_inputs; i++)        {
+    SimdAxpy(n_outputs, multiplier * f_inputs[i], alpha_, der_weights_);
+    der_weights_ += n_outputs;
   }
 
 }
@@ -118,16 +201,22 @@ void TransposedTiedLinear::frameBackward(int t, real *f_inputs, real *beta_, rea
 void TransposedTiedLinear::reset_()
 {
   // Do nothing with the tied weights (will be reset by the Linear layer that owns
-  // them). Initialize bias as usual in torch.
+  // them). Initialize bias as usual in torch, from the layer's own stream.
+  if(init_rng.Rekey())
+    n_resets = 0;
+  init_rng.SetSubstream(n_resets++);
+
   real bound = 1./sqrt((real)n_inputs);
-  for(int i=0; i<n_outputs; i++)    {
-    bias[i] = Random::boundedUniform(-bound, bound);
-  }
+  init_rng.BoundedUniforms(n_outputs, -bound, bound, bias);
 
 }
 
 TransposedTiedLinear::~TransposedTiedLinear()
 {
+  if(der_weights_flag)  {
+    ReleaseLazyDerivatives(der_weights);
+    ReleaseLazyDerivatives(der_bias);
+  }
 }
 
 }
@@ -17,6 +17,7 @@
 #define TORCH_TRANSPOSED_TIED_LINEAR_H_
 
 #include "Linear.h"
+#include "random_streams.h"
 
 namespace Torch {
 
@@ -39,9 +40,27 @@ class TransposedTiedLinear : public Linear
 
    Linear *base_linear;
 
+   // Flags of base_linear's derivatives (der_weights and its der_bias) and
+   // of der_bias when they are cleared lazily (see lazy_derivatives.h).
+   // Overwriting der_weights zeroes base_linear's der_bias.
+   bool *der_weights_flag;
+   bool *der_bias_flag;
+
+   // Stream of the initial bias, taken at construction: the n-th reset_()
+   // since the seed was set draws the substream n.
+   RandomStream init_rng;
+   unsigned long long n_resets;
+
    TransposedTiedLinear(int n_inputs_, int n_outputs_, Linear* base_linear_, bool reparametrize_);
 
+   // Registers der_weights and der_bias to be cleared lazily.
+   void SetLazyDerivatives();
+
    //-----
+   // Several frames (a minibatch) are processed as a block, see BlockLinear.
+   virtual void forward(Sequence *inputs);
+   virtual void backward(Sequence *inputs, Sequence *alpha);
+
    virtual void frameForward(int t, real *f_inputs, real *f_outputs);
    // No weight decay. The layer that owns the weights will do it.
    virtual void frameBackward(int t, real *f_inputs, real *beta_, real *f_outputs, real *alpha_);